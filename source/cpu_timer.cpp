@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "cpu_timer.hpp"
+#include <algorithm>
+
+reshade::cpu_timer_table::cpu_timer_table() :
+	_effects(new row[MAX_EFFECTS]),
+	_techniques(new row[MAX_TECHNIQUES]),
+	_start_ticks(read_cpu_timer()),
+	_start_time(std::chrono::steady_clock::now()),
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	_nanoseconds_per_tick(0.0) // The frequency of the time stamp counter is only known once it was calibrated in 'end_frame'
+#else
+	_nanoseconds_per_tick(1.0) // The fallback timer counts nanoseconds already
+#endif
+{
+	// There can never be more free rows than rows, so releasing a row does not need to allocate
+	_free_techniques.reserve(MAX_TECHNIQUES);
+
+	clear();
+}
+
+size_t reshade::cpu_timer_table::allocate_technique_row()
+{
+	{	const std::lock_guard<std::mutex> lock(_free_techniques_mutex);
+
+		if (!_free_techniques.empty())
+		{
+			const size_t index = _free_techniques.back();
+			_free_techniques.pop_back();
+
+			clear(_techniques[index]);
+			return index;
+		}
+	}
+
+	const size_t index = _num_techniques.fetch_add(1, std::memory_order_relaxed);
+	if (index >= MAX_TECHNIQUES)
+		return NO_ROW;
+
+	clear(_techniques[index]);
+	return index;
+}
+void reshade::cpu_timer_table::free_technique_row(size_t technique_row)
+{
+	if (technique_row >= MAX_TECHNIQUES)
+		return;
+
+	const std::lock_guard<std::mutex> lock(_free_techniques_mutex);
+	_free_techniques.push_back(technique_row);
+}
+
+void reshade::cpu_timer_table::clear_effect(size_t effect_index)
+{
+	if (effect_index >= MAX_EFFECTS)
+		return;
+
+	clear(_effects[effect_index]);
+
+	// Keep track of the highest effect index in use, so that 'end_frame' does not have to go through the entire table
+	for (size_t num_effects = _num_effects.load(std::memory_order_relaxed); num_effects <= effect_index && !_num_effects.compare_exchange_weak(num_effects, effect_index + 1, std::memory_order_relaxed);)
+		continue;
+}
+void reshade::cpu_timer_table::clear()
+{
+	for (size_t i = 0; i < MAX_EFFECTS; ++i)
+		clear(_effects[i]);
+	for (size_t i = 0; i < MAX_TECHNIQUES; ++i)
+		clear(_techniques[i]);
+
+	_num_effects.store(0, std::memory_order_relaxed);
+	_num_techniques.store(0, std::memory_order_relaxed);
+
+	const std::lock_guard<std::mutex> lock(_free_techniques_mutex);
+	_free_techniques.clear();
+}
+void reshade::cpu_timer_table::clear(row &row)
+{
+	for (size_t category = 0; category < NUM_CATEGORIES; ++category)
+	{
+		row.ticks[category].store(0, std::memory_order_relaxed);
+		row.average_ticks[category].store(0, std::memory_order_relaxed);
+	}
+}
+
+void reshade::cpu_timer_table::end_frame()
+{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	// Calibrate the time stamp counter against the system clock, which gets more precise the longer the runtime runs
+	if (const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start_time);
+		elapsed >= std::chrono::milliseconds(10))
+		_nanoseconds_per_tick = static_cast<double>(elapsed.count()) / static_cast<double>(read_cpu_timer() - _start_ticks);
+#endif
+
+	const auto end_frame = [](row &row) {
+		// Loading is not done every frame, so keep its total time instead
+		for (size_t category = static_cast<size_t>(cpu_timer_category::load) + 1; category < NUM_CATEGORIES; ++category)
+		{
+			// Per-frame time is only added on the render thread, which is also the one calling this, so no atomic exchange is needed
+			const uint64_t ticks = row.ticks[category].load(std::memory_order_relaxed);
+			row.ticks[category].store(0, std::memory_order_relaxed);
+			const uint64_t average = row.average_ticks[category].load(std::memory_order_relaxed);
+
+			// Exponential moving average over roughly the last 16 frames, which needs no history
+			row.average_ticks[category].store(average - average / 16 + ticks / 16, std::memory_order_relaxed);
+		}
+	};
+
+	for (size_t i = 0, num_effects = _num_effects.load(std::memory_order_relaxed); i < num_effects; ++i)
+		end_frame(_effects[i]);
+	for (size_t i = 0, num_techniques = std::min(_num_techniques.load(std::memory_order_relaxed), MAX_TECHNIQUES); i < num_techniques; ++i)
+		end_frame(_techniques[i]);
+}
+
+uint64_t reshade::cpu_timer_table::to_nanoseconds(const row &row, cpu_timer_category category) const
+{
+	const uint64_t ticks = category == cpu_timer_category::load ?
+		row.ticks[static_cast<size_t>(category)].load(std::memory_order_relaxed) :
+		row.average_ticks[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+
+	return static_cast<uint64_t>(ticks * _nanoseconds_per_tick);
+}
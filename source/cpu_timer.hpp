@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+namespace reshade
+{
+	/// <summary>
+	/// The kinds of work the runtime does for an effect that CPU time is accounted for separately.
+	/// </summary>
+	enum class cpu_timer_category : unsigned int
+	{
+		load, // Parsing, compiling and creating resources, which is not done every frame, so this is a total instead of an average
+		update_uniforms,
+		upload_constants,
+		render_technique,
+		count
+	};
+
+	/// <summary>
+	/// Reads a counter that increases at a constant rate, which is the time stamp counter on x86 (a single instruction, without any call into the system).
+	/// </summary>
+	inline uint64_t read_cpu_timer()
+	{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	/// <summary>
+	/// Accumulates CPU time per effect and per technique in a table that is allocated once, so that adding time never allocates or takes a lock.
+	/// Each row is only written by one thread at a time (effects are loaded by one worker each and rendered on the render thread), which makes plain relaxed atomic stores sufficient.
+	/// Rows that do not fit into the table are not accounted for.
+	/// </summary>
+	class cpu_timer_table
+	{
+	public:
+		static constexpr size_t MAX_EFFECTS = 1024;
+		static constexpr size_t MAX_TECHNIQUES = 1024;
+		static constexpr size_t NO_ROW = ~size_t(0);
+
+		cpu_timer_table();
+
+		cpu_timer_table(const cpu_timer_table &) = delete;
+		cpu_timer_table &operator=(const cpu_timer_table &) = delete;
+
+		/// <summary>
+		/// Reserves a technique row and clears it, reusing one released by <see cref="free_technique_row"/> if possible. This may be called from any thread.
+		/// </summary>
+		/// <returns>The index of the row, or <see cref="NO_ROW"/> if the table is full.</returns>
+		size_t allocate_technique_row();
+		/// <summary>
+		/// Releases a technique row (e.g. when its effect is unloaded), so that a later call to <see cref="allocate_technique_row"/> can reuse it. This may be called from any thread.
+		/// </summary>
+		/// <param name="technique_row">The row to release, or <see cref="NO_ROW"/>.</param>
+		void free_technique_row(size_t technique_row);
+
+		/// <summary>
+		/// Adds time to an effect and optionally one of its techniques.
+		/// </summary>
+		/// <param name="effect_index">The index of the effect.</param>
+		/// <param name="technique_row">The row of the technique, or <see cref="NO_ROW"/> to add to the effect only.</param>
+		/// <param name="category">The kind of work the time was spent on.</param>
+		/// <param name="ticks">The time in units of <see cref="read_cpu_timer"/>.</param>
+		void add(size_t effect_index, size_t technique_row, cpu_timer_category category, uint64_t ticks)
+		{
+			if (effect_index < MAX_EFFECTS)
+				add(_effects[effect_index], category, ticks);
+			if (technique_row < MAX_TECHNIQUES)
+				add(_techniques[technique_row], category, ticks);
+		}
+
+		/// <summary>
+		/// Clears all time of the specified effect. This has to be called before any time is added to an effect (e.g. when it is loaded).
+		/// </summary>
+		void clear_effect(size_t effect_index);
+		/// <summary>
+		/// Clears all rows and releases all technique rows. No other thread may use the table during this call.
+		/// </summary>
+		void clear();
+
+		/// <summary>
+		/// Folds the time accumulated during the current frame into the per-frame averages and starts a new frame.
+		/// </summary>
+		void end_frame();
+
+		/// <summary>
+		/// Gets the average time per frame an effect spent in the specified category (or the total time for <see cref="cpu_timer_category::load"/>).
+		/// </summary>
+		/// <returns>The time in nanoseconds.</returns>
+		uint64_t effect_time(size_t effect_index, cpu_timer_category category) const
+		{
+			return effect_index < MAX_EFFECTS ? to_nanoseconds(_effects[effect_index], category) : 0;
+		}
+		/// <summary>
+		/// Gets the average time per frame a technique spent in the specified category.
+		/// </summary>
+		/// <returns>The time in nanoseconds.</returns>
+		uint64_t technique_time(size_t technique_row, cpu_timer_category category) const
+		{
+			return technique_row < MAX_TECHNIQUES ? to_nanoseconds(_techniques[technique_row], category) : 0;
+		}
+
+	private:
+		static constexpr size_t NUM_CATEGORIES = static_cast<size_t>(cpu_timer_category::count);
+
+		struct row
+		{
+			std::atomic<uint64_t> ticks[NUM_CATEGORIES]; // Accumulated during the current frame
+			std::atomic<uint64_t> average_ticks[NUM_CATEGORIES];
+		};
+
+		static void add(row &row, cpu_timer_category category, uint64_t ticks)
+		{
+			std::atomic<uint64_t> &value = row.ticks[static_cast<size_t>(category)];
+			value.store(value.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+		}
+		static void clear(row &row);
+		uint64_t to_nanoseconds(const row &row, cpu_timer_category category) const;
+
+		std::unique_ptr<row[]> _effects;
+		std::unique_ptr<row[]> _techniques;
+		std::atomic<size_t> _num_effects = 0;
+		std::atomic<size_t> _num_techniques = 0;
+		// Only touched when effects are loaded or unloaded, never when time is added
+		std::mutex _free_techniques_mutex;
+		std::vector<size_t> _free_techniques;
+		uint64_t _start_ticks;
+		std::chrono::steady_clock::time_point _start_time;
+		double _nanoseconds_per_tick;
+	};
+
+	/// <summary>
+	/// Adds the CPU time between its construction and destruction to a <see cref="cpu_timer_table"/>.
+	/// Use the <see cref="RESHADE_CPU_TIMER"/> macro instead of this directly, so that it is compiled out when CPU timers are disabled.
+	/// </summary>
+	class scoped_cpu_timer
+	{
+	public:
+		scoped_cpu_timer(cpu_timer_table &table, size_t effect_index, size_t technique_row, cpu_timer_category category) :
+			_table(table), _effect_index(effect_index), _technique_row(technique_row), _category(category), _start(read_cpu_timer()) {}
+		~scoped_cpu_timer()
+		{
+			_table.add(_effect_index, _technique_row, _category, read_cpu_timer() - _start);
+		}
+
+		scoped_cpu_timer(const scoped_cpu_timer &) = delete;
+		scoped_cpu_timer &operator=(const scoped_cpu_timer &) = delete;
+
+	private:
+		cpu_timer_table &_table;
+		size_t _effect_index;
+		size_t _technique_row;
+		cpu_timer_category _category;
+		uint64_t _start;
+	};
+}
+
+#if RESHADE_CPU_TIMERS
+	#define RESHADE_CPU_TIMER_NAME_(line) cpu_timer_##line
+	#define RESHADE_CPU_TIMER_NAME(line) RESHADE_CPU_TIMER_NAME_(line)
+	/// <summary>
+	/// Adds the CPU time spent until the end of the current scope to the specified effect and technique row of a <see cref="reshade::cpu_timer_table"/>.
+	/// </summary>
+	#define RESHADE_CPU_TIMER(table, effect_index, technique_row, category) \
+		const reshade::scoped_cpu_timer RESHADE_CPU_TIMER_NAME(__LINE__)(table, effect_index, technique_row, reshade::cpu_timer_category::category)
+#else
+	#define RESHADE_CPU_TIMER(table, effect_index, technique_row, category) ((void)0)
+#endif
@@ -6,7 +6,6 @@
 #include "dll_log.hpp"
 #include "buffer_detection.hpp"
 #include "dxgi/format_utils.hpp"
-#include <cmath>
 
 #if RESHADE_DEPTH
 static inline com_ptr<ID3D10Texture2D> texture_from_dsv(ID3D10DepthStencilView *dsv)
@@ -23,40 +22,44 @@ static inline com_ptr<ID3D10Texture2D> texture_from_dsv(ID3D10DepthStencilView *
 
 void reshade::d3d10::buffer_detection::reset(bool release_resources)
 {
-	_stats = { 0, 0 };
 #if RESHADE_DEPTH
 	_best_copy_stats = { 0, 0 };
-	_counters_per_used_depth_texture.clear();
 
 	if (release_resources)
 	{
+		// Release all references to depth-stencil textures
+		_tracker.reset();
+
 		_previous_stats = { 0, 0 };
 		_depthstencil_clear_texture.reset();
+		return;
 	}
 #else
 	UNREFERENCED_PARAMETER(release_resources);
 #endif
+
+	// Keep depth-stencil textures that are still in use, so that their slots stay valid and binding them again does not need to allocate
+	_tracker.reset_unused();
 }
 
 void reshade::d3d10::buffer_detection::on_draw(UINT vertices)
 {
-	_stats.vertices += vertices;
-	_stats.drawcalls += 1;
-
 #if RESHADE_DEPTH
 	com_ptr<ID3D10DepthStencilView> depthstencil;
 	_device->OMGetRenderTargets(0, nullptr, &depthstencil);
 
 	const auto dsv_texture = texture_from_dsv(depthstencil.get());
-	if (dsv_texture == nullptr)
-		return; // This is a draw call with no depth-stencil bound
-
-	auto &counters = _counters_per_used_depth_texture[dsv_texture];
-	counters.total_stats.vertices += vertices;
-	counters.total_stats.drawcalls += 1;
-	counters.current_stats.vertices += vertices;
-	counters.current_stats.drawcalls += 1;
+
+	// The tracker keeps a reference to the texture in the bound slot, so it is safe to compare against its pointer
+	const uint32_t bound_slot = _tracker.bound();
+	if (dsv_texture.get() != (bound_slot != _tracker.npos ? _tracker.data(bound_slot).get() : nullptr))
+	{
+		// A null texture unbinds, so that subsequent draw calls are not counted for any depth-stencil
+		_tracker.bind(dsv_texture != nullptr ? find_or_add_depthstencil(dsv_texture) : _tracker.npos);
+	}
 #endif
+
+	_tracker.on_draw(vertices);
 }
 
 #if RESHADE_DEPTH
@@ -69,30 +72,36 @@ void reshade::d3d10::buffer_detection::on_clear_depthstencil(UINT clear_flags, I
 	if (dsv_texture == nullptr || dsv_texture != _depthstencil_clear_index.first)
 		return;
 
-	auto &counters = _counters_per_used_depth_texture[dsv_texture];
+	const uint32_t slot = find_or_add_depthstencil(dsv_texture);
 
-	// Update stats with data from previous frame
-	if (counters.current_stats.drawcalls == 0)
-		counters.current_stats = _previous_stats;
+	// Update stats with data from previous frame if there were no draw calls since the last clear
+	const depth_selection::draw_stats current_stats = _tracker.on_clear(slot, _previous_stats);
 
 	// Ignore clears when there was no meaningful workload
-	if (counters.current_stats.drawcalls == 0)
+	if (current_stats.drawcalls == 0)
 		return;
 
-	counters.clears.push_back(counters.current_stats);
-
 	// Make a backup copy of the depth texture before it is cleared
 	if (_depthstencil_clear_index.second == std::numeric_limits<UINT>::max() ?
-		counters.current_stats.vertices > _best_copy_stats.vertices :
-		counters.clears.size() == _depthstencil_clear_index.second)
+		current_stats.vertices > _best_copy_stats.vertices :
+		_tracker.counters(slot).clears.size() == _depthstencil_clear_index.second)
 	{
-		_best_copy_stats = counters.current_stats;
+		_best_copy_stats = current_stats;
 
 		_device->CopyResource(_depthstencil_clear_texture.get(), dsv_texture.get());
 	}
+}
+
+uint32_t reshade::d3d10::buffer_detection::find_or_add_depthstencil(const com_ptr<ID3D10Texture2D> &dsv_texture)
+{
+	if (const uint32_t slot = _tracker.find(reinterpret_cast<uintptr_t>(dsv_texture.get())); slot != _tracker.npos)
+		return slot;
 
-	// Reset draw call stats for clears
-	counters.current_stats = { 0, 0 };
+	D3D10_TEXTURE2D_DESC desc;
+	dsv_texture->GetDesc(&desc);
+	assert((desc.BindFlags & D3D10_BIND_DEPTH_STENCIL) != 0);
+
+	return _tracker.add(reinterpret_cast<uintptr_t>(dsv_texture.get()), { desc.Width, desc.Height, desc.SampleDesc.Count }, dsv_texture);
 }
 
 bool reshade::d3d10::buffer_detection::update_depthstencil_clear_texture(D3D10_TEXTURE2D_DESC desc)
@@ -122,56 +131,32 @@ bool reshade::d3d10::buffer_detection::update_depthstencil_clear_texture(D3D10_T
 
 com_ptr<ID3D10Texture2D> reshade::d3d10::buffer_detection::find_best_depth_texture(UINT width, UINT height, com_ptr<ID3D10Texture2D> override, UINT clear_index_override)
 {
-	depthstencil_info best_snapshot;
+	uint32_t best_slot = _tracker.npos;
 	com_ptr<ID3D10Texture2D> best_match;
 
 	if (override != nullptr)
 	{
+		best_slot = _tracker.find(reinterpret_cast<uintptr_t>(override.get()));
 		best_match = std::move(override);
-		best_snapshot = _counters_per_used_depth_texture[best_match];
 	}
 	else
 	{
-		for (auto &[dsv_texture, snapshot] : _counters_per_used_depth_texture)
-		{
-			if (snapshot.total_stats.drawcalls == 0)
-				continue; // Skip unused
-
-			D3D10_TEXTURE2D_DESC desc; dsv_texture->GetDesc(&desc);
-			assert((desc.BindFlags & D3D10_BIND_DEPTH_STENCIL) != 0);
-
-			if (desc.SampleDesc.Count > 1)
-				continue; // Ignore MSAA textures, since they would need to be resolved first
-
-			assert((desc.BindFlags & D3D10_BIND_SHADER_RESOURCE) != 0);
-
-			if (width != 0 && height != 0)
-			{
-				const float w = static_cast<float>(width);
-				const float w_ratio = w / desc.Width;
-				const float h = static_cast<float>(height);
-				const float h_ratio = h / desc.Height;
-				const float aspect_ratio = (w / h) - (static_cast<float>(desc.Width) / desc.Height);
-
-				if (std::fabs(aspect_ratio) > 0.1f || w_ratio > 1.85f || h_ratio > 1.85f || w_ratio < 0.5f || h_ratio < 0.5f)
-					continue; // Not a good fit
-			}
-
-			// Choose snapshot with the most vertices, since that is likely to contain the main scene
-			if (snapshot.total_stats.vertices > best_snapshot.total_stats.vertices)
-			{
-				best_match = dsv_texture;
-				best_snapshot = snapshot;
-			}
-		}
+		depth_selection::selection_options options;
+		options.width = width;
+		options.height = height;
+		options.heuristic = depth_selection::selection_heuristic::most_vertices;
+
+		best_slot = _tracker.find_best(options);
+		if (best_slot != _tracker.npos)
+			best_match = _tracker.data(best_slot);
 	}
 
 	if (clear_index_override != 0 && best_match != nullptr)
 	{
-		_previous_stats = best_snapshot.current_stats;
+		_previous_stats = best_slot != _tracker.npos ? _tracker.counters(best_slot).current_stats : depth_selection::draw_stats {};
 		_depthstencil_clear_index = { best_match.get(), std::numeric_limits<UINT>::max() };
 
-		if (clear_index_override <= best_snapshot.clears.size())
+		if (best_slot != _tracker.npos && clear_index_override <= _tracker.counters(best_slot).clears.size())
 		{
 			_depthstencil_clear_index.second = clear_index_override;
 		}
@@ -5,19 +5,22 @@
 
 #pragma once
 
-#include <map>
 #include <d3d10_1.h>
 #include "com_ptr.hpp"
+#include "depth_selection.hpp"
 
 namespace reshade::d3d10
 {
 	class buffer_detection
 	{
+		// A reference to each depth-stencil texture is stored alongside its counters, so that the handle (the texture pointer) stays valid until it is removed
+		using depth_tracker = depth_selection::tracker<com_ptr<ID3D10Texture2D>>;
+
 	public:
 		explicit buffer_detection(ID3D10Device *device) : _device(device) {}
 
-		UINT total_vertices() const { return _stats.vertices; }
-		UINT total_drawcalls() const { return _stats.drawcalls; }
+		UINT total_vertices() const { return _tracker.total_vertices(); }
+		UINT total_drawcalls() const { return _tracker.total_drawcalls(); }
 
 		void reset(bool release_resources);
 
@@ -26,7 +29,7 @@ namespace reshade::d3d10
 #if RESHADE_DEPTH
 		UINT current_clear_index() const { return _depthstencil_clear_index.second; }
 		ID3D10Texture2D *current_depth_texture() const { return _depthstencil_clear_index.first; }
-		const auto &depth_buffer_counters() const { return _counters_per_used_depth_texture; }
+		const auto &depth_buffer_tracker() const { return _tracker; }
 
 		void on_clear_depthstencil(UINT clear_flags, ID3D10DepthStencilView *dsv);
 
@@ -35,31 +38,19 @@ namespace reshade::d3d10
 #endif
 
 	private:
-		struct draw_stats
-		{
-			UINT vertices = 0;
-			UINT drawcalls = 0;
-		};
-		struct depthstencil_info
-		{
-			draw_stats total_stats;
-			draw_stats current_stats; // Stats since last clear
-			std::vector<draw_stats> clears;
-		};
-
 #if RESHADE_DEPTH
 		bool update_depthstencil_clear_texture(D3D10_TEXTURE2D_DESC desc);
+
+		uint32_t find_or_add_depthstencil(const com_ptr<ID3D10Texture2D> &dsv_texture);
 #endif
 
 		ID3D10Device *const _device;
-		draw_stats _stats;
+		depth_tracker _tracker;
 #if RESHADE_DEPTH
-		draw_stats _previous_stats;
-		draw_stats _best_copy_stats;
+		depth_selection::draw_stats _previous_stats;
+		depth_selection::draw_stats _best_copy_stats;
 		com_ptr<ID3D10Texture2D> _depthstencil_clear_texture;
 		std::pair<ID3D10Texture2D *, UINT> _depthstencil_clear_index = { nullptr, std::numeric_limits<UINT>::max() };
-		// Use "std::map" instead of "std::unordered_map" so that the iteration order is guaranteed
-		std::map<com_ptr<ID3D10Texture2D>, depthstencil_info> _counters_per_used_depth_texture;
 #endif
 	};
 }
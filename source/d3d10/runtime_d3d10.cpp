@@ -8,6 +8,7 @@
 #include "runtime_d3d10.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "format_conversion.hpp"
 #include "dxgi/format_utils.hpp"
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -40,10 +41,10 @@ namespace reshade::d3d10
 
 	struct d3d10_technique_data
 	{
-		bool query_in_flight = false;
-		com_ptr<ID3D10Query> timestamp_disjoint;
-		com_ptr<ID3D10Query> timestamp_query_beg;
-		com_ptr<ID3D10Query> timestamp_query_end;
+		query_ring<NUM_GPU_QUERY_FRAMES> queries;
+		com_ptr<ID3D10Query> timestamp_disjoint[NUM_GPU_QUERY_FRAMES];
+		std::vector<com_ptr<ID3D10Query>> timestamp_queries; // One before the first pass and one after every pass for each frame
+		std::vector<UINT64> timestamps;
 		std::vector<com_ptr<ID3D10SamplerState>> sampler_states;
 		std::vector<com_ptr<ID3D10ShaderResourceView>> texture_bindings;
 		std::vector<d3d10_pass_data> passes;
@@ -223,6 +224,7 @@ void reshade::d3d10::runtime_d3d10::on_reset()
 	_backbuffer_texture.reset();
 	_backbuffer_texture_srv[0].reset();
 	_backbuffer_texture_srv[1].reset();
+	_readback_textures.clear();
 
 	_copy_vertex_shader.reset();
 	_copy_pixel_shader.reset();
@@ -341,27 +343,12 @@ bool reshade::d3d10::runtime_d3d10::capture_screenshot(uint8_t *buffer) const
 	{
 		if (_color_bit_depth == 10)
 		{
-			for (uint32_t x = 0; x < pitch; x += 4)
-			{
-				const uint32_t rgba = *reinterpret_cast<const uint32_t *>(mapped_data + x);
-				// Divide by 4 to get 10-bit range (0-1023) into 8-bit range (0-255)
-				buffer[x + 0] = ((rgba & 0x3FF) / 4) & 0xFF;
-				buffer[x + 1] = (((rgba & 0xFFC00) >> 10) / 4) & 0xFF;
-				buffer[x + 2] = (((rgba & 0x3FF00000) >> 20) / 4) & 0xFF;
-				buffer[x + 3] = 0xFF;
-			}
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
 		}
 		else
 		{
-			std::memcpy(buffer, mapped_data, pitch);
-
-			for (uint32_t x = 0; x < pitch; x += 4)
-			{
-				buffer[x + 3] = 0xFF; // Clear alpha channel
-				if (_backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM ||
-					_backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB)
-					std::swap(buffer[x + 0], buffer[x + 2]); // Format is BGRA, but output should be RGBA, so flip channels
-			}
+			// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM || _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
 		}
 	}
 
@@ -370,6 +357,74 @@ bool reshade::d3d10::runtime_d3d10::capture_screenshot(uint8_t *buffer) const
 	return true;
 }
 
+bool reshade::d3d10::runtime_d3d10::begin_readback(unsigned int slot)
+{
+	if (slot >= _readback_textures.size())
+		_readback_textures.resize(slot + 1);
+
+	// Textures are kept until the next reset, at which point the frame dimensions may change
+	if (_readback_textures[slot] == nullptr)
+	{
+		D3D10_TEXTURE2D_DESC desc = {};
+		desc.Width = _width;
+		desc.Height = _height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = _backbuffer_format;
+		desc.SampleDesc = { 1, 0 };
+		desc.Usage = D3D10_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D10_CPU_ACCESS_READ;
+
+		if (FAILED(_device->CreateTexture2D(&desc, nullptr, &_readback_textures[slot])))
+		{
+			LOG(ERROR) << "Failed to create system memory texture for screenshot capture!";
+			return false;
+		}
+	}
+
+	_device->CopyResource(_readback_textures[slot].get(), _backbuffer_resolved.get());
+
+	return true;
+}
+bool reshade::d3d10::runtime_d3d10::is_readback_complete(unsigned int slot) const
+{
+	assert(slot < _readback_textures.size());
+
+	// Mapping without waiting fails with 'DXGI_ERROR_WAS_STILL_DRAWING' while the copy is still in flight
+	D3D10_MAPPED_TEXTURE2D mapped;
+	const HRESULT hr = _readback_textures[slot]->Map(0, D3D10_MAP_READ, D3D10_MAP_FLAG_DO_NOT_WAIT, &mapped);
+	if (SUCCEEDED(hr))
+		_readback_textures[slot]->Unmap(0);
+
+	return hr != DXGI_ERROR_WAS_STILL_DRAWING;
+}
+bool reshade::d3d10::runtime_d3d10::finish_readback(unsigned int slot, uint8_t *buffer)
+{
+	assert(slot < _readback_textures.size());
+
+	D3D10_MAPPED_TEXTURE2D mapped;
+	if (FAILED(_readback_textures[slot]->Map(0, D3D10_MAP_READ, 0, &mapped)))
+		return false;
+	auto mapped_data = static_cast<const uint8_t *>(mapped.pData);
+
+	for (uint32_t y = 0; y < _height; y++, buffer += _width * 4, mapped_data += mapped.RowPitch)
+	{
+		if (_color_bit_depth == 10)
+		{
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
+		}
+		else
+		{
+			// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM || _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
+		}
+	}
+
+	_readback_textures[slot]->Unmap(0);
+
+	return true;
+}
+
 bool reshade::d3d10::runtime_d3d10::init_effect(size_t index)
 {
 	if (_d3d_compiler == nullptr)
@@ -387,6 +442,7 @@ bool reshade::d3d10::runtime_d3d10::init_effect(size_t index)
 
 	const auto D3DCompile = reinterpret_cast<pD3DCompile>(GetProcAddress(_d3d_compiler, "D3DCompile"));
 	const auto D3DDisassemble = reinterpret_cast<pD3DDisassemble>(GetProcAddress(_d3d_compiler, "D3DDisassemble"));
+	const auto D3DCreateBlob = reinterpret_cast<decltype(&::D3DCreateBlob)>(GetProcAddress(_d3d_compiler, "D3DCreateBlob"));
 
 	const std::string hlsl = effect.preamble + effect.module.hlsl;
 	std::unordered_map<std::string, com_ptr<IUnknown>> entry_points;
@@ -415,16 +471,38 @@ bool reshade::d3d10::runtime_d3d10::init_effect(size_t index)
 			break;
 		}
 
-		HRESULT hr = D3DCompile(
-			hlsl.c_str(), hlsl.size(),
-			nullptr, nullptr, nullptr,
-			entry_point.name.c_str(),
-			profile.c_str(),
-			D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3, 0,
-			&d3d_compiled, &d3d_errors);
+		const UINT compile_flags = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3;
 
-		if (d3d_errors != nullptr) // Append warnings to the output error string as well
-			effect.errors.append(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+		HRESULT hr = S_OK;
+		std::string warnings;
+		const uint64_t cache_key = permutation_cache::hash(hlsl, entry_point.name, profile, compile_flags);
+
+		// Compiling is by far the slowest part of loading an effect, so reuse byte code compiled from the same source code before (in this or a previous session)
+		if (std::vector<uint8_t> cached_data; _permutation_cache->find_binary(cache_key, cached_data, warnings) &&
+			D3DCreateBlob != nullptr && SUCCEEDED(D3DCreateBlob(cached_data.size(), &d3d_compiled)))
+		{
+			std::memcpy(d3d_compiled->GetBufferPointer(), cached_data.data(), cached_data.size());
+		}
+		else
+		{
+			hr = D3DCompile(
+				hlsl.c_str(), hlsl.size(),
+				nullptr, nullptr, nullptr,
+				entry_point.name.c_str(),
+				profile.c_str(),
+				compile_flags, 0,
+				&d3d_compiled, &d3d_errors);
+
+			warnings.clear();
+			if (d3d_errors != nullptr)
+				warnings.assign(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+
+			if (SUCCEEDED(hr))
+				_permutation_cache->insert_binary(cache_key, d3d_compiled->GetBufferPointer(), d3d_compiled->GetBufferSize(), warnings);
+		}
+
+		// Append warnings to the output error string as well
+		effect.errors += warnings;
 
 		// No need to setup resources if any of the shaders failed to compile
 		if (FAILED(hr))
@@ -543,12 +621,16 @@ bool reshade::d3d10::runtime_d3d10::init_effect(size_t index)
 		auto impl = new d3d10_technique_data(technique_init);
 		technique.impl = impl;
 
+		impl->timestamps.resize(technique.schedule.passes.size() + 1);
+		impl->timestamp_queries.resize(impl->timestamps.size() * NUM_GPU_QUERY_FRAMES);
+
 		D3D10_QUERY_DESC query_desc = {};
 		query_desc.Query = D3D10_QUERY_TIMESTAMP;
-		_device->CreateQuery(&query_desc, &impl->timestamp_query_beg);
-		_device->CreateQuery(&query_desc, &impl->timestamp_query_end);
+		for (com_ptr<ID3D10Query> &query : impl->timestamp_queries)
+			_device->CreateQuery(&query_desc, &query);
 		query_desc.Query = D3D10_QUERY_TIMESTAMP_DISJOINT;
-		_device->CreateQuery(&query_desc, &impl->timestamp_disjoint);
+		for (com_ptr<ID3D10Query> &query : impl->timestamp_disjoint)
+			_device->CreateQuery(&query_desc, &query);
 
 		impl->passes.resize(technique.passes.size());
 		for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
@@ -901,16 +983,13 @@ void reshade::d3d10::runtime_d3d10::upload_texture(const texture &texture, const
 	case reshadefx::texture_format::r8:
 		upload_pitch = texture.width;
 		upload_data.resize(upload_pitch * texture.height);
-		for (uint32_t i = 0, k = 0; i < texture.width * texture.height * 4; i += 4, k += 1)
-			upload_data[k] = pixels[i];
+		convert_rgba8_to_r8(upload_data.data(), pixels, size_t(texture.width) * texture.height);
 		pixels = upload_data.data();
 		break;
 	case reshadefx::texture_format::rg8:
 		upload_pitch = texture.width * 2;
 		upload_data.resize(upload_pitch * texture.height);
-		for (uint32_t i = 0, k = 0; i < texture.width * texture.height * 4; i += 4, k += 2)
-			upload_data[k + 0] = pixels[i + 0],
-			upload_data[k + 1] = pixels[i + 1];
+		convert_rgba8_to_rg8(upload_data.data(), pixels, size_t(texture.width) * texture.height);
 		pixels = upload_data.data();
 		break;
 	case reshadefx::texture_format::rgba8:
@@ -937,26 +1016,36 @@ void reshade::d3d10::runtime_d3d10::render_technique(technique &technique)
 	const auto impl = static_cast<d3d10_technique_data *>(technique.impl);
 	d3d10_effect_data &effect_data = _effect_data[technique.effect_index];
 
-	// Evaluate queries
-	if (impl->query_in_flight)
+	const size_t num_timestamps = impl->timestamps.size();
+
+	// Evaluate queries of previous frames that finished by now
+	for (size_t slot; impl->queries.oldest_pending(slot); impl->queries.pop())
 	{
-		UINT64 timestamp0, timestamp1;
 		D3D10_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		if (impl->timestamp_disjoint[slot]->GetData(&disjoint, sizeof(disjoint), D3D10_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			break;
 
-		if (impl->timestamp_disjoint->GetData(&disjoint,    sizeof(disjoint),   D3D10_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
-			impl->timestamp_query_beg->GetData(&timestamp0, sizeof(timestamp0), D3D10_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
-			impl->timestamp_query_end->GetData(&timestamp1, sizeof(timestamp1), D3D10_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
-		{
-			if (!disjoint.Disjoint)
-				technique.average_gpu_duration.append((timestamp1 - timestamp0) * 1'000'000'000 / disjoint.Frequency);
-			impl->query_in_flight = false;
-		}
+		// The disjoint query ends after all time stamps, so those are available too once it is
+		bool available = true;
+		for (size_t i = 0; i < num_timestamps && available; ++i)
+			available = impl->timestamp_queries[slot * num_timestamps + i]->GetData(&impl->timestamps[i], sizeof(UINT64), D3D10_ASYNC_GETDATA_DONOTFLUSH) == S_OK;
+		if (!available)
+			break;
+
+		if (!disjoint.Disjoint)
+			technique.append_gpu_timestamps(impl->timestamps.data(), disjoint.Frequency);
 	}
 
-	if (!impl->query_in_flight)
+	// Skip time measurement this frame if the queries of all frames are still in flight
+	const com_ptr<ID3D10Query> *timestamp_query = nullptr;
+	ID3D10Query *timestamp_disjoint = nullptr;
+	if (size_t slot; impl->queries.push(slot))
 	{
-		impl->timestamp_disjoint->Begin();
-		impl->timestamp_query_beg->End();
+		timestamp_query = impl->timestamp_queries.data() + slot * num_timestamps;
+		timestamp_disjoint = impl->timestamp_disjoint[slot].get();
+
+		timestamp_disjoint->Begin();
+		(*timestamp_query++)->End();
 	}
 
 	// Setup vertex input
@@ -974,6 +1063,8 @@ void reshade::d3d10::runtime_d3d10::render_technique(technique &technique)
 	if (ID3D10Buffer *const cb = effect_data.cb.get();
 		cb != nullptr)
 	{
+		RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, upload_constants);
+
 		if (void *mapped; SUCCEEDED(cb->Map(D3D10_MAP_WRITE_DISCARD, 0, &mapped)))
 		{
 			std::memcpy(mapped, _effects[technique.effect_index].uniform_data_storage.data(), _effects[technique.effect_index].uniform_data_storage.size());
@@ -988,11 +1079,12 @@ void reshade::d3d10::runtime_d3d10::render_technique(technique &technique)
 	_device->GSSetShader(nullptr);
 
 	bool is_effect_stencil_cleared = false;
-	bool needs_implicit_backbuffer_copy = true; // First pass always needs the back buffer updated
 
-	for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
+	for (const reshadefx::scheduled_pass &scheduled : technique.schedule.passes)
 	{
-		if (needs_implicit_backbuffer_copy)
+		const size_t pass_index = scheduled.pass_index;
+
+		if (scheduled.copy_backbuffer)
 		{
 			// Save back buffer of previous pass
 			_device->CopyResource(_backbuffer_texture.get(), _backbuffer_resolved.get());
@@ -1029,7 +1121,7 @@ void reshade::d3d10::runtime_d3d10::render_technique(technique &technique)
 			_device->OMSetRenderTargets(D3D10_SIMULTANEOUS_RENDER_TARGET_COUNT, reinterpret_cast<ID3D10RenderTargetView *const *>(pass_data.render_targets), nullptr);
 		}
 
-		if (pass_info.clear_render_targets)
+		if (scheduled.clear_render_targets)
 		{
 			for (const com_ptr<ID3D10RenderTargetView> &target : pass_data.render_targets)
 			{
@@ -1067,26 +1159,22 @@ void reshade::d3d10::runtime_d3d10::render_technique(technique &technique)
 		_vertices += pass_info.num_vertices;
 		_drawcalls += 1;
 
-		// Reset render targets
-		_device->OMSetRenderTargets(0, nullptr, nullptr);
+		// Reset render targets (unless the next pass renders to the same ones)
+		if (scheduled.end_render_pass)
+			_device->OMSetRenderTargets(0, nullptr, nullptr);
 
 		// Reset shader resources
 		ID3D10ShaderResourceView *null_srv[D3D10_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT] = { nullptr };
 		_device->VSSetShaderResources(0, static_cast<UINT>(pass_data.shader_resources.size()), null_srv);
 		_device->PSSetShaderResources(0, static_cast<UINT>(pass_data.shader_resources.size()), null_srv);
 
-		needs_implicit_backbuffer_copy = false;
-		for (const com_ptr<ID3D10ShaderResourceView> &resource : pass_data.render_target_resources)
+		// Generate mipmaps (the schedule never requests this for the back buffer)
+		for (UINT k = 0; k < D3D10_SIMULTANEOUS_RENDER_TARGET_COUNT && pass_data.render_target_resources[k] != nullptr; ++k)
 		{
-			if (resource == nullptr)
-				break;
+			if ((scheduled.generate_mipmaps & (1 << k)) == 0)
+				continue;
 
-			if (resource == _backbuffer_texture_srv[0] ||
-				resource == _backbuffer_texture_srv[1])
-			{
-				needs_implicit_backbuffer_copy = true;
-				break;
-			}
+			const com_ptr<ID3D10ShaderResourceView> &resource = pass_data.render_target_resources[k];
 
 			D3D10_SHADER_RESOURCE_VIEW_DESC resource_desc;
 			resource->GetDesc(&resource_desc);
@@ -1094,15 +1182,13 @@ void reshade::d3d10::runtime_d3d10::render_technique(technique &technique)
 			if (resource_desc.Texture2D.MipLevels > 1)
 				_device->GenerateMips(resource.get());
 		}
-	}
 
-	if (!impl->query_in_flight)
-	{
-		impl->timestamp_query_end->End();
-		impl->timestamp_disjoint->End();
+		if (timestamp_query != nullptr)
+			(*timestamp_query++)->End();
 	}
 
-	impl->query_in_flight = true;
+	if (timestamp_disjoint != nullptr)
+		timestamp_disjoint->End();
 }
 
 #if RESHADE_GUI
@@ -1332,15 +1418,20 @@ void reshade::d3d10::runtime_d3d10::draw_depth_debug_menu(buffer_detection &trac
 	ImGui::Separator();
 	ImGui::Spacing();
 
-	for (const auto &[dsv_texture, snapshot] : tracker.depth_buffer_counters())
+	const auto &depth_buffers = tracker.depth_buffer_tracker();
+
+	for (uint32_t slot = 0; slot < depth_buffers.resources().size(); ++slot)
 	{
+		const auto &snapshot = depth_buffers.counters(slot);
+		if (!snapshot.in_use)
+			continue;
+
+		const com_ptr<ID3D10Texture2D> &dsv_texture = depth_buffers.data(slot);
+
 		char label[512] = "";
 		sprintf_s(label, "%s0x%p", (dsv_texture == _depth_texture || dsv_texture == tracker.current_depth_texture() ? "> " : "  "), dsv_texture.get());
 
-		D3D10_TEXTURE2D_DESC desc;
-		dsv_texture->GetDesc(&desc);
-
-		const bool msaa = desc.SampleDesc.Count > 1;
+		const bool msaa = snapshot.desc.samples > 1;
 		if (msaa) // Disable widget for MSAA textures
 		{
 			ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
@@ -1353,7 +1444,7 @@ void reshade::d3d10::runtime_d3d10::draw_depth_debug_menu(buffer_detection &trac
 
 		ImGui::SameLine();
 		ImGui::Text("| %4ux%-4u | %5u draw calls ==> %8u vertices |%s",
-			desc.Width, desc.Height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
+			snapshot.desc.width, snapshot.desc.height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
 
 		if (_preserve_depth_buffers && dsv_texture == tracker.current_depth_texture())
 		{
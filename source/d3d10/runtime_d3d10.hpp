@@ -36,6 +36,10 @@ namespace reshade::d3d10
 
 		void render_technique(technique &technique) override;
 
+		bool begin_readback(unsigned int slot) override;
+		bool is_readback_complete(unsigned int slot) const override;
+		bool finish_readback(unsigned int slot, uint8_t *buffer) override;
+
 		state_block _app_state;
 		const com_ptr<ID3D10Device1> _device;
 		const com_ptr<IDXGISwapChain> _swapchain;
@@ -46,6 +50,7 @@ namespace reshade::d3d10
 		com_ptr<ID3D10RenderTargetView> _backbuffer_rtv[3];
 		com_ptr<ID3D10Texture2D> _backbuffer_texture;
 		com_ptr<ID3D10ShaderResourceView> _backbuffer_texture_srv[2];
+		std::vector<com_ptr<ID3D10Texture2D>> _readback_textures;
 
 		com_ptr<ID3D10PixelShader> _copy_pixel_shader;
 		com_ptr<ID3D10VertexShader> _copy_vertex_shader;
@@ -6,7 +6,7 @@
 #include "dll_log.hpp"
 #include "buffer_detection.hpp"
 #include "dxgi/format_utils.hpp"
-#include <cmath>
+#include <cassert>
 
 #if RESHADE_DEPTH
 static inline com_ptr<ID3D11Texture2D> texture_from_dsv(ID3D11DepthStencilView *dsv)
@@ -29,79 +29,98 @@ void reshade::d3d11::buffer_detection::init(ID3D11DeviceContext *device, const b
 
 void reshade::d3d11::buffer_detection::reset()
 {
-	_stats = { 0, 0 };
+	// Keep depth-stencil textures that are still in use, so that their slots stay valid and binding them again does not need to allocate
+	_tracker.reset_unused();
 #if RESHADE_DEPTH
 	_best_copy_stats = { 0, 0 };
-	_has_indirect_drawcalls = false;
-	_counters_per_used_depth_texture.clear();
 #endif
 }
 void reshade::d3d11::buffer_detection_context::reset(bool release_resources)
 {
-	buffer_detection::reset();
-
 #if RESHADE_DEPTH
 	assert(_depthstencil_clear_texture == nullptr || _context == this);
 
 	if (release_resources)
 	{
 		assert(_context == this);
-		
+
+		// Release all references to depth-stencil textures
+		_tracker.reset();
+		_best_copy_stats = { 0, 0 };
+		invalidate_depthstencil();
+
 		_previous_stats = { 0, 0 };
 		_depthstencil_clear_texture.reset();
+		return;
 	}
 #else
 	UNREFERENCED_PARAMETER(release_resources);
 #endif
+
+	buffer_detection::reset();
 }
 
-void reshade::d3d11::buffer_detection::merge(const buffer_detection &source)
+void reshade::d3d11::buffer_detection::take_snapshot(snapshot &out) const
 {
-	_stats.vertices += source._stats.vertices;
-	_stats.drawcalls += source._stats.drawcalls;
+	_tracker.take_snapshot(out.counters);
 
 #if RESHADE_DEPTH
-	_best_copy_stats = source._best_copy_stats;
-	_has_indirect_drawcalls |= source._has_indirect_drawcalls;
-
-	for (const auto &[dsv_texture, snapshot] : source._counters_per_used_depth_texture)
-	{
-		auto &target_snapshot = _counters_per_used_depth_texture[dsv_texture];
-		target_snapshot.total_stats.vertices += snapshot.total_stats.vertices;
-		target_snapshot.total_stats.drawcalls += snapshot.total_stats.drawcalls;
-		target_snapshot.current_stats.vertices += snapshot.current_stats.vertices;
-		target_snapshot.current_stats.drawcalls += snapshot.current_stats.drawcalls;
+	out.best_copy_stats = _best_copy_stats;
+#endif
+}
+void reshade::d3d11::buffer_detection::merge(const snapshot &source)
+{
+	_tracker.merge(source.counters);
 
-		target_snapshot.clears.insert(target_snapshot.clears.end(), snapshot.clears.begin(), snapshot.clears.end());
-	}
+#if RESHADE_DEPTH
+	_best_copy_stats = source.best_copy_stats;
 #endif
 }
 
 void reshade::d3d11::buffer_detection::on_draw(UINT vertices)
 {
-	_stats.vertices += vertices;
-	_stats.drawcalls += 1;
+#if RESHADE_DEPTH
+	if (_has_unknown_depthstencil)
+	{
+		com_ptr<ID3D11DepthStencilView> dsv;
+		_device->OMGetRenderTargets(0, nullptr, &dsv);
+		on_set_depthstencil(dsv.get());
+	}
+#endif
+
+	// The depth-stencil texture is otherwise looked up when it is bound, so this only has to update counters
+	_tracker.on_draw(vertices);
+}
 
 #if RESHADE_DEPTH
-	com_ptr<ID3D11DepthStencilView> depthstencil;
-	_device->OMGetRenderTargets(0, nullptr, &depthstencil);
+void reshade::d3d11::buffer_detection::on_set_depthstencil(ID3D11DepthStencilView *dsv)
+{
+	if (dsv == _current_dsv && !_has_unknown_depthstencil)
+		return; // Same view is bound again (which is common when only render targets change)
+
+	_current_dsv = dsv;
+	_has_unknown_depthstencil = false;
 
-	const auto dsv_texture = texture_from_dsv(depthstencil.get());
+	const com_ptr<ID3D11Texture2D> dsv_texture = texture_from_dsv(dsv);
 	if (dsv_texture == nullptr)
-		return; // This is a draw call with no depth-stencil bound
+	{
+		_tracker.bind(_tracker.npos); // Subsequent draw calls have no depth-stencil bound
+		return;
+	}
 
-	auto &counters = _counters_per_used_depth_texture[dsv_texture];
-	counters.total_stats.vertices += vertices;
-	counters.total_stats.drawcalls += 1;
-	counters.current_stats.vertices += vertices;
-	counters.current_stats.drawcalls += 1;
+	uint32_t slot = _tracker.find(reinterpret_cast<uintptr_t>(dsv_texture.get()));
+	if (slot == _tracker.npos)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		dsv_texture->GetDesc(&desc);
+		assert((desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) != 0);
 
-	if (vertices == 0)
-		_has_indirect_drawcalls = true;
-#endif
+		slot = _tracker.add(reinterpret_cast<uintptr_t>(dsv_texture.get()), { desc.Width, desc.Height, desc.SampleDesc.Count }, dsv_texture);
+	}
+
+	_tracker.bind(slot);
 }
 
-#if RESHADE_DEPTH
 void reshade::d3d11::buffer_detection::on_clear_depthstencil(UINT clear_flags, ID3D11DepthStencilView *dsv)
 {
 	assert(_context != nullptr);
@@ -113,31 +132,32 @@ void reshade::d3d11::buffer_detection::on_clear_depthstencil(UINT clear_flags, I
 	if (dsv_texture == nullptr || dsv_texture != _context->_depthstencil_clear_index.first)
 		return;
 
-	auto &counters = _counters_per_used_depth_texture[dsv_texture];
+	uint32_t slot = _tracker.find(reinterpret_cast<uintptr_t>(dsv_texture.get()));
+	if (slot == _tracker.npos)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		dsv_texture->GetDesc(&desc);
+
+		slot = _tracker.add(reinterpret_cast<uintptr_t>(dsv_texture.get()), { desc.Width, desc.Height, desc.SampleDesc.Count }, dsv_texture);
+	}
 
-	// Update stats with data from previous frame
-	if (counters.current_stats.drawcalls == 0)
-		counters.current_stats = _context->_previous_stats;
+	// Update stats with data from previous frame if there were no draw calls since the last clear
+	const depth_selection::draw_stats current_stats = _tracker.on_clear(slot, _context->_previous_stats);
 
 	// Ignore clears when there was no meaningful workload
-	if (counters.current_stats.drawcalls == 0)
+	if (current_stats.drawcalls == 0)
 		return;
 
-	counters.clears.push_back(counters.current_stats);
-
 	// Make a backup copy of the depth texture before it is cleared
 	if (_context->_depthstencil_clear_index.second == std::numeric_limits<UINT>::max() ?
-		counters.current_stats.vertices > _best_copy_stats.vertices :
+		current_stats.vertices > _best_copy_stats.vertices :
 		// This is not really correct, since clears may accumulate over multiple command lists, but it's unlikely that the same depth-stencil is used in more than one
-		counters.clears.size() == _context->_depthstencil_clear_index.second)
+		_tracker.counters(slot).clears.size() == _context->_depthstencil_clear_index.second)
 	{
-		_best_copy_stats = counters.current_stats;
+		_best_copy_stats = current_stats;
 
 		_device->CopyResource(_context->_depthstencil_clear_texture.get(), dsv_texture.get());
 	}
-
-	// Reset draw call stats for clears
-	counters.current_stats = { 0, 0 };
 }
 
 bool reshade::d3d11::buffer_detection_context::update_depthstencil_clear_texture(D3D11_TEXTURE2D_DESC desc)
@@ -172,59 +192,32 @@ bool reshade::d3d11::buffer_detection_context::update_depthstencil_clear_texture
 
 com_ptr<ID3D11Texture2D> reshade::d3d11::buffer_detection_context::find_best_depth_texture(UINT width, UINT height, com_ptr<ID3D11Texture2D> override, UINT clear_index_override)
 {
-	depthstencil_info best_snapshot;
+	uint32_t best_slot = _tracker.npos;
 	com_ptr<ID3D11Texture2D> best_match;
 
 	if (override != nullptr)
 	{
+		best_slot = _tracker.find(reinterpret_cast<uintptr_t>(override.get()));
 		best_match = std::move(override);
-		best_snapshot = _counters_per_used_depth_texture[best_match];
 	}
 	else
 	{
-		for (auto &[dsv_texture, snapshot] : _counters_per_used_depth_texture)
-		{
-			if (snapshot.total_stats.drawcalls == 0)
-				continue; // Skip unused
-
-			D3D11_TEXTURE2D_DESC desc; dsv_texture->GetDesc(&desc);
-			assert((desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) != 0);
-
-			if (desc.SampleDesc.Count > 1)
-				continue; // Ignore MSAA textures, since they would need to be resolved first
-
-			assert((desc.BindFlags & D3D11_BIND_SHADER_RESOURCE) != 0);
-
-			if (width != 0 && height != 0)
-			{
-				const float w = static_cast<float>(width);
-				const float w_ratio = w / desc.Width;
-				const float h = static_cast<float>(height);
-				const float h_ratio = h / desc.Height;
-				const float aspect_ratio = (w / h) - (static_cast<float>(desc.Width) / desc.Height);
-
-				if (std::fabs(aspect_ratio) > 0.1f || w_ratio > 1.85f || h_ratio > 1.85f || w_ratio < 0.5f || h_ratio < 0.5f)
-					continue; // Not a good fit
-			}
-
-			if (!_has_indirect_drawcalls ?
-				// Choose snapshot with the most vertices, since that is likely to contain the main scene
-				snapshot.total_stats.vertices > best_snapshot.total_stats.vertices :
-				// Or check draw calls, since vertices may not be accurate if application is using indirect draw calls
-				snapshot.total_stats.drawcalls > best_snapshot.total_stats.drawcalls)
-			{
-				best_match = dsv_texture;
-				best_snapshot = snapshot;
-			}
-		}
+		depth_selection::selection_options options;
+		options.width = width;
+		options.height = height;
+		options.heuristic = depth_selection::selection_heuristic::most_vertices;
+
+		best_slot = _tracker.find_best(options);
+		if (best_slot != _tracker.npos)
+			best_match = _tracker.data(best_slot);
 	}
 
 	if (clear_index_override != 0 && best_match != nullptr)
 	{
-		_previous_stats = best_snapshot.current_stats;
+		_previous_stats = best_slot != _tracker.npos ? _tracker.counters(best_slot).current_stats : depth_selection::draw_stats {};
 		_depthstencil_clear_index = { best_match.get(), std::numeric_limits<UINT>::max() };
 
-		if (clear_index_override <= best_snapshot.clears.size())
+		if (best_slot != _tracker.npos && clear_index_override <= _tracker.counters(best_slot).clears.size())
 		{
 			_depthstencil_clear_index.second = clear_index_override;
 		}
@@ -5,47 +5,60 @@
 
 #pragma once
 
-#include <map>
 #include <d3d11.h>
 #include "com_ptr.hpp"
+#include "depth_selection.hpp"
 
 namespace reshade::d3d11
 {
 	class buffer_detection
 	{
+		// A reference to each depth-stencil texture is stored alongside its counters, so that the handle (the texture pointer) stays valid until it is removed
+		using depth_tracker = depth_selection::tracker<com_ptr<ID3D11Texture2D>>;
+
 	public:
+		/// <summary>
+		/// The statistics recorded into a command list, which are merged into the immediate context when the command list is executed.
+		/// </summary>
+		struct snapshot
+		{
+			depth_tracker::snapshot counters;
+#if RESHADE_DEPTH
+			depth_selection::draw_stats best_copy_stats;
+#endif
+		};
+
 		void init(ID3D11DeviceContext *device, const class buffer_detection_context *context);
 		void reset();
 
-		void merge(const buffer_detection &source);
+		/// <summary>
+		/// Copy all statistics that changed since the last reset into a snapshot (only visits the depth-stencil textures that were actually used).
+		/// This is called on the thread recording a deferred context, so that executing the command list later only has to merge the compact snapshot.
+		/// </summary>
+		void take_snapshot(snapshot &out) const;
+		void merge(const snapshot &source);
 
 		void on_draw(UINT vertices);
 
 #if RESHADE_DEPTH
+		void on_set_depthstencil(ID3D11DepthStencilView *dsv);
 		void on_clear_depthstencil(UINT clear_flags, ID3D11DepthStencilView *dsv);
+
+		/// <summary>
+		/// Query the bound depth-stencil view again before the next draw call, because the pipeline state was changed without going through <see cref="on_set_depthstencil"/>.
+		/// </summary>
+		void invalidate_depthstencil() { _current_dsv = nullptr; _has_unknown_depthstencil = true; }
 #endif
 
 	protected:
-		struct draw_stats
-		{
-			UINT vertices = 0;
-			UINT drawcalls = 0;
-		};
-		struct depthstencil_info
-		{
-			draw_stats total_stats;
-			draw_stats current_stats; // Stats since last clear
-			std::vector<draw_stats> clears;
-		};
-
 		ID3D11DeviceContext *_device = nullptr;
 		const buffer_detection_context *_context = nullptr;
-		draw_stats _stats;
+		depth_tracker _tracker;
 #if RESHADE_DEPTH
-		draw_stats _best_copy_stats;
-		bool _has_indirect_drawcalls = false;
-		// Use "std::map" instead of "std::unordered_map" so that the iteration order is guaranteed
-		std::map<com_ptr<ID3D11Texture2D>, depthstencil_info> _counters_per_used_depth_texture;
+		depth_selection::draw_stats _best_copy_stats;
+		// The pipeline keeps a reference to the bound depth-stencil view, so it cannot be destroyed while bound and it is safe to compare against without keeping another reference here
+		ID3D11DepthStencilView *_current_dsv = nullptr;
+		bool _has_unknown_depthstencil = true;
 #endif
 	};
 
@@ -56,14 +69,14 @@ namespace reshade::d3d11
 	public:
 		explicit buffer_detection_context(ID3D11DeviceContext *context) { init(context, nullptr); }
 
-		UINT total_vertices() const { return _stats.vertices; }
-		UINT total_drawcalls() const { return _stats.drawcalls; }
+		UINT total_vertices() const { return _tracker.total_vertices(); }
+		UINT total_drawcalls() const { return _tracker.total_drawcalls(); }
 
 		void reset(bool release_resources);
 
 #if RESHADE_DEPTH
 		UINT current_clear_index() const { return _depthstencil_clear_index.second; }
-		const auto &depth_buffer_counters() const { return _counters_per_used_depth_texture; }
+		const auto &depth_buffer_tracker() const { return _tracker; }
 		ID3D11Texture2D *current_depth_texture() const { return _depthstencil_clear_index.first; }
 
 		com_ptr<ID3D11Texture2D> find_best_depth_texture(UINT width, UINT height,
@@ -74,7 +87,7 @@ namespace reshade::d3d11
 #if RESHADE_DEPTH
 		bool update_depthstencil_clear_texture(D3D11_TEXTURE2D_DESC desc);
 
-		draw_stats _previous_stats;
+		depth_selection::draw_stats _previous_stats;
 		com_ptr<ID3D11Texture2D> _depthstencil_clear_texture;
 		std::pair<ID3D11Texture2D *, UINT> _depthstencil_clear_index = { nullptr, std::numeric_limits<UINT>::max() };
 #endif
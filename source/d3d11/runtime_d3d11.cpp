@@ -8,6 +8,7 @@
 #include "runtime_d3d11.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "format_conversion.hpp"
 #include "dxgi/format_utils.hpp"
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -40,10 +41,10 @@ namespace reshade::d3d11
 
 	struct d3d11_technique_data
 	{
-		bool query_in_flight = false;
-		com_ptr<ID3D11Query> timestamp_disjoint;
-		com_ptr<ID3D11Query> timestamp_query_beg;
-		com_ptr<ID3D11Query> timestamp_query_end;
+		query_ring<NUM_GPU_QUERY_FRAMES> queries;
+		com_ptr<ID3D11Query> timestamp_disjoint[NUM_GPU_QUERY_FRAMES];
+		std::vector<com_ptr<ID3D11Query>> timestamp_queries; // One before the first pass and one after every pass for each frame
+		std::vector<UINT64> timestamps;
 		std::vector<com_ptr<ID3D11SamplerState>> sampler_states;
 		std::vector<com_ptr<ID3D11ShaderResourceView>> texture_bindings;
 		std::vector<d3d11_pass_data> passes;
@@ -243,6 +244,7 @@ void reshade::d3d11::runtime_d3d11::on_reset()
 	_backbuffer_texture.reset();
 	_backbuffer_texture_srv[0].reset();
 	_backbuffer_texture_srv[1].reset();
+	_readback_textures.clear();
 
 	_copy_vertex_shader.reset();
 	_copy_pixel_shader.reset();
@@ -363,27 +365,12 @@ bool reshade::d3d11::runtime_d3d11::capture_screenshot(uint8_t *buffer) const
 	{
 		if (_color_bit_depth == 10)
 		{
-			for (uint32_t x = 0; x < pitch; x += 4)
-			{
-				const uint32_t rgba = *reinterpret_cast<const uint32_t *>(mapped_data + x);
-				// Divide by 4 to get 10-bit range (0-1023) into 8-bit range (0-255)
-				buffer[x + 0] = ((rgba & 0x3FF) / 4) & 0xFF;
-				buffer[x + 1] = (((rgba & 0xFFC00) >> 10) / 4) & 0xFF;
-				buffer[x + 2] = (((rgba & 0x3FF00000) >> 20) / 4) & 0xFF;
-				buffer[x + 3] = 0xFF;
-			}
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
 		}
 		else
 		{
-			std::memcpy(buffer, mapped_data, pitch);
-
-			for (uint32_t x = 0; x < pitch; x += 4)
-			{
-				buffer[x + 3] = 0xFF; // Clear alpha channel
-				if (_backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM ||
-					_backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB)
-					std::swap(buffer[x + 0], buffer[x + 2]); // Format is BGRA, but output should be RGBA, so flip channels
-			}
+			// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM || _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
 		}
 	}
 
@@ -392,6 +379,74 @@ bool reshade::d3d11::runtime_d3d11::capture_screenshot(uint8_t *buffer) const
 	return true;
 }
 
+bool reshade::d3d11::runtime_d3d11::begin_readback(unsigned int slot)
+{
+	if (slot >= _readback_textures.size())
+		_readback_textures.resize(slot + 1);
+
+	// Textures are kept until the next reset, at which point the frame dimensions may change
+	if (_readback_textures[slot] == nullptr)
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = _width;
+		desc.Height = _height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = _backbuffer_format;
+		desc.SampleDesc = { 1, 0 };
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+		if (FAILED(_device->CreateTexture2D(&desc, nullptr, &_readback_textures[slot])))
+		{
+			LOG(ERROR) << "Failed to create system memory texture for screenshot capture!";
+			return false;
+		}
+	}
+
+	_immediate_context->CopyResource(_readback_textures[slot].get(), _backbuffer_resolved.get());
+
+	return true;
+}
+bool reshade::d3d11::runtime_d3d11::is_readback_complete(unsigned int slot) const
+{
+	assert(slot < _readback_textures.size());
+
+	// Mapping without waiting fails with 'DXGI_ERROR_WAS_STILL_DRAWING' while the copy is still in flight
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	const HRESULT hr = _immediate_context->Map(_readback_textures[slot].get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+	if (SUCCEEDED(hr))
+		_immediate_context->Unmap(_readback_textures[slot].get(), 0);
+
+	return hr != DXGI_ERROR_WAS_STILL_DRAWING;
+}
+bool reshade::d3d11::runtime_d3d11::finish_readback(unsigned int slot, uint8_t *buffer)
+{
+	assert(slot < _readback_textures.size());
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(_immediate_context->Map(_readback_textures[slot].get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		return false;
+	auto mapped_data = static_cast<const uint8_t *>(mapped.pData);
+
+	for (uint32_t y = 0; y < _height; y++, buffer += _width * 4, mapped_data += mapped.RowPitch)
+	{
+		if (_color_bit_depth == 10)
+		{
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
+		}
+		else
+		{
+			// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM || _backbuffer_format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
+		}
+	}
+
+	_immediate_context->Unmap(_readback_textures[slot].get(), 0);
+
+	return true;
+}
+
 bool reshade::d3d11::runtime_d3d11::init_effect(size_t index)
 {
 	if (_d3d_compiler == nullptr)
@@ -409,6 +464,7 @@ bool reshade::d3d11::runtime_d3d11::init_effect(size_t index)
 
 	const auto D3DCompile = reinterpret_cast<pD3DCompile>(GetProcAddress(_d3d_compiler, "D3DCompile"));
 	const auto D3DDisassemble = reinterpret_cast<pD3DDisassemble>(GetProcAddress(_d3d_compiler, "D3DDisassemble"));
+	const auto D3DCreateBlob = reinterpret_cast<decltype(&::D3DCreateBlob)>(GetProcAddress(_d3d_compiler, "D3DCreateBlob"));
 
 	const std::string hlsl = effect.preamble + effect.module.hlsl;
 	std::unordered_map<std::string, com_ptr<IUnknown>> entry_points;
@@ -440,16 +496,38 @@ bool reshade::d3d11::runtime_d3d11::init_effect(size_t index)
 			break;
 		}
 
-		HRESULT hr = D3DCompile(
-			hlsl.c_str(), hlsl.size(),
-			nullptr, nullptr, nullptr,
-			entry_point.name.c_str(),
-			profile.c_str(),
-			D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3, 0,
-			&d3d_compiled, &d3d_errors);
+		const UINT compile_flags = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3;
 
-		if (d3d_errors != nullptr) // Append warnings to the output error string as well
-			effect.errors.append(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+		HRESULT hr = S_OK;
+		std::string warnings;
+		const uint64_t cache_key = permutation_cache::hash(hlsl, entry_point.name, profile, compile_flags);
+
+		// Compiling is by far the slowest part of loading an effect, so reuse byte code compiled from the same source code before (in this or a previous session)
+		if (std::vector<uint8_t> cached_data; _permutation_cache->find_binary(cache_key, cached_data, warnings) &&
+			D3DCreateBlob != nullptr && SUCCEEDED(D3DCreateBlob(cached_data.size(), &d3d_compiled)))
+		{
+			std::memcpy(d3d_compiled->GetBufferPointer(), cached_data.data(), cached_data.size());
+		}
+		else
+		{
+			hr = D3DCompile(
+				hlsl.c_str(), hlsl.size(),
+				nullptr, nullptr, nullptr,
+				entry_point.name.c_str(),
+				profile.c_str(),
+				compile_flags, 0,
+				&d3d_compiled, &d3d_errors);
+
+			warnings.clear();
+			if (d3d_errors != nullptr)
+				warnings.assign(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+
+			if (SUCCEEDED(hr))
+				_permutation_cache->insert_binary(cache_key, d3d_compiled->GetBufferPointer(), d3d_compiled->GetBufferSize(), warnings);
+		}
+
+		// Append warnings to the output error string as well
+		effect.errors += warnings;
 
 		// No need to setup resources if any of the shaders failed to compile
 		if (FAILED(hr))
@@ -568,12 +646,16 @@ bool reshade::d3d11::runtime_d3d11::init_effect(size_t index)
 		auto impl = new d3d11_technique_data(technique_init);
 		technique.impl = impl;
 
+		impl->timestamps.resize(technique.schedule.passes.size() + 1);
+		impl->timestamp_queries.resize(impl->timestamps.size() * NUM_GPU_QUERY_FRAMES);
+
 		D3D11_QUERY_DESC query_desc = {};
 		query_desc.Query = D3D11_QUERY_TIMESTAMP;
-		_device->CreateQuery(&query_desc, &impl->timestamp_query_beg);
-		_device->CreateQuery(&query_desc, &impl->timestamp_query_end);
+		for (com_ptr<ID3D11Query> &query : impl->timestamp_queries)
+			_device->CreateQuery(&query_desc, &query);
 		query_desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
-		_device->CreateQuery(&query_desc, &impl->timestamp_disjoint);
+		for (com_ptr<ID3D11Query> &query : impl->timestamp_disjoint)
+			_device->CreateQuery(&query_desc, &query);
 
 		impl->passes.resize(technique.passes.size());
 		for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
@@ -920,16 +1002,13 @@ void reshade::d3d11::runtime_d3d11::upload_texture(const texture &texture, const
 	case reshadefx::texture_format::r8:
 		upload_pitch = texture.width;
 		upload_data.resize(upload_pitch * texture.height);
-		for (uint32_t i = 0, k = 0; i < texture.width * texture.height * 4; i += 4, k += 1)
-			upload_data[k] = pixels[i];
+		convert_rgba8_to_r8(upload_data.data(), pixels, size_t(texture.width) * texture.height);
 		pixels = upload_data.data();
 		break;
 	case reshadefx::texture_format::rg8:
 		upload_pitch = texture.width * 2;
 		upload_data.resize(upload_pitch * texture.height);
-		for (uint32_t i = 0, k = 0; i < texture.width * texture.height * 4; i += 4, k += 2)
-			upload_data[k + 0] = pixels[i + 0],
-			upload_data[k + 1] = pixels[i + 1];
+		convert_rgba8_to_rg8(upload_data.data(), pixels, size_t(texture.width) * texture.height);
 		pixels = upload_data.data();
 		break;
 	case reshadefx::texture_format::rgba8:
@@ -956,26 +1035,36 @@ void reshade::d3d11::runtime_d3d11::render_technique(technique &technique)
 	const auto impl = static_cast<d3d11_technique_data *>(technique.impl);
 	d3d11_effect_data &effect_data = _effect_data[technique.effect_index];
 
-	// Evaluate queries
-	if (impl->query_in_flight)
+	const size_t num_timestamps = impl->timestamps.size();
+
+	// Evaluate queries of previous frames that finished by now
+	for (size_t slot; impl->queries.oldest_pending(slot); impl->queries.pop())
 	{
-		UINT64 timestamp0, timestamp1;
 		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		if (_immediate_context->GetData(impl->timestamp_disjoint[slot].get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			break;
 
-		if (_immediate_context->GetData(impl->timestamp_disjoint.get(),  &disjoint,   sizeof(disjoint),   D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
-			_immediate_context->GetData(impl->timestamp_query_beg.get(), &timestamp0, sizeof(timestamp0), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
-			_immediate_context->GetData(impl->timestamp_query_end.get(), &timestamp1, sizeof(timestamp1), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
-		{
-			if (!disjoint.Disjoint)
-				technique.average_gpu_duration.append((timestamp1 - timestamp0) * 1'000'000'000 / disjoint.Frequency);
-			impl->query_in_flight = false;
-		}
+		// The disjoint query ends after all time stamps, so those are available too once it is
+		bool available = true;
+		for (size_t i = 0; i < num_timestamps && available; ++i)
+			available = _immediate_context->GetData(impl->timestamp_queries[slot * num_timestamps + i].get(), &impl->timestamps[i], sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK;
+		if (!available)
+			break;
+
+		if (!disjoint.Disjoint)
+			technique.append_gpu_timestamps(impl->timestamps.data(), disjoint.Frequency);
 	}
 
-	if (!impl->query_in_flight)
+	// Skip time measurement this frame if the queries of all frames are still in flight
+	const com_ptr<ID3D11Query> *timestamp_query = nullptr;
+	ID3D11Query *timestamp_disjoint = nullptr;
+	if (size_t slot; impl->queries.push(slot))
 	{
-		_immediate_context->Begin(impl->timestamp_disjoint.get());
-		_immediate_context->End(impl->timestamp_query_beg.get());
+		timestamp_query = impl->timestamp_queries.data() + slot * num_timestamps;
+		timestamp_disjoint = impl->timestamp_disjoint[slot].get();
+
+		_immediate_context->Begin(timestamp_disjoint);
+		_immediate_context->End((timestamp_query++)->get());
 	}
 
 	// Setup vertex input
@@ -993,6 +1082,8 @@ void reshade::d3d11::runtime_d3d11::render_technique(technique &technique)
 	if (ID3D11Buffer *const cb = effect_data.cb.get();
 		cb != nullptr)
 	{
+		RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, upload_constants);
+
 		if (D3D11_MAPPED_SUBRESOURCE mapped;
 			SUCCEEDED(_immediate_context->Map(cb, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
 		{
@@ -1010,11 +1101,12 @@ void reshade::d3d11::runtime_d3d11::render_technique(technique &technique)
 	_immediate_context->GSSetShader(nullptr, nullptr, 0);
 
 	bool is_effect_stencil_cleared = false;
-	bool needs_implicit_backbuffer_copy = true; // First pass always needs the back buffer updated
 
-	for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
+	for (const reshadefx::scheduled_pass &scheduled : technique.schedule.passes)
 	{
-		if (needs_implicit_backbuffer_copy)
+		const size_t pass_index = scheduled.pass_index;
+
+		if (scheduled.copy_backbuffer)
 		{
 			// Save back buffer of previous pass
 			_immediate_context->CopyResource(_backbuffer_texture.get(), _backbuffer_resolved.get());
@@ -1051,7 +1143,7 @@ void reshade::d3d11::runtime_d3d11::render_technique(technique &technique)
 			_immediate_context->OMSetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, reinterpret_cast<ID3D11RenderTargetView *const *>(pass_data.render_targets), nullptr);
 		}
 
-		if (pass_info.clear_render_targets)
+		if (scheduled.clear_render_targets)
 		{
 			for (const com_ptr<ID3D11RenderTargetView> &target : pass_data.render_targets)
 			{
@@ -1089,26 +1181,22 @@ void reshade::d3d11::runtime_d3d11::render_technique(technique &technique)
 		_vertices += pass_info.num_vertices;
 		_drawcalls += 1;
 
-		// Reset render targets
-		_immediate_context->OMSetRenderTargets(0, nullptr, nullptr);
+		// Reset render targets (unless the next pass renders to the same ones)
+		if (scheduled.end_render_pass)
+			_immediate_context->OMSetRenderTargets(0, nullptr, nullptr);
 
 		// Reset shader resources
 		ID3D11ShaderResourceView *null_srv[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT] = { nullptr };
 		_immediate_context->VSSetShaderResources(0, static_cast<UINT>(pass_data.shader_resources.size()), null_srv);
 		_immediate_context->PSSetShaderResources(0, static_cast<UINT>(pass_data.shader_resources.size()), null_srv);
 
-		needs_implicit_backbuffer_copy = false;
-		for (const com_ptr<ID3D11ShaderResourceView> &resource : pass_data.render_target_resources)
+		// Generate mipmaps (the schedule never requests this for the back buffer)
+		for (UINT k = 0; k < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT && pass_data.render_target_resources[k] != nullptr; ++k)
 		{
-			if (resource == nullptr)
-				break;
+			if ((scheduled.generate_mipmaps & (1 << k)) == 0)
+				continue;
 
-			if (resource == _backbuffer_texture_srv[0] ||
-				resource == _backbuffer_texture_srv[1])
-			{
-				needs_implicit_backbuffer_copy = true;
-				break;
-			}
+			const com_ptr<ID3D11ShaderResourceView> &resource = pass_data.render_target_resources[k];
 
 			D3D11_SHADER_RESOURCE_VIEW_DESC resource_desc;
 			resource->GetDesc(&resource_desc);
@@ -1116,15 +1204,13 @@ void reshade::d3d11::runtime_d3d11::render_technique(technique &technique)
 			if (resource_desc.Texture2D.MipLevels > 1)
 				_immediate_context->GenerateMips(resource.get());
 		}
-	}
 
-	if (!impl->query_in_flight)
-	{
-		_immediate_context->End(impl->timestamp_query_end.get());
-		_immediate_context->End(impl->timestamp_disjoint.get());
+		if (timestamp_query != nullptr)
+			_immediate_context->End((timestamp_query++)->get());
 	}
 
-	impl->query_in_flight = true;
+	if (timestamp_disjoint != nullptr)
+		_immediate_context->End(timestamp_disjoint);
 }
 
 #if RESHADE_GUI
@@ -1358,15 +1444,20 @@ void reshade::d3d11::runtime_d3d11::draw_depth_debug_menu(buffer_detection_conte
 	ImGui::Separator();
 	ImGui::Spacing();
 
-	for (const auto &[dsv_texture, snapshot] : tracker.depth_buffer_counters())
+	const auto &depth_buffers = tracker.depth_buffer_tracker();
+
+	for (uint32_t slot = 0; slot < depth_buffers.resources().size(); ++slot)
 	{
+		const auto &snapshot = depth_buffers.counters(slot);
+		if (!snapshot.in_use)
+			continue;
+
+		const com_ptr<ID3D11Texture2D> &dsv_texture = depth_buffers.data(slot);
+
 		char label[512] = "";
 		sprintf_s(label, "%s0x%p", (dsv_texture == _depth_texture || dsv_texture == tracker.current_depth_texture() ? "> " : "  "), dsv_texture.get());
 
-		D3D11_TEXTURE2D_DESC desc;
-		dsv_texture->GetDesc(&desc);
-
-		const bool msaa = desc.SampleDesc.Count > 1;
+		const bool msaa = snapshot.desc.samples > 1;
 		if (msaa) // Disable widget for MSAA textures
 		{
 			ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
@@ -1379,7 +1470,7 @@ void reshade::d3d11::runtime_d3d11::draw_depth_debug_menu(buffer_detection_conte
 
 		ImGui::SameLine();
 		ImGui::Text("| %4ux%-4u | %5u draw calls ==> %8u vertices |%s",
-			desc.Width, desc.Height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
+			snapshot.desc.width, snapshot.desc.height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
 
 		if (_preserve_depth_buffers && dsv_texture == tracker.current_depth_texture())
 		{
@@ -1412,6 +1503,9 @@ void reshade::d3d11::runtime_d3d11::draw_depth_debug_menu(buffer_detection_conte
 	ImGui::Separator();
 	ImGui::Spacing();
 
+	if (ImGui::Button("Record trace of next frame", ImVec2(-1, 0)))
+		start_depth_trace();
+
 	if (modified)
 		runtime::save_config();
 }
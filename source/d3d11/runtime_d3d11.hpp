@@ -36,6 +36,10 @@ namespace reshade::d3d11
 
 		void render_technique(technique &technique) override;
 
+		bool begin_readback(unsigned int slot) override;
+		bool is_readback_complete(unsigned int slot) const override;
+		bool finish_readback(unsigned int slot, uint8_t *buffer) override;
+
 		state_block _app_state;
 		const com_ptr<ID3D11Device> _device;
 		com_ptr<ID3D11DeviceContext> _immediate_context;
@@ -47,6 +51,7 @@ namespace reshade::d3d11
 		com_ptr<ID3D11RenderTargetView> _backbuffer_rtv[3];
 		com_ptr<ID3D11Texture2D> _backbuffer_texture;
 		com_ptr<ID3D11ShaderResourceView> _backbuffer_texture_srv[2];
+		std::vector<com_ptr<ID3D11Texture2D>> _readback_textures;
 
 		com_ptr<ID3D11PixelShader> _copy_pixel_shader;
 		com_ptr<ID3D11VertexShader> _copy_vertex_shader;
@@ -6,10 +6,6 @@
 #include "dll_log.hpp"
 #include "buffer_detection.hpp"
 #include "dxgi/format_utils.hpp"
-#include <mutex>
-#include <cmath>
-
-static std::mutex s_global_mutex;
 
 void reshade::d3d12::buffer_detection::init(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list, const buffer_detection_context *context)
 {
@@ -20,85 +16,68 @@ void reshade::d3d12::buffer_detection::init(ID3D12Device *device, ID3D12Graphics
 
 void reshade::d3d12::buffer_detection::reset()
 {
-	_stats = { 0, 0 };
+	// A command list starts without a depth-stencil bound after a reset, so do not count draw calls for the previous one
+	_tracker.bind(_tracker.npos);
+	// Keep depth-stencil resources that are still in use, so that their slots stay valid and binding them again does not need to allocate
+	_tracker.reset_unused();
 #if RESHADE_DEPTH
 	_best_copy_stats = { 0, 0 };
-	_current_depthstencil.reset();
-	_has_indirect_drawcalls = false;
-	_counters_per_used_depth_texture.clear();
 #endif
 }
 void reshade::d3d12::buffer_detection_context::reset(bool release_resources)
 {
-	buffer_detection::reset();
-
 #if RESHADE_DEPTH
 	assert(_depthstencil_clear_texture == nullptr || _context == this);
 
 	if (release_resources)
 	{
 		assert(_context == this);
-		
+
+		// Release all references to depth-stencil resources
+		_tracker.reset();
+		_best_copy_stats = { 0, 0 };
+
 		_previous_stats = { 0, 0 };
 
 		// Can only destroy this when it is guaranteed to no longer be in use
 		_depthstencil_clear_texture.reset();
-		_depthstencil_resources_by_handle.clear();
+		_depthstencil_resources_by_handle.reset_values();
+		return;
 	}
 #else
 	UNREFERENCED_PARAMETER(release_resources);
 #endif
+
+	buffer_detection::reset();
 }
 
 void reshade::d3d12::buffer_detection::merge(const buffer_detection &source)
 {
-	_stats.vertices += source._stats.vertices;
-	_stats.drawcalls += source._stats.drawcalls;
+	// Only visits the depth-stencil resources that were actually used in the source
+	_tracker.merge(source._tracker);
 
 #if RESHADE_DEPTH
 	// Executing a command list in a different command list inherits state
-	_current_depthstencil = source._current_depthstencil;
+	const uint32_t source_bound_slot = source._tracker.bound();
+	_tracker.bind(source_bound_slot != source._tracker.npos ? _tracker.find(source._tracker.counters(source_bound_slot).handle) : _tracker.npos);
 
 	_best_copy_stats = source._best_copy_stats;
-	_has_indirect_drawcalls |= source._has_indirect_drawcalls;
-
-	for (const auto &[dsv_texture, snapshot] : source._counters_per_used_depth_texture)
-	{
-		auto &target_snapshot = _counters_per_used_depth_texture[dsv_texture];
-		target_snapshot.total_stats.vertices += snapshot.total_stats.vertices;
-		target_snapshot.total_stats.drawcalls += snapshot.total_stats.drawcalls;
-		target_snapshot.current_stats.vertices += snapshot.current_stats.vertices;
-		target_snapshot.current_stats.drawcalls += snapshot.current_stats.drawcalls;
-
-		target_snapshot.clears.insert(target_snapshot.clears.end(), snapshot.clears.begin(), snapshot.clears.end());
-	}
 #endif
 }
 
 void reshade::d3d12::buffer_detection::on_draw(UINT vertices)
 {
-	_stats.vertices += vertices;
-	_stats.drawcalls += 1;
-
-#if RESHADE_DEPTH
-	if (_current_depthstencil == nullptr)
-		return; // This is a draw call with no depth-stencil bound
-
-	auto &counters = _counters_per_used_depth_texture[_current_depthstencil];
-	counters.total_stats.vertices += vertices;
-	counters.total_stats.drawcalls += 1;
-	counters.current_stats.vertices += vertices;
-	counters.current_stats.drawcalls += 1;
-
-	if (vertices == 0)
-		_has_indirect_drawcalls = true;
-#endif
+	// The depth-stencil resource is looked up when it is bound, so this only has to update counters
+	_tracker.on_draw(vertices);
 }
 
 #if RESHADE_DEPTH
 void reshade::d3d12::buffer_detection::on_set_depthstencil(D3D12_CPU_DESCRIPTOR_HANDLE dsv)
 {
-	_current_depthstencil = _context->resource_from_handle(dsv);
+	const com_ptr<ID3D12Resource> dsv_texture = _context->resource_from_handle(dsv);
+
+	// A null resource unbinds, so that subsequent draw calls are not counted for any depth-stencil
+	_tracker.bind(dsv_texture != nullptr ? find_or_add_depthstencil(dsv_texture) : _tracker.npos);
 }
 void reshade::d3d12::buffer_detection::on_clear_depthstencil(D3D12_CLEAR_FLAGS clear_flags, D3D12_CPU_DESCRIPTOR_HANDLE dsv)
 {
@@ -111,25 +90,22 @@ void reshade::d3d12::buffer_detection::on_clear_depthstencil(D3D12_CLEAR_FLAGS c
 	if (dsv_texture == nullptr || dsv_texture != _context->_depthstencil_clear_index.first)
 		return;
 
-	auto &counters = _counters_per_used_depth_texture[dsv_texture];
+	const uint32_t slot = find_or_add_depthstencil(dsv_texture);
 
-	// Update stats with data from previous frame
-	if (counters.current_stats.drawcalls == 0)
-		counters.current_stats = _context->_previous_stats;
+	// Update stats with data from previous frame if there were no draw calls since the last clear
+	const depth_selection::draw_stats current_stats = _tracker.on_clear(slot, _context->_previous_stats);
 
 	// Ignore clears when there was no meaningful workload
-	if (counters.current_stats.drawcalls == 0)
+	if (current_stats.drawcalls == 0)
 		return;
 
-	counters.clears.push_back(counters.current_stats);
-
 	// Make a backup copy of the depth texture before it is cleared
 	if (_context->_depthstencil_clear_index.second == std::numeric_limits<UINT>::max() ?
-		counters.current_stats.vertices > _best_copy_stats.vertices :
+		current_stats.vertices > _best_copy_stats.vertices :
 		// This is not really correct, since clears may accumulate over multiple command lists, but it's unlikely that the same depth-stencil is used in more than one
-		counters.clears.size() == _context->_depthstencil_clear_index.second)
+		_tracker.counters(slot).clears.size() == _context->_depthstencil_clear_index.second)
 	{
-		_best_copy_stats = counters.current_stats;
+		_best_copy_stats = current_stats;
 
 		D3D12_RESOURCE_BARRIER transition = { D3D12_RESOURCE_BARRIER_TYPE_TRANSITION };
 		transition.Transition.pResource = dsv_texture.get();
@@ -144,26 +120,39 @@ void reshade::d3d12::buffer_detection::on_clear_depthstencil(D3D12_CLEAR_FLAGS c
 		std::swap(transition.Transition.StateBefore, transition.Transition.StateAfter);
 		_cmd_list->ResourceBarrier(1, &transition);
 	}
+}
+
+uint32_t reshade::d3d12::buffer_detection::find_or_add_depthstencil(const com_ptr<ID3D12Resource> &dsv_texture)
+{
+	if (const uint32_t slot = _tracker.find(reinterpret_cast<uintptr_t>(dsv_texture.get())); slot != _tracker.npos)
+		return slot;
 
-	// Reset draw call stats for clears
-	counters.current_stats = { 0, 0 };
+	const D3D12_RESOURCE_DESC desc = dsv_texture->GetDesc();
+	assert((desc.Flags & D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL) != 0);
+
+	return _tracker.add(reinterpret_cast<uintptr_t>(dsv_texture.get()), { static_cast<uint32_t>(desc.Width), desc.Height, desc.SampleDesc.Count }, dsv_texture);
 }
 
+void reshade::d3d12::buffer_detection_context::on_create_descriptor_heap(ID3D12DescriptorHeap *heap)
+{
+	const D3D12_DESCRIPTOR_HEAP_DESC desc = heap->GetDesc();
+	if (desc.Type != D3D12_DESCRIPTOR_HEAP_TYPE_DSV)
+		return;
+
+	_depthstencil_resources_by_handle.register_heap(heap, heap->GetCPUDescriptorHandleForHeapStart().ptr, desc.NumDescriptors,
+		_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV));
+}
 void reshade::d3d12::buffer_detection_context::on_create_dsv(ID3D12Resource *dsv_texture, D3D12_CPU_DESCRIPTOR_HANDLE handle)
 {
-	const std::lock_guard<std::mutex> lock(s_global_mutex);
-	_depthstencil_resources_by_handle[handle.ptr] = dsv_texture;
+	_depthstencil_resources_by_handle.set(handle.ptr, dsv_texture);
 }
 com_ptr<ID3D12Resource> reshade::d3d12::buffer_detection_context::resource_from_handle(D3D12_CPU_DESCRIPTOR_HANDLE handle) const
 {
 	if (handle.ptr == 0)
 		return nullptr;
 
-	const std::lock_guard<std::mutex> lock(s_global_mutex);
-	if (const auto it = _depthstencil_resources_by_handle.find(handle.ptr);
-		it != _depthstencil_resources_by_handle.end())
-		return it->second;
-	return nullptr;
+	// This is called for every depth-stencil bind and clear from all recording threads, so it must not take a lock
+	return _depthstencil_resources_by_handle.get(handle.ptr);
 }
 
 bool reshade::d3d12::buffer_detection_context::update_depthstencil_clear_texture(ID3D12CommandQueue *queue, D3D12_RESOURCE_DESC desc)
@@ -211,49 +200,25 @@ bool reshade::d3d12::buffer_detection_context::update_depthstencil_clear_texture
 
 com_ptr<ID3D12Resource> reshade::d3d12::buffer_detection_context::update_depth_texture(ID3D12CommandQueue *queue, ID3D12GraphicsCommandList *list, UINT width, UINT height, ID3D12Resource *override, UINT clear_index_override)
 {
-	depthstencil_info best_snapshot;
+	uint32_t best_slot = _tracker.npos;
 	com_ptr<ID3D12Resource> best_match;
 
 	if (override != nullptr)
 	{
+		best_slot = _tracker.find(reinterpret_cast<uintptr_t>(override));
 		best_match = override;
-		best_snapshot = _counters_per_used_depth_texture[best_match];
 	}
 	else
 	{
-		for (auto &[dsv_texture, snapshot] : _counters_per_used_depth_texture)
-		{
-			if (snapshot.total_stats.drawcalls == 0)
-				continue; // Skip unused
-
-			const D3D12_RESOURCE_DESC desc = dsv_texture->GetDesc();
-			assert((desc.Flags & D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL) != 0);
-
-			if (desc.SampleDesc.Count > 1)
-				continue; // Ignore MSAA textures, since they would need to be resolved first
-
-			if (width != 0 && height != 0)
-			{
-				const float w = static_cast<float>(width);
-				const float w_ratio = w / desc.Width;
-				const float h = static_cast<float>(height);
-				const float h_ratio = h / desc.Height;
-				const float aspect_ratio = (w / h) - (static_cast<float>(desc.Width) / desc.Height);
-
-				if (std::fabs(aspect_ratio) > 0.1f || w_ratio > 1.85f || h_ratio > 1.85f || w_ratio < 0.5f || h_ratio < 0.5f)
-					continue; // Not a good fit
-			}
-
-			if (!_has_indirect_drawcalls ?
-				// Choose snapshot with the most vertices, since that is likely to contain the main scene
-				snapshot.total_stats.vertices > best_snapshot.total_stats.vertices :
-				// Or check draw calls, since vertices may not be accurate if application is using indirect draw calls
-				snapshot.total_stats.drawcalls > best_snapshot.total_stats.drawcalls)
-			{
-				best_match = dsv_texture;
-				best_snapshot = snapshot;
-			}
-		}
+		// Uses the draw call count instead of vertices when the application used indirect draw calls
+		depth_selection::selection_options options;
+		options.width = width;
+		options.height = height;
+		options.heuristic = depth_selection::selection_heuristic::most_vertices;
+
+		best_slot = _tracker.find_best(options);
+		if (best_slot != _tracker.npos)
+			best_match = _tracker.data(best_slot);
 	}
 
 	_depthstencil_clear_index = { nullptr, std::numeric_limits<UINT>::max() };
@@ -263,10 +228,10 @@ com_ptr<ID3D12Resource> reshade::d3d12::buffer_detection_context::update_depth_t
 
 	if (clear_index_override != 0)
 	{
-		_previous_stats = best_snapshot.current_stats;
+		_previous_stats = best_slot != _tracker.npos ? _tracker.counters(best_slot).current_stats : depth_selection::draw_stats {};
 		_depthstencil_clear_index.first = best_match.get();
 
-		if (clear_index_override <= best_snapshot.clears.size())
+		if (best_slot != _tracker.npos && clear_index_override <= _tracker.counters(best_slot).clears.size())
 		{
 			_depthstencil_clear_index.second = clear_index_override;
 		}
@@ -5,15 +5,18 @@
 
 #pragma once
 
-#include <map>
-#include <unordered_map>
 #include <d3d12.h>
 #include "com_ptr.hpp"
+#include "depth_selection.hpp"
+#include "descriptor_heap_index.hpp"
 
 namespace reshade::d3d12
 {
 	class buffer_detection
 	{
+		// A reference to each depth-stencil resource is stored alongside its counters, so that the handle (the resource pointer) stays valid until it is removed
+		using depth_tracker = depth_selection::tracker<com_ptr<ID3D12Resource>>;
+
 	public:
 		void init(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list, const class buffer_detection_context *context);
 		void reset();
@@ -28,28 +31,16 @@ namespace reshade::d3d12
 #endif
 
 	protected:
-		struct draw_stats
-		{
-			UINT vertices = 0;
-			UINT drawcalls = 0;
-		};
-		struct depthstencil_info
-		{
-			draw_stats total_stats;
-			draw_stats current_stats; // Stats since last clear
-			std::vector<draw_stats> clears;
-		};
+#if RESHADE_DEPTH
+		uint32_t find_or_add_depthstencil(const com_ptr<ID3D12Resource> &dsv_texture);
+#endif
 
 		ID3D12Device *_device = nullptr;
 		ID3D12GraphicsCommandList *_cmd_list = nullptr;
 		const buffer_detection_context *_context = nullptr;
-		draw_stats _stats;
+		depth_tracker _tracker;
 #if RESHADE_DEPTH
-		draw_stats _best_copy_stats;
-		com_ptr<ID3D12Resource> _current_depthstencil;
-		bool _has_indirect_drawcalls = false;
-		// Use "std::map" instead of "std::unordered_map" so that the iteration order is guaranteed
-		std::map<com_ptr<ID3D12Resource>, depthstencil_info> _counters_per_used_depth_texture;
+		depth_selection::draw_stats _best_copy_stats;
 #endif
 	};
 
@@ -60,16 +51,17 @@ namespace reshade::d3d12
 	public:
 		explicit buffer_detection_context(ID3D12Device *device) { init(device, nullptr, nullptr); }
 
-		UINT total_vertices() const { return _stats.vertices; }
-		UINT total_drawcalls() const { return _stats.drawcalls; }
+		UINT total_vertices() const { return _tracker.total_vertices(); }
+		UINT total_drawcalls() const { return _tracker.total_drawcalls(); }
 
 		void reset(bool release_resources);
 
 #if RESHADE_DEPTH
 		UINT current_clear_index() const { return _depthstencil_clear_index.second; }
-		const auto &depth_buffer_counters() const { return _counters_per_used_depth_texture; }
+		const auto &depth_buffer_tracker() const { return _tracker; }
 		ID3D12Resource *current_depth_texture() const { return _depthstencil_clear_index.first; }
 
+		void on_create_descriptor_heap(ID3D12DescriptorHeap *heap);
 		void on_create_dsv(ID3D12Resource *dsv_texture, D3D12_CPU_DESCRIPTOR_HANDLE handle);
 
 		com_ptr<ID3D12Resource> update_depth_texture(ID3D12CommandQueue *queue, ID3D12GraphicsCommandList *list,
@@ -83,11 +75,11 @@ namespace reshade::d3d12
 
 		com_ptr<ID3D12Resource> resource_from_handle(D3D12_CPU_DESCRIPTOR_HANDLE handle) const;
 
-		draw_stats _previous_stats;
+		depth_selection::draw_stats _previous_stats;
 		com_ptr<ID3D12Resource> _depthstencil_clear_texture;
 		std::pair<ID3D12Resource *, UINT> _depthstencil_clear_index = { nullptr, std::numeric_limits<UINT>::max() };
 		// Do not hold a reference to the resources here
-		std::unordered_map<SIZE_T, ID3D12Resource *> _depthstencil_resources_by_handle;
+		descriptor_heap_index<ID3D12Resource> _depthstencil_resources_by_handle;
 #endif
 	};
 }
@@ -6,12 +6,27 @@
 #include "dll_log.hpp"
 #include "d3d12_device.hpp"
 #include "d3d12_command_list.hpp"
+#include <atomic>
+
+// All proxy objects share the same virtual function table, so its address identifies them
+static std::atomic<const void *> s_proxy_vtable = nullptr;
 
 D3D12GraphicsCommandList::D3D12GraphicsCommandList(D3D12Device *device, ID3D12GraphicsCommandList *original) :
 	_orig(original),
 	_interface_version(0),
 	_device(device) {
 	assert(_orig != nullptr && _device != nullptr);
+	s_proxy_vtable.store(*reinterpret_cast<const void *const *>(this), std::memory_order_relaxed);
+}
+
+D3D12GraphicsCommandList *D3D12GraphicsCommandList::get_proxy(ID3D12CommandList *command_list)
+{
+	assert(command_list != nullptr);
+
+	if (*reinterpret_cast<const void *const *>(command_list) != s_proxy_vtable.load(std::memory_order_relaxed))
+		return nullptr;
+
+	return static_cast<D3D12GraphicsCommandList *>(command_list);
 }
 
 bool D3D12GraphicsCommandList::check_and_upgrade_interface(REFIID riid)
@@ -112,6 +112,12 @@ struct DECLSPEC_UUID("479B29E3-9A2C-11D0-B696-00A0C903487A") D3D12GraphicsComman
 
 	bool check_and_upgrade_interface(REFIID riid);
 
+	/// <summary>
+	/// Returns the proxy object if the specified command list is one, or <c>nullptr</c> otherwise.
+	/// This compares the virtual function table pointer of the object, which is much cheaper than calling 'QueryInterface'.
+	/// </summary>
+	static D3D12GraphicsCommandList *get_proxy(ID3D12CommandList *command_list);
+
 	ULONG _ref = 1;
 	ID3D12GraphicsCommandList *_orig;
 	unsigned int _interface_version;
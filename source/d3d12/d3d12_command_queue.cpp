@@ -8,15 +8,29 @@
 #include "d3d12_command_list.hpp"
 #include "d3d12_command_queue.hpp"
 #include "d3d12_command_queue_downlevel.hpp"
-#include <mutex>
-
-static std::mutex s_global_mutex;
+#include <memory>
+#include <algorithm>
 
 D3D12CommandQueue::D3D12CommandQueue(D3D12Device *device, ID3D12CommandQueue *original) :
 	_orig(original),
 	_interface_version(0),
 	_device(device) {
 	assert(_orig != nullptr && _device != nullptr);
+	_buffer_detection.init(device->_orig, nullptr, &device->_buffer_detection);
+
+	// Keep the device proxy alive for as long as this queue is registered with it (the application may release the device before its queues)
+	_device->AddRef();
+
+	const std::lock_guard<std::mutex> lock(_device->_command_queue_mutex);
+	_device->_command_queues.push_back(this);
+}
+D3D12CommandQueue::~D3D12CommandQueue()
+{
+	{	const std::lock_guard<std::mutex> lock(_device->_command_queue_mutex);
+		_device->_command_queues.erase(std::find(_device->_command_queues.begin(), _device->_command_queues.end(), this));
+	}
+
+	_device->Release();
 }
 
 bool D3D12CommandQueue::check_and_upgrade_interface(REFIID riid)
@@ -142,31 +156,61 @@ void    STDMETHODCALLTYPE D3D12CommandQueue::CopyTileMappings(ID3D12Resource *pD
 }
 void    STDMETHODCALLTYPE D3D12CommandQueue::ExecuteCommandLists(UINT NumCommandLists, ID3D12CommandList *const *ppCommandLists)
 {
-	std::vector<ID3D12CommandList *> command_lists(NumCommandLists);
-	for (UINT i = 0; i < NumCommandLists; i++)
+	// Most submissions only consist of a few command lists, so avoid a heap allocation for those
+	ID3D12CommandList *command_lists_small[32];
+	std::unique_ptr<ID3D12CommandList *[]> command_lists_large;
+	ID3D12CommandList **command_lists = command_lists_small;
+	if (NumCommandLists > ARRAYSIZE(command_lists_small))
 	{
-		assert(ppCommandLists[i] != nullptr);
-
-		if (com_ptr<D3D12GraphicsCommandList> command_list_proxy;
-			SUCCEEDED(ppCommandLists[i]->QueryInterface(&command_list_proxy)))
-		{
-			// Lock here in case there are multiple command queues
-			const std::lock_guard<std::mutex> lock(s_global_mutex);
+		command_lists_large.reset(new ID3D12CommandList *[NumCommandLists]);
+		command_lists = command_lists_large.get();
+	}
 
-			// Merge command list trackers into device one
-			_device->_buffer_detection.merge(command_list_proxy->_buffer_detection);
+	{	// Only threads submitting to this queue can contend for this lock
+		const std::lock_guard<std::mutex> lock(_buffer_detection_mutex);
 
-			// Get original command list pointer from proxy object
-			command_lists[i] = command_list_proxy->_orig;
-		}
-		else
+		for (UINT i = 0; i < NumCommandLists; i++)
 		{
-			// This can be a compute command list too, which have no proxy object
-			command_lists[i] = ppCommandLists[i];
+			assert(ppCommandLists[i] != nullptr);
+
+			if (D3D12GraphicsCommandList *const command_list_proxy = D3D12GraphicsCommandList::get_proxy(ppCommandLists[i]))
+			{
+				// Merge command list trackers into the one of this queue, which is merged into the device one on present
+				_buffer_detection.merge(command_list_proxy->_buffer_detection);
+
+				// Get original command list pointer from proxy object
+				command_lists[i] = command_list_proxy->_orig;
+			}
+			else if (const void *const vtable = *reinterpret_cast<const void *const *>(ppCommandLists[i]);
+				std::find(_native_command_list_vtables, _native_command_list_vtables + _num_native_command_list_vtables, vtable) != _native_command_list_vtables + _num_native_command_list_vtables)
+			{
+				// A command list of a class that was already found to not wrap a proxy, so skip the 'QueryInterface' call below
+				command_lists[i] = ppCommandLists[i];
+			}
+			else if (com_ptr<D3D12GraphicsCommandList> wrapped_command_list_proxy;
+				SUCCEEDED(ppCommandLists[i]->QueryInterface(&wrapped_command_list_proxy)))
+			{
+				// The proxy object may be wrapped by another layer, in which case only 'QueryInterface' can find it
+				_buffer_detection.merge(wrapped_command_list_proxy->_buffer_detection);
+
+				command_lists[i] = wrapped_command_list_proxy->_orig;
+
+				_wrapped_command_list_seen = true;
+				_num_native_command_list_vtables = 0;
+			}
+			else
+			{
+				// This can be a command list that was not created through a proxy device
+				command_lists[i] = ppCommandLists[i];
+
+				// Remember its class until a wrapping layer was detected, so that the next command lists of it are passed through directly
+				if (!_wrapped_command_list_seen && _num_native_command_list_vtables < ARRAYSIZE(_native_command_list_vtables))
+					_native_command_list_vtables[_num_native_command_list_vtables++] = vtable;
+			}
 		}
 	}
 
-	_orig->ExecuteCommandLists(NumCommandLists, command_lists.data());
+	_orig->ExecuteCommandLists(NumCommandLists, command_lists);
 }
 void    STDMETHODCALLTYPE D3D12CommandQueue::SetMarker(UINT Metadata, const void *pData, UINT Size)
 {
@@ -5,11 +5,14 @@
 
 #pragma once
 
+#include <mutex>
 #include <d3d12.h>
+#include "buffer_detection.hpp"
 
 struct DECLSPEC_UUID("2C576D2A-0C1C-4D1D-AD7C-BC4FAEC15ABC") D3D12CommandQueue : ID3D12CommandQueue
 {
 	D3D12CommandQueue(D3D12Device *device, ID3D12CommandQueue *original);
+	~D3D12CommandQueue();
 
 	D3D12CommandQueue(const D3D12CommandQueue &) = delete;
 	D3D12CommandQueue &operator=(const D3D12CommandQueue &) = delete;
@@ -47,6 +50,14 @@ struct DECLSPEC_UUID("2C576D2A-0C1C-4D1D-AD7C-BC4FAEC15ABC") D3D12CommandQueue :
 	ID3D12CommandQueue *_orig;
 	unsigned int _interface_version;
 	D3D12Device *const _device;
+	// Command lists executed on this queue since the last present are merged here first, so that queues do not contend with each other
+	std::mutex _buffer_detection_mutex;
+	reshade::d3d12::buffer_detection _buffer_detection;
+	// Classes of command lists (identified by their vtable) that are neither proxies nor wrap one, so that those can be submitted without a 'QueryInterface' call
+	// This stops once a proxy wrapped by another layer was seen, since that layer may then also wrap command lists that were not created through a proxy
+	const void *_native_command_list_vtables[4] = {};
+	unsigned int _num_native_command_list_vtables = 0;
+	bool _wrapped_command_list_seen = false;
 #if RESHADE_D3D12ON7
 	struct D3D12CommandQueueDownlevel *_downlevel = nullptr;
 #endif
@@ -87,6 +87,7 @@ HRESULT STDMETHODCALLTYPE D3D12CommandQueueDownlevel::Present(ID3D12GraphicsComm
 			LOG(ERROR) << "Failed to initialize Direct3D 12 runtime environment on runtime " << _runtime.get() << '.';
 	}
 
+	_device->merge_command_queue_stats();
 	_runtime->on_present();
 
 	// Clear current frame stats
@@ -16,6 +16,19 @@ D3D12Device::D3D12Device(ID3D12Device *original) :
 	_buffer_detection.init(_orig, nullptr, &_buffer_detection);
 }
 
+void D3D12Device::merge_command_queue_stats()
+{
+	const std::lock_guard<std::mutex> lock(_command_queue_mutex);
+
+	for (D3D12CommandQueue *const command_queue : _command_queues)
+	{
+		const std::lock_guard<std::mutex> queue_lock(command_queue->_buffer_detection_mutex);
+
+		_buffer_detection.merge(command_queue->_buffer_detection);
+		command_queue->_buffer_detection.reset();
+	}
+}
+
 bool D3D12Device::check_and_upgrade_interface(REFIID riid)
 {
 	if (riid == __uuidof(this) ||
@@ -200,7 +213,12 @@ HRESULT STDMETHODCALLTYPE D3D12Device::CheckFeatureSupport(D3D12_FEATURE Feature
 }
 HRESULT STDMETHODCALLTYPE D3D12Device::CreateDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC *pDescriptorHeapDesc, REFIID riid, void **ppvHeap)
 {
-	return _orig->CreateDescriptorHeap(pDescriptorHeapDesc, riid, ppvHeap);
+	const HRESULT hr = _orig->CreateDescriptorHeap(pDescriptorHeapDesc, riid, ppvHeap);
+#if RESHADE_DEPTH
+	if (SUCCEEDED(hr) && ppvHeap != nullptr && riid == __uuidof(ID3D12DescriptorHeap))
+		_buffer_detection.on_create_descriptor_heap(static_cast<ID3D12DescriptorHeap *>(*ppvHeap));
+#endif
+	return hr;
 }
 UINT    STDMETHODCALLTYPE D3D12Device::GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE DescriptorHeapType)
 {
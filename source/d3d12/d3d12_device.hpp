@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <mutex>
+#include <vector>
 #include <d3d12.h>
 #include "buffer_detection.hpp"
 
@@ -100,8 +102,16 @@ struct __declspec(uuid("2523AFF4-978B-4939-BA16-8EE876A4CB2A")) D3D12Device : ID
 
 	bool check_and_upgrade_interface(REFIID riid);
 
+	/// <summary>
+	/// Merges the statistics of command lists executed on all command queues of this device since the last call into the device tracker.
+	/// This has to be called once per frame before the device tracker is evaluated.
+	/// </summary>
+	void merge_command_queue_stats();
+
 	LONG _ref = 1;
 	ID3D12Device *_orig;
 	unsigned int _interface_version;
 	reshade::d3d12::buffer_detection_context _buffer_detection;
+	std::mutex _command_queue_mutex;
+	std::vector<struct D3D12CommandQueue *> _command_queues;
 };
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include "lockfree_epoch.hpp"
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+#include <algorithm>
+
+namespace reshade::d3d12
+{
+	/// <summary>
+	/// Associates a value with every descriptor of the registered descriptor heaps, so that it can be looked up through a CPU descriptor handle.
+	/// Each heap has an array with one slot per descriptor, which a handle indexes with its offset from the heap start divided by the descriptor increment.
+	/// The heap containing a handle is found through a hash table of the address pages covered by each heap. That table is never modified in place when it has to grow, but replaced with a larger copy.
+	/// This makes look ups and value updates wait-free, so they can be done from any number of threads at once. Only registering a new heap takes a lock, which is rare in comparison.
+	/// It is not known when the application releases a heap, but a heap that is registered at the same object address as an older one or overlaps its descriptors means the older one was released.
+	/// Those are unlinked then and freed once no thread holds a <see cref="lockfree_epoch::guard"/> anymore that may have found them before (tables that were replaced with a larger copy are freed the same way).
+	/// </summary>
+	/// <typeparam name="T">Type of the objects to associate with descriptors (only a pointer to them is stored).</typeparam>
+	template <typename T>
+	class descriptor_heap_index
+	{
+		static constexpr unsigned int PAGE_SHIFT = 16;
+		static constexpr uintptr_t EMPTY_PAGE = ~uintptr_t(0);
+
+		struct heap_range;
+		struct page_link
+		{
+			const heap_range *range;
+			std::atomic<const page_link *> next;
+		};
+		struct heap_range
+		{
+			const void *heap;
+			uintptr_t base;
+			uintptr_t end;
+			size_t increment;
+			std::unique_ptr<std::atomic<T *>[]> slots;
+			std::unique_ptr<page_link[]> links; // One for every page the heap covers, starting with the page of its base address
+		};
+		struct page_entry
+		{
+			std::atomic<uintptr_t> page;
+			std::atomic<const page_link *> links; // Linked list of heaps covering this page, newest first
+		};
+		struct page_table
+		{
+			explicit page_table(size_t capacity) :
+				capacity(capacity), entries(new page_entry[capacity])
+			{
+				for (size_t i = 0; i < capacity; ++i)
+				{
+					entries[i].page.store(EMPTY_PAGE, std::memory_order_relaxed);
+					entries[i].links.store(nullptr, std::memory_order_relaxed);
+				}
+			}
+
+			const size_t capacity; // Always a power of two
+			size_t num_pages = 0;
+			const std::unique_ptr<page_entry[]> entries;
+		};
+		template <typename U>
+		struct retired_object
+		{
+			uint64_t epoch;
+			std::unique_ptr<U> object;
+		};
+
+	public:
+		descriptor_heap_index() :
+			_table(std::make_unique<page_table>(64))
+		{
+			_current_table.store(_table.get(), std::memory_order_relaxed);
+		}
+
+		descriptor_heap_index(const descriptor_heap_index &) = delete;
+		descriptor_heap_index &operator=(const descriptor_heap_index &) = delete;
+
+		/// <summary>
+		/// Adds a descriptor heap to the index, with all its descriptors initially associated with no value.
+		/// Heaps previously registered with the same <paramref name="heap"/> object or overlapping descriptors are removed, since they must have been released for this one to be created.
+		/// </summary>
+		/// <param name="heap">The descriptor heap object.</param>
+		/// <param name="base">The CPU descriptor handle of the first descriptor in the heap.</param>
+		/// <param name="num_descriptors">The number of descriptors in the heap.</param>
+		/// <param name="increment">The size of a descriptor in the heap.</param>
+		void register_heap(const void *heap, uintptr_t base, size_t num_descriptors, size_t increment)
+		{
+			if (num_descriptors == 0 || increment == 0)
+				return;
+
+			const std::lock_guard<std::mutex> lock(_mutex);
+
+			const uintptr_t end = base + num_descriptors * increment;
+
+			// Free memory of heaps that were removed during previous registrations and that no look up can still be using
+			reclaim();
+
+			std::vector<std::unique_ptr<heap_range>> released_ranges;
+			for (auto it = _ranges.begin(); it != _ranges.end();)
+			{
+				if (heap_range &range = **it; range.heap == heap || (range.base < end && base < range.end))
+				{
+					unlink(range);
+					released_ranges.push_back(std::move(*it));
+					it = _ranges.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+
+			if (!released_ranges.empty())
+			{
+				const uint64_t epoch = lockfree_epoch::retire();
+				for (std::unique_ptr<heap_range> &range : released_ranges)
+					_retired_ranges.push_back({ epoch, std::move(range) });
+			}
+
+			heap_range &range = *_ranges.emplace_back(std::make_unique<heap_range>());
+			range.heap = heap;
+			range.base = base;
+			range.end = end;
+			range.increment = increment;
+			range.slots.reset(new std::atomic<T *>[num_descriptors]()); // Value-initialize, so that all slots start out empty
+			range.links.reset(new page_link[((end - 1) >> PAGE_SHIFT) - (base >> PAGE_SHIFT) + 1]);
+
+			for (uintptr_t page = base >> PAGE_SHIFT; page <= (end - 1) >> PAGE_SHIFT; ++page)
+			{
+				page_entry &entry = add_page(page);
+
+				page_link &link = range.links[page - (base >> PAGE_SHIFT)];
+				link.range = &range;
+				link.next.store(entry.links.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+				// The link is fully initialized before it is published, so look ups never see a partial one
+				entry.links.store(&link, std::memory_order_release);
+			}
+		}
+
+		/// <summary>
+		/// Associates a value with the descriptor at the specified <paramref name="handle"/>.
+		/// </summary>
+		/// <param name="handle">The CPU descriptor handle of the descriptor.</param>
+		/// <param name="value">The value to associate with the descriptor.</param>
+		/// <returns><c>true</c> if the handle points into a registered heap, <c>false</c> otherwise.</returns>
+		bool set(uintptr_t handle, T *value)
+		{
+			const lockfree_epoch::guard guard;
+
+			std::atomic<T *> *const slot = find_slot(handle);
+			if (slot == nullptr)
+				return false;
+
+			slot->store(value, std::memory_order_release);
+			return true;
+		}
+		/// <summary>
+		/// Gets the value associated with the descriptor at the specified <paramref name="handle"/>.
+		/// </summary>
+		/// <param name="handle">The CPU descriptor handle of the descriptor.</param>
+		/// <returns>The associated value or <c>nullptr</c> if there is none.</returns>
+		T *get(uintptr_t handle) const
+		{
+			const lockfree_epoch::guard guard;
+
+			std::atomic<T *> *const slot = find_slot(handle);
+			if (slot == nullptr)
+				return nullptr;
+
+			return slot->load(std::memory_order_acquire);
+		}
+
+		/// <summary>
+		/// Removes the values associated with all descriptors, but keeps the registered heaps.
+		/// </summary>
+		void reset_values()
+		{
+			const std::lock_guard<std::mutex> lock(_mutex);
+
+			for (const std::unique_ptr<heap_range> &range : _ranges)
+				for (size_t i = 0, num_descriptors = (range->end - range->base) / range->increment; i < num_descriptors; ++i)
+					range->slots[i].store(nullptr, std::memory_order_relaxed);
+		}
+
+	private:
+		static size_t start_index(uintptr_t page, size_t capacity)
+		{
+			// Mix the page number (Fibonacci hashing), since neighbouring pages are common
+			return static_cast<size_t>((static_cast<uint64_t>(page) * 11400714819323198485ull) >> 32) & (capacity - 1);
+		}
+
+		std::atomic<T *> *find_slot(uintptr_t handle) const
+		{
+			const page_table *const table = _current_table.load(std::memory_order_acquire);
+			const uintptr_t page = handle >> PAGE_SHIFT;
+
+			// The table is never more than half full, so this always reaches an empty entry eventually
+			for (size_t i = start_index(page, table->capacity);; i = (i + 1) & (table->capacity - 1))
+			{
+				const page_entry &entry = table->entries[i];
+
+				const uintptr_t entry_page = entry.page.load(std::memory_order_acquire);
+				if (entry_page == EMPTY_PAGE)
+					return nullptr;
+				if (entry_page != page)
+					continue;
+
+				for (const page_link *link = entry.links.load(std::memory_order_acquire); link != nullptr; link = link->next.load(std::memory_order_acquire))
+				{
+					const heap_range &range = *link->range;
+					if (handle >= range.base && handle < range.end)
+						return &range.slots[(handle - range.base) / range.increment];
+				}
+
+				return nullptr;
+			}
+		}
+
+		page_entry &add_page(uintptr_t page)
+		{
+			page_table *table = _current_table.load(std::memory_order_relaxed);
+
+			for (size_t i = start_index(page, table->capacity);; i = (i + 1) & (table->capacity - 1))
+			{
+				page_entry &entry = table->entries[i];
+				if (entry.page.load(std::memory_order_relaxed) == page)
+					return entry;
+				if (entry.page.load(std::memory_order_relaxed) == EMPTY_PAGE)
+					break;
+			}
+
+			if ((table->num_pages + 1) * 2 > table->capacity)
+			{
+				// Copy all pages into a table with twice the capacity and then publish that, look ups still using the old table continue to see consistent data
+				// The lists of links are shared between both tables, so links removed later are removed from the lists of the old table too
+				std::unique_ptr<page_table> new_table_storage = std::make_unique<page_table>(table->capacity * 2);
+				page_table *const new_table = new_table_storage.get();
+
+				for (size_t k = 0; k < table->capacity; ++k)
+				{
+					const page_entry &old_entry = table->entries[k];
+					if (const uintptr_t old_page = old_entry.page.load(std::memory_order_relaxed); old_page != EMPTY_PAGE)
+						insert_page(*new_table, old_page, old_entry.links.load(std::memory_order_relaxed));
+				}
+
+				_current_table.store(new_table, std::memory_order_release);
+				_retired_tables.push_back({ lockfree_epoch::retire(), std::exchange(_table, std::move(new_table_storage)) });
+				table = new_table;
+			}
+
+			return insert_page(*table, page, nullptr);
+		}
+
+		page_entry &find_page(uintptr_t page) const
+		{
+			page_table *const table = _current_table.load(std::memory_order_relaxed);
+
+			for (size_t i = start_index(page, table->capacity);; i = (i + 1) & (table->capacity - 1))
+			{
+				page_entry &entry = table->entries[i];
+				if (entry.page.load(std::memory_order_relaxed) == page)
+					return entry;
+				assert(entry.page.load(std::memory_order_relaxed) != EMPTY_PAGE);
+			}
+		}
+
+		void unlink(heap_range &range)
+		{
+			for (uintptr_t page = range.base >> PAGE_SHIFT; page <= (range.end - 1) >> PAGE_SHIFT; ++page)
+			{
+				const page_link &link = range.links[page - (range.base >> PAGE_SHIFT)];
+				const page_link *const next = link.next.load(std::memory_order_relaxed);
+
+				// Look ups that already reached the link continue to its successor, which is still in the list afterwards
+				page_entry &entry = find_page(page);
+				if (entry.links.load(std::memory_order_relaxed) == &link)
+				{
+					entry.links.store(next, std::memory_order_release);
+					continue;
+				}
+
+				for (const page_link *prev = entry.links.load(std::memory_order_relaxed); prev != nullptr; prev = prev->next.load(std::memory_order_relaxed))
+				{
+					if (prev->next.load(std::memory_order_relaxed) == &link)
+					{
+						const_cast<page_link *>(prev)->next.store(next, std::memory_order_release);
+						break;
+					}
+				}
+			}
+		}
+
+		void reclaim()
+		{
+			const uint64_t oldest_epoch = lockfree_epoch::oldest_epoch();
+
+			const auto is_unused = [oldest_epoch](const auto &retired) { return retired.epoch < oldest_epoch; };
+			_retired_ranges.erase(std::remove_if(_retired_ranges.begin(), _retired_ranges.end(), is_unused), _retired_ranges.end());
+			_retired_tables.erase(std::remove_if(_retired_tables.begin(), _retired_tables.end(), is_unused), _retired_tables.end());
+		}
+
+		static page_entry &insert_page(page_table &table, uintptr_t page, const page_link *links)
+		{
+			for (size_t i = start_index(page, table.capacity);; i = (i + 1) & (table.capacity - 1))
+			{
+				page_entry &entry = table.entries[i];
+				if (entry.page.load(std::memory_order_relaxed) != EMPTY_PAGE)
+					continue;
+
+				// Set links before the page number, so that a look up that finds the page also finds its links
+				entry.links.store(links, std::memory_order_relaxed);
+				entry.page.store(page, std::memory_order_release);
+				table.num_pages++;
+				return entry;
+			}
+		}
+
+		std::mutex _mutex;
+		std::atomic<page_table *> _current_table;
+		std::unique_ptr<page_table> _table;
+		std::vector<std::unique_ptr<heap_range>> _ranges;
+		std::vector<retired_object<heap_range>> _retired_ranges;
+		std::vector<retired_object<page_table>> _retired_tables;
+	};
+}
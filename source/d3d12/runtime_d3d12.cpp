@@ -9,6 +9,7 @@
 #include "runtime_d3d12.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "format_conversion.hpp"
 #include "dxgi/format_utils.hpp"
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -327,6 +328,7 @@ void reshade::d3d12::runtime_d3d12::on_reset()
 	_backbuffers.clear();
 	_backbuffer_rtvs.reset();
 	_backbuffer_texture.reset();
+	_readback_slots.clear();
 	_depthstencil_dsvs.reset();
 
 	_mipmap_pipeline.reset();
@@ -464,27 +466,117 @@ bool reshade::d3d12::runtime_d3d12::capture_screenshot(uint8_t *buffer) const
 	for (uint32_t y = 0; y < _height; y++, buffer += data_pitch, mapped_data += download_pitch)
 	{
 		if (_color_bit_depth == 10)
-		{
-			for (uint32_t x = 0; x < data_pitch; x += 4)
-			{
-				const uint32_t rgba = *reinterpret_cast<const uint32_t *>(mapped_data + x);
-				// Divide by 4 to get 10-bit range (0-1023) into 8-bit range (0-255)
-				buffer[x + 0] = ((rgba & 0x3FF) / 4) & 0xFF;
-				buffer[x + 1] = (((rgba & 0xFFC00) >> 10) / 4) & 0xFF;
-				buffer[x + 2] = (((rgba & 0x3FF00000) >> 20) / 4) & 0xFF;
-				buffer[x + 3] = 0xFF;
-			}
-		}
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
 		else
-		{
-			std::memcpy(buffer, mapped_data, data_pitch);
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, false); // Clear alpha channel
+	}
 
-			for (uint32_t x = 0; x < data_pitch; x += 4)
-				buffer[x + 3] = 0xFF; // Clear alpha channel
+	intermediate->Unmap(0, nullptr);
+
+	return true;
+}
+
+bool reshade::d3d12::runtime_d3d12::begin_readback(unsigned int slot)
+{
+	const uint32_t download_pitch = (_width * 4 + D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1u) & ~(D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1u);
+
+	if (slot >= _readback_slots.size())
+		_readback_slots.resize(slot + 1);
+	readback_slot &info = _readback_slots[slot];
+
+	// Buffers are kept until the next reset, at which point the frame dimensions may change
+	if (info.buffer == nullptr)
+	{
+		D3D12_RESOURCE_DESC desc = { D3D12_RESOURCE_DIMENSION_BUFFER };
+		desc.Width = _height * download_pitch;
+		desc.Height = 1;
+		desc.DepthOrArraySize = 1;
+		desc.MipLevels = 1;
+		desc.SampleDesc = { 1, 0 };
+		desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+		D3D12_HEAP_PROPERTIES props = { D3D12_HEAP_TYPE_READBACK };
+
+		if (FAILED(_device->CreateCommittedResource(&props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&info.buffer))))
+		{
+			LOG(ERROR) << "Failed to create system memory texture for screenshot capture!";
+			return false;
 		}
+
+#ifndef NDEBUG
+		info.buffer->SetName(L"ReShade screenshot texture");
+#endif
 	}
 
-	intermediate->Unmap(0, nullptr);
+	if (!begin_command_list())
+		return false;
+
+	// Was transitioned to D3D12_RESOURCE_STATE_RENDER_TARGET in 'on_present' already
+	transition_state(_cmd_list, _backbuffers[_swap_index], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE, 0);
+	{
+		D3D12_TEXTURE_COPY_LOCATION src_location = { _backbuffers[_swap_index].get() };
+		src_location.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+		src_location.SubresourceIndex = 0;
+
+		D3D12_TEXTURE_COPY_LOCATION dst_location = { info.buffer.get() };
+		dst_location.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+		dst_location.PlacedFootprint.Footprint.Width = _width;
+		dst_location.PlacedFootprint.Footprint.Height = _height;
+		dst_location.PlacedFootprint.Footprint.Depth = 1;
+		dst_location.PlacedFootprint.Footprint.Format = make_dxgi_format_normal(_backbuffer_format);
+		dst_location.PlacedFootprint.Footprint.RowPitch = download_pitch;
+
+		_cmd_list->CopyTextureRegion(&dst_location, 0, 0, 0, &src_location, nullptr);
+	}
+	transition_state(_cmd_list, _backbuffers[_swap_index], D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET, 0);
+
+	// The command list is executed before the fence of the current back buffer is signaled the next time (see 'on_present' and 'wait_for_command_queue'), so the copy has finished once that signal came through
+	info.fence_index = _swap_index;
+	info.fence_value = _fence_value[_swap_index] + 1;
+
+	return true;
+}
+bool reshade::d3d12::runtime_d3d12::is_readback_complete(unsigned int slot) const
+{
+	assert(slot < _readback_slots.size());
+	const readback_slot &info = _readback_slots[slot];
+
+	return _fence[info.fence_index]->GetCompletedValue() >= info.fence_value;
+}
+bool reshade::d3d12::runtime_d3d12::finish_readback(unsigned int slot, uint8_t *buffer)
+{
+	assert(slot < _readback_slots.size());
+	const readback_slot &info = _readback_slots[slot];
+
+	if (_fence_value[info.fence_index] < info.fence_value)
+	{
+		// Copy was recorded this frame and the fence was not signaled since, so execute it right away
+		assert(info.fence_index == _swap_index);
+		if (!wait_for_command_queue())
+			return false;
+	}
+	else if (_fence[info.fence_index]->GetCompletedValue() < info.fence_value)
+	{
+		if (SUCCEEDED(_fence[info.fence_index]->SetEventOnCompletion(info.fence_value, _fence_event)))
+			WaitForSingleObject(_fence_event, INFINITE);
+	}
+
+	const uint32_t data_pitch = _width * 4;
+	const uint32_t download_pitch = (data_pitch + D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1u) & ~(D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1u);
+
+	uint8_t *mapped_data;
+	if (FAILED(info.buffer->Map(0, nullptr, reinterpret_cast<void **>(&mapped_data))))
+		return false;
+
+	for (uint32_t y = 0; y < _height; y++, buffer += data_pitch, mapped_data += download_pitch)
+	{
+		if (_color_bit_depth == 10)
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
+		else
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, false); // Clear alpha channel
+	}
+
+	const D3D12_RANGE no_write = { 0, 0 };
+	info.buffer->Unmap(0, &no_write);
 
 	return true;
 }
@@ -504,6 +596,7 @@ bool reshade::d3d12::runtime_d3d12::init_effect(size_t index)
 
 	const auto D3DCompile = reinterpret_cast<pD3DCompile>(GetProcAddress(_d3d_compiler, "D3DCompile"));
 	const auto D3DDisassemble = reinterpret_cast<pD3DDisassemble>(GetProcAddress(_d3d_compiler, "D3DDisassemble"));
+	const auto D3DCreateBlob = reinterpret_cast<decltype(&::D3DCreateBlob)>(GetProcAddress(_d3d_compiler, "D3DCreateBlob"));
 
 	const std::string hlsl = effect.preamble + effect.module.hlsl;
 	std::unordered_map<std::string, com_ptr<ID3DBlob>> entry_points;
@@ -513,16 +606,40 @@ bool reshade::d3d12::runtime_d3d12::init_effect(size_t index)
 	{
 		com_ptr<ID3DBlob> d3d_errors;
 
-		const HRESULT hr = D3DCompile(
-			hlsl.c_str(), hlsl.size(),
-			nullptr, nullptr, nullptr,
-			entry_point.name.c_str(),
-			entry_point.is_pixel_shader ? "ps_5_0" : "vs_5_0",
-			D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3, 0,
-			&entry_points[entry_point.name], &d3d_errors);
+		com_ptr<ID3DBlob> &d3d_compiled = entry_points[entry_point.name];
+		const char *const profile = entry_point.is_pixel_shader ? "ps_5_0" : "vs_5_0";
+		const UINT compile_flags = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3;
 
-		if (d3d_errors != nullptr) // Append warnings to the output error string as well
-			effect.errors.append(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+		HRESULT hr = S_OK;
+		std::string warnings;
+		const uint64_t cache_key = permutation_cache::hash(hlsl, entry_point.name, profile, compile_flags);
+
+		// Compiling is by far the slowest part of loading an effect, so reuse byte code compiled from the same source code before (in this or a previous session)
+		if (std::vector<uint8_t> cached_data; _permutation_cache->find_binary(cache_key, cached_data, warnings) &&
+			D3DCreateBlob != nullptr && SUCCEEDED(D3DCreateBlob(cached_data.size(), &d3d_compiled)))
+		{
+			std::memcpy(d3d_compiled->GetBufferPointer(), cached_data.data(), cached_data.size());
+		}
+		else
+		{
+			hr = D3DCompile(
+				hlsl.c_str(), hlsl.size(),
+				nullptr, nullptr, nullptr,
+				entry_point.name.c_str(),
+				profile,
+				compile_flags, 0,
+				&d3d_compiled, &d3d_errors);
+
+			warnings.clear();
+			if (d3d_errors != nullptr)
+				warnings.assign(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+
+			if (SUCCEEDED(hr))
+				_permutation_cache->insert_binary(cache_key, d3d_compiled->GetBufferPointer(), d3d_compiled->GetBufferSize(), warnings);
+		}
+
+		// Append warnings to the output error string as well
+		effect.errors += warnings;
 
 		// No need to setup resources if any of the shaders failed to compile
 		if (FAILED(hr))
@@ -1077,14 +1194,11 @@ void reshade::d3d12::runtime_d3d12::upload_texture(const texture &texture, const
 	{
 	case reshadefx::texture_format::r8:
 		for (uint32_t y = 0; y < texture.height; ++y, mapped_data += upload_pitch, pixels += data_pitch)
-			for (uint32_t x = 0; x < texture.width; ++x)
-				mapped_data[x] = pixels[x * 4];
+			convert_rgba8_to_r8(mapped_data, pixels, texture.width);
 		break;
 	case reshadefx::texture_format::rg8:
 		for (uint32_t y = 0; y < texture.height; ++y, mapped_data += upload_pitch, pixels += data_pitch)
-			for (uint32_t x = 0; x < texture.width; ++x)
-				mapped_data[x * 2 + 0] = pixels[x * 4 + 0],
-				mapped_data[x * 2 + 1] = pixels[x * 4 + 1];
+			convert_rgba8_to_rg8(mapped_data, pixels, texture.width);
 		break;
 	case reshadefx::texture_format::rgba8:
 		for (uint32_t y = 0; y < texture.height; ++y, mapped_data += upload_pitch, pixels += data_pitch)
@@ -1181,6 +1295,8 @@ void reshade::d3d12::runtime_d3d12::render_technique(technique &technique)
 	// Setup shader constants
 	if (effect_data.cb != nullptr)
 	{
+		RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, upload_constants);
+
 		if (void *mapped; SUCCEEDED(effect_data.cb->Map(0, nullptr, &mapped)))
 		{
 			std::memcpy(mapped, _effects[technique.effect_index].uniform_data_storage.data(), _effects[technique.effect_index].uniform_data_storage.size());
@@ -1199,12 +1315,13 @@ void reshade::d3d12::runtime_d3d12::render_technique(technique &technique)
 	// TODO: Technically need to transition the depth texture here as well
 
 	bool is_effect_stencil_cleared = false;
-	bool needs_implicit_backbuffer_copy = true; // First pass always needs the back buffer updated
 	D3D12_CPU_DESCRIPTOR_HANDLE effect_stencil = _depthstencil_dsvs->GetCPUDescriptorHandleForHeapStart();
 
-	for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
+	for (const reshadefx::scheduled_pass &scheduled : technique.schedule.passes)
 	{
-		if (needs_implicit_backbuffer_copy)
+		const size_t pass_index = scheduled.pass_index;
+
+		if (scheduled.copy_backbuffer)
 		{
 			// Save back buffer of previous pass
 			transition_state(_cmd_list, _backbuffer_texture, D3D12_RESOURCE_STATE_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
@@ -1217,8 +1334,8 @@ void reshade::d3d12::runtime_d3d12::render_technique(technique &technique)
 		const d3d12_pass_data &pass_data = impl->passes[pass_index];
 		const reshadefx::pass_info &pass_info = technique.passes[pass_index];
 
-		// Transition resource state for render targets
-		for (UINT k = 0; k < pass_data.num_render_targets; ++k)
+		// Transition resource state for render targets (they are still in that state if this pass continues the previous one)
+		for (UINT k = 0; k < pass_data.num_render_targets && scheduled.begin_render_pass; ++k)
 		{
 			const auto render_target_texture = std::find_if(_textures.begin(), _textures.end(),
 				[&render_target = pass_info.render_target_names[k]](const auto &item) {
@@ -1244,22 +1361,18 @@ void reshade::d3d12::runtime_d3d12::render_technique(technique &technique)
 
 		if (pass_data.num_render_targets == 0)
 		{
-			needs_implicit_backbuffer_copy = true;
-
 			D3D12_CPU_DESCRIPTOR_HANDLE render_target = { _backbuffer_rtvs->GetCPUDescriptorHandleForHeapStart().ptr + (_swap_index * 2 + pass_info.srgb_write_enable) * _rtv_handle_size };
 			_cmd_list->OMSetRenderTargets(1, &render_target, false, pass_info.stencil_enable ? &effect_stencil : nullptr);
 
-			if (pass_info.clear_render_targets)
+			if (scheduled.clear_render_targets)
 				_cmd_list->ClearRenderTargetView(render_target, clear_color, 0, nullptr);
 		}
 		else
 		{
-			needs_implicit_backbuffer_copy = false;
-
 			_cmd_list->OMSetRenderTargets(pass_data.num_render_targets, &pass_data.render_targets, true,
 				pass_info.stencil_enable && pass_info.viewport_width == _width && pass_info.viewport_height == _height ? &effect_stencil : nullptr);
 
-			if (pass_info.clear_render_targets)
+			if (scheduled.clear_render_targets)
 				for (UINT k = 0; k < pass_data.num_render_targets; ++k)
 					_cmd_list->ClearRenderTargetView({ pass_data.render_targets.ptr + k * _rtv_handle_size }, clear_color, 0, nullptr);
 		}
@@ -1293,8 +1406,8 @@ void reshade::d3d12::runtime_d3d12::render_technique(technique &technique)
 		_vertices += pass_info.num_vertices;
 		_drawcalls += 1;
 
-		// Generate mipmaps and transition resource state back to shader access
-		for (UINT k = 0; k < pass_data.num_render_targets; ++k)
+		// Generate mipmaps and transition resource state back to shader access (unless the next pass continues to render to them)
+		for (UINT k = 0; k < pass_data.num_render_targets && scheduled.end_render_pass; ++k)
 		{
 			const auto render_target_texture = std::find_if(_textures.begin(), _textures.end(),
 				[&render_target = pass_info.render_target_names[k]](const auto &item) {
@@ -1302,7 +1415,9 @@ void reshade::d3d12::runtime_d3d12::render_technique(technique &technique)
 			});
 
 			transition_state(_cmd_list, static_cast<d3d12_tex_data *>(render_target_texture->impl)->resource, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_SHADER_RESOURCE);
-			generate_mipmaps(*render_target_texture);
+
+			if ((scheduled.generate_mipmaps & (1 << k)) != 0)
+				generate_mipmaps(*render_target_texture);
 		}
 	}
 }
@@ -1606,15 +1721,21 @@ void reshade::d3d12::runtime_d3d12::draw_depth_debug_menu(buffer_detection_conte
 	ImGui::Separator();
 	ImGui::Spacing();
 
-	for (const auto &[dsv_texture, snapshot] : tracker.depth_buffer_counters())
+	const auto &depth_buffers = tracker.depth_buffer_tracker();
+
+	for (uint32_t slot = 0; slot < depth_buffers.resources().size(); ++slot)
 	{
+		const auto &snapshot = depth_buffers.counters(slot);
+		if (!snapshot.in_use)
+			continue;
+
+		const com_ptr<ID3D12Resource> &dsv_texture = depth_buffers.data(slot);
+
 		// TODO: Display current resource when not preserving depth buffers
 		char label[512] = "";
 		sprintf_s(label, "%s0x%p", (dsv_texture == tracker.current_depth_texture() ? "> " : "  "), dsv_texture.get());
 
-		const D3D12_RESOURCE_DESC desc = dsv_texture->GetDesc();
-
-		const bool msaa = desc.SampleDesc.Count > 1;
+		const bool msaa = snapshot.desc.samples > 1;
 		if (msaa) // Disable widget for MSAA textures
 		{
 			ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
@@ -1627,7 +1748,7 @@ void reshade::d3d12::runtime_d3d12::draw_depth_debug_menu(buffer_detection_conte
 
 		ImGui::SameLine();
 		ImGui::Text("| %4ux%-4u | %5u draw calls ==> %8u vertices |%s",
-			desc.Width, desc.Height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
+			snapshot.desc.width, snapshot.desc.height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
 
 		if (_preserve_depth_buffers && dsv_texture == tracker.current_depth_texture())
 		{
@@ -43,6 +43,10 @@ namespace reshade::d3d12
 
 		void render_technique(technique &technique) override;
 
+		bool begin_readback(unsigned int slot) override;
+		bool is_readback_complete(unsigned int slot) const override;
+		bool finish_readback(unsigned int slot, uint8_t *buffer) override;
+
 		bool begin_command_list(const com_ptr<ID3D12PipelineState> &state = nullptr) const;
 		void execute_command_list() const;
 		bool wait_for_command_queue() const;
@@ -68,6 +72,14 @@ namespace reshade::d3d12
 		DXGI_FORMAT _backbuffer_format = DXGI_FORMAT_UNKNOWN;
 		std::vector<com_ptr<ID3D12Resource>> _backbuffers;
 		com_ptr<ID3D12Resource> _backbuffer_texture;
+
+		struct readback_slot
+		{
+			com_ptr<ID3D12Resource> buffer;
+			UINT fence_index = 0;
+			UINT64 fence_value = 0;
+		};
+		std::vector<readback_slot> _readback_slots;
 		com_ptr<ID3D12DescriptorHeap> _backbuffer_rtvs;
 		com_ptr<ID3D12DescriptorHeap> _depthstencil_dsvs;
 
@@ -5,7 +5,7 @@
 
 #include "dll_log.hpp"
 #include "buffer_detection.hpp"
-#include <cmath>
+#include <algorithm>
 
 static constexpr auto D3DFMT_INTZ = static_cast<D3DFORMAT>(MAKEFOURCC('I', 'N', 'T', 'Z'));
 static constexpr auto D3DFMT_DF16 = static_cast<D3DFORMAT>(MAKEFOURCC('D', 'F', '1', '6'));
@@ -13,16 +13,17 @@ static constexpr auto D3DFMT_DF24 = static_cast<D3DFORMAT>(MAKEFOURCC('D', 'F',
 
 void reshade::d3d9::buffer_detection::reset(bool release_resources)
 {
-	_stats.vertices = 0;
-	_stats.drawcalls = 0;
 #if RESHADE_DEPTH
 	_clear_stats.vertices = 0;
 	_clear_stats.drawcalls = 0;
-	_counters_per_used_depth_surface.clear();
 
 	if (release_resources)
 	{
+		// Release all references to depth-stencil surfaces (which is required before the device can be reset)
+		_tracker.reset();
+
 		update_depthstencil_replacement(nullptr);
+		return;
 	}
 	else if (_preserve_depth_buffers && _depthstencil_replacement != nullptr)
 	{
@@ -38,6 +39,9 @@ void reshade::d3d9::buffer_detection::reset(bool release_resources)
 #else
 	UNREFERENCED_PARAMETER(release_resources);
 #endif
+
+	// Keep depth-stencil surfaces that are still in use, so that their slots stay valid and binding them again does not need to allocate
+	_tracker.reset_unused();
 }
 
 void reshade::d3d9::buffer_detection::on_draw(D3DPRIMITIVETYPE type, UINT vertices)
@@ -59,33 +63,41 @@ void reshade::d3d9::buffer_detection::on_draw(D3DPRIMITIVETYPE type, UINT vertic
 		break;
 	}
 
-	_stats.vertices += vertices;
-	_stats.drawcalls += 1;
-
 #if RESHADE_DEPTH
 	com_ptr<IDirect3DSurface9> depthstencil;
 	_device->GetDepthStencilSurface(&depthstencil);
 
-	if (depthstencil != nullptr)
+	// Draw calls to the replacement are counted for the original surface
+	if (depthstencil != nullptr && depthstencil == _depthstencil_replacement)
+		depthstencil = _depthstencil_original;
+
+	// The tracker keeps a reference to the surface in the bound slot, so it is safe to compare against its pointer
+	const uint32_t bound_slot = _tracker.bound();
+	if (depthstencil.get() != (bound_slot != _tracker.npos ? _tracker.data(bound_slot).get() : nullptr))
 	{
-		// Update draw statistics for tracked depth-stencil surfaces
-		auto &counters = _counters_per_used_depth_surface[depthstencil == _depthstencil_replacement ? _depthstencil_original : depthstencil];
-		counters.stats.vertices += vertices;
-		counters.stats.drawcalls += 1;
+		// A null surface unbinds, so that subsequent draw calls are not counted for any depth-stencil
+		_tracker.bind(depthstencil != nullptr ? find_or_add_depthstencil(depthstencil) : _tracker.npos);
 	}
+#endif
+
+	// Update draw statistics for the bound depth-stencil surface
+	_tracker.on_draw(vertices);
 
+#if RESHADE_DEPTH
 	if (_preserve_depth_buffers && _depthstencil_replacement != nullptr)
 	{
 		D3DVIEWPORT9 viewport;
 		_device->GetViewport(&viewport);
 
-		D3DSURFACE_DESC viewport_desc;
-		viewport_desc.Width = viewport.Width;
-		viewport_desc.Height = viewport.Height;
 		D3DSURFACE_DESC depthstencil_desc;
 		_depthstencil_replacement->GetDesc(&depthstencil_desc);
 
-		if (!check_aspect_ratio(viewport_desc, depthstencil_desc.Width, depthstencil_desc.Height))
+		depth_selection::selection_options options;
+		options.width = depthstencil_desc.Width;
+		options.height = depthstencil_desc.Height;
+		options.exact_dimensions = true;
+
+		if (!depth_selection::check_dimensions({ static_cast<uint32_t>(viewport.Width), static_cast<uint32_t>(viewport.Height) }, options))
 			return; // Ignore draw calls that go to a smaller viewport (this helps removing infrequent clears in e.g. Mirror's Edge)
 
 		_clear_stats.vertices += vertices;
@@ -97,9 +109,13 @@ void reshade::d3d9::buffer_detection::on_draw(D3DPRIMITIVETYPE type, UINT vertic
 #if RESHADE_DEPTH
 void reshade::d3d9::buffer_detection::on_set_depthstencil(IDirect3DSurface9 *&depthstencil)
 {
-	if (_depthstencil_replacement != nullptr && depthstencil == _depthstencil_original &&
-		// Do not replace surface after targeted clear, so that all draw calls from then on end up in the original surface
-		_counters_per_used_depth_surface[_depthstencil_original].clears.size() < _depthstencil_clear_index)
+	if (_depthstencil_replacement == nullptr || depthstencil != _depthstencil_original)
+		return;
+
+	const uint32_t slot = _tracker.find(reinterpret_cast<uintptr_t>(_depthstencil_original.get()));
+
+	// Do not replace surface after targeted clear, so that all draw calls from then on end up in the original surface
+	if ((slot != _tracker.npos ? _tracker.counters(slot).clears.size() : 0) < _depthstencil_clear_index)
 	{
 		// Replace application depth-stencil surface with our custom one
 		depthstencil = _depthstencil_replacement.get();
@@ -134,13 +150,15 @@ void reshade::d3d9::buffer_detection::on_clear_depthstencil(UINT clear_flags)
 	com_ptr<IDirect3DSurface9> depthstencil;
 	_device->GetDepthStencilSurface(&depthstencil);
 
-	if (depthstencil != _depthstencil_original && depthstencil != _depthstencil_replacement)
+	if (_depthstencil_original == nullptr || (depthstencil != _depthstencil_original && depthstencil != _depthstencil_replacement))
 		return; // Can only avoid clear of the replacement surface
 
-	auto &clears = _counters_per_used_depth_surface[_depthstencil_original].clears;
-	clears.push_back(std::move(current_stats));
+	const uint32_t slot = find_or_add_depthstencil(_depthstencil_original);
+
+	// Only draw calls to a viewport that covers the surface were counted since the last clear, so pass those instead of the per-surface statistics
+	_tracker.on_clear_with_stats(slot, current_stats);
 
-	if (_depthstencil_clear_index == clears.size())
+	if (_depthstencil_clear_index == _tracker.counters(slot).clears.size())
 	{
 		// Bind the original surface again so the clear is not performed on the replacement
 		_device->SetDepthStencilSurface(_depthstencil_original.get());
@@ -233,10 +251,18 @@ bool reshade::d3d9::buffer_detection::update_depthstencil_replacement(com_ptr<ID
 	return true;
 }
 
-bool reshade::d3d9::buffer_detection::check_aspect_ratio(const D3DSURFACE_DESC &desc, UINT width, UINT height)
+uint32_t reshade::d3d9::buffer_detection::find_or_add_depthstencil(const com_ptr<IDirect3DSurface9> &depthstencil)
 {
-	return (desc.Width >= std::floor(width * 0.95f) && desc.Width <= std::ceil(width * 1.05f))
-		&& (desc.Height >= std::floor(height * 0.95f) && desc.Height <= std::ceil(height * 1.05f));
+	if (const uint32_t slot = _tracker.find(reinterpret_cast<uintptr_t>(depthstencil.get())); slot != _tracker.npos)
+		return slot;
+
+	D3DSURFACE_DESC desc;
+	depthstencil->GetDesc(&desc);
+
+	// Non-maskable multisampling does not specify a sample count, but still has to be treated as MSAA
+	const uint32_t samples = desc.MultiSampleType != D3DMULTISAMPLE_NONE ? std::max(static_cast<uint32_t>(desc.MultiSampleType), 2u) : 1u;
+
+	return _tracker.add(reinterpret_cast<uintptr_t>(depthstencil.get()), { desc.Width, desc.Height, samples }, depthstencil);
 }
 bool reshade::d3d9::buffer_detection::check_texture_format(const D3DSURFACE_DESC &desc)
 {
@@ -247,42 +273,36 @@ bool reshade::d3d9::buffer_detection::check_texture_format(const D3DSURFACE_DESC
 com_ptr<IDirect3DSurface9> reshade::d3d9::buffer_detection::find_best_depth_surface(UINT width, UINT height, com_ptr<IDirect3DSurface9> override, UINT clear_index_override)
 {
 	bool no_replacement = true;
-	depthstencil_info best_snapshot;
+	uint32_t best_slot = _tracker.npos;
 	com_ptr<IDirect3DSurface9> best_match;
 
 	if (override != nullptr)
 	{
+		best_slot = _tracker.find(reinterpret_cast<uintptr_t>(override.get()));
 		best_match = std::move(override);
-		best_snapshot = _counters_per_used_depth_surface[best_match];
 
 		// Always replace when there is an override surface
 		no_replacement = false;
 	}
 	else
 	{
-		for (const auto &[surface, snapshot] : _counters_per_used_depth_surface)
+		// MSAA depth buffers are skipped, since they would have to be moved into a plain surface before attaching to a shader slot
+		depth_selection::selection_options options;
+		options.width = width;
+		options.height = height;
+		options.heuristic = depth_selection::selection_heuristic::weighted_vertices;
+		options.exact_dimensions = true;
+
+		best_slot = _tracker.find_best(options);
+		if (best_slot != _tracker.npos)
 		{
-			if (snapshot.stats.drawcalls == 0 || snapshot.stats.vertices == 0)
-				continue; // Skip unused
+			best_match = _tracker.data(best_slot);
 
 			D3DSURFACE_DESC desc;
-			surface->GetDesc(&desc);
-
-			if (desc.MultiSampleType != D3DMULTISAMPLE_NONE)
-				continue; // MSAA depth buffers are not supported since they would have to be moved into a plain surface before attaching to a shader slot
-			if (width != 0 && height != 0 && !check_aspect_ratio(desc, width, height))
-				continue; // Not a good fit
-
-			const auto curr_weight = snapshot.stats.vertices * (1.2f - static_cast<float>(snapshot.stats.drawcalls) / _stats.drawcalls);
-			const auto best_weight = best_snapshot.stats.vertices * (1.2f - static_cast<float>(best_snapshot.stats.drawcalls) / _stats.vertices);
-			if (curr_weight >= best_weight)
-			{
-				best_match = surface;
-				best_snapshot = snapshot;
-
-				// Do not need to replace if format already support shader access
-				no_replacement = check_texture_format(desc);
-			}
+			best_match->GetDesc(&desc);
+
+			// Do not need to replace if format already support shader access
+			no_replacement = check_texture_format(desc);
 		}
 	}
 
@@ -296,26 +316,14 @@ com_ptr<IDirect3DSurface9> reshade::d3d9::buffer_detection::find_best_depth_surf
 		_preserve_depth_buffers = true;
 		_depthstencil_clear_index = std::numeric_limits<UINT>::max();
 
-		if (clear_index_override <= best_snapshot.clears.size())
+		if (best_slot != _tracker.npos)
 		{
-			_depthstencil_clear_index = clear_index_override;
-		}
-		else
-		{
-			UINT last_vertices = 0;
-
-			for (UINT clear_index = 0; clear_index < best_snapshot.clears.size(); clear_index++)
-			{
-				const auto &snapshot = best_snapshot.clears[clear_index];
-
-				// Fix for source engine games: Add a weight in order not to select the first db instance if it is related to the background scene
-				int mult = (clear_index > 0) ? 10 : 1;
-				if (mult * snapshot.vertices >= last_vertices)
-				{
-					last_vertices = mult * snapshot.vertices;
-					_depthstencil_clear_index = clear_index + 1;
-				}
-			}
+			const depth_selection::resource_counters &best_counters = _tracker.counters(best_slot);
+
+			if (clear_index_override <= best_counters.clears.size())
+				_depthstencil_clear_index = clear_index_override;
+			else if (const uint32_t best_clear_index = depth_selection::find_best_clear_index(best_counters); best_clear_index != 0)
+				_depthstencil_clear_index = best_clear_index;
 		}
 	}
 
@@ -5,19 +5,22 @@
 
 #pragma once
 
-#include <map>
 #include <d3d9.h>
 #include "com_ptr.hpp"
+#include "depth_selection.hpp"
 
 namespace reshade::d3d9
 {
 	class buffer_detection
 	{
+		// A reference to each depth-stencil surface is stored alongside its counters, so that the handle (the surface pointer) stays valid until it is removed
+		using depth_tracker = depth_selection::tracker<com_ptr<IDirect3DSurface9>>;
+
 	public:
 		explicit buffer_detection(IDirect3DDevice9 *device) : _device(device) {}
 
-		UINT total_vertices() const { return _stats.vertices; }
-		UINT total_drawcalls() const { return _stats.drawcalls; }
+		UINT total_vertices() const { return _tracker.total_vertices(); }
+		UINT total_drawcalls() const { return _tracker.total_drawcalls(); }
 
 		void reset(bool release_resources);
 
@@ -27,7 +30,7 @@ namespace reshade::d3d9
 		bool disable_intz = false;
 
 		UINT current_clear_index() const { return _depthstencil_clear_index; }
-		const auto &depth_buffer_counters() const { return _counters_per_used_depth_surface; }
+		const auto &depth_buffer_tracker() const { return _tracker; }
 		IDirect3DSurface9 *current_depth_surface() const { return _depthstencil_original.get(); }
 		IDirect3DSurface9 *current_depth_replacement() const { return _depthstencil_replacement.get(); }
 
@@ -41,34 +44,22 @@ namespace reshade::d3d9
 #endif
 
 	private:
-		struct draw_stats
-		{
-			UINT vertices = 0;
-			UINT drawcalls = 0;
-		};
-		struct depthstencil_info
-		{
-			draw_stats stats;
-			std::vector<draw_stats> clears;
-		};
-
 #if RESHADE_DEPTH
-		bool check_aspect_ratio(const D3DSURFACE_DESC &desc, UINT width, UINT height);
 		bool check_texture_format(const D3DSURFACE_DESC &desc);
 
+		uint32_t find_or_add_depthstencil(const com_ptr<IDirect3DSurface9> &depthstencil);
+
 		bool update_depthstencil_replacement(com_ptr<IDirect3DSurface9> depthstencil);
 #endif
 
 		IDirect3DDevice9 *const _device;
-		draw_stats _stats;
+		depth_tracker _tracker;
 #if RESHADE_DEPTH
 		bool _preserve_depth_buffers = false;
-		draw_stats _clear_stats;
+		depth_selection::draw_stats _clear_stats;
 		UINT _depthstencil_clear_index = std::numeric_limits<UINT>::max();
 		com_ptr<IDirect3DSurface9> _depthstencil_original;
 		com_ptr<IDirect3DSurface9> _depthstencil_replacement;
-		// Use "std::map" instead of "std::unordered_map" so that the iteration order is guaranteed
-		std::map<com_ptr<IDirect3DSurface9>, depthstencil_info> _counters_per_used_depth_surface;
 #endif
 	};
 }
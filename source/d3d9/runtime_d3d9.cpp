@@ -7,6 +7,7 @@
 #include "runtime_d3d9.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "format_conversion.hpp"
 #include <imgui.h>
 #include <imgui_internal.h>
 #include <d3dcompiler.h>
@@ -270,27 +271,12 @@ bool reshade::d3d9::runtime_d3d9::capture_screenshot(uint8_t *buffer) const
 	{
 		if (_color_bit_depth == 10)
 		{
-			for (uint32_t x = 0; x < pitch; x += 4)
-			{
-				const uint32_t rgba = *reinterpret_cast<const uint32_t *>(mapped_data + x);
-				// Divide by 4 to get 10-bit range (0-1023) into 8-bit range (0-255)
-				buffer[x + 0] = ((rgba & 0x3FF) / 4) & 0xFF;
-				buffer[x + 1] = (((rgba & 0xFFC00) >> 10) / 4) & 0xFF;
-				buffer[x + 2] = (((rgba & 0x3FF00000) >> 20) / 4) & 0xFF;
-				buffer[x + 3] = 0xFF;
-			}
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, _width, false);
 		}
 		else
 		{
-			std::memcpy(buffer, mapped_data, pitch);
-
-			for (uint32_t x = 0; x < pitch; x += 4)
-			{
-				buffer[x + 3] = 0xFF; // Clear alpha channel
-				if (_backbuffer_format == D3DFMT_A8R8G8B8 ||
-					_backbuffer_format == D3DFMT_X8R8G8B8)
-					std::swap(buffer[x + 0], buffer[x + 2]); // Format is BGRA, but output should be RGBA, so flip channels
-			}
+			// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+			convert_rgbx8_to_rgba8(buffer, mapped_data, _width, _backbuffer_format == D3DFMT_A8R8G8B8 || _backbuffer_format == D3DFMT_X8R8G8B8);
 		}
 	}
 
@@ -316,6 +302,7 @@ bool reshade::d3d9::runtime_d3d9::init_effect(size_t index)
 
 	const auto D3DCompile = reinterpret_cast<pD3DCompile>(GetProcAddress(_d3d_compiler, "D3DCompile"));
 	const auto D3DDisassemble = reinterpret_cast<pD3DDisassemble>(GetProcAddress(_d3d_compiler, "D3DDisassemble"));
+	const auto D3DCreateBlob = reinterpret_cast<decltype(&::D3DCreateBlob)>(GetProcAddress(_d3d_compiler, "D3DCreateBlob"));
 
 	// Add specialization constant defines to source code
 	effect.preamble +=
@@ -335,16 +322,39 @@ bool reshade::d3d9::runtime_d3d9::init_effect(size_t index)
 		com_ptr<ID3DBlob> compiled, d3d_errors;
 		const std::string &hlsl = entry_point.is_pixel_shader ? hlsl_ps : hlsl_vs;
 
-		HRESULT hr = D3DCompile(
-			hlsl.c_str(), hlsl.size(),
-			nullptr, nullptr, nullptr,
-			entry_point.name.c_str(),
-			entry_point.is_pixel_shader ? "ps_3_0" : "vs_3_0",
-			D3DCOMPILE_OPTIMIZATION_LEVEL3, 0,
-			&compiled, &d3d_errors);
+		const char *const profile = entry_point.is_pixel_shader ? "ps_3_0" : "vs_3_0";
+		const UINT compile_flags = D3DCOMPILE_OPTIMIZATION_LEVEL3;
+
+		HRESULT hr = S_OK;
+		std::string warnings;
+		const uint64_t cache_key = permutation_cache::hash(hlsl, entry_point.name, profile, compile_flags);
 
-		if (d3d_errors != nullptr) // Append warnings to the output error string as well
-			effect.errors.append(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+		// Compiling is by far the slowest part of loading an effect, so reuse byte code compiled from the same source code before (in this or a previous session)
+		if (std::vector<uint8_t> cached_data; _permutation_cache->find_binary(cache_key, cached_data, warnings) &&
+			D3DCreateBlob != nullptr && SUCCEEDED(D3DCreateBlob(cached_data.size(), &compiled)))
+		{
+			std::memcpy(compiled->GetBufferPointer(), cached_data.data(), cached_data.size());
+		}
+		else
+		{
+			hr = D3DCompile(
+				hlsl.c_str(), hlsl.size(),
+				nullptr, nullptr, nullptr,
+				entry_point.name.c_str(),
+				profile,
+				compile_flags, 0,
+				&compiled, &d3d_errors);
+
+			warnings.clear();
+			if (d3d_errors != nullptr)
+				warnings.assign(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
+
+			if (SUCCEEDED(hr))
+				_permutation_cache->insert_binary(cache_key, compiled->GetBufferPointer(), compiled->GetBufferSize(), warnings);
+		}
+
+		// Append warnings to the output error string as well
+		effect.errors += warnings;
 
 		// No need to setup resources if any of the shaders failed to compile
 		if (FAILED(hr))
@@ -781,28 +791,16 @@ void reshade::d3d9::runtime_d3d9::upload_texture(const texture &texture, const u
 	switch (texture.format)
 	{
 	case reshadefx::texture_format::r8: // These are actually D3DFMT_A8R8G8B8, see 'init_texture'
-		for (uint32_t y = 0, pitch = texture.width * 4; y < texture.height; ++y, mapped_data += mapped.Pitch, pixels += pitch)
-			for (uint32_t x = 0; x < pitch; x += 4)
-				mapped_data[x + 0] = 0, // Set green and blue channel to zero
-				mapped_data[x + 1] = 0,
-				mapped_data[x + 2] = pixels[x + 0],
-				mapped_data[x + 3] = 0xFF;
+		for (uint32_t y = 0; y < texture.height; ++y, mapped_data += mapped.Pitch, pixels += texture.width * 4)
+			convert_rgba8_to_bgra8(mapped_data, pixels, texture.width, 1); // Set green and blue channel to zero
 		break;
 	case reshadefx::texture_format::rg8:
-		for (uint32_t y = 0, pitch = texture.width * 4; y < texture.height; ++y, mapped_data += mapped.Pitch, pixels += pitch)
-			for (uint32_t x = 0; x < pitch; x += 4)
-				mapped_data[x + 0] = 0, // Set blue channel to zero
-				mapped_data[x + 1] = pixels[x + 1],
-				mapped_data[x + 2] = pixels[x + 0],
-				mapped_data[x + 3] = 0xFF;
+		for (uint32_t y = 0; y < texture.height; ++y, mapped_data += mapped.Pitch, pixels += texture.width * 4)
+			convert_rgba8_to_bgra8(mapped_data, pixels, texture.width, 2); // Set blue channel to zero
 		break;
 	case reshadefx::texture_format::rgba8:
-		for (uint32_t y = 0, pitch = texture.width * 4; y < texture.height; ++y, mapped_data += mapped.Pitch, pixels += pitch)
-			for (uint32_t x = 0; x < pitch; x += 4)
-				mapped_data[x + 0] = pixels[x + 2], // Flip RGBA input to BGRA
-				mapped_data[x + 1] = pixels[x + 1],
-				mapped_data[x + 2] = pixels[x + 0],
-				mapped_data[x + 3] = pixels[x + 3];
+		for (uint32_t y = 0; y < texture.height; ++y, mapped_data += mapped.Pitch, pixels += texture.width * 4)
+			convert_rgba8_to_bgra8(mapped_data, pixels, texture.width); // Flip RGBA input to BGRA
 		break;
 	default:
 		LOG(ERROR) << "Texture upload is not supported for format " << static_cast<unsigned int>(texture.format) << '!';
@@ -834,17 +832,20 @@ void reshade::d3d9::runtime_d3d9::render_technique(technique &technique)
 	// Setup shader constants
 	if (impl->constant_register_count != 0)
 	{
+		RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, upload_constants);
+
 		const auto uniform_storage_data = reinterpret_cast<const float *>(_effects[technique.effect_index].uniform_data_storage.data());
 		_device->SetPixelShaderConstantF(0, uniform_storage_data, impl->constant_register_count);
 		_device->SetVertexShaderConstantF(0, uniform_storage_data, impl->constant_register_count);
 	}
 
 	bool is_effect_stencil_cleared = false;
-	bool needs_implicit_backbuffer_copy = true; // First pass always needs the back buffer updated
 
-	for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
+	for (const reshadefx::scheduled_pass &scheduled : technique.schedule.passes)
 	{
-		if (needs_implicit_backbuffer_copy)
+		const size_t pass_index = scheduled.pass_index;
+
+		if (scheduled.copy_backbuffer)
 		{
 			// Save back buffer of previous pass
 			_device->StretchRect(_backbuffer_resolved.get(), nullptr, _backbuffer_texture_surface.get(), nullptr, D3DTEXF_NONE);
@@ -887,9 +888,9 @@ void reshade::d3d9::runtime_d3d9::render_technique(technique &technique)
 		{
 			is_effect_stencil_cleared = true;
 
-			_device->Clear(0, nullptr, (pass_info.clear_render_targets ? D3DCLEAR_TARGET : 0) | D3DCLEAR_STENCIL, 0, 1.0f, 0);
+			_device->Clear(0, nullptr, (scheduled.clear_render_targets ? D3DCLEAR_TARGET : 0) | D3DCLEAR_STENCIL, 0, 1.0f, 0);
 		}
-		else if (pass_info.clear_render_targets)
+		else if (scheduled.clear_render_targets)
 		{
 			_device->Clear(0, nullptr, D3DCLEAR_TARGET, 0, 0.0f, 0);
 		}
@@ -924,20 +925,14 @@ void reshade::d3d9::runtime_d3d9::render_technique(technique &technique)
 		_vertices += pass_info.num_vertices;
 		_drawcalls += 1;
 
-		needs_implicit_backbuffer_copy = false;
-		for (IDirect3DSurface9 *target : pass_data.render_targets)
+		// Generate mipmaps (the schedule never requests this for the back buffer)
+		for (DWORD k = 0; k < _num_simultaneous_rendertargets && pass_data.render_targets[k] != nullptr; ++k)
 		{
-			if (target == nullptr)
-				break;
-
-			if (target == _backbuffer_resolved)
-			{
-				needs_implicit_backbuffer_copy = true;
-				break;
-			}
+			if ((scheduled.generate_mipmaps & (1 << k)) == 0)
+				continue;
 
 			if (com_ptr<IDirect3DBaseTexture9> texture;
-				SUCCEEDED(target->GetContainer(IID_PPV_ARGS(&texture))) && texture->GetLevelCount() > 1)
+				SUCCEEDED(pass_data.render_targets[k]->GetContainer(IID_PPV_ARGS(&texture))) && texture->GetLevelCount() > 1)
 			{
 				texture->SetAutoGenFilterType(D3DTEXF_LINEAR);
 				texture->GenerateMipSubLevels();
@@ -1153,15 +1148,20 @@ void reshade::d3d9::runtime_d3d9::draw_depth_debug_menu(buffer_detection &tracke
 	ImGui::Separator();
 	ImGui::Spacing();
 
-	for (const auto &[ds_surface, snapshot] : tracker.depth_buffer_counters())
+	const auto &depth_buffers = tracker.depth_buffer_tracker();
+
+	for (uint32_t slot = 0; slot < depth_buffers.resources().size(); ++slot)
 	{
+		const auto &snapshot = depth_buffers.counters(slot);
+		if (!snapshot.in_use)
+			continue;
+
+		const com_ptr<IDirect3DSurface9> &ds_surface = depth_buffers.data(slot);
+
 		char label[512] = "";
 		sprintf_s(label, "%s0x%p", (ds_surface == tracker.current_depth_surface() ? "> " : "  "), ds_surface.get());
 
-		D3DSURFACE_DESC desc;
-		ds_surface->GetDesc(&desc);
-
-		const bool msaa = desc.MultiSampleType != D3DMULTISAMPLE_NONE;
+		const bool msaa = snapshot.desc.samples > 1;
 		if (msaa) // Disable widget for MSAA textures
 		{
 			ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
@@ -1174,7 +1174,7 @@ void reshade::d3d9::runtime_d3d9::draw_depth_debug_menu(buffer_detection &tracke
 
 		ImGui::SameLine();
 		ImGui::Text("| %4ux%-4u | %5u draw calls ==> %8u vertices |%s",
-			desc.Width, desc.Height, snapshot.stats.drawcalls, snapshot.stats.vertices, (msaa ? " MSAA" : ""));
+			snapshot.desc.width, snapshot.desc.height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
 
 		if (_preserve_depth_buffers && ds_surface == tracker.current_depth_surface())
 		{
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "depth_selection.hpp"
+#include <cmath>
+#include <cstring>
+
+using namespace reshade::depth_selection;
+using namespace reshade::depth_selection::trace_format;
+
+trace_writer trace_writer::s_instance;
+std::atomic<bool> trace_writer::s_is_active = false;
+
+bool reshade::depth_selection::check_dimensions(const resource_desc &desc, const selection_options &options)
+{
+	if (options.width == 0 || options.height == 0)
+		return true;
+
+	if (options.exact_dimensions)
+	{
+		return (desc.width >= std::floor(options.width * 0.95f) && desc.width <= std::ceil(options.width * 1.05f))
+			&& (desc.height >= std::floor(options.height * 0.95f) && desc.height <= std::ceil(options.height * 1.05f));
+	}
+
+	const float w = static_cast<float>(options.width);
+	const float w_ratio = w / desc.width;
+	const float h = static_cast<float>(options.height);
+	const float h_ratio = h / desc.height;
+	const float aspect_ratio = (w / h) - (static_cast<float>(desc.width) / desc.height);
+
+	return !(std::fabs(aspect_ratio) > 0.1f || w_ratio > 1.85f || h_ratio > 1.85f || w_ratio < 0.5f || h_ratio < 0.5f);
+}
+
+bool reshade::depth_selection::is_better_candidate(const resource_counters &candidate, const resource_counters &best, const draw_stats &total_stats, bool has_indirect_drawcalls, const selection_options &options)
+{
+	switch (options.heuristic)
+	{
+	default:
+	case selection_heuristic::most_vertices:
+		return !has_indirect_drawcalls ?
+			// Choose snapshot with the most vertices, since that is likely to contain the main scene
+			candidate.total_stats.vertices > best.total_stats.vertices :
+			// Or check draw calls, since vertices may not be accurate if application is using indirect draw calls
+			candidate.total_stats.drawcalls > best.total_stats.drawcalls;
+	case selection_heuristic::weighted_vertices:
+		const auto curr_weight = candidate.total_stats.vertices * (1.2f - static_cast<float>(candidate.total_stats.drawcalls) / total_stats.drawcalls);
+		const auto best_weight = best.total_stats.vertices * (1.2f - static_cast<float>(best.total_stats.drawcalls) / total_stats.vertices);
+		return curr_weight >= best_weight;
+	}
+}
+
+uint32_t reshade::depth_selection::find_best_clear_index(const resource_counters &counters)
+{
+	uint32_t best_clear_index = 0;
+	uint32_t last_vertices = 0;
+
+	for (uint32_t clear_index = 0; clear_index < counters.clears.size(); clear_index++)
+	{
+		const draw_stats &snapshot = counters.clears[clear_index];
+
+		// Fix for source engine games: Add a weight in order not to select the first db instance if it is related to the background scene
+		const uint32_t mult = (clear_index > 0) ? 10 : 1;
+		if (mult * snapshot.vertices >= last_vertices)
+		{
+			last_vertices = mult * snapshot.vertices;
+			best_clear_index = clear_index + 1;
+		}
+	}
+
+	return best_clear_index;
+}
+
+bool trace_writer::start(const std::filesystem::path &path)
+{
+	const std::lock_guard<std::mutex> lock(s_instance._mutex);
+
+	if (s_instance._file.is_open())
+		return false;
+
+	s_instance._file.open(path, std::ios::binary | std::ios::trunc);
+	if (!s_instance._file)
+		return false;
+
+	trace_file_header header = {};
+	std::memcpy(header.magic, trace_file_header::expected_magic, sizeof(header.magic));
+	header.version = trace_file_header::expected_version;
+	s_instance._file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+	s_instance._known_streams.clear();
+
+	s_is_active.store(true, std::memory_order_release);
+
+	return true;
+}
+void trace_writer::stop()
+{
+	s_is_active.store(false, std::memory_order_release);
+
+	// Trackers may still be in the middle of recording an event, so only close the file while holding the lock
+	const std::lock_guard<std::mutex> lock(s_instance._mutex);
+
+	s_instance._file.close();
+	s_instance._known_streams.clear();
+}
+
+bool trace_writer::begin_stream(const void *stream)
+{
+	const std::lock_guard<std::mutex> lock(_mutex);
+	return _file.is_open() && _known_streams.insert(stream).second;
+}
+void trace_writer::end_stream(const void *stream)
+{
+	const std::lock_guard<std::mutex> lock(_mutex);
+	_known_streams.erase(stream);
+}
+
+void trace_writer::write(uint32_t type, const void *stream, const void *data, uint32_t size)
+{
+	const trace_record_header header = { type, size, reinterpret_cast<uintptr_t>(stream) };
+
+	const std::lock_guard<std::mutex> lock(_mutex);
+
+	if (!_file.is_open())
+		return; // Recording was stopped in the meantime
+
+	_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	_file.write(static_cast<const char *>(data), size);
+}
+
+void trace_writer::record_state(const void *stream, const draw_stats &stats, bool has_indirect_drawcalls, const resource_counters *resources, size_t num_resources, const resource_counters *bound)
+{
+	// Serialize the entire state into a single record, so that it is not interleaved with records of other threads
+	std::vector<uint8_t> data(sizeof(state_record));
+
+	state_record &record = *reinterpret_cast<state_record *>(data.data());
+	record.stats = stats;
+	record.has_indirect_drawcalls = has_indirect_drawcalls;
+	record.has_bound = bound != nullptr;
+	record.bound = bound != nullptr ? bound->handle : 0;
+	record.num_resources = 0;
+	record.reserved = 0;
+
+	for (size_t i = 0; i < num_resources; ++i)
+	{
+		const resource_counters &counters = resources[i];
+		if (!counters.in_use)
+			continue;
+
+		state_resource_record resource_record = {};
+		resource_record.handle = counters.handle;
+		resource_record.desc = counters.desc;
+		resource_record.slot = static_cast<uint32_t>(i);
+		resource_record.total_stats = counters.total_stats;
+		resource_record.current_stats = counters.current_stats;
+		resource_record.num_clears = static_cast<uint32_t>(counters.clears.size());
+
+		const size_t offset = data.size();
+		data.resize(offset + sizeof(resource_record) + counters.clears.size() * sizeof(draw_stats));
+		std::memcpy(data.data() + offset, &resource_record, sizeof(resource_record));
+		std::memcpy(data.data() + offset + sizeof(resource_record), counters.clears.data(), counters.clears.size() * sizeof(draw_stats));
+
+		reinterpret_cast<state_record *>(data.data())->num_resources++;
+	}
+
+	write(trace_format::record_state, stream, data.data(), static_cast<uint32_t>(data.size()));
+}
+void trace_writer::record_reset(const void *stream, uint32_t mode)
+{
+	const reset_record record = { mode };
+	write(trace_format::record_reset, stream, &record, sizeof(record));
+}
+void trace_writer::record_add(const void *stream, resource_handle handle, const resource_desc &desc)
+{
+	const add_record record = { handle, desc, 0 };
+	write(trace_format::record_add, stream, &record, sizeof(record));
+}
+void trace_writer::record_remove(const void *stream, resource_handle handle)
+{
+	const handle_record record = { handle };
+	write(trace_format::record_remove, stream, &record, sizeof(record));
+}
+void trace_writer::record_bind(const void *stream, const resource_counters *resource)
+{
+	const bind_record record = { resource != nullptr ? resource->handle : 0, resource != nullptr, 0 };
+	write(trace_format::record_bind, stream, &record, sizeof(record));
+}
+void trace_writer::record_draw(const void *stream, uint32_t vertices)
+{
+	const draw_record record = { vertices };
+	write(trace_format::record_draw, stream, &record, sizeof(record));
+}
+void trace_writer::record_clear(const void *stream, resource_handle handle, const draw_stats &fallback_stats)
+{
+	const clear_record record = { handle, fallback_stats };
+	write(trace_format::record_clear, stream, &record, sizeof(record));
+}
+void trace_writer::record_clear_with_stats(const void *stream, resource_handle handle, const draw_stats &stats)
+{
+	const clear_record record = { handle, stats };
+	write(trace_format::record_clear_with_stats, stream, &record, sizeof(record));
+}
+void trace_writer::record_merge(const void *stream, const void *source)
+{
+	const merge_record record = { reinterpret_cast<uintptr_t>(source) };
+	write(trace_format::record_merge, stream, &record, sizeof(record));
+}
+void trace_writer::record_select(const void *stream, const selection_options &options, const resource_counters *fallback, const resource_counters *result)
+{
+	select_record record = {};
+	record.width = options.width;
+	record.height = options.height;
+	record.heuristic = static_cast<uint32_t>(options.heuristic);
+	record.exact_dimensions = options.exact_dimensions;
+	record.has_fallback = fallback != nullptr;
+	record.has_result = result != nullptr;
+	record.fallback = fallback != nullptr ? fallback->handle : 0;
+	record.result = result != nullptr ? result->handle : 0;
+	write(trace_format::record_select, stream, &record, sizeof(record));
+}
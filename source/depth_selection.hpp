@@ -0,0 +1,769 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <limits>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <filesystem>
+#include <unordered_set>
+
+namespace reshade::depth_selection
+{
+	/// <summary>
+	/// An opaque handle to a depth-stencil resource (e.g. a pointer to an API object or an object name).
+	/// </summary>
+	using resource_handle = uint64_t;
+
+	struct draw_stats
+	{
+		uint32_t vertices = 0;
+		uint32_t drawcalls = 0;
+	};
+
+	struct resource_desc
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t samples = 1;
+	};
+
+	struct resource_counters
+	{
+		resource_handle handle = 0;
+		resource_desc desc;
+		bool in_use = false; // Set to false for slots of removed resources, which are reused by the next added one (the lowest first)
+		draw_stats total_stats;
+		draw_stats current_stats; // Stats since last clear
+		std::vector<draw_stats> clears;
+	};
+
+	enum class selection_heuristic : uint32_t
+	{
+		// Choose the resource with the most vertices, or with the most draw calls if indirect draw calls were used (since vertex counts are not accurate then)
+		most_vertices,
+		// Choose the resource with the most vertices, weighted by the share of draw calls that went to it
+		weighted_vertices,
+	};
+
+	struct selection_options
+	{
+		uint32_t width = 0; // Back buffer width to compare against, or zero to accept any dimensions
+		uint32_t height = 0; // Back buffer height to compare against, or zero to accept any dimensions
+		selection_heuristic heuristic = selection_heuristic::most_vertices;
+		bool exact_dimensions = false; // Only accept resources that match the back buffer dimensions within 5%, instead of just a similar aspect ratio
+	};
+
+	/// <summary>
+	/// Check whether a resource with the specified description is a candidate for the specified back buffer dimensions.
+	/// </summary>
+	bool check_dimensions(const resource_desc &desc, const selection_options &options);
+	/// <summary>
+	/// Check whether the <paramref name="candidate"/> resource is a better match than the current <paramref name="best"/> one according to the selection heuristic.
+	/// </summary>
+	bool is_better_candidate(const resource_counters &candidate, const resource_counters &best, const draw_stats &total_stats, bool has_indirect_drawcalls, const selection_options &options);
+	/// <summary>
+	/// Find the one-based index of the clear which most likely happened after the main scene was drawn to the specified resource, or zero if it was never cleared.
+	/// </summary>
+	uint32_t find_best_clear_index(const resource_counters &counters);
+
+	/// <summary>
+	/// Records all events of depth-stencil trackers to a file, so that they can be replayed offline (see 'tools/depth_replay.cpp').
+	/// Only one trace can be recorded at a time. All methods are thread-safe.
+	/// </summary>
+	class trace_writer
+	{
+	public:
+		/// <summary>
+		/// Return the trace that is currently being recorded, or <c>nullptr</c> if there is none.
+		/// </summary>
+		static trace_writer *active() { return s_is_active.load(std::memory_order_acquire) ? &s_instance : nullptr; }
+
+		/// <summary>
+		/// Start recording a new trace to the file at the specified path (replacing any existing file).
+		/// </summary>
+		static bool start(const std::filesystem::path &path);
+		/// <summary>
+		/// Finish recording the current trace and close its file.
+		/// </summary>
+		static void stop();
+
+		/// <summary>
+		/// Check whether the state of the specified tracker needs to be written before its next event (which is the case for the first event of every tracker in a trace).
+		/// </summary>
+		bool begin_stream(const void *stream);
+		/// <summary>
+		/// Forget about the specified tracker (e.g. because it is destroyed).
+		/// </summary>
+		void end_stream(const void *stream);
+
+		void record_state(const void *stream, const draw_stats &stats, bool has_indirect_drawcalls, const resource_counters *resources, size_t num_resources, const resource_counters *bound);
+		void record_reset(const void *stream, uint32_t mode);
+		void record_add(const void *stream, resource_handle handle, const resource_desc &desc);
+		void record_remove(const void *stream, resource_handle handle);
+		void record_bind(const void *stream, const resource_counters *resource);
+		void record_draw(const void *stream, uint32_t vertices);
+		void record_clear(const void *stream, resource_handle handle, const draw_stats &fallback_stats);
+		void record_clear_with_stats(const void *stream, resource_handle handle, const draw_stats &stats);
+		void record_merge(const void *stream, const void *source);
+		void record_select(const void *stream, const selection_options &options, const resource_counters *fallback, const resource_counters *result);
+
+	private:
+		void write(uint32_t type, const void *stream, const void *data, uint32_t size);
+
+		static trace_writer s_instance;
+		static std::atomic<bool> s_is_active;
+
+		std::mutex _mutex;
+		std::ofstream _file;
+		std::unordered_set<const void *> _known_streams;
+	};
+
+	/// <summary>
+	/// Binary layout of a trace file (*.rsdepth). All values are stored little-endian.
+	/// The file starts with a <see cref="trace_file_header"/>, followed by a sequence of records, each starting with a <see cref="trace_record_header"/>.
+	/// </summary>
+	namespace trace_format
+	{
+		struct trace_file_header
+		{
+			static constexpr char expected_magic[4] = { 'R', 'S', 'D', 'T' };
+			static constexpr uint32_t expected_version = 1;
+
+			char magic[4];
+			uint32_t version;
+		};
+
+		enum record_type : uint32_t
+		{
+			record_state = 1, // state_record, followed by 'num_resources' times a state_resource_record and its clears
+			record_reset, // reset_record
+			record_add, // add_record
+			record_remove, // handle_record
+			record_bind, // bind_record
+			record_draw, // draw_record
+			record_clear, // clear_record
+			record_merge, // merge_record
+			record_select, // select_record
+			record_clear_with_stats, // clear_record (with the statistics that were recorded in 'fallback_stats')
+		};
+
+		struct trace_record_header
+		{
+			uint32_t type;
+			uint32_t size; // Size of the data following this header in bytes
+			uint64_t stream; // Identifies the tracker this record applies to
+		};
+
+		struct state_record
+		{
+			draw_stats stats;
+			uint32_t has_indirect_drawcalls;
+			uint32_t has_bound;
+			resource_handle bound;
+			uint32_t num_resources;
+			uint32_t reserved;
+		};
+		struct state_resource_record
+		{
+			resource_handle handle;
+			resource_desc desc;
+			uint32_t slot;
+			draw_stats total_stats;
+			draw_stats current_stats;
+			uint32_t num_clears; // Number of draw_stats entries following this record
+			uint32_t reserved;
+		};
+		enum reset_mode : uint32_t
+		{
+			reset_all, // tracker::reset
+			reset_keep_resources, // tracker::reset_stats
+			reset_keep_used_resources, // tracker::reset_unused
+		};
+
+		struct reset_record
+		{
+			uint32_t mode;
+		};
+		struct add_record
+		{
+			resource_handle handle;
+			resource_desc desc;
+			uint32_t reserved;
+		};
+		struct handle_record
+		{
+			resource_handle handle;
+		};
+		struct bind_record
+		{
+			resource_handle handle;
+			uint32_t has_bound;
+			uint32_t reserved;
+		};
+		struct draw_record
+		{
+			uint32_t vertices;
+		};
+		struct clear_record
+		{
+			resource_handle handle;
+			draw_stats fallback_stats;
+		};
+		struct merge_record
+		{
+			uint64_t source;
+		};
+		struct select_record
+		{
+			uint32_t width;
+			uint32_t height;
+			uint32_t heuristic;
+			uint32_t exact_dimensions;
+			uint32_t has_fallback;
+			uint32_t has_result;
+			resource_handle fallback;
+			resource_handle result;
+		};
+	}
+
+	/// <summary>
+	/// Default type for the backend data associated with each resource, if a backend does not need any.
+	/// </summary>
+	struct no_data {};
+
+	/// <summary>
+	/// Collects draw call statistics per depth-stencil resource and selects the one most likely to contain the main scene.
+	/// Resources are stored in a flat array of slots, which stay valid until the resource is removed or the tracker is reset, so that backends can bind a resource once and count draw calls without any look ups.
+	/// Handles are looked up through a small direct-mapped cache in front of a linear search through a flat array, since there are usually only a few dozen depth-stencil resources and look ups only happen when a resource is bound, not per draw call.
+	/// Slots that changed since the last reset are remembered, so that merging into another tracker only has to visit those.
+	/// </summary>
+	/// <typeparam name="TData">Backend data stored alongside each resource (e.g. a reference to the API object, or its description).</typeparam>
+	template <typename TData = no_data>
+	class tracker
+	{
+	public:
+		static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+		/// <summary>
+		/// A compact copy of the statistics of all resources that changed in a tracker (e.g. those recorded into a command list), which can be merged into another tracker later.
+		/// The clears of all resources are stored in a single array, so that taking a snapshot only needs a handful of allocations.
+		/// </summary>
+		struct snapshot
+		{
+			struct entry
+			{
+				resource_handle handle;
+				resource_desc desc;
+				draw_stats total_stats;
+				draw_stats current_stats;
+				uint32_t first_clear; // Index of the first clear of this resource in 'clears'
+				uint32_t num_clears;
+			};
+
+			draw_stats stats;
+			bool has_indirect_drawcalls = false;
+			std::vector<entry> entries;
+			std::vector<draw_stats> clears;
+			std::vector<TData> data; // Backend data of each entry
+		};
+
+		tracker() = default;
+		~tracker()
+		{
+			// Another tracker may be created at the same address later, which has to start with a new state in the trace
+			if (trace_writer *const trace = trace_writer::active())
+				trace->end_stream(this);
+		}
+
+		tracker(const tracker &) = delete;
+		tracker &operator=(const tracker &) = delete;
+
+		uint32_t total_vertices() const { return _stats.vertices; }
+		uint32_t total_drawcalls() const { return _stats.drawcalls; }
+		bool has_indirect_drawcalls() const { return _has_indirect_drawcalls; }
+
+		/// <summary>
+		/// Return the counters of all slots (including unused ones, see <see cref="resource_counters::in_use"/>).
+		/// </summary>
+		const std::vector<resource_counters> &resources() const { return _resources; }
+		const resource_counters &counters(uint32_t slot) const { return _resources[slot]; }
+		const TData &data(uint32_t slot) const { return _data[slot]; }
+		TData &data(uint32_t slot) { return _data[slot]; }
+
+		/// <summary>
+		/// Return the slot of the resource with the specified <paramref name="handle"/>, or <see cref="npos"/> if it was not added yet.
+		/// </summary>
+		uint32_t find(resource_handle handle) const
+		{
+			// Entries in the cache may be stale, so verify them before use
+			uint32_t &cached_slot = _find_cache[(handle * 11400714819323198485ull) >> (64 - FIND_CACHE_SIZE_LOG2)];
+			if (cached_slot < _handles.size() && _handles[cached_slot] == handle && _resources[cached_slot].in_use)
+				return cached_slot;
+
+			for (uint32_t slot = 0; slot < _handles.size(); ++slot)
+				if (_handles[slot] == handle && _resources[slot].in_use)
+					return cached_slot = slot;
+			return npos;
+		}
+
+		/// <summary>
+		/// Add a resource to this tracker, or return the slot of an existing one with the same <paramref name="handle"/>.
+		/// </summary>
+		/// <param name="handle">The opaque handle of the resource.</param>
+		/// <param name="desc">The description of the resource (only used when it was not added yet).</param>
+		/// <param name="data">The backend data to associate with the resource (only used when it was not added yet).</param>
+		uint32_t add(resource_handle handle, const resource_desc &desc, const TData &data = TData())
+		{
+			if (const uint32_t slot = find(handle); slot != npos)
+				return slot;
+
+			if (trace_writer *const trace = begin_trace())
+				trace->record_add(this, handle, desc);
+
+			const uint32_t slot = add_untraced(handle, desc);
+			_data[slot] = data;
+
+			return slot;
+		}
+		/// <summary>
+		/// Remove the resource with the specified <paramref name="handle"/> from this tracker, so that its slot can be reused.
+		/// </summary>
+		void remove(resource_handle handle)
+		{
+			const uint32_t slot = find(handle);
+			if (slot == npos)
+				return;
+
+			if (trace_writer *const trace = begin_trace())
+				trace->record_remove(this, handle);
+
+			remove_untraced(slot);
+		}
+
+		/// <summary>
+		/// Remove all resources and reset all statistics.
+		/// </summary>
+		void reset()
+		{
+			if (trace_writer *const trace = begin_trace())
+				trace->record_reset(this, trace_format::reset_all);
+
+			_stats = {};
+			_has_indirect_drawcalls = false;
+			_bound = npos;
+			_handles.clear();
+			_resources.clear();
+			_num_free_slots = 0;
+			_data.clear();
+			_is_dirty.clear();
+			_dirty_slots.clear();
+		}
+		/// <summary>
+		/// Reset all statistics, but keep the resources (for backends that only learn about resources when they are created).
+		/// </summary>
+		void reset_stats()
+		{
+			if (trace_writer *const trace = begin_trace())
+				trace->record_reset(this, trace_format::reset_keep_resources);
+
+			reset_stats_untraced();
+		}
+		/// <summary>
+		/// Reset all statistics and remove resources that were neither drawn to nor cleared since the last reset (except for the bound one).
+		/// This releases the backend data of resources that are no longer used, while resources used every frame keep their slot, so that tracking them does not allocate.
+		/// </summary>
+		void reset_unused()
+		{
+			if (trace_writer *const trace = begin_trace())
+				trace->record_reset(this, trace_format::reset_keep_used_resources);
+
+			for (uint32_t slot = 0; slot < _resources.size(); ++slot)
+			{
+				const resource_counters &counters = _resources[slot];
+				if (counters.in_use && counters.total_stats.drawcalls == 0 && counters.clears.empty() && slot != _bound)
+					remove_untraced(slot);
+			}
+
+			reset_stats_untraced();
+		}
+
+		/// <summary>
+		/// Add the statistics of another tracker to this one (e.g. of a command list when it is executed).
+		/// This only visits resources that changed in the <paramref name="source"/> tracker since its last reset.
+		/// Backend data of resources in the <paramref name="source"/> tracker replaces that of the same resources in this one.
+		/// </summary>
+		void merge(const tracker &source)
+		{
+			if (trace_writer *const trace = begin_trace())
+			{
+				if (trace->begin_stream(&source))
+					source.record_state(*trace);
+				trace->record_merge(this, &source);
+			}
+
+			_stats.vertices += source._stats.vertices;
+			_stats.drawcalls += source._stats.drawcalls;
+			_has_indirect_drawcalls |= source._has_indirect_drawcalls;
+
+			for (const uint32_t source_slot : source._dirty_slots)
+			{
+				const resource_counters &source_counters = source._resources[source_slot];
+				if (!source_counters.in_use)
+					continue;
+
+				merge_counters(source_counters.handle, source_counters.desc, source._data[source_slot],
+					source_counters.total_stats, source_counters.current_stats, source_counters.clears.data(), source_counters.clears.size());
+			}
+		}
+		/// <summary>
+		/// Add the statistics of a snapshot taken from another tracker to this one.
+		/// </summary>
+		void merge(const snapshot &source)
+		{
+			if (trace_writer *const trace = begin_trace())
+			{
+				// Snapshots are usually short-lived, so always write their entire state before merging
+				std::vector<resource_counters> resources(source.entries.size());
+				for (size_t i = 0; i < source.entries.size(); ++i)
+				{
+					const typename snapshot::entry &entry = source.entries[i];
+					resources[i].handle = entry.handle;
+					resources[i].desc = entry.desc;
+					resources[i].in_use = true;
+					resources[i].total_stats = entry.total_stats;
+					resources[i].current_stats = entry.current_stats;
+					resources[i].clears.assign(source.clears.begin() + entry.first_clear, source.clears.begin() + entry.first_clear + entry.num_clears);
+				}
+
+				trace->record_state(&source, source.stats, source.has_indirect_drawcalls, resources.data(), resources.size(), nullptr);
+				trace->record_merge(this, &source);
+			}
+
+			_stats.vertices += source.stats.vertices;
+			_stats.drawcalls += source.stats.drawcalls;
+			_has_indirect_drawcalls |= source.has_indirect_drawcalls;
+
+			for (size_t i = 0; i < source.entries.size(); ++i)
+			{
+				const typename snapshot::entry &entry = source.entries[i];
+
+				merge_counters(entry.handle, entry.desc, source.data[i],
+					entry.total_stats, entry.current_stats, source.clears.data() + entry.first_clear, entry.num_clears);
+			}
+		}
+
+		/// <summary>
+		/// Copy the statistics of all resources that changed since the last reset into the specified <paramref name="snapshot"/> (replacing its contents, but reusing its storage).
+		/// </summary>
+		void take_snapshot(snapshot &out) const
+		{
+			out.stats = _stats;
+			out.has_indirect_drawcalls = _has_indirect_drawcalls;
+			out.entries.clear();
+			out.clears.clear();
+			out.data.clear();
+
+			for (const uint32_t slot : _dirty_slots)
+			{
+				const resource_counters &counters = _resources[slot];
+				if (!counters.in_use)
+					continue;
+
+				out.entries.push_back({ counters.handle, counters.desc, counters.total_stats, counters.current_stats,
+					static_cast<uint32_t>(out.clears.size()), static_cast<uint32_t>(counters.clears.size()) });
+				out.clears.insert(out.clears.end(), counters.clears.begin(), counters.clears.end());
+				out.data.push_back(_data[slot]);
+			}
+		}
+
+		/// <summary>
+		/// Return the slot of the currently bound resource, or <see cref="npos"/> if none is bound.
+		/// </summary>
+		uint32_t bound() const { return _bound; }
+		/// <summary>
+		/// Set the resource in the specified slot as the one subsequent draw calls are counted for.
+		/// </summary>
+		/// <param name="slot">The slot returned by <see cref="add"/>, or <see cref="npos"/> to unbind.</param>
+		void bind(uint32_t slot)
+		{
+			assert(slot == npos || (slot < _resources.size() && _resources[slot].in_use));
+
+			if (trace_writer *const trace = begin_trace())
+				trace->record_bind(this, slot != npos ? &_resources[slot] : nullptr);
+
+			_bound = slot;
+
+			// Draw calls are only counted for the bound resource, so it is enough to mark it as changed here instead of on every draw call
+			if (slot != npos)
+				mark_dirty(slot);
+		}
+
+		/// <summary>
+		/// Count a draw call for the currently bound resource.
+		/// </summary>
+		/// <param name="vertices">The number of vertices drawn, or zero for an indirect draw call.</param>
+		void on_draw(uint32_t vertices)
+		{
+			if (trace_writer *const trace = begin_trace())
+				trace->record_draw(this, vertices);
+
+			_stats.vertices += vertices;
+			_stats.drawcalls += 1;
+
+			if (_bound == npos)
+				return; // This is a draw call with no depth-stencil bound
+
+			resource_counters &counters = _resources[_bound];
+			counters.total_stats.vertices += vertices;
+			counters.total_stats.drawcalls += 1;
+			counters.current_stats.vertices += vertices;
+			counters.current_stats.drawcalls += 1;
+
+			if (vertices == 0)
+				_has_indirect_drawcalls = true;
+		}
+		/// <summary>
+		/// Record a clear of the resource in the specified slot.
+		/// </summary>
+		/// <param name="slot">The slot returned by <see cref="add"/>.</param>
+		/// <param name="fallback_stats">The statistics to use if no draw calls happened on this tracker since the last clear (e.g. those of the previous frame).</param>
+		/// <returns>The statistics of the draw calls since the last clear, or zero draw calls if there was no meaningful workload (in which case the clear is not recorded).</returns>
+		draw_stats on_clear(uint32_t slot, const draw_stats &fallback_stats = {})
+		{
+			assert(slot < _resources.size() && _resources[slot].in_use);
+
+			if (trace_writer *const trace = begin_trace())
+				trace->record_clear(this, _resources[slot].handle, fallback_stats);
+
+			resource_counters &counters = _resources[slot];
+			mark_dirty(slot);
+
+			draw_stats current_stats = counters.current_stats;
+			if (current_stats.drawcalls == 0)
+				current_stats = fallback_stats;
+
+			// Ignore clears when there was no meaningful workload
+			if (current_stats.drawcalls == 0)
+				return current_stats;
+
+			counters.clears.push_back(current_stats);
+
+			// Reset draw call stats for clears
+			counters.current_stats = {};
+
+			return current_stats;
+		}
+		/// <summary>
+		/// Record a clear of the resource in the specified slot with statistics the backend collected itself, instead of those of the draw calls counted since the last clear.
+		/// This is for backends that only count some draw calls towards clears (e.g. D3D9, which ignores draw calls to a smaller viewport).
+		/// </summary>
+		/// <param name="slot">The slot returned by <see cref="add"/>.</param>
+		/// <param name="stats">The statistics to record for this clear. The clear is not recorded if these contain zero draw calls.</param>
+		void on_clear_with_stats(uint32_t slot, const draw_stats &stats)
+		{
+			assert(slot < _resources.size() && _resources[slot].in_use);
+
+			if (trace_writer *const trace = begin_trace())
+				trace->record_clear_with_stats(this, _resources[slot].handle, stats);
+
+			resource_counters &counters = _resources[slot];
+			mark_dirty(slot);
+
+			if (stats.drawcalls == 0)
+				return;
+
+			counters.clears.push_back(stats);
+
+			counters.current_stats = {};
+		}
+
+		/// <summary>
+		/// Find the resource that most likely contains the main scene.
+		/// </summary>
+		/// <param name="options">The options to select with.</param>
+		/// <param name="fallback_slot">The slot of a resource to return if no better match is found (e.g. the default depth buffer), or <see cref="npos"/>.</param>
+		/// <returns>The slot of the best match, or <see cref="npos"/> if there is none.</returns>
+		uint32_t find_best(const selection_options &options, uint32_t fallback_slot = npos) const
+		{
+			const resource_counters empty_counters;
+
+			uint32_t best_slot = fallback_slot;
+
+			for (uint32_t slot = 0; slot < _resources.size(); ++slot)
+			{
+				const resource_counters &counters = _resources[slot];
+
+				if (!counters.in_use || counters.total_stats.drawcalls == 0)
+					continue; // Skip unused
+				if (options.heuristic == selection_heuristic::weighted_vertices && counters.total_stats.vertices == 0)
+					continue;
+				if (counters.desc.samples > 1)
+					continue; // Ignore MSAA textures, since they would need to be resolved first
+				if (!check_dimensions(counters.desc, options))
+					continue; // Not a good fit
+
+				if (is_better_candidate(counters, best_slot != npos ? _resources[best_slot] : empty_counters, _stats, _has_indirect_drawcalls, options))
+					best_slot = slot;
+			}
+
+			if (trace_writer *const trace = begin_trace())
+				trace->record_select(this, options,
+					fallback_slot != npos ? &_resources[fallback_slot] : nullptr,
+					best_slot != npos ? &_resources[best_slot] : nullptr);
+
+			return best_slot;
+		}
+
+		/// <summary>
+		/// Restore the state written by <see cref="trace_writer::record_state"/>. This is only used when replaying a trace.
+		/// </summary>
+		/// <param name="resources">The counters of all slots, with <see cref="resource_counters::in_use"/> set to <c>false</c> for unused ones.</param>
+		void restore(const draw_stats &stats, bool has_indirect_drawcalls, std::vector<resource_counters> resources, const resource_handle *bound)
+		{
+			reset();
+
+			_stats = stats;
+			_has_indirect_drawcalls = has_indirect_drawcalls;
+			_resources = std::move(resources);
+			_data.resize(_resources.size());
+
+			_is_dirty.resize(_resources.size());
+
+			for (uint32_t slot = 0; slot < _resources.size(); ++slot)
+			{
+				_handles.push_back(_resources[slot].handle);
+
+				if (_resources[slot].in_use)
+					mark_dirty(slot);
+				else
+					_num_free_slots++;
+			}
+
+			if (bound != nullptr)
+				_bound = find(*bound);
+		}
+
+	private:
+		trace_writer *begin_trace() const
+		{
+			trace_writer *const trace = trace_writer::active();
+			// Write the current state before the first event of this tracker, so that the trace does not depend on what happened before recording started
+			if (trace != nullptr && trace->begin_stream(this))
+				record_state(*trace);
+			return trace;
+		}
+		void record_state(trace_writer &trace) const
+		{
+			trace.record_state(this, _stats, _has_indirect_drawcalls, _resources.data(), _resources.size(), _bound != npos ? &_resources[_bound] : nullptr);
+		}
+
+		uint32_t add_untraced(resource_handle handle, const resource_desc &desc)
+		{
+			uint32_t slot = static_cast<uint32_t>(_resources.size());
+			if (_num_free_slots == 0)
+			{
+				_handles.emplace_back();
+				_resources.emplace_back();
+				_data.emplace_back();
+				_is_dirty.push_back(false);
+			}
+			else
+			{
+				// Always reuse the lowest free slot, so that the iteration order in 'find_best' only depends on the sequence of events (and is the same when replaying a trace)
+				slot = 0;
+				while (_resources[slot].in_use)
+					++slot;
+				_num_free_slots--;
+			}
+
+			_handles[slot] = handle;
+
+			// Keep the storage of the clears list of a reused slot, so that it does not need to allocate again
+			resource_counters &counters = _resources[slot];
+			counters.handle = handle;
+			counters.desc = desc;
+			counters.in_use = true;
+			counters.total_stats = {};
+			counters.current_stats = {};
+			counters.clears.clear();
+
+			return slot;
+		}
+		void remove_untraced(uint32_t slot)
+		{
+			if (_bound == slot)
+				_bound = npos;
+
+			_resources[slot].in_use = false;
+			_resources[slot].clears.clear();
+			_data[slot] = TData();
+			_num_free_slots++;
+		}
+		void reset_stats_untraced()
+		{
+			_stats = {};
+			_has_indirect_drawcalls = false;
+
+			for (const uint32_t slot : _dirty_slots)
+			{
+				resource_counters &counters = _resources[slot];
+				counters.total_stats = {};
+				counters.current_stats = {};
+				counters.clears.clear();
+
+				_is_dirty[slot] = false;
+			}
+
+			_dirty_slots.clear();
+
+			// The bound resource stays bound, so draw calls following this are counted for it without another call to 'bind'
+			if (_bound != npos)
+				mark_dirty(_bound);
+		}
+
+		void mark_dirty(uint32_t slot)
+		{
+			if (_is_dirty[slot])
+				return;
+			_is_dirty[slot] = true;
+			_dirty_slots.push_back(slot);
+		}
+
+		void merge_counters(resource_handle handle, const resource_desc &desc, const TData &data, const draw_stats &total_stats, const draw_stats &current_stats, const draw_stats *clears, size_t num_clears)
+		{
+			uint32_t slot = find(handle);
+			if (slot == npos)
+				slot = add_untraced(handle, desc);
+			_data[slot] = data;
+			mark_dirty(slot);
+
+			resource_counters &counters = _resources[slot];
+			counters.total_stats.vertices += total_stats.vertices;
+			counters.total_stats.drawcalls += total_stats.drawcalls;
+			counters.current_stats.vertices += current_stats.vertices;
+			counters.current_stats.drawcalls += current_stats.drawcalls;
+
+			counters.clears.insert(counters.clears.end(), clears, clears + num_clears);
+		}
+
+		draw_stats _stats;
+		bool _has_indirect_drawcalls = false;
+		uint32_t _bound = npos;
+		std::vector<resource_counters> _resources;
+		std::vector<TData> _data;
+		uint32_t _num_free_slots = 0;
+		std::vector<resource_handle> _handles; // Copy of the handles of all slots, so that look ups only touch a compact array
+		std::vector<bool> _is_dirty;
+		std::vector<uint32_t> _dirty_slots; // Slots that changed since the last reset
+		static constexpr unsigned int FIND_CACHE_SIZE_LOG2 = 6;
+		mutable uint32_t _find_cache[1 << FIND_CACHE_SIZE_LOG2] = {};
+	};
+}
@@ -4,15 +4,79 @@
  */
 
 #include "dll_log.hpp"
+#include "lockfree_queue.hpp"
 #include <mutex>
 #include <cassert>
 #include <fstream>
 #include <Windows.h>
 
-std::ostringstream reshade::log::line;
-std::vector<std::string> reshade::log::lines;
-static std::mutex s_message_mutex;
+thread_local std::ostringstream reshade::log::line;
 static std::ofstream s_file_stream;
+static lockfree_queue<std::string> s_pending_lines;
+// Number of lines pushed to the queue but not popped yet, which unlike the queue itself may be read while another thread is consuming it
+static std::atomic<size_t> s_num_pending_lines = 0;
+// Set while a thread is writing pending lines, which makes it the only consumer of the queue
+static std::atomic<bool> s_is_writing = false;
+static std::atomic<bool> s_is_background_writer_running = false;
+static PTP_WORK s_background_writer = nullptr;
+static std::mutex s_history_mutex;
+static std::vector<std::string> s_history_lines;
+static size_t s_history_start = 0;
+
+static void write_pending_lines()
+{
+	std::string batch;
+	std::vector<std::string> lines;
+
+	for (std::string line; s_pending_lines.pop(line);)
+	{
+		s_num_pending_lines.fetch_sub(1);
+
+		batch += line;
+		batch += '\n';
+#ifndef NDEBUG
+		// Write line to the debug output
+		OutputDebugStringA((line + '\n').c_str());
+#endif
+		lines.push_back(std::move(line));
+	}
+
+	if (lines.empty())
+		return;
+
+	// Write all lines with a single call and flush once per batch instead of once per line
+	s_file_stream.write(batch.data(), batch.size());
+	s_file_stream.flush();
+
+	const std::lock_guard<std::mutex> lock(s_history_mutex);
+
+	for (std::string &line : lines)
+	{
+		// Overwrite the oldest line once the history is full
+		if (s_history_lines.size() < reshade::log::max_history_lines)
+		{
+			s_history_lines.push_back(std::move(line));
+		}
+		else
+		{
+			s_history_lines[s_history_start] = std::move(line);
+			s_history_start = (s_history_start + 1) % reshade::log::max_history_lines;
+		}
+	}
+}
+
+static void CALLBACK background_writer_callback(PTP_CALLBACK_INSTANCE, PVOID, PTP_WORK)
+{
+	do
+	{
+		write_pending_lines();
+
+		s_is_writing.store(false);
+
+		// Another line may have been added after the queue was drained but before the flag was reset, in which case its thread did not schedule a new write, so handle it here
+		// This has to check the counter rather than the queue, since the queue may only be accessed by the thread that owns the flag, which may already be another one at this point
+	} while (s_num_pending_lines.load() != 0 && !s_is_writing.exchange(true));
+}
 
 reshade::log::message::message(level level)
 {
@@ -22,12 +86,10 @@ reshade::log::message::message(level level)
 	const char level_names[][6] = { "ERROR", "WARN ", "INFO ", "DEBUG" };
 	assert(static_cast<unsigned int>(level) - 1 < ARRAYSIZE(level_names));
 
-	// Lock the stream until the message is complete
-	s_message_mutex.lock();
-
-	// Start a new line
+	// Start a new line (and reset any formatting left over from the previous message on this thread)
 	line.str("");
 	line.clear();
+	line.flags(std::ios::dec | std::ios::left | std::ios::showbase);
 
 	line << std::right << std::setfill('0')
 #if RESHADE_VERBOSE_LOG
@@ -44,32 +106,96 @@ reshade::log::message::message(level level)
 }
 reshade::log::message::~message()
 {
-	std::string line_string = line.str();
-	lines.push_back(line_string);
+	s_pending_lines.push(line.str());
+	s_num_pending_lines.fetch_add(1);
 
-	// Write line to the log file and flush it
-	s_file_stream << line_string << std::endl;
+	if (s_is_background_writer_running.load())
+	{
+		// Only schedule a write if none is pending yet, the scheduled one picks up all lines queued until it runs
+		if (!s_is_writing.exchange(true))
+			SubmitThreadpoolWork(s_background_writer);
+	}
+	else
+	{
+		// Wait for any other thread writing lines to finish, then write everything pending (including this line)
+		while (s_is_writing.exchange(true))
+			SwitchToThread();
 
-#ifndef NDEBUG
-	// Write line to the debug output
-	line_string += '\n';
-	OutputDebugStringA(line_string.c_str());
-#endif
+		write_pending_lines();
 
-	// The message is finished, we can unlock the stream
-	s_message_mutex.unlock();
+		s_is_writing.store(false);
+	}
 }
 
 bool reshade::log::open(const std::filesystem::path &path)
 {
-	line.setf(std::ios::left);
-	line.setf(std::ios::showbase);
-
 	s_file_stream.open(path, std::ios::out | std::ios::trunc);
 
 	s_file_stream.setf(std::ios::left);
 	s_file_stream.setf(std::ios::showbase);
 	s_file_stream.flush();
 
+	if (s_background_writer == nullptr)
+	{
+		// Keep this module loaded while a write is in progress, so that it cannot be unloaded with the callback still running
+		TP_CALLBACK_ENVIRON environment;
+		InitializeThreadpoolEnvironment(&environment);
+		if (HMODULE module_handle = nullptr;
+			GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, reinterpret_cast<LPCWSTR>(&background_writer_callback), &module_handle))
+			SetThreadpoolCallbackLibrary(&environment, module_handle);
+
+		// Creating the work object does not create any threads, so this is safe to call from 'DllMain'
+		s_background_writer = CreateThreadpoolWork(&background_writer_callback, nullptr, &environment);
+		DestroyThreadpoolEnvironment(&environment);
+	}
+
+	s_is_background_writer_running.store(s_background_writer != nullptr);
+
 	return s_file_stream.is_open();
 }
+
+void reshade::log::stop_background_writer(bool wait_for_background_writer)
+{
+	s_is_background_writer_running.store(false);
+
+	if (s_background_writer != nullptr)
+	{
+		if (wait_for_background_writer)
+		{
+			// Let any scheduled write finish, after which nothing references the work object anymore
+			WaitForThreadpoolWorkCallbacks(s_background_writer, FALSE);
+			CloseThreadpoolWork(s_background_writer);
+			s_background_writer = nullptr;
+		}
+		else
+		{
+			// The thread pool threads were terminated together with the process, so a write that was in progress will never reset the flag
+			s_is_writing.store(false);
+		}
+	}
+
+	while (s_is_writing.exchange(true))
+		SwitchToThread();
+
+	write_pending_lines();
+
+	s_is_writing.store(false);
+}
+
+std::vector<std::string> reshade::log::history()
+{
+	const std::lock_guard<std::mutex> lock(s_history_mutex);
+
+	std::vector<std::string> lines;
+	lines.reserve(s_history_lines.size());
+	lines.insert(lines.end(), s_history_lines.begin() + s_history_start, s_history_lines.end());
+	lines.insert(lines.end(), s_history_lines.begin(), s_history_lines.begin() + s_history_start);
+	return lines;
+}
+void reshade::log::clear_history()
+{
+	const std::lock_guard<std::mutex> lock(s_history_mutex);
+
+	s_history_lines.clear();
+	s_history_start = 0;
+}
@@ -29,21 +29,38 @@ namespace reshade::log
 
 	/// <summary>
 	/// Open a log file for writing.
+	/// Messages are written to it asynchronously by a background writer in batches.
 	/// </summary>
 	/// <param name="path">The path to the log file.</param>
 	bool open(const std::filesystem::path &path);
+	/// <summary>
+	/// Writes all pending messages and makes every following message be written synchronously by the thread logging it.
+	/// Call this when the background writer can no longer run, e.g. in DLL_PROCESS_DETACH.
+	/// </summary>
+	/// <param name="wait_for_background_writer">Set to <c>true</c> to wait for a scheduled write to finish and release the background writer, or <c>false</c> if the process is terminating and the thread pool threads are gone already.</param>
+	void stop_background_writer(bool wait_for_background_writer = true);
 
 	/// <summary>
-	/// The current log line stream.
+	/// The maximum number of messages kept in the in-memory history.
+	/// </summary>
+	constexpr size_t max_history_lines = 4096;
+	/// <summary>
+	/// Gets a copy of the in-memory history of the most recent log messages, oldest first.
 	/// </summary>
-	extern std::ostringstream line;
+	std::vector<std::string> history();
+	/// <summary>
+	/// Removes all messages from the in-memory history.
+	/// </summary>
+	void clear_history();
+
 	/// <summary>
-	/// An in-memory history of all log messages.
+	/// The current log line stream of the calling thread.
 	/// </summary>
-	extern std::vector<std::string> lines;
+	extern thread_local std::ostringstream line;
 
 	/// <summary>
-	/// Constructs a single log message including current time and level and writes it to the open log file.
+	/// Constructs a single log message including current time and level and queues it for writing to the open log file.
+	/// Each thread formats into its own stream, so logging threads do not block each other.
 	/// </summary>
 	struct message
 	{
@@ -744,7 +744,7 @@ static PVOID g_exception_handler_handle = nullptr;
 // Export special symbol to identify modules as ReShade instances
 extern "C" __declspec(dllexport) const char *ReShadeVersion = VERSION_STRING_PRODUCT;
 
-BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
+BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID lpReserved)
 {
 	using namespace reshade;
 
@@ -842,6 +842,9 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
 		LOG(INFO) << "Initialized.";
 		break;
 	case DLL_PROCESS_DETACH:
+		// Write everything from here on directly (when the process is terminating, the thread pool threads were already terminated and must not be waited on)
+		log::stop_background_writer(lpReserved == nullptr);
+
 		LOG(INFO) << "Exiting ...";
 
 		hooks::uninstall();
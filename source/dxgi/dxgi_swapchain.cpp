@@ -118,6 +118,7 @@ void DXGISwapChain::runtime_present(UINT flags)
 		break; }
 	case 12: {
 		const auto device = static_cast<D3D12Device *>(_direct3d_device.get());
+		device->merge_command_queue_stats();
 		std::static_pointer_cast<reshade::d3d12::runtime_d3d12>(_runtime)->on_present();
 		device->_buffer_detection.reset(false);
 		break; }
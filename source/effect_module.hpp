@@ -231,6 +231,7 @@ namespace reshadefx
 		reshadefx::type return_type;
 		std::string return_semantic;
 		std::vector<struct_member_info> parameter_list;
+		std::vector<std::string> sampled_texture_names; // Unique names of all textures this function (or any function it calls) samples from
 	};
 
 	/// <summary>
@@ -239,6 +240,7 @@ namespace reshadefx
 	struct pass_info
 	{
 		std::string render_target_names[8] = {};
+		std::vector<std::string> sampled_texture_names; // Unique names of all textures the shaders of this pass sample from
 		std::string vs_entry_point;
 		std::string ps_entry_point;
 		uint8_t clear_render_targets = false;
@@ -18,6 +18,12 @@ struct on_scope_exit
 	std::function<void()> leave;
 };
 
+static void add_sampled_texture(std::vector<std::string> &texture_names, const std::string &texture_name)
+{
+	if (std::find(texture_names.begin(), texture_names.end(), texture_name) == texture_names.end())
+		texture_names.push_back(texture_name);
+}
+
 reshadefx::parser::parser()
 {
 }
@@ -32,6 +38,7 @@ bool reshadefx::parser::parse(std::string input, codegen *backend)
 
 	// Set backend for subsequent code-generation
 	_codegen = backend;
+	_sampler_texture_names.clear();
 
 	consume();
 
@@ -910,6 +917,11 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 				if (parameters[i].is_lvalue && parameters[i].type.has(type::q_in) && !parameters[i].type.is_sampler())
 					_codegen->emit_store(parameters[i], _codegen->emit_load(arguments[i]));
 
+			// Calling a function also samples all the textures that function samples from
+			if (symbol.op == symbol_type::function && _current_function != nullptr)
+				for (const std::string &texture_name : symbol.function->sampled_texture_names)
+					add_sampled_texture(_current_function->sampled_texture_names, texture_name);
+
 			// Check if the call resolving found an intrinsic or function and invoke the corresponding code
 			const auto result = symbol.op == symbol_type::function ?
 				_codegen->emit_call(location, symbol.id, symbol.type, parameters) :
@@ -931,6 +943,13 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 		else if (symbol.op == symbol_type::variable)
 		{
 			assert(symbol.id != 0);
+
+			// Keep track of the textures each function samples from, so that the pass graph compiler knows which resources a pass reads
+			// Sampler parameters are not in the list, but the sampler passed in as argument was already added when the caller referenced it
+			if (symbol.type.is_sampler() && _current_function != nullptr)
+				if (const auto it = _sampler_texture_names.find(symbol.id); it != _sampler_texture_names.end())
+					add_sampled_texture(_current_function->sampled_texture_names, it->second);
+
 			// Simply return the pointer to the variable, dereferencing is done on site where necessary
 			exp.reset_to_lvalue(location, symbol.id, symbol.type);
 		}
@@ -2430,9 +2449,13 @@ bool reshadefx::parser::parse_function(type type, std::string name)
 	// A function has to start with a new block
 	_codegen->enter_block(_codegen->create_block());
 
+	_current_function = &_codegen->find_function(id);
+
 	if (!parse_statement_block(false))
 		parse_success = false;
 
+	_current_function = nullptr;
+
 	// Add implicit return statement to the end of functions
 	if (_codegen->is_in_block())
 		_codegen->leave_block_and_return();
@@ -2708,6 +2731,8 @@ bool reshadefx::parser::parse_variable(type type, std::string name, bool global)
 
 		symbol = { symbol_type::variable, 0, type };
 		symbol.id = _codegen->define_sampler(location, sampler_info);
+
+		_sampler_texture_names[symbol.id] = sampler_info.texture_name;
 	}
 	// Uniform variables are put into a global uniform buffer structure
 	else if (type.has(type::q_uniform))
@@ -2847,6 +2872,9 @@ bool reshadefx::parser::parse_technique_pass(pass_info &info)
 							ps_info = function_info;
 							info.ps_entry_point = function_info.unique_name;
 						}
+
+						for (const std::string &texture_name : function_info.sampled_texture_names)
+							add_sampled_texture(info.sampled_texture_names, texture_name);
 					}
 				}
 				else
@@ -80,6 +80,8 @@ namespace reshadefx
 		token _token, _token_next, _token_backup;
 		std::unique_ptr<class lexer> _lexer, _lexer_backup;
 		reshadefx::type _current_return_type;
+		reshadefx::function_info *_current_function = nullptr;
+		std::unordered_map<uint32_t, std::string> _sampler_texture_names;
 		std::vector<uint32_t> _loop_break_target_stack;
 		std::vector<uint32_t> _loop_continue_target_stack;
 	};
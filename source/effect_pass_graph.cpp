@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "effect_pass_graph.hpp"
+#include <algorithm>
+
+namespace
+{
+	constexpr uint32_t no_resource = 0xFFFFFFFF;
+
+	struct pass_access
+	{
+		uint32_t render_targets[8];
+		std::vector<uint32_t> sampled;
+		bool writes_backbuffer = false;
+		bool samples_backbuffer = false;
+
+		bool reads(uint32_t resource) const
+		{
+			return std::find(sampled.begin(), sampled.end(), resource) != sampled.end();
+		}
+		bool writes(uint32_t resource) const
+		{
+			return std::find(std::begin(render_targets), std::end(render_targets), resource) != std::end(render_targets);
+		}
+	};
+
+	const reshadefx::annotation *find_annotation(const reshadefx::texture_info &texture, const char *name)
+	{
+		const auto it = std::find_if(texture.annotations.begin(), texture.annotations.end(),
+			[name](const reshadefx::annotation &annotation) { return annotation.name == name; });
+		return it != texture.annotations.end() ? &(*it) : nullptr;
+	}
+
+	bool has_same_render_targets(const reshadefx::pass_info &a, const reshadefx::pass_info &b)
+	{
+		return std::equal(std::begin(a.render_target_names), std::end(a.render_target_names), std::begin(b.render_target_names)) &&
+			a.srgb_write_enable == b.srgb_write_enable &&
+			a.stencil_enable == b.stencil_enable &&
+			a.viewport_width == b.viewport_width &&
+			a.viewport_height == b.viewport_height;
+	}
+}
+
+reshadefx::pass_schedule reshadefx::compile_pass_graph(const module &module, const technique_info &technique)
+{
+	// Give every texture the technique references an index, so that accesses can be compared cheaply
+	std::vector<std::string> resources;
+	const auto resource_index = [&resources](const std::string &unique_name) {
+		const auto it = std::find(resources.begin(), resources.end(), unique_name);
+		if (it != resources.end())
+			return static_cast<uint32_t>(it - resources.begin());
+		resources.push_back(unique_name);
+		return static_cast<uint32_t>(resources.size() - 1);
+	};
+	const auto find_texture = [&module](const std::string &unique_name) -> const texture_info * {
+		const auto it = std::find_if(module.textures.begin(), module.textures.end(),
+			[&unique_name](const auto &item) { return item.unique_name == unique_name; });
+		return it != module.textures.end() ? &(*it) : nullptr;
+	};
+
+	const size_t num_passes = technique.passes.size();
+
+	std::vector<pass_access> accesses(num_passes);
+	for (size_t i = 0; i < num_passes; ++i)
+	{
+		const pass_info &pass = technique.passes[i];
+		pass_access &access = accesses[i];
+
+		std::fill_n(access.render_targets, 8, no_resource);
+
+		// An empty render target list means this pass renders to the back buffer
+		if (pass.render_target_names[0].empty())
+			access.writes_backbuffer = true;
+		else
+			for (uint32_t k = 0; k < 8 && !pass.render_target_names[k].empty(); ++k)
+				access.render_targets[k] = resource_index(pass.render_target_names[k]);
+
+		for (const std::string &texture_name : pass.sampled_texture_names)
+		{
+			if (const texture_info *const texture = find_texture(texture_name);
+				texture != nullptr && texture->semantic == "COLOR")
+				access.samples_backbuffer = true;
+
+			access.sampled.push_back(resource_index(texture_name));
+		}
+	}
+
+	// Remove passes whose results are never observed, because every render target they write is cleared by a later pass before anything samples it
+	// Passes that write to the back buffer or the effect stencil buffer are always kept, since it is not known who reads those
+	std::vector<uint32_t> live_passes;
+	live_passes.reserve(num_passes);
+
+	for (size_t i = 0; i < num_passes; ++i)
+	{
+		const pass_access &access = accesses[i];
+
+		bool is_overwritten = !access.writes_backbuffer && !technique.passes[i].stencil_enable;
+
+		for (uint32_t k = 0; k < 8 && is_overwritten && access.render_targets[k] != no_resource; ++k)
+		{
+			is_overwritten = false;
+
+			for (size_t next = i + 1; next < num_passes; ++next)
+			{
+				if (accesses[next].reads(access.render_targets[k]))
+					break;
+				if (accesses[next].writes(access.render_targets[k]))
+				{
+					is_overwritten = technique.passes[next].clear_render_targets != 0;
+					break;
+				}
+			}
+		}
+
+		if (!is_overwritten)
+			live_passes.push_back(static_cast<uint32_t>(i));
+	}
+
+	pass_schedule schedule;
+	schedule.passes.reserve(live_passes.size());
+
+	// The back buffer may have been modified by other techniques since its last copy, so always copy before it is first sampled
+	bool is_backbuffer_modified = true;
+
+	for (size_t live_index = 0; live_index < live_passes.size(); ++live_index)
+	{
+		const uint32_t pass_index = live_passes[live_index];
+		const pass_info &pass = technique.passes[pass_index];
+		const pass_access &access = accesses[pass_index];
+
+		scheduled_pass &scheduled = schedule.passes.emplace_back();
+		scheduled.pass_index = pass_index;
+		scheduled.clear_render_targets = pass.clear_render_targets != 0;
+
+		if (access.samples_backbuffer && is_backbuffer_modified)
+		{
+			scheduled.copy_backbuffer = true;
+			is_backbuffer_modified = false;
+		}
+		if (access.writes_backbuffer)
+		{
+			is_backbuffer_modified = true;
+		}
+
+		// Mipmaps only have to be regenerated if something can sample the render target before it is written again (since regenerating recomputes all levels from the first one)
+		// Passes cannot sample their own render targets, so a pass that writes the same render target again before anyone samples it makes the regeneration here redundant
+		for (uint32_t k = 0; k < 8 && access.render_targets[k] != no_resource; ++k)
+		{
+			// Render targets without mipmaps have nothing to regenerate, which also keeps them from preventing the merge with the next pass below
+			if (const texture_info *const texture = find_texture(resources[access.render_targets[k]]);
+				texture != nullptr && texture->levels <= 1)
+				continue;
+
+			bool is_observed = true;
+
+			for (size_t next = live_index + 1; next < live_passes.size(); ++next)
+			{
+				if (accesses[live_passes[next]].reads(access.render_targets[k]))
+					break;
+				if (accesses[live_passes[next]].writes(access.render_targets[k]))
+				{
+					is_observed = false;
+					break;
+				}
+			}
+
+			if (is_observed)
+				scheduled.generate_mipmaps |= 1 << k;
+		}
+
+		// Merge with the previous pass if it renders to the same targets and there is nothing to do in between
+		if (live_index != 0)
+		{
+			scheduled_pass &prev_scheduled = schedule.passes[live_index - 1];
+			const pass_access &prev_access = accesses[prev_scheduled.pass_index];
+
+			if (!scheduled.copy_backbuffer && !scheduled.clear_render_targets && prev_scheduled.generate_mipmaps == 0 &&
+				has_same_render_targets(technique.passes[prev_scheduled.pass_index], pass) &&
+				std::none_of(access.sampled.begin(), access.sampled.end(), [&prev_access](uint32_t resource) { return prev_access.writes(resource); }))
+			{
+				prev_scheduled.end_render_pass = false;
+				scheduled.begin_render_pass = false;
+			}
+		}
+	}
+
+	// Find textures that are only used by this technique and whose first access clears them, since their contents are never observed outside their lifetime then
+	for (uint32_t resource = 0; resource < resources.size(); ++resource)
+	{
+		const texture_info *const texture = find_texture(resources[resource]);
+		if (texture == nullptr || !texture->semantic.empty())
+			continue;
+
+		size_t num_referencing_techniques = 0;
+		for (const technique_info &other_technique : module.techniques)
+		{
+			num_referencing_techniques += std::any_of(other_technique.passes.begin(), other_technique.passes.end(), [&texture](const pass_info &pass) {
+				return std::find(std::begin(pass.render_target_names), std::end(pass.render_target_names), texture->unique_name) != std::end(pass.render_target_names) ||
+					std::find(pass.sampled_texture_names.begin(), pass.sampled_texture_names.end(), texture->unique_name) != pass.sampled_texture_names.end();
+			}) ? 1 : 0;
+		}
+		if (num_referencing_techniques > 1)
+			continue;
+
+		transient_texture lifetime;
+		lifetime.unique_name = texture->unique_name;
+		lifetime.first_pass = no_resource;
+
+		for (uint32_t live_index = 0; live_index < live_passes.size(); ++live_index)
+		{
+			const pass_access &access = accesses[live_passes[live_index]];
+			if (!access.reads(resource) && !access.writes(resource))
+				continue;
+
+			if (lifetime.first_pass == no_resource)
+				lifetime.first_pass = live_index;
+			lifetime.last_pass = live_index;
+		}
+
+		if (lifetime.first_pass == no_resource)
+			continue;
+
+		if (const pass_access &first_access = accesses[live_passes[lifetime.first_pass]];
+			first_access.reads(resource) || !schedule.passes[lifetime.first_pass].clear_render_targets)
+			continue; // Contents from a previous frame are observed
+
+		schedule.transient_textures.push_back(std::move(lifetime));
+	}
+
+	// Assign alias slots greedily in order of first use, reusing a slot if its last texture is no longer used and has a matching description
+	std::sort(schedule.transient_textures.begin(), schedule.transient_textures.end(),
+		[](const transient_texture &a, const transient_texture &b) { return a.first_pass < b.first_pass; });
+
+	std::vector<const transient_texture *> alias_slots;
+	for (transient_texture &lifetime : schedule.transient_textures)
+	{
+		const texture_info *const texture = find_texture(lifetime.unique_name);
+
+		const auto slot = std::find_if(alias_slots.begin(), alias_slots.end(), [&](const transient_texture *last) {
+			const texture_info *const last_texture = find_texture(last->unique_name);
+			return last->last_pass < lifetime.first_pass &&
+				last_texture->width == texture->width && last_texture->height == texture->height && last_texture->levels == texture->levels && last_texture->format == texture->format;
+		});
+
+		if (slot != alias_slots.end())
+		{
+			lifetime.alias_slot = static_cast<uint32_t>(slot - alias_slots.begin());
+			*slot = &lifetime;
+		}
+		else
+		{
+			lifetime.alias_slot = static_cast<uint32_t>(alias_slots.size());
+			alias_slots.push_back(&lifetime);
+		}
+	}
+
+	schedule.num_alias_slots = static_cast<uint32_t>(alias_slots.size());
+
+	return schedule;
+}
+
+std::vector<std::pair<std::string, std::string>> reshadefx::find_texture_aliases(const module &module, const pass_schedule &schedule)
+{
+	std::vector<std::pair<std::string, std::string>> aliases;
+	std::vector<std::string> slot_owners(schedule.num_alias_slots);
+
+	// Transient textures are sorted by first use, so the texture that keeps its memory is the first one in its slot that opted into aliasing
+	for (const transient_texture &lifetime : schedule.transient_textures)
+	{
+		const auto texture = std::find_if(module.textures.begin(), module.textures.end(),
+			[&lifetime](const texture_info &item) { return item.unique_name == lifetime.unique_name; });
+		if (texture == module.textures.end())
+			continue;
+
+		if (const annotation *const transient = find_annotation(*texture, "transient");
+			transient == nullptr || (transient->type.is_integral() ? transient->value.as_int[0] == 0 : transient->value.as_float[0] == 0.0f))
+			continue;
+		if (const annotation *const source = find_annotation(*texture, "source");
+			source != nullptr && !source->value.string_data.empty())
+			continue;
+
+		std::string &owner = slot_owners[lifetime.alias_slot];
+		if (owner.empty())
+			owner = lifetime.unique_name;
+		else
+			aliases.emplace_back(lifetime.unique_name, owner);
+	}
+
+	return aliases;
+}
+
+void reshadefx::rename_texture_references(module &module, const std::string &unique_name, const std::string &replacement_unique_name)
+{
+	for (sampler_info &sampler : module.samplers)
+		if (sampler.texture_name == unique_name)
+			sampler.texture_name = replacement_unique_name;
+
+	for (technique_info &technique : module.techniques)
+	{
+		for (pass_info &pass : technique.passes)
+		{
+			for (std::string &target_name : pass.render_target_names)
+				if (target_name == unique_name)
+					target_name = replacement_unique_name;
+
+			for (std::string &texture_name : pass.sampled_texture_names)
+				if (texture_name == unique_name)
+					texture_name = replacement_unique_name;
+
+			// A pass may now sample the same texture under both names, so only keep it once
+			std::sort(pass.sampled_texture_names.begin(), pass.sampled_texture_names.end());
+			pass.sampled_texture_names.erase(std::unique(pass.sampled_texture_names.begin(), pass.sampled_texture_names.end()), pass.sampled_texture_names.end());
+		}
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include "effect_module.hpp"
+
+namespace reshadefx
+{
+	/// <summary>
+	/// A single pass in a compiled pass schedule with the operations a back-end has to perform around it.
+	/// </summary>
+	struct scheduled_pass
+	{
+		uint32_t pass_index = 0; // Index into the pass list of the technique
+		bool copy_backbuffer = false; // Update the back buffer texture with the current back buffer contents before this pass
+		bool clear_render_targets = false;
+		bool begin_render_pass = true; // Set to false if this pass continues the render pass of the previous one (same render targets and no dependency between them)
+		bool end_render_pass = true; // Set to false if the next pass continues the render pass of this one
+		uint8_t generate_mipmaps = 0; // Bit mask of the render target slots whose mipmaps have to be regenerated after this pass
+	};
+
+	/// <summary>
+	/// Lifetime of a texture that is only used within a single technique and whose contents do not have to be preserved outside of it.
+	/// </summary>
+	struct transient_texture
+	{
+		std::string unique_name;
+		uint32_t first_pass = 0; // Index into the scheduled pass list of the first pass accessing the texture
+		uint32_t last_pass = 0; // Index into the scheduled pass list of the last pass accessing the texture
+		uint32_t alias_slot = 0; // Transient textures in the same slot have non-overlapping lifetimes and matching descriptions, so they can share memory
+	};
+
+	/// <summary>
+	/// The order in which to execute the passes of a technique, as computed by <see cref="compile_pass_graph"/>.
+	/// </summary>
+	struct pass_schedule
+	{
+		std::vector<scheduled_pass> passes;
+		std::vector<transient_texture> transient_textures;
+		uint32_t num_alias_slots = 0;
+	};
+
+	/// <summary>
+	/// Builds a graph of the resources the passes of a technique read and write and compiles it into a schedule:
+	/// Passes whose results are overwritten before they are ever read are removed, back buffer copies are only done before passes that actually sample the back buffer,
+	/// mipmaps are only regenerated when a later pass (or a later frame) can observe them and adjacent passes with the same render targets that do not depend on each other are merged.
+	/// </summary>
+	/// <param name="module">The effect module the technique belongs to.</param>
+	/// <param name="technique">The technique to compile.</param>
+	/// <returns>The compiled schedule.</returns>
+	pass_schedule compile_pass_graph(const module &module, const technique_info &technique);
+
+	/// <summary>
+	/// Finds the transient textures of a compiled schedule that can reference the first texture in their alias slot instead of having memory of their own.
+	/// Textures are shared with all other effects that declare a texture with the same name, which would observe the contents of the other textures in the slot, so only textures with a "transient" annotation opt into this.
+	/// Textures loaded from an image file (with a "source" annotation) are never aliased either, so that the image does not have to be loaded again every frame.
+	/// </summary>
+	/// <param name="module">The effect module the technique belongs to.</param>
+	/// <param name="schedule">The schedule of the technique, as returned by <see cref="compile_pass_graph"/>.</param>
+	/// <returns>Pairs of the unique name of a texture and the unique name of the texture to reference instead (see <see cref="rename_texture_references"/>).</returns>
+	std::vector<std::pair<std::string, std::string>> find_texture_aliases(const module &module, const pass_schedule &schedule);
+
+	/// <summary>
+	/// Replaces all references to a texture in the samplers and passes of a module with another texture, so that both names refer to the same texture (e.g. for pooled textures, or transient textures in the same alias slot).
+	/// </summary>
+	/// <param name="module">The effect module to modify.</param>
+	/// <param name="unique_name">The unique name of the texture that is no longer referenced afterwards.</param>
+	/// <param name="replacement_unique_name">The unique name of the texture to reference instead.</param>
+	void rename_texture_references(module &module, const std::string &unique_name, const std::string &replacement_unique_name);
+}
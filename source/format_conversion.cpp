@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "format_conversion.hpp"
+#include <cassert>
+#include <cstring>
+
+#ifndef RESHADE_FORMAT_CONVERSION_SSE2
+	// SSE2 is part of the baseline instruction set of all supported x86 and x64 targets, so no runtime detection is needed
+	// Define this to zero on the command-line to only build the scalar conversions (e.g. to compare against them with 'tools/format_conversion_test.cpp')
+	#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+		#define RESHADE_FORMAT_CONVERSION_SSE2 1
+	#else
+		#define RESHADE_FORMAT_CONVERSION_SSE2 0
+	#endif
+#endif
+
+#if RESHADE_FORMAT_CONVERSION_SSE2
+	#include <emmintrin.h>
+#endif
+
+// All conversions below treat a pixel as a little-endian 32-bit integer, with the first channel in the lowest byte
+
+static inline uint32_t load_pixel(const uint8_t *src)
+{
+	uint32_t value;
+	std::memcpy(&value, src, sizeof(value));
+	return value;
+}
+static inline void store_pixel(uint8_t *dst, uint32_t value)
+{
+	std::memcpy(dst, &value, sizeof(value));
+}
+
+static inline uint32_t swap_rb(uint32_t value)
+{
+	return (value & 0xFF00FF00) | ((value & 0xFF) << 16) | ((value >> 16) & 0xFF);
+}
+
+#if RESHADE_FORMAT_CONVERSION_SSE2
+static inline __m128i swap_rb(__m128i value)
+{
+	const __m128i mask_ga = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+	const __m128i mask_lo = _mm_set1_epi32(0x000000FF);
+	return _mm_or_si128(_mm_and_si128(value, mask_ga), _mm_or_si128(
+		_mm_slli_epi32(_mm_and_si128(value, mask_lo), 16),
+		_mm_and_si128(_mm_srli_epi32(value, 16), mask_lo)));
+}
+#endif
+
+// Optionally swaps red and blue channel, then computes (pixel & and_mask) | or_mask for every pixel
+static void convert_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap, uint32_t and_mask, uint32_t or_mask)
+{
+	size_t i = 0;
+
+#if RESHADE_FORMAT_CONVERSION_SSE2
+	const __m128i and_mask_v = _mm_set1_epi32(static_cast<int>(and_mask));
+	const __m128i or_mask_v = _mm_set1_epi32(static_cast<int>(or_mask));
+
+	if (swap)
+	{
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+			value = _mm_or_si128(_mm_and_si128(swap_rb(value), and_mask_v), or_mask_v);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), value);
+		}
+	}
+	else
+	{
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+			value = _mm_or_si128(_mm_and_si128(value, and_mask_v), or_mask_v);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), value);
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		uint32_t value = load_pixel(src + i * 4);
+		if (swap)
+			value = swap_rb(value);
+		store_pixel(dst + i * 4, (value & and_mask) | or_mask);
+	}
+}
+
+void reshade::convert_rgbx8_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap_rb)
+{
+	convert_rgba8(dst, src, count, swap_rb, 0x00FFFFFF, 0xFF000000);
+}
+
+void reshade::convert_rgb10a2_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap_rb)
+{
+	size_t i = 0;
+
+	// Divide by 4 (shift right by 2) to get 10-bit range (0-1023) into 8-bit range (0-255)
+	const unsigned int shift_r = swap_rb ? 16 : 0;
+	const unsigned int shift_b = swap_rb ? 0 : 16;
+
+#if RESHADE_FORMAT_CONVERSION_SSE2
+	const __m128i mask_lo = _mm_set1_epi32(0x000000FF);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+	const __m128i shift_r_v = _mm_cvtsi32_si128(static_cast<int>(shift_r));
+	const __m128i shift_b_v = _mm_cvtsi32_si128(static_cast<int>(shift_b));
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+		const __m128i r = _mm_and_si128(_mm_srli_epi32(value,  2), mask_lo);
+		const __m128i g = _mm_and_si128(_mm_srli_epi32(value, 12), mask_lo);
+		const __m128i b = _mm_and_si128(_mm_srli_epi32(value, 22), mask_lo);
+		const __m128i result = _mm_or_si128(
+			_mm_or_si128(_mm_sll_epi32(r, shift_r_v), _mm_slli_epi32(g, 8)),
+			_mm_or_si128(_mm_sll_epi32(b, shift_b_v), alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), result);
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		const uint32_t value = load_pixel(src + i * 4);
+		const uint32_t r = (value >>  2) & 0xFF;
+		const uint32_t g = (value >> 12) & 0xFF;
+		const uint32_t b = (value >> 22) & 0xFF;
+		store_pixel(dst + i * 4, (r << shift_r) | (g << 8) | (b << shift_b) | 0xFF000000);
+	}
+}
+
+void reshade::convert_rgba8_to_r8(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+
+#if RESHADE_FORMAT_CONVERSION_SSE2
+	const __m128i mask_lo = _mm_set1_epi32(0x000000FF);
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i v0 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 +  0)), mask_lo);
+		const __m128i v1 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 + 16)), mask_lo);
+		const __m128i v2 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 + 32)), mask_lo);
+		const __m128i v3 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 + 48)), mask_lo);
+		// Values are in range 0-255, so the saturating packs never clamp
+		const __m128i result = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), result);
+	}
+#endif
+
+	for (; i < count; ++i)
+		dst[i] = src[i * 4];
+}
+
+void reshade::convert_rgba8_to_rg8(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+
+#if RESHADE_FORMAT_CONVERSION_SSE2
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 +  0));
+		__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4 + 16));
+		// Sign-extend the lower 16 bits, so that the signed saturating pack keeps them unchanged (SSE2 has no unsigned 32 to 16-bit pack)
+		v0 = _mm_srai_epi32(_mm_slli_epi32(v0, 16), 16);
+		v1 = _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 2), _mm_packs_epi32(v0, v1));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		dst[i * 2 + 0] = src[i * 4 + 0];
+		dst[i * 2 + 1] = src[i * 4 + 1];
+	}
+}
+
+void reshade::convert_rgba8_to_bgra8(uint8_t *dst, const uint8_t *src, size_t count, unsigned int channels)
+{
+	assert(channels >= 1 && channels <= 4);
+
+	// Masks are applied after the swap, so red is in the third byte
+	switch (channels)
+	{
+	case 1:
+		convert_rgba8(dst, src, count, true, 0x00FF0000, 0xFF000000);
+		break;
+	case 2:
+		convert_rgba8(dst, src, count, true, 0x00FFFF00, 0xFF000000);
+		break;
+	case 3:
+		convert_rgba8(dst, src, count, true, 0x00FFFFFF, 0xFF000000);
+		break;
+	default:
+		convert_rgba8(dst, src, count, true, 0xFFFFFFFF, 0x00000000);
+		break;
+	}
+}
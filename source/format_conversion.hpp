@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace reshade
+{
+	/// <summary>
+	/// Copies 8-bit per channel pixels and sets the alpha channel to 0xFF, optionally swapping the red and blue channel (to convert BGRX to RGBA).
+	/// Source and destination may be the same buffer.
+	/// </summary>
+	/// <param name="dst">Output buffer with space for <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="src">Input buffer with <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="count">Number of pixels to convert.</param>
+	/// <param name="swap_rb">Set to <c>true</c> to swap the first and third channel.</param>
+	void convert_rgbx8_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap_rb);
+	/// <summary>
+	/// Converts 10-bit per channel RGB pixels with a 2-bit alpha channel to 8-bit per channel RGBA pixels with alpha set to 0xFF.
+	/// Source and destination may be the same buffer.
+	/// </summary>
+	/// <param name="dst">Output buffer with space for <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="src">Input buffer with <paramref name="count"/> packed 32-bit pixels (first channel in the lowest bits).</param>
+	/// <param name="count">Number of pixels to convert.</param>
+	/// <param name="swap_rb">Set to <c>true</c> to swap the first and third channel.</param>
+	void convert_rgb10a2_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap_rb);
+
+	/// <summary>
+	/// Extracts the red channel of 8-bit per channel RGBA pixels.
+	/// </summary>
+	/// <param name="dst">Output buffer with space for <paramref name="count"/> bytes.</param>
+	/// <param name="src">Input buffer with <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="count">Number of pixels to convert.</param>
+	void convert_rgba8_to_r8(uint8_t *dst, const uint8_t *src, size_t count);
+	/// <summary>
+	/// Extracts the red and green channel of 8-bit per channel RGBA pixels.
+	/// </summary>
+	/// <param name="dst">Output buffer with space for <paramref name="count"/> * 2 bytes.</param>
+	/// <param name="src">Input buffer with <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="count">Number of pixels to convert.</param>
+	void convert_rgba8_to_rg8(uint8_t *dst, const uint8_t *src, size_t count);
+	/// <summary>
+	/// Converts 8-bit per channel RGBA pixels to BGRA, keeping only the first <paramref name="channels"/> channels of the input.
+	/// Dropped color channels are set to zero and a dropped alpha channel is set to 0xFF (e.g. to store R8 or RG8 data in a BGRA texture).
+	/// Source and destination may be the same buffer.
+	/// </summary>
+	/// <param name="dst">Output buffer with space for <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="src">Input buffer with <paramref name="count"/> * 4 bytes.</param>
+	/// <param name="count">Number of pixels to convert.</param>
+	/// <param name="channels">Number of input channels to keep (1 to 4).</param>
+	void convert_rgba8_to_bgra8(uint8_t *dst, const uint8_t *src, size_t count, unsigned int channels = 4);
+}
@@ -74,15 +74,8 @@ const char *imgui_code_editor::get_palette_color_name(unsigned int col)
 	return nullptr;
 }
 
-imgui_code_editor::imgui_code_editor()
-{
-	_lines.emplace_back();
-}
-
 void imgui_code_editor::render(const char *title, bool border)
 {
-	assert(!_lines.empty());
-
 	// Get all the style values here, before they are overwritten via 'PushStyleVar'
 	const float button_size = ImGui::GetFrameHeight();
 	const float bottom_height = ImGui::GetFrameHeightWithSpacing() + ImGui::GetStyle().ItemSpacing.y;
@@ -103,7 +96,7 @@ void imgui_code_editor::render(const char *title, bool border)
 	};
 
 	// Deduce text start offset by evaluating maximum number of lines plus two spaces as text width
-	snprintf(buf, 16, " %zu ", _lines.size());
+	snprintf(buf, 16, " %zu ", _text.line_count());
 	const float text_start = ImGui::CalcTextSize(buf).x + _left_margin;
 	// The following holds the approximate width and height of a default character for offset calculation
 	const ImVec2 char_advance = ImVec2(calc_text_size(" ").x, ImGui::GetTextLineHeightWithSpacing() * _line_spacing);
@@ -180,19 +173,20 @@ void imgui_code_editor::render(const char *title, bool border)
 
 			text_pos res;
 			res.line = std::max<size_t>(0, static_cast<size_t>(floor(pos.y / char_advance.y)));
-			res.line = std::min<size_t>(res.line, _lines.size() - 1);
+			res.line = std::min<size_t>(res.line, _text.line_count() - 1);
 
 			float column_width = 0.0f;
 			std::string cumulated_string = "";
 			float cumulated_string_width[2] = { 0.0f, 0.0f }; // [0] is the latest, [1] is the previous. I use that trick to check where cursor is exactly (important for tabs).
 
-			const auto &line = _lines[res.line];
+			std::string line;
+			_text.get_line(res.line, line);
 
 			// First we find the hovered column
 			while (text_start + cumulated_string_width[0] < pos.x && res.column < line.size())
 			{
 				cumulated_string_width[1] = cumulated_string_width[0];
-				cumulated_string += line[res.column].c;
+				cumulated_string += line[res.column];
 				cumulated_string_width[0] = calc_text_size(cumulated_string.c_str()).x;
 				column_width = (cumulated_string_width[0] - cumulated_string_width[1]);
 				res.column++;
@@ -273,22 +267,29 @@ void imgui_code_editor::render(const char *title, bool border)
 	const float space_size = calc_text_size(" ").x;
 
 	size_t line_no = static_cast<size_t>(floor(ImGui::GetScrollY() / char_advance.y));
-	size_t line_max = std::max<size_t>(0, std::min(_lines.size() - 1, line_no + static_cast<size_t>(floor((ImGui::GetScrollY() + ImGui::GetWindowContentRegionMax().y) / char_advance.y))));
+	size_t line_max = std::max<size_t>(0, std::min(_text.line_count() - 1, line_no + static_cast<size_t>(floor((ImGui::GetScrollY() + ImGui::GetWindowContentRegionMax().y) / char_advance.y))));
 
-	const auto calc_text_distance_to_line_begin = [this, space_size, &calc_text_size](const text_pos &from) {
+	const auto calc_text_distance_to_line_begin = [this, space_size, &calc_text_size](const std::string &line, size_t column) {
 		float distance = 0.0f;
-		const auto &line = _lines[from.line];
-		for (size_t i = 0u; i < line.size() && i < from.column; ++i)
-			if (line[i].c == '\t')
+		for (size_t i = 0u; i < line.size() && i < column; ++i)
+			if (line[i] == '\t')
 				distance += _tab_size * space_size;
 			else
-				distance += calc_text_size(&line[i].c, &line[i].c + 1).x;
+				distance += calc_text_size(&line[i], &line[i] + 1).x;
 		return distance;
 	};
 
+	// Temporary buffers holding the characters and colors of the line that is currently being drawn
+	std::string line;
+	std::vector<color> line_colors;
+
 	for (; line_no <= line_max; ++line_no, buf_end = buf)
 	{
-		const auto &line = _lines[line_no];
+		_text.get_line(line_no, line);
+
+		line_colors.clear();
+		for (const text_buffer::color_run &run : _text.line_colors(line_no))
+			line_colors.insert(line_colors.end(), run.length, static_cast<color>(run.color));
 
 		// Position of the line number
 		const ImVec2 line_screen_pos = ImVec2(ImGui::GetCursorScreenPos().x, ImGui::GetCursorScreenPos().y + line_no * char_advance.y);
@@ -297,15 +298,15 @@ void imgui_code_editor::render(const char *title, bool border)
 
 		const text_pos line_beg_pos(line_no, 0);
 		const text_pos line_end_pos(line_no, line.size());
-		longest_line = std::max(calc_text_distance_to_line_begin(line_end_pos), longest_line);
+		longest_line = std::max(calc_text_distance_to_line_begin(line, line_end_pos.column), longest_line);
 
 		// Calculate selection rectangle
 		float selection_beg = -1.0f;
 		if (_select_beg <= line_end_pos)
-			selection_beg = _select_beg > line_beg_pos ? calc_text_distance_to_line_begin(_select_beg) : 0.0f;
+			selection_beg = _select_beg > line_beg_pos ? calc_text_distance_to_line_begin(line, _select_beg.column) : 0.0f;
 		float selection_end = -1.0f;
 		if (_select_end >  line_beg_pos)
-			selection_end = calc_text_distance_to_line_begin(_select_end < line_end_pos ? _select_end : line_end_pos);
+			selection_end = calc_text_distance_to_line_begin(line, _select_end < line_end_pos ? _select_end.column : line_end_pos.column);
 
 		// Add small overhead rectangle at the end of selected lines
 		if (_select_end.line > line_no)
@@ -328,7 +329,7 @@ void imgui_code_editor::render(const char *title, bool border)
 
 			for (size_t i = 0; i < line.size(); ++i)
 			{
-				if (line[i].c == _highlighted[highlight_index] && line[i].col == color_identifier)
+				if (line[i] == _highlighted[highlight_index] && line_colors[i] == color_identifier)
 				{
 					if (highlight_index == 0)
 						begin_column = i;
@@ -337,11 +338,11 @@ void imgui_code_editor::render(const char *title, bool border)
 
 					if (highlight_index == _highlighted.size())
 					{
-						if ((begin_column == 0 || line[begin_column - 1].col != color_identifier) && (i + 1 == line.size() || line[i + 1].col != color_identifier)) // Make sure this is a whole word and not just part of one
+						if ((begin_column == 0 || line_colors[begin_column - 1] != color_identifier) && (i + 1 == line.size() || line_colors[i + 1] != color_identifier)) // Make sure this is a whole word and not just part of one
 						{
 							// We found a matching text block
-							const ImVec2 beg = ImVec2(text_screen_pos.x + calc_text_distance_to_line_begin(text_pos(line_no, begin_column)), text_screen_pos.y);
-							const ImVec2 end = ImVec2(text_screen_pos.x + calc_text_distance_to_line_begin(text_pos(line_no, i + 1)), text_screen_pos.y + char_advance.y);
+							const ImVec2 beg = ImVec2(text_screen_pos.x + calc_text_distance_to_line_begin(line, begin_column), text_screen_pos.y);
+							const ImVec2 end = ImVec2(text_screen_pos.x + calc_text_distance_to_line_begin(line, i + 1), text_screen_pos.y + char_advance.y);
 
 							draw_list->AddRectFilled(beg, end, _palette[color_selection]);
 						}
@@ -391,7 +392,7 @@ void imgui_code_editor::render(const char *title, bool border)
 			// Draw the cursor animation
 			if (is_focused && io.ConfigInputTextCursorBlink && fmodf(_cursor_anim, 1.0f) <= 0.5f)
 			{
-				const float cx = calc_text_distance_to_line_begin(_cursor_pos);
+				const float cx = calc_text_distance_to_line_begin(line, _cursor_pos.column);
 
 				const ImVec2 beg = ImVec2(text_screen_pos.x + cx, line_screen_pos.y);
 				const ImVec2 end = ImVec2(text_screen_pos.x + cx + (_overwrite ? char_advance.x : 1.0f), line_screen_pos.y + char_advance.y); // Larger cursor while overwriting
@@ -411,24 +412,24 @@ void imgui_code_editor::render(const char *title, bool border)
 
 		// Draw colorized line text
 		auto text_offset = 0.0f;
-		auto current_color = line[0].col;
+		auto current_color = line_colors[0];
 
-		// Fill temporary buffer with glyph characters and commit it every time the color changes or a tab character is encountered
-		for (const glyph &glyph : line)
+		// Fill temporary buffer with line characters and commit it every time the color changes or a tab character is encountered
+		for (size_t i = 0; i < line.size(); ++i)
 		{
-			if (buf != buf_end && (glyph.col != current_color || glyph.c == '\t' || buf_end - buf >= sizeof(buf)))
+			if (buf != buf_end && (line_colors[i] != current_color || line[i] == '\t' || buf_end - buf >= sizeof(buf)))
 			{
 				draw_list->AddText(ImVec2(text_screen_pos.x + text_offset, text_screen_pos.y), _palette[current_color], buf, buf_end);
 
 				text_offset += calc_text_size(buf, buf_end).x; buf_end = buf; // Reset temporary buffer
 			}
 
-			if (glyph.c != '\t')
-				*buf_end++ = glyph.c;
+			if (line[i] != '\t')
+				*buf_end++ = line[i];
 			else
 				text_offset += _tab_size * space_size;
 
-			current_color = glyph.col;
+			current_color = line_colors[i];
 		}
 
 		// Draw any text still in the temporary buffer that was not yet committed
@@ -437,11 +438,13 @@ void imgui_code_editor::render(const char *title, bool border)
 	}
 
 	// Create dummy widget so a horizontal scrollbar appears
-	ImGui::Dummy(ImVec2(text_start + longest_line, _lines.size() * char_advance.y));
+	ImGui::Dummy(ImVec2(text_start + longest_line, _text.line_count() * char_advance.y));
 
 	if (_scroll_to_cursor)
 	{
-		const float len = calc_text_distance_to_line_begin(_cursor_pos);
+		_text.get_line(_cursor_pos.line, line);
+
+		const float len = calc_text_distance_to_line_begin(line, _cursor_pos.column);
 		const float extra_space = 8.0f;
 
 		const float max_scroll_width = ImGui::GetWindowWidth() - 16.0f;
@@ -571,10 +574,10 @@ void imgui_code_editor::render(const char *title, bool border)
 
 void imgui_code_editor::select(const text_pos &beg, const text_pos &end, selection_mode mode)
 {
-	assert(beg.line < _lines.size());
-	assert(end.line < _lines.size());
-	assert(beg.column <= _lines[beg.line].size()); // The last column is after the last character in the line
-	assert(end.column <= _lines[end.line].size());
+	assert(beg.line < _text.line_count());
+	assert(end.line < _text.line_count());
+	assert(beg.column <= _text.line_length(beg.line)); // The last column is after the last character in the line
+	assert(end.column <= _text.line_length(end.line));
 
 	if (end > beg)
 		_select_beg = beg,
@@ -584,23 +587,23 @@ void imgui_code_editor::select(const text_pos &beg, const text_pos &end, selecti
 		_select_beg = end;
 
 	const auto select_word = [this](text_pos &beg, text_pos &end) {
-		const auto &beg_line = _lines[beg.line];
-		const auto &end_line = _lines[end.line];
+		const size_t beg_line_length = _text.line_length(beg.line);
+		const size_t end_line_length = _text.line_length(end.line);
 		// Empty lines cannot have any words, so abort
-		if (beg_line.empty() || end_line.empty())
+		if (beg_line_length == 0 || end_line_length == 0)
 			return;
 		// Whitespace has a special meaning in that if we select the space next to a word, then that word is precedence over the whitespace
-		if (beg.column == beg_line.size() || (beg.column > 0 && beg_line[beg.column].col == color_default))
+		if (beg.column == beg_line_length || (beg.column > 0 && _text.color_at(beg.line, beg.column) == color_default))
 			beg.column--;
-		if (end.column == end_line.size() || (end.column > 0 && end_line[end.column].col == color_default))
+		if (end.column == end_line_length || (end.column > 0 && _text.color_at(end.line, end.column) == color_default))
 			end.column--;
 		// Search from the first position backwards until a character with a different color is found
-		for (auto word_color = beg_line[beg.column].col;
-			beg.column > 0 && beg_line[beg.column - 1].col == word_color;
+		for (auto word_color = _text.color_at(beg.line, beg.column);
+			beg.column > 0 && _text.color_at(beg.line, beg.column - 1) == word_color;
 			--beg.column) continue;
 		// Search from the selection end position forwards until a character with a different color is found
-		for (auto word_color = end_line[end.column].col;
-			end.column < end_line.size() && end_line[end.column].col == word_color;
+		for (auto word_color = _text.color_at(end.line, end.column);
+			end.column < end_line_length && _text.color_at(end.line, end.column) == word_color;
 			++end.column) continue;
 	};
 
@@ -611,7 +614,7 @@ void imgui_code_editor::select(const text_pos &beg, const text_pos &end, selecti
 	text_pos highlight_beg = _select_beg;
 	text_pos highlight_end = _select_end;
 	select_word(highlight_beg, highlight_end);
-	_highlighted = _lines[highlight_beg.line].size() > highlight_beg.column && _lines[highlight_beg.line][highlight_beg.column].col == color_identifier ?
+	_highlighted = _text.line_length(highlight_beg.line) > highlight_beg.column && _text.color_at(highlight_beg.line, highlight_beg.column) == color_identifier ?
 		get_text(highlight_beg, highlight_end) : std::string();
 
 	switch (mode)
@@ -621,17 +624,14 @@ void imgui_code_editor::select(const text_pos &beg, const text_pos &end, selecti
 		break;
 	case selection_mode::line:
 		_select_beg.column = 0;
-		_select_end.column = _lines[end.line].size();
+		_select_end.column = _text.line_length(end.line);
 		break;
 	}
 }
 void imgui_code_editor::select_all()
 {
-	if (_lines.empty())
-		return; // Cannot select anything if no text is set
-
 	// Move cursor to end of text
-	_cursor_pos = text_pos(_lines.size() - 1, _lines.back().size());
+	_cursor_pos = text_pos(_text.line_count() - 1, _text.line_length(_text.line_count() - 1));
 
 	// Update selection to contain everything
 	_interactive_beg = text_pos(0, 0);
@@ -645,28 +645,17 @@ void imgui_code_editor::set_text(const std::string &text)
 	_undo.clear();
 	_undo_index = 0;
 
-	_lines.clear();
-	_lines.emplace_back();
+	_text.set_text(text);
 
 	_errors.clear();
 
-	for (char c : text)
-	{
-		if (c == '\r')
-			continue; // Ignore the carriage return character
-		else if (c == '\n')
-			_lines.emplace_back();
-		else
-			_lines.back().push_back({ c, color_default });
-	}
-
 	// Restrict cursor position to new text bounds
 	_select_beg = _select_end = text_pos();
 	_interactive_beg = _interactive_end = text_pos();
-	_cursor_pos = std::min(_cursor_pos, text_pos(_lines.size() - 1, _lines.back().size()));
+	_cursor_pos = std::min(_cursor_pos, text_pos(_text.line_count() - 1, _text.line_length(_text.line_count() - 1)));
 
 	_colorize_line_beg = 0;
-	_colorize_line_end = _lines.size();
+	_colorize_line_end = _text.line_count();
 }
 void imgui_code_editor::clear_text()
 {
@@ -674,16 +663,21 @@ void imgui_code_editor::clear_text()
 }
 void imgui_code_editor::insert_text(const std::string &text)
 {
-	// Insert all characters of the text
-	for (const char c : text)
-		insert_character(c, false);
+	if (_readonly)
+		return;
+
+	// Insert text in place of the current selection (if any)
+	_cursor_pos = replace_text(_select_beg, _select_end, text);
 
 	// Move cursor to end of inserted text
+	_interactive_beg = _interactive_end = _cursor_pos;
 	select(_cursor_pos, _cursor_pos);
+
+	_scroll_to_cursor = true;
 }
 void imgui_code_editor::insert_character(char c, bool auto_indent)
 {
-	if (_readonly)
+	if (_readonly || c == '\r') // Ignore carriage return
 		return;
 
 	undo_record u;
@@ -695,48 +689,42 @@ void imgui_code_editor::insert_character(char c, bool auto_indent)
 			auto &beg = _select_beg;
 			auto &end = _select_end;
 
-			_colorize_line_beg = std::min(_colorize_line_beg, beg.line - std::min<size_t>(beg.line, 10));
-			_colorize_line_end = std::max(_colorize_line_end, end.line + 10 + 1);
+			_colorize_line_beg = std::min(_colorize_line_beg, beg.line);
+			_colorize_line_end = std::max(_colorize_line_end, end.line + 1);
 
 			beg.column = 0;
 			if (end.column == 0 && end.line > 0)
-				end.column = _lines[--end.line].size();
+				end.column = _text.line_length(--end.line);
 
-			u.removed = get_text(beg, end);
+			u.removed = _text.get_pieces(beg.line, beg.column, end.line, end.column);
 			u.removed_beg = beg;
 			u.removed_end = end;
 
 			for (size_t i = beg.line; i <= end.line; i++)
 			{
-				auto &line = _lines[i];
-
 				if (ImGui::GetIO().KeyShift)
 				{
-					if (line.empty())
-						continue; // Line is already empty, so there is no indentation to remove
-
-					if (line[0].c == '\t')
-					{
-						line.erase(line.begin());
-						if (i == end.line && end.column > 0)
-							end.column--;
-					}
-					else for (size_t j = 0; j < _tab_size && line[0].c == ' '; j++) // Do the same for spaces
-					{
-						line.erase(line.begin());
-						if (i == end.line && end.column > 0)
-							end.column--;
-					}
+					// Remove a tab or the same amount of spaces
+					size_t indentation = 0;
+					if (_text.line_length(i) != 0 && _text.at(i, 0) == '\t')
+						indentation = 1;
+					else while (indentation < _tab_size && indentation < _text.line_length(i) && _text.at(i, indentation) == ' ')
+						indentation++;
+
+					_text.erase(i, 0, i, indentation);
+					if (i == end.line)
+						end.column -= std::min(end.column, indentation);
 				}
 				else
 				{
-					line.insert(line.begin(), { '\t', color_background });
+					_text.insert(i, 0, "\t", 1);
+					_text.set_color(i, 0, 1, color_background);
 					if (i == end.line)
 						++end.column;
 				}
 			}
 
-			u.added = get_text(beg, end);
+			u.added = _text.get_pieces(beg.line, beg.column, end.line, end.column);
 			u.added_beg = beg;
 			u.added_end = end;
 			record_undo(std::move(u));
@@ -747,92 +735,128 @@ void imgui_code_editor::insert_character(char c, bool auto_indent)
 		delete_selection();
 	}
 
-	assert(!_lines.empty());
-
-	u.added = c;
-	u.added_beg = _cursor_pos;
-
-	// Colorize additional 10 lines above and below to better catch multi-line constructs
-	_colorize_line_beg = std::min(_colorize_line_beg, _cursor_pos.line - std::min<size_t>(_cursor_pos.line, 10));
+	std::string text(1, c);
 
 	// New line feed requires insertion of a new line
 	if (c == '\n')
 	{
-		// Move all error markers after the new line one up
-		std::unordered_map<size_t, std::pair<std::string, bool>> errors;
-		errors.reserve(_errors.size());
-		for (auto &i : _errors)
-			errors.insert({ i.first >= _cursor_pos.line + 1 ? i.first + 1 : i.first, i.second });
-		_errors = std::move(errors);
-
-		auto &new_line = *_lines.emplace(_lines.begin() + _cursor_pos.line + 1);
-		auto &line = _lines[_cursor_pos.line];
-
 		// Auto indentation
-		if (auto_indent && _cursor_pos.column == line.size())
-			for (size_t i = 0; i < line.size() && isblank(line[i].c); ++i)
-				new_line.push_back(line[i]), u.added.push_back(line[i].c);
-		const size_t indentation = new_line.size();
-
-		new_line.insert(new_line.end(), line.begin() + _cursor_pos.column, line.end());
-		line.erase(line.begin() + _cursor_pos.column, line.begin() + line.size());
+		if (auto_indent && _cursor_pos.column == _text.line_length(_cursor_pos.line))
+		{
+			std::string line;
+			_text.get_line(_cursor_pos.line, line);
 
-		_cursor_pos.line++;
-		_cursor_pos.column = indentation;
+			for (size_t i = 0; i < line.size() && isblank(line[i]); ++i)
+				text.push_back(line[i]);
+		}
 	}
-	else if (c != '\r') // Ignore carriage return
+	else if (_overwrite && _cursor_pos.column < _text.line_length(_cursor_pos.line))
 	{
-		auto &line = _lines[_cursor_pos.line];
+		u.removed_beg = _cursor_pos;
+		u.removed_end = text_pos(_cursor_pos.line, _cursor_pos.column + 1);
+		u.removed = _text.get_pieces(u.removed_beg.line, u.removed_beg.column, u.removed_end.line, u.removed_end.column);
 
-		if (_overwrite && _cursor_pos.column < line.size())
-			line[_cursor_pos.column] = { c, color_default };
-		else
-			line.insert(line.begin() + _cursor_pos.column, { c, color_default });
-
-		_cursor_pos.column++;
+		erase_text(u.removed_beg, u.removed_end);
 	}
 
+	u.added_beg = _cursor_pos;
+	_cursor_pos = insert_text_at(_cursor_pos, text);
 	u.added_end = _cursor_pos;
+	u.added = _text.get_pieces(u.added_beg.line, u.added_beg.column, u.added_end.line, u.added_end.column);
+
 	record_undo(std::move(u));
 
 	// Reset cursor animation
 	_cursor_anim = 0;
 
 	_scroll_to_cursor = true;
+}
+
+imgui_code_editor::text_pos imgui_code_editor::insert_text_at(const text_pos &pos, const std::string &text)
+{
+	const auto [end_line, end_column] = _text.insert(pos.line, pos.column, text);
+	const text_pos end(end_line, end_column);
 
-	_colorize_line_end = std::max(_colorize_line_end, _cursor_pos.line + 10 + 1);
+	update_inserted_lines(pos, end);
+
+	return end;
 }
+imgui_code_editor::text_pos imgui_code_editor::insert_text_at(const text_pos &pos, const std::vector<text_buffer::piece> &pieces)
+{
+	const auto [end_line, end_column] = _text.insert(pos.line, pos.column, pieces);
+	const text_pos end(end_line, end_column);
 
-std::string imgui_code_editor::get_text() const
+	update_inserted_lines(pos, end);
+
+	return end;
+}
+void imgui_code_editor::update_inserted_lines(const text_pos &beg, const text_pos &end)
 {
-	return get_text(0, _lines.size());
+	// Move all error markers after the inserted lines down
+	if (const size_t added_lines = end.line - beg.line; added_lines != 0)
+	{
+		std::unordered_map<size_t, std::pair<std::string, bool>> errors;
+		errors.reserve(_errors.size());
+		for (auto &i : _errors)
+			errors.insert({ i.first > beg.line + (beg.column != 0) ? i.first + added_lines : i.first, i.second });
+		_errors = std::move(errors);
+	}
+
+	// Only the modified lines need to be colorized again, any following lines are updated as well if this changes their lexer state
+	_colorize_line_beg = std::min(_colorize_line_beg, beg.line);
+	_colorize_line_end = std::max(_colorize_line_end, end.line + 1);
 }
-std::string imgui_code_editor::get_text(const text_pos &beg, const text_pos &end) const
+imgui_code_editor::text_pos imgui_code_editor::replace_text(const text_pos &beg, const text_pos &end, const std::string &text)
 {
-	std::string result;
+	undo_record u;
 
-	for (auto it = beg; it < end;)
+	if (end > beg)
 	{
-		const auto &line = _lines[it.line];
+		u.removed = _text.get_pieces(beg.line, beg.column, end.line, end.column);
+		u.removed_beg = beg;
+		u.removed_end = end;
 
-		if (it.column < line.size())
-		{
-			result.push_back(line[it.column].c);
+		erase_text(beg, end);
+	}
 
-			it.column++;
-		}
-		else
-		{
-			it.line++;
-			it.column = 0;
+	u.added_beg = beg;
+	u.added_end = insert_text_at(beg, text);
+	u.added = _text.get_pieces(u.added_beg.line, u.added_beg.column, u.added_end.line, u.added_end.column);
 
-			if (it.line < _lines.size())
-				// Reached end of line, so append a new line feed
-				result.push_back('\n');
-		}
+	const text_pos added_end = u.added_end;
+	if (!u.added.empty() || !u.removed.empty())
+		record_undo(std::move(u));
+
+	return added_end;
+}
+void imgui_code_editor::erase_text(const text_pos &beg, const text_pos &end)
+{
+	assert(beg <= end);
+
+	_text.erase(beg.line, beg.column, end.line, end.column);
+
+	// Remove error markers in the deleted lines and move all error markers after them up
+	if (const size_t removed_lines = end.line - beg.line; removed_lines != 0)
+	{
+		std::unordered_map<size_t, std::pair<std::string, bool>> errors;
+		errors.reserve(_errors.size());
+		for (auto &i : _errors)
+			if (i.first <= beg.line + 1 || i.first > end.line + 1)
+				errors.insert({ i.first > end.line + 1 ? i.first - removed_lines : i.first, i.second });
+		_errors = std::move(errors);
 	}
 
-	return result;
+	_colorize_line_beg = std::min(_colorize_line_beg, beg.line);
+	_colorize_line_end = std::max(_colorize_line_end, beg.line + 1);
+}
+
+std::string imgui_code_editor::get_text() const
+{
+	return _text.get_text(0, 0, _text.line_count(), 0);
+}
+std::string imgui_code_editor::get_text(const text_pos &beg, const text_pos &end) const
+{
+	return _text.get_text(beg.line, beg.column, end.line, end.column);
 }
 std::string imgui_code_editor::get_selected_text() const
 {
@@ -846,69 +870,56 @@ void imgui_code_editor::undo(unsigned int steps)
 	if (_readonly)
 		return;
 
-	// Reset selection
-	_select_beg = _select_end = _cursor_pos;
-	_interactive_beg = _interactive_end = _cursor_pos;
-
-	_in_undo_operation = true;
-
 	while (can_undo() && steps-- > 0)
 	{
 		const undo_record &record = _undo[--_undo_index];
 
 		if (!record.added.empty())
 		{
+			erase_text(record.added_beg, record.added_end);
 			_cursor_pos = record.added_beg;
-			select(record.added_beg, record.added_end);
-			delete_selection();
 		}
 		if (!record.removed.empty())
 		{
-			_cursor_pos = record.removed_beg;
-			insert_text(record.removed);
+			_cursor_pos = insert_text_at(record.removed_beg, record.removed);
 		}
 	}
 
+	// Reset selection
+	_interactive_beg = _interactive_end = _cursor_pos;
+	select(_cursor_pos, _cursor_pos);
+
 	_scroll_to_cursor = true;
-	_in_undo_operation = false;
 }
 void imgui_code_editor::redo(unsigned int steps)
 {
 	if (_readonly)
 		return;
 
-	// Reset selection
-	_select_beg = _select_end = _cursor_pos;
-	_interactive_beg = _interactive_end = _cursor_pos;
-
-	_in_undo_operation = true;
-
 	while (can_redo() && steps-- > 0)
 	{
 		const undo_record &record = _undo[_undo_index++];
 
 		if (!record.removed.empty())
 		{
+			erase_text(record.removed_beg, record.removed_end);
 			_cursor_pos = record.removed_beg;
-			select(record.removed_beg, record.removed_end);
-			delete_selection();
 		}
 		if (!record.added.empty())
 		{
-			_cursor_pos = record.added_beg;
-			insert_text(record.added);
+			_cursor_pos = insert_text_at(record.added_beg, record.added);
 		}
 	}
 
+	// Reset selection
+	_interactive_beg = _interactive_end = _cursor_pos;
+	select(_cursor_pos, _cursor_pos);
+
 	_scroll_to_cursor = true;
-	_in_undo_operation = false;
 }
 
 void imgui_code_editor::record_undo(undo_record &&record)
 {
-	if (_in_undo_operation)
-		return;
-
 	_undo.resize(_undo_index); // Remove all undo records after the current one
 	_undo.push_back(std::move(record)); // Append new record to the list
 	_undo_index++;
@@ -925,45 +936,29 @@ void imgui_code_editor::delete_next()
 		return;
 	}
 
-	assert(!_lines.empty());
-
-	auto &line = _lines[_cursor_pos.line];
-
 	undo_record u;
 	u.removed_beg = _cursor_pos;
 	u.removed_end = _cursor_pos;
 
 	// If at end of line, move next line into the current one
-	if (_cursor_pos.column == line.size())
+	if (_cursor_pos.column == _text.line_length(_cursor_pos.line))
 	{
-		if (_cursor_pos.line == _lines.size() - 1)
+		if (_cursor_pos.line == _text.line_count() - 1)
 			return; // This already is the last line
 
-		const auto &next_line = _lines[_cursor_pos.line + 1];
-
-		u.removed = '\n';
 		u.removed_end.line++;
 		u.removed_end.column = 0;
-
-		// Copy next line into current line
-		line.insert(line.end(), next_line.begin(), next_line.end());
-
-		// Remove the line
-		delete_lines(_cursor_pos.line + 1, _cursor_pos.line + 1);
 	}
 	else
 	{
-		u.removed = line[_cursor_pos.column].c;
-		u.removed_end.column++;
-
 		// Otherwise just remove the character at the cursor position
-		line.erase(line.begin() + _cursor_pos.column);
+		u.removed_end.column++;
 	}
 
-	record_undo(std::move(u));
+	u.removed = _text.get_pieces(u.removed_beg.line, u.removed_beg.column, u.removed_end.line, u.removed_end.column);
+	erase_text(u.removed_beg, u.removed_end);
 
-	_colorize_line_beg = std::min(_colorize_line_beg, _cursor_pos.line - std::min<size_t>(_cursor_pos.line, 10));
-	_colorize_line_end = std::max(_colorize_line_end, _cursor_pos.line + 10 + 1);
+	record_undo(std::move(u));
 }
 void imgui_code_editor::delete_previous()
 {
@@ -976,48 +971,31 @@ void imgui_code_editor::delete_previous()
 		return;
 	}
 
-	assert(!_lines.empty());
-
-	auto &line = _lines[_cursor_pos.line];
-
 	undo_record u;
 	u.removed_end = _cursor_pos;
 
-	// If at beginning of line, move previous line into the current one
+	// If at beginning of line, move current line into the previous one
 	if (_cursor_pos.column == 0)
 	{
 		if (_cursor_pos.line == 0)
 			return; // This already is the first line
 
-		auto &prev_line = _lines[_cursor_pos.line - 1];
 		_cursor_pos.line--;
-		_cursor_pos.column = prev_line.size();
-
-		u.removed = '\n';
-
-		// Copy current line into previous line
-		prev_line.insert(prev_line.end(), line.begin(), line.end());
-
-		// Remove the line
-		delete_lines(_cursor_pos.line + 1, _cursor_pos.line + 1);
+		_cursor_pos.column = _text.line_length(_cursor_pos.line);
 	}
 	else
 	{
-		_cursor_pos.column--;
-
-		u.removed = line[_cursor_pos.column].c;
-
 		// Otherwise remove the character next to the cursor position
-		line.erase(line.begin() + _cursor_pos.column);
+		_cursor_pos.column--;
 	}
 
 	u.removed_beg = _cursor_pos;
+	u.removed = _text.get_pieces(u.removed_beg.line, u.removed_beg.column, u.removed_end.line, u.removed_end.column);
+	erase_text(u.removed_beg, u.removed_end);
+
 	record_undo(std::move(u));
 
 	_scroll_to_cursor = true;
-
-	_colorize_line_beg = std::min(_colorize_line_beg, _cursor_pos.line - std::min<size_t>(_cursor_pos.line, 10));
-	_colorize_line_end = std::max(_colorize_line_end, _cursor_pos.line + 10 + 1);
 }
 void imgui_code_editor::delete_selection()
 {
@@ -1027,63 +1005,18 @@ void imgui_code_editor::delete_selection()
 	if (!has_selection())
 		return;
 
-	assert(!_lines.empty());
-
 	undo_record u;
-	u.removed = get_selected_text();
+	u.removed = _text.get_pieces(_select_beg.line, _select_beg.column, _select_end.line, _select_end.column);
 	u.removed_beg = _select_beg;
 	u.removed_end = _select_end;
 	record_undo(std::move(u));
 
-	if (_select_beg.line == _select_end.line)
-	{
-		auto &line = _lines[_select_beg.line];
-
-		if (_select_end.column >= line.size())
-			line.erase(line.begin() + _select_beg.column, line.end());
-		else
-			line.erase(line.begin() + _select_beg.column, line.begin() + _select_end.column);
-	}
-	else
-	{
-		auto &beg_line = _lines[_select_beg.line];
-		auto &end_line = _lines[_select_end.line];
-
-		beg_line.erase(beg_line.begin() + _select_beg.column, beg_line.end());
-		end_line.erase(end_line.begin(), end_line.begin() + _select_end.column);
-
-		if (_select_beg.line < _select_end.line)
-		{
-			beg_line.insert(beg_line.end(), end_line.begin(), end_line.end());
-
-			delete_lines(_select_beg.line + 1, _select_end.line);
-		}
-
-		assert(!_lines.empty());
-	}
-
-	_colorize_line_beg = std::min(_colorize_line_beg, _select_beg.line - std::min<size_t>(_cursor_pos.line, 10));
-	_colorize_line_end = std::max(_colorize_line_end, _select_end.line + 10 + 1);
+	erase_text(_select_beg, _select_end);
 
 	// Reset selection
 	_cursor_pos = _select_beg;
 	select(_cursor_pos, _cursor_pos);
 }
-void imgui_code_editor::delete_lines(size_t first_line, size_t last_line)
-{
-	if (_readonly)
-		return;
-
-	// Move all error markers after the deleted lines down
-	std::unordered_map<size_t, std::pair<std::string, bool>> errors;
-	errors.reserve(_errors.size());
-	for (auto &i : _errors)
-		if (i.first < first_line && i.first > last_line)
-			errors.insert({ i.first > last_line ? i.first - (last_line - first_line) : i.first, i.second });
-	_errors = std::move(errors);
-
-	_lines.erase(_lines.begin() + first_line, _lines.begin() + last_line + 1);
-}
 
 void imgui_code_editor::clipboard_copy()
 {
@@ -1091,12 +1024,10 @@ void imgui_code_editor::clipboard_copy()
 	{
 		ImGui::SetClipboardText(get_selected_text().c_str());
 	}
-	else if (!_lines.empty()) // Copy current line if there is no selection
+	else // Copy current line if there is no selection
 	{
 		std::string line_text;
-		line_text.reserve(_lines[_cursor_pos.line].size());
-		for (const glyph &glyph : _lines[_cursor_pos.line])
-			line_text.push_back(glyph.c);
+		_text.get_line(_cursor_pos.line, line_text);
 
 		ImGui::SetClipboardText(line_text.c_str());
 	}
@@ -1119,40 +1050,16 @@ void imgui_code_editor::clipboard_paste()
 	if (text == nullptr || *text == '\0')
 		return;
 
-	undo_record u;
-
-	_in_undo_operation = true;
-
-	if (has_selection())
-	{
-		u.removed = get_selected_text();
-		u.removed_beg = _select_beg;
-		u.removed_end = _select_end;
-
-		delete_selection();
-	}
-
-	u.added = text;
-	u.added_beg = _cursor_pos;
-
 	insert_text(text);
-
-	u.added_end = _cursor_pos;
-
-	_in_undo_operation = false;
-
-	record_undo(std::move(u));
 }
 
 void imgui_code_editor::move_up(size_t amount, bool selection)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
 	_cursor_pos.line = std::max<intptr_t>(0, _cursor_pos.line - amount);
 
 	// The line before could be shorter, so adjust column
-	_cursor_pos.column = std::min<intptr_t>(_cursor_pos.column, _lines[_cursor_pos.line].size());
+	_cursor_pos.column = std::min<intptr_t>(_cursor_pos.column, _text.line_length(_cursor_pos.line));
 
 	if (prev_pos == _cursor_pos)
 		return;
@@ -1178,13 +1085,11 @@ void imgui_code_editor::move_up(size_t amount, bool selection)
 }
 void imgui_code_editor::move_down(size_t amount, bool selection)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
-	_cursor_pos.line = std::min<intptr_t>(_cursor_pos.line + amount, _lines.size() - 1);
+	_cursor_pos.line = std::min<intptr_t>(_cursor_pos.line + amount, _text.line_count() - 1);
 
 	// The line after could be shorter, so adjust column
-	_cursor_pos.column = std::min<intptr_t>(_cursor_pos.column, _lines[_cursor_pos.line].size());
+	_cursor_pos.column = std::min<intptr_t>(_cursor_pos.column, _text.line_length(_cursor_pos.line));
 
 	if (prev_pos == _cursor_pos)
 		return;
@@ -1210,8 +1115,6 @@ void imgui_code_editor::move_down(size_t amount, bool selection)
 }
 void imgui_code_editor::move_left(size_t amount, bool selection, bool word_mode)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
 
 	// Move cursor to selection start when moving left and no longer selecting
@@ -1230,12 +1133,12 @@ void imgui_code_editor::move_left(size_t amount, bool selection, bool word_mode)
 					break;
 
 				_cursor_pos.line--;
-				_cursor_pos.column = _lines[_cursor_pos.line].size();
+				_cursor_pos.column = _text.line_length(_cursor_pos.line);
 			}
 			else if (word_mode)
 			{
-				for (const auto word_color = _lines[_cursor_pos.line][_cursor_pos.column - 1].col; _cursor_pos.column > 0; --_cursor_pos.column)
-					if (_lines[_cursor_pos.line][_cursor_pos.column - 1].col != word_color)
+				for (const auto word_color = _text.color_at(_cursor_pos.line, _cursor_pos.column - 1); _cursor_pos.column > 0; --_cursor_pos.column)
+					if (_text.color_at(_cursor_pos.line, _cursor_pos.column - 1) != word_color)
 						break;
 			}
 			else
@@ -1266,17 +1169,13 @@ void imgui_code_editor::move_left(size_t amount, bool selection, bool word_mode)
 }
 void imgui_code_editor::move_right(size_t amount, bool selection, bool word_mode)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
 
 	while (amount-- > 0)
 	{
-		auto &line = _lines[_cursor_pos.line];
-
-		if (_cursor_pos.column >= line.size()) // At the end of the current line, so move on to next
+		if (_cursor_pos.column >= _text.line_length(_cursor_pos.line)) // At the end of the current line, so move on to next
 		{
-			if (_cursor_pos.line >= _lines.size() - 1)
+			if (_cursor_pos.line >= _text.line_count() - 1)
 				break; // Reached end of input
 
 			_cursor_pos.line++;
@@ -1284,8 +1183,8 @@ void imgui_code_editor::move_right(size_t amount, bool selection, bool word_mode
 		}
 		else if (word_mode)
 		{
-			for (const auto word_color = _lines[_cursor_pos.line][_cursor_pos.column].col; _cursor_pos.column < _lines[_cursor_pos.line].size(); ++_cursor_pos.column)
-				if (_lines[_cursor_pos.line][_cursor_pos.column].col != word_color)
+			for (const auto word_color = _text.color_at(_cursor_pos.line, _cursor_pos.column); _cursor_pos.column < _text.line_length(_cursor_pos.line); ++_cursor_pos.column)
+				if (_text.color_at(_cursor_pos.line, _cursor_pos.column) != word_color)
 					break;
 		}
 		else
@@ -1314,8 +1213,6 @@ void imgui_code_editor::move_right(size_t amount, bool selection, bool word_mode
 }
 void imgui_code_editor::move_top(bool selection)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
 	_cursor_pos = text_pos(0, 0);
 
@@ -1343,10 +1240,8 @@ void imgui_code_editor::move_top(bool selection)
 }
 void imgui_code_editor::move_bottom(bool selection)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
-	_cursor_pos = text_pos(_lines.size() - 1, 0);
+	_cursor_pos = text_pos(_text.line_count() - 1, 0);
 
 	if (prev_pos == _cursor_pos)
 		return;
@@ -1371,8 +1266,6 @@ void imgui_code_editor::move_bottom(bool selection)
 }
 void imgui_code_editor::move_home(bool selection)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
 	_cursor_pos.column = 0;
 
@@ -1400,10 +1293,8 @@ void imgui_code_editor::move_home(bool selection)
 }
 void imgui_code_editor::move_end(bool selection)
 {
-	assert(!_lines.empty());
-
 	const auto prev_pos = _cursor_pos;
-	_cursor_pos.column = _lines[_cursor_pos.line].size();
+	_cursor_pos.column = _text.line_length(_cursor_pos.line);
 
 	if (prev_pos == _cursor_pos &&
 		_interactive_beg == _interactive_end) // This ensures that deselection works even when cursor is already at end
@@ -1432,8 +1323,14 @@ void imgui_code_editor::move_lines_up()
 	if (_select_beg.line == 0 || _readonly)
 		return;
 
-	for (size_t line = _select_beg.line; line <= _select_end.line; ++line)
-		std::swap(_lines[line], _lines[line - 1]);
+	// Move the line above the selection to below it
+	std::string line_above;
+	_text.get_line(_select_beg.line - 1, line_above);
+
+	replace_text(
+		text_pos(_select_beg.line - 1, 0),
+		text_pos(_select_end.line, _text.line_length(_select_end.line)),
+		get_text(_select_beg.line, text_pos(_select_end.line, _text.line_length(_select_end.line))) + '\n' + line_above);
 
 	_select_beg.line--;
 	_select_end.line--;
@@ -1441,11 +1338,17 @@ void imgui_code_editor::move_lines_up()
 }
 void imgui_code_editor::move_lines_down()
 {
-	if (_select_end.line + 1 >= _lines.size() || _readonly)
+	if (_select_end.line + 1 >= _text.line_count() || _readonly)
 		return;
 
-	for (size_t line = _select_end.line; line >= _select_beg.line && line < _lines.size(); --line)
-		std::swap(_lines[line], _lines[line + 1]);
+	// Move the line below the selection to above it
+	std::string line_below;
+	_text.get_line(_select_end.line + 1, line_below);
+
+	replace_text(
+		text_pos(_select_beg.line, 0),
+		text_pos(_select_end.line + 1, _text.line_length(_select_end.line + 1)),
+		line_below + '\n' + get_text(_select_beg.line, text_pos(_select_end.line, _text.line_length(_select_end.line))));
 
 	_select_beg.line++;
 	_select_end.line++;
@@ -1464,6 +1367,8 @@ bool imgui_code_editor::find_and_scroll_to_text(const std::string &text, bool ba
 	// Start search at the cursor position
 	text_pos match_pos_beg, search_pos = backwards != with_selection ? _select_beg : _select_end;
 
+	std::string line;
+
 	if (backwards)
 	{
 		const size_t match_last = text.size() - 1;
@@ -1471,14 +1376,16 @@ bool imgui_code_editor::find_and_scroll_to_text(const std::string &text, bool ba
 
 		while (true)
 		{
-			if (!_lines[search_pos.line].empty())
+			_text.get_line(search_pos.line, line);
+
+			if (!line.empty())
 			{
 				// Trim column index to the last character in the line (rather than the actual end)
-				search_pos.column = std::min(search_pos.column, _lines[search_pos.line].size() - 1);
+				search_pos.column = std::min(search_pos.column, line.size() - 1);
 
 				while (true)
 				{
-					if (compare_c(_lines[search_pos.line][search_pos.column].c, text[match_offset]))
+					if (compare_c(line[search_pos.column], text[match_offset]))
 					{
 						if (match_offset == match_last) // Keep track of end of the match
 							match_pos_beg = search_pos;
@@ -1518,21 +1425,23 @@ bool imgui_code_editor::find_and_scroll_to_text(const std::string &text, bool ba
 			if (match_offset != match_last && text[match_offset--] != '\n')
 				match_offset  = match_last; // Check for line feed in search text between lines
 
-			search_pos.column = _lines[search_pos.line].size(); // Continue at end of previous line
+			search_pos.column = _text.line_length(search_pos.line); // Continue at end of previous line
 		}
 	}
 	else
 	{
 		size_t match_offset = 0;
 
-		while (search_pos.line < _lines.size())
+		while (search_pos.line < _text.line_count())
 		{
 			if (match_offset != 0 && text[match_offset++] != '\n')
 				match_offset  = 0; // Check for line feed in search text between lines
 
-			while (search_pos.column < _lines[search_pos.line].size())
+			_text.get_line(search_pos.line, line);
+
+			while (search_pos.column < line.size())
 			{
-				if (compare_c(_lines[search_pos.line][search_pos.column].c, text[match_offset]))
+				if (compare_c(line[search_pos.column], text[match_offset]))
 				{
 					if (match_offset == 0) // Keep track of beginning of the match
 						match_pos_beg = search_pos;
@@ -1568,36 +1477,66 @@ bool imgui_code_editor::find_and_scroll_to_text(const std::string &text, bool ba
 
 void imgui_code_editor::colorize()
 {
-	if (_colorize_line_beg >= _colorize_line_end)
-		return;
+	if (_colorize_line_end > _text.line_count())
+		_colorize_line_end = _text.line_count();
+
+	std::string line;
 
 	// Step through code incrementally rather than coloring everything at once
-	const size_t from = _colorize_line_beg, to = std::min(from + 1000, _colorize_line_end);
-	_colorize_line_beg = to;
+	for (size_t budget = 1000; budget != 0 && _colorize_line_beg < _colorize_line_end; --budget)
+	{
+		const size_t line_no = _colorize_line_beg++;
+		_text.get_line(line_no, line);
+
+		const uint8_t end_state = colorize_line(line_no, line);
+
+		// Continue on to the next line if its start state changed (e.g. because a multi-line comment was opened or closed), otherwise the following lines are still valid
+		if (line_no + 1 < _text.line_count() && _text.line_state(line_no + 1) != end_state)
+		{
+			_text.set_line_state(line_no + 1, end_state);
+			_colorize_line_end = std::max(_colorize_line_end, line_no + 2);
+		}
+	}
 
-	// Reset coloring range if we have finished coloring it after this iteration
-	if (_colorize_line_end > _lines.size())
-		_colorize_line_end = _lines.size();
-	if (_colorize_line_beg == _colorize_line_end)
+	// Reset coloring range if we have finished coloring it
+	if (_colorize_line_beg >= _colorize_line_end)
 	{
 		_colorize_line_beg = std::numeric_limits<size_t>::max();
 		_colorize_line_end = 0;
 	}
+}
+uint8_t imgui_code_editor::colorize_line(size_t line_no, const std::string &line)
+{
+	size_t column = 0;
 
-	// Copy lines into string for consumption by the lexer
-	std::string input_string;
-	for (size_t l = from; l < to && l < _lines.size(); ++l, input_string.push_back('\n'))
-		for (size_t k = 0; k < _lines[l].size(); ++k)
-			input_string.push_back(_lines[l][k].c);
+	// Finish a multi-line comment started in a previous line
+	if (_text.line_state(line_no) == line_state_multiline_comment)
+	{
+		const size_t comment_end = line.find("*/");
+		if (comment_end == std::string::npos)
+		{
+			_text.set_color(line_no, 0, line.size(), color_multiline_comment);
+			return line_state_multiline_comment;
+		}
+
+		column = comment_end + 2;
+		_text.set_color(line_no, 0, column, color_multiline_comment);
+	}
+
+	// Reset colors, so that whitespace between tokens does not keep stale colors
+	_text.set_color(line_no, column, line.size() - column, color_default);
+
+	uint8_t end_state = line_state_default;
 
 	reshadefx::lexer lexer(
-		input_string,
+		line.substr(column),
 		false /* ignore_comments */,
 		true  /* ignore_whitespace */,
 		false /* ignore_pp_directives */,
 		true  /* ignore_line_directives */,
 		false /* ignore_keywords */,
-		false /* escape_string_literals */);
+		false /* escape_string_literals */,
+		reshadefx::location(1, static_cast<unsigned int>(column + 1)));
 
 	for (reshadefx::token tok; (tok = lexer.lex()).id != reshadefx::tokenid::end_of_file;)
 	{
@@ -1759,20 +1698,13 @@ void imgui_code_editor::colorize()
 			break;
 		}
 
-		// Update character range matching the current the token
-		size_t line = from + tok.location.line - 1;
-		size_t column = tok.location.column - 1;
-
-		for (size_t k = 0; k < tok.length; ++k)
-		{
-			if (column >= _lines[line].size())
-			{
-				line++;
-				column = 0;
-				continue;
-			}
+		// Multi-line comment tokens that are not terminated continue on the next line
+		if (tok.id == reshadefx::tokenid::multi_line_comment && (tok.length < 4 || line.compare(column + tok.offset + tok.length - 2, 2, "*/") != 0))
+			end_state = line_state_multiline_comment;
 
-			_lines[line][column++].col = col;
-		}
+		// Update character range matching the current the token
+		_text.set_color(line_no, column + tok.offset, tok.length, static_cast<uint8_t>(col));
 	}
+
+	return end_state;
 }
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "text_buffer.hpp"
 #include <array>
 #include <string>
 #include <vector>
@@ -61,8 +62,6 @@ public:
 		line
 	};
 
-	imgui_code_editor();
-
 	void render(const char *title, bool border = false);
 
 	void select(const text_pos &beg, const text_pos &end, selection_mode mode = selection_mode::normal);
@@ -96,30 +95,35 @@ public:
 	bool find_and_scroll_to_text(const std::string &text, bool backwards = false, bool with_selection = false);
 
 private:
-	struct glyph
+	enum line_state : uint8_t
 	{
-		char c = '\0';
-		color col = color_default;
+		line_state_default,
+		line_state_multiline_comment,
 	};
 
 	struct undo_record
 	{
 		text_pos added_beg;
 		text_pos added_end;
-		std::string added;
+		std::vector<text_buffer::piece> added;
 		text_pos removed_beg;
 		text_pos removed_end;
-		std::string removed;
+		std::vector<text_buffer::piece> removed;
 	};
 
 	void record_undo(undo_record &&record);
 
 	void insert_character(char c, bool auto_indent);
 
+	text_pos insert_text_at(const text_pos &pos, const std::string &text);
+	text_pos insert_text_at(const text_pos &pos, const std::vector<text_buffer::piece> &pieces);
+	text_pos replace_text(const text_pos &beg, const text_pos &end, const std::string &text);
+	void erase_text(const text_pos &beg, const text_pos &end);
+	void update_inserted_lines(const text_pos &beg, const text_pos &end);
+
 	void delete_next();
 	void delete_previous();
 	void delete_selection();
-	void delete_lines(size_t first_line, size_t last_line);
 
 	void clipboard_copy();
 	void clipboard_cut();
@@ -137,6 +141,7 @@ private:
 	void move_lines_down();
 
 	void colorize();
+	uint8_t colorize_line(size_t line_no, const std::string &line);
 
 	float _left_margin = 10.0f;
 	float _line_spacing = 1.0f;
@@ -147,7 +152,7 @@ private:
 	float _cursor_anim = 0.0f;
 	double _last_click_time = -1.0;
 
-	std::vector<std::vector<glyph>> _lines;
+	text_buffer _text;
 	std::unordered_map<size_t, std::pair<std::string, bool>> _errors;
 
 	text_pos _cursor_pos;
@@ -166,7 +171,6 @@ private:
 
 	size_t _undo_index = 0;
 	std::vector<undo_record> _undo;
-	bool _in_undo_operation = false;
 
 	size_t _colorize_line_beg = 0;
 	size_t _colorize_line_end = 0;
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/// <summary>
+/// Epoch-based reclamation shared by all lock-free data structures (e.g. <see cref="lockfree_table"/>), whether they belong to the Vulkan or the D3D12 backend.
+/// A thread holds a <see cref="guard"/> while it uses references to values, and a value that was erased is only destroyed once no thread holds a guard anymore that it entered before the erase.
+/// </summary>
+class lockfree_epoch
+{
+public:
+	/// <summary>
+	/// Number of threads that can hold guards at the same time without blocking reclamation altogether.
+	/// </summary>
+	static constexpr size_t MAX_THREADS = 256;
+
+	/// <summary>
+	/// Keeps all values that are reachable from a table when this is constructed alive until it is destroyed. Guards may be nested.
+	/// </summary>
+	class guard
+	{
+	public:
+		guard() { enter(); }
+		~guard() { leave(); }
+
+		guard(const guard &) = delete;
+		guard &operator=(const guard &) = delete;
+	};
+
+	/// <summary>
+	/// Advances the global epoch. Call this after a value was made unreachable and tag it with the result.
+	/// </summary>
+	/// <returns>The epoch the value was retired in.</returns>
+	static uint64_t retire()
+	{
+		return s_global_epoch.fetch_add(1, std::memory_order_seq_cst);
+	}
+
+	/// <summary>
+	/// Gets the oldest epoch a thread entered its current guard in. Values that were retired in an earlier epoch than this can no longer be in use by any thread.
+	/// </summary>
+	static uint64_t oldest_epoch()
+	{
+		// Order this after the stores that made the values unreachable
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (s_num_unregistered_guards.load(std::memory_order_seq_cst) != 0)
+			return 0;
+
+		uint64_t oldest = std::numeric_limits<uint64_t>::max();
+		for (const thread_record &record : s_records)
+			if (const uint64_t epoch = record.epoch.load(std::memory_order_seq_cst); epoch != 0 && epoch < oldest)
+				oldest = epoch;
+		return oldest;
+	}
+
+private:
+	struct alignas(64) thread_record
+	{
+		std::atomic<bool> in_use;
+		std::atomic<uint64_t> epoch; // Epoch the owning thread entered its outermost guard in, or zero if it holds none
+	};
+
+	struct thread_state
+	{
+		~thread_state()
+		{
+			// Hand the record over to another thread once this one exits
+			if (record != nullptr)
+				record->in_use.store(false, std::memory_order_release);
+		}
+
+		thread_record *record = nullptr;
+		bool is_registered = false;
+		size_t depth = 0;
+	};
+
+	static thread_state &current_thread()
+	{
+		thread_local thread_state state;
+
+		if (!state.is_registered)
+		{
+			state.is_registered = true;
+
+			for (thread_record &record : s_records)
+			{
+				if (bool in_use = false; !record.in_use.load(std::memory_order_relaxed) &&
+					record.in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+				{
+					state.record = &record;
+					break;
+				}
+			}
+		}
+
+		return state;
+	}
+
+	static void enter()
+	{
+		thread_state &state = current_thread();
+		if (state.depth++ != 0)
+			return;
+
+		// This has to be visible before any value is looked up, which is why it is an exchange and not a store (which could be reordered with the following loads)
+		if (state.record != nullptr)
+			state.record->epoch.exchange(s_global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+		else
+			s_num_unregistered_guards.fetch_add(1, std::memory_order_seq_cst); // Ran out of records, so block reclamation entirely while this thread is using values
+	}
+	static void leave()
+	{
+		thread_state &state = current_thread();
+		assert(state.depth != 0);
+		if (--state.depth != 0)
+			return;
+
+		if (state.record != nullptr)
+			state.record->epoch.store(0, std::memory_order_release);
+		else
+			s_num_unregistered_guards.fetch_sub(1, std::memory_order_release);
+	}
+
+	static inline std::atomic<uint64_t> s_global_epoch = 1;
+	static inline std::atomic<size_t> s_num_unregistered_guards = 0;
+	static inline thread_record s_records[MAX_THREADS] = {};
+};
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+/// <summary>
+/// An unbounded lock-free queue for multiple producers and a single consumer (based on the node-based MPSC queue by Dmitry Vyukov).
+/// Adding a value is a single atomic exchange, so producers never block each other or the consumer.
+/// </summary>
+template <typename T>
+class lockfree_queue
+{
+	struct node
+	{
+		std::atomic<node *> next = nullptr;
+		T value = {};
+	};
+
+public:
+	lockfree_queue() : _head(new node()), _tail(_head.load(std::memory_order_relaxed)) {}
+	~lockfree_queue()
+	{
+		for (node *entry = _tail, *next; entry != nullptr; entry = next)
+		{
+			next = entry->next.load(std::memory_order_relaxed);
+			delete entry;
+		}
+	}
+
+	lockfree_queue(const lockfree_queue &) = delete;
+	lockfree_queue &operator=(const lockfree_queue &) = delete;
+
+	/// <summary>
+	/// Adds a value to the end of the queue. This may be called from any thread.
+	/// </summary>
+	/// <param name="value">The value to add.</param>
+	void push(T &&value)
+	{
+		node *const entry = new node();
+		entry->value = std::move(value);
+
+		// Publish the new entry as head first, then link it to the previous one (the consumer stops at an entry whose successor is not linked yet)
+		node *const prev = _head.exchange(entry, std::memory_order_acq_rel);
+		prev->next.store(entry, std::memory_order_release);
+	}
+
+	/// <summary>
+	/// Removes the value at the front of the queue. This may only be called from one thread at a time.
+	/// </summary>
+	/// <param name="value">The removed value.</param>
+	/// <returns><c>true</c> if a value was removed, <c>false</c> if the queue is empty (or the next value is still being added).</returns>
+	bool pop(T &value)
+	{
+		node *const tail = _tail;
+		node *const next = tail->next.load(std::memory_order_acquire);
+		if (next == nullptr)
+			return false;
+
+		// The removed entry becomes the new sentinel, so only move its value out
+		value = std::move(next->value);
+		_tail = next;
+		delete tail;
+
+		return true;
+	}
+
+	/// <summary>
+	/// Checks whether there are values left in the queue. This may only be called from the consumer thread.
+	/// </summary>
+	bool empty() const
+	{
+		return _tail->next.load(std::memory_order_acquire) == nullptr;
+	}
+
+private:
+	std::atomic<node *> _head;
+	node *_tail;
+};
@@ -4,23 +4,21 @@
  */
 
 #include "buffer_detection.hpp"
-#include <cmath>
 #include <cassert>
 
 void reshade::opengl::buffer_detection::reset(GLuint default_width, GLuint default_height, GLenum default_format)
 {
-	// Reset statistics for next frame
-	_stats.vertices = 0;
-	_stats.drawcalls = 0;
+	// Do not remove FBO attachments, since they are usually only created during startup
+	// Instead only reset the draw call statistics
+	_tracker.reset_stats();
 
 #if RESHADE_DEPTH
-	// Initialize information for the default depth buffer
-	_depth_source_table[0] = { 0, 0, default_width, default_height, 0, default_format };
+	// Initialize information for the default depth buffer (and update it in case the back buffer was resized)
+	if (const uint32_t slot = _tracker.find(0); slot != _tracker.npos &&
+		(_tracker.data(slot).width != default_width || _tracker.data(slot).height != default_height || _tracker.data(slot).format != default_format))
+		_tracker.remove(0);
 
-	// Do not clear depth source table, since FBO attachments are usually only created during startup
-	for (auto &source : _depth_source_table)
-		// Instead only reset the draw call statistics
-		source.second.stats = { 0, 0 };
+	_tracker.add(0, { default_width, default_height }, { 0, 0, default_width, default_height, 0, default_format });
 #else
 	UNREFERENCED_PARAMETER(default_width);
 	UNREFERENCED_PARAMETER(default_height);
@@ -33,27 +31,24 @@ void reshade::opengl::buffer_detection::on_draw(GLsizei vertices)
 	vertices += _current_vertex_count;
 	_current_vertex_count = 0;
 
-	_stats.vertices += vertices;
-	_stats.drawcalls += 1;
-
 #if RESHADE_DEPTH
 	GLint object = 0;
 	GLint target = GL_NONE;
 	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &object);
 	if (object != 0) { // Zero is valid too, in which case the default depth buffer is referenced, instead of a FBO
 		glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &target);
-		if (target == GL_NONE)
-			return; // FBO does not have a depth attachment
-		glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &object);
+		if (target != GL_NONE)
+			glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &object);
 	}
 
-	if (const auto it = _depth_source_table.find(object | (target == GL_RENDERBUFFER ? 0x80000000 : 0));
-		it != _depth_source_table.end())
-	{
-		it->second.stats.vertices += vertices;
-		it->second.stats.drawcalls += 1;
-	}
+	// There is no notification when the draw framebuffer binding changes, so have to look up the attachment on every draw call
+	const uint32_t slot = (object == 0 || target != GL_NONE) ? // Skip FBOs that do not have a depth attachment
+		_tracker.find(object | (target == GL_RENDERBUFFER ? 0x80000000 : 0)) : _tracker.npos;
+	if (slot != _tracker.bound())
+		_tracker.bind(slot);
 #endif
+
+	_tracker.on_draw(vertices);
 }
 
 #if RESHADE_DEPTH
@@ -63,7 +58,7 @@ void reshade::opengl::buffer_detection::on_fbo_attachment(GLenum attachment, GLe
 		return;
 
 	const GLuint id = object | (target == GL_RENDERBUFFER ? 0x80000000 : 0);
-	if (_depth_source_table.find(id) != _depth_source_table.end())
+	if (_tracker.find(id) != _tracker.npos)
 		return;
 
 	depthstencil_info info = { object, static_cast<GLuint>(level), 0, 0, target, GL_NONE };
@@ -146,7 +141,7 @@ void reshade::opengl::buffer_detection::on_fbo_attachment(GLenum attachment, GLe
 		glBindTexture(target, previous_tex);
 	}
 
-	_depth_source_table.emplace(id, info);
+	_tracker.add(id, { info.width, info.height }, info);
 }
 void reshade::opengl::buffer_detection::on_delete_fbo_attachment(GLenum target, GLuint object)
 {
@@ -154,49 +149,26 @@ void reshade::opengl::buffer_detection::on_delete_fbo_attachment(GLenum target,
 		return;
 
 	const GLuint id = object | (target == GL_RENDERBUFFER ? 0x80000000 : 0);
-	_depth_source_table.erase(id);
+	_tracker.remove(id);
 }
 
 reshade::opengl::buffer_detection::depthstencil_info reshade::opengl::buffer_detection::find_best_depth_texture(GLuint width, GLuint height, GLuint override) const
 {
-	GLuint best_match = 0;
-	depthstencil_info best_snapshot = _depth_source_table.at(0); // Always fall back to default depth buffer if no better match is found
+	// Always fall back to default depth buffer if no better match is found
+	const uint32_t default_slot = _tracker.find(0);
+	assert(default_slot != _tracker.npos);
 
 	if (override != std::numeric_limits<GLuint>::max())
 	{
-		const auto source_it = _depth_source_table.find(override);
-		if (source_it != _depth_source_table.end())
-			return source_it->second;
-		else
-			return best_snapshot;
+		const uint32_t slot = _tracker.find(override);
+		return _tracker.data(slot != _tracker.npos ? slot : default_slot);
 	}
 
-	for (const auto &[image, snapshot] : _depth_source_table)
-	{
-		if (snapshot.stats.drawcalls == 0 || snapshot.stats.vertices == 0)
-			continue; // Skip unused
-
-		if (width != 0 && height != 0)
-		{
-			const float w = static_cast<float>(width);
-			const float w_ratio = w / snapshot.width;
-			const float h = static_cast<float>(height);
-			const float h_ratio = h / snapshot.height;
-			const float aspect_ratio = (w / h) - (static_cast<float>(snapshot.width) / snapshot.height);
-
-			if (std::fabs(aspect_ratio) > 0.1f || w_ratio > 1.85f || h_ratio > 1.85f || w_ratio < 0.5f || h_ratio < 0.5f)
-				continue; // Not a good fit
-		}
-
-		const auto curr_weight = snapshot.stats.vertices * (1.2f - static_cast<float>(snapshot.stats.drawcalls) / _stats.drawcalls);
-		const auto best_weight = best_snapshot.stats.vertices * (1.2f - static_cast<float>(best_snapshot.stats.drawcalls) / _stats.vertices);
-		if (curr_weight >= best_weight)
-		{
-			best_match = image;
-			best_snapshot = snapshot;
-		}
-	}
+	depth_selection::selection_options options;
+	options.width = width;
+	options.height = height;
+	options.heuristic = depth_selection::selection_heuristic::weighted_vertices;
 
-	return best_snapshot;
+	return _tracker.data(_tracker.find_best(options, default_slot));
 }
 #endif
@@ -5,31 +5,25 @@
 
 #pragma once
 
-#include <map>
 #include "opengl.hpp"
+#include "depth_selection.hpp"
 
 namespace reshade::opengl
 {
 	class buffer_detection
 	{
 	public:
-		struct draw_stats
-		{
-			GLuint vertices = 0;
-			GLuint drawcalls = 0;
-		};
 		struct depthstencil_info
 		{
 			GLuint obj, level;
 			GLuint width, height;
 			GLenum target, format;
-			draw_stats stats;
 		};
 
 		void reset(GLuint default_width, GLuint default_height, GLenum default_format);
 
-		GLuint total_vertices() const { return _stats.vertices; }
-		GLuint total_drawcalls() const { return _stats.drawcalls; }
+		GLuint total_vertices() const { return _tracker.total_vertices(); }
+		GLuint total_drawcalls() const { return _tracker.total_drawcalls(); }
 
 		void on_draw(GLsizei vertices);
 		void on_draw_vertex(GLsizei vertices) { _current_vertex_count += vertices; }
@@ -38,7 +32,7 @@ namespace reshade::opengl
 		void on_fbo_attachment(GLenum attachment, GLenum target, GLuint object, GLint level);
 		void on_delete_fbo_attachment(GLenum target, GLuint object);
 
-		const auto &depth_buffer_counters() const { return _depth_source_table; }
+		const auto &depth_buffer_tracker() const { return _tracker; }
 
 		depthstencil_info find_best_depth_texture(GLuint width, GLuint height,
 			GLuint override = std::numeric_limits<GLuint>::max()) const;
@@ -46,9 +40,7 @@ namespace reshade::opengl
 
 	private:
 		GLuint _current_vertex_count = 0; // Used to calculate vertex count inside glBegin/glEnd pairs
-		draw_stats _stats;
-#if RESHADE_DEPTH
-		std::map<GLuint, depthstencil_info> _depth_source_table;
-#endif
+		// Handles are the object names of FBO attachments (with the highest bit set for RBOs), or zero for the default depth buffer
+		depth_selection::tracker<depthstencil_info> _tracker;
 	};
 }
@@ -7,6 +7,7 @@
 #include "runtime_gl.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "format_conversion.hpp"
 #include <imgui.h>
 
 namespace reshade::opengl
@@ -44,8 +45,9 @@ namespace reshade::opengl
 
 	struct opengl_technique_data
 	{
-		GLuint query = 0;
-		bool query_in_flight = false;
+		query_ring<NUM_GPU_QUERY_FRAMES> queries;
+		std::vector<GLuint> timestamp_queries; // One before the first pass and one after every pass for each frame
+		std::vector<GLuint64> timestamps;
 		std::vector<opengl_pass_data> passes;
 		std::vector<opengl_sampler_data> samplers;
 	};
@@ -303,21 +305,17 @@ bool reshade::opengl::runtime_gl::capture_screenshot(uint8_t *buffer) const
 	glReadBuffer(_current_fbo == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
 	glReadPixels(0, 0, GLsizei(_width), GLsizei(_height), GL_RGBA, GL_UNSIGNED_BYTE, buffer);
 
-	// Flip image horizontally
-	for (unsigned int y = 0, pitch = _width * 4; y * 2 < _height; ++y)
+	// Flip image horizontally and clear alpha channel
+	const unsigned int pitch = _width * 4;
+	const auto temp = static_cast<uint8_t *>(alloca(pitch));
+	for (unsigned int y = 0; y * 2 < _height; ++y)
 	{
-		const auto i1 = y * pitch;
-		const auto i2 = (_height - 1 - y) * pitch;
+		const auto line1 = buffer + pitch * (y);
+		const auto line2 = buffer + pitch * (_height - 1 - y);
 
-		for (unsigned int x = 0; x < pitch; x += 4)
-		{
-			buffer[i1 + x + 3] = 0xFF; // Clear alpha channel
-			buffer[i2 + x + 3] = 0xFF;
-
-			std::swap(buffer[i1 + x + 0], buffer[i2 + x + 0]);
-			std::swap(buffer[i1 + x + 1], buffer[i2 + x + 1]);
-			std::swap(buffer[i1 + x + 2], buffer[i2 + x + 2]);
-		}
+		std::memcpy(temp, line1, pitch);
+		convert_rgbx8_to_rgba8(line1, line2, _width, false);
+		convert_rgbx8_to_rgba8(line2, temp, _width, false);
 	}
 
 	return true;
@@ -522,7 +520,9 @@ bool reshade::opengl::runtime_gl::init_effect(size_t index)
 		auto impl = new opengl_technique_data(technique_init);
 		technique.impl = impl;
 
-		glGenQueries(1, &impl->query);
+		impl->timestamps.resize(technique.schedule.passes.size() + 1);
+		impl->timestamp_queries.resize(impl->timestamps.size() * NUM_GPU_QUERY_FRAMES);
+		glGenQueries(static_cast<GLsizei>(impl->timestamp_queries.size()), impl->timestamp_queries.data());
 
 		impl->passes.resize(technique.passes.size());
 		for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
@@ -683,7 +683,7 @@ void reshade::opengl::runtime_gl::unload_effect(size_t index)
 		if (impl == nullptr)
 			continue;
 
-		glDeleteQueries(1, &impl->query);
+		glDeleteQueries(static_cast<GLsizei>(impl->timestamp_queries.size()), impl->timestamp_queries.data());
 
 		for (opengl_pass_data &pass_data : impl->passes)
 		{
@@ -712,7 +712,7 @@ void reshade::opengl::runtime_gl::unload_effects()
 		if (impl == nullptr)
 			continue;
 
-		glDeleteQueries(1, &impl->query);
+		glDeleteQueries(static_cast<GLsizei>(impl->timestamp_queries.size()), impl->timestamp_queries.data());
 
 		for (opengl_pass_data &pass_data : impl->passes)
 		{
@@ -842,19 +842,11 @@ void reshade::opengl::runtime_gl::upload_texture(const texture &texture, const u
 	assert(impl != nullptr && pixels != nullptr && texture.impl_reference == texture_reference::none);
 
 	unsigned int upload_pitch = texture.width * 4;
-	std::vector<uint8_t> upload_data(pixels, pixels + upload_pitch * texture.height);
+	std::vector<uint8_t> upload_data(upload_pitch * texture.height);
 
-	// Flip image data horizontally
-	const auto temp = static_cast<uint8_t *>(alloca(upload_pitch));
-	for (uint32_t y = 0; 2 * y < texture.height; y++)
-	{
-		const auto line1 = upload_data.data() + upload_pitch * (y);
-		const auto line2 = upload_data.data() + upload_pitch * (texture.height - 1 - y);
-
-		std::memcpy(temp,  line1, upload_pitch);
-		std::memcpy(line1, line2, upload_pitch);
-		std::memcpy(line2, temp,  upload_pitch);
-	}
+	// Flip image data horizontally while copying it
+	for (uint32_t y = 0; y < texture.height; y++)
+		std::memcpy(upload_data.data() + upload_pitch * (y), pixels + upload_pitch * (texture.height - 1 - y), upload_pitch);
 
 	// Get current state
 	GLint previous_tex = 0;
@@ -931,19 +923,34 @@ void reshade::opengl::runtime_gl::render_technique(technique &technique)
 
 	const auto impl = static_cast<opengl_technique_data *>(technique.impl);
 
-	if (GLuint available = 0; impl->query_in_flight)
+	const size_t num_timestamps = impl->timestamps.size();
+
+	// Evaluate queries of previous frames that finished by now
+	for (size_t slot; impl->queries.oldest_pending(slot); impl->queries.pop())
 	{
-		glGetQueryObjectuiv(impl->query, GL_QUERY_RESULT_AVAILABLE, &available);
-		if (GLuint64 elapsed_time = 0; available != GL_FALSE)
-		{
-			glGetQueryObjectui64v(impl->query, GL_QUERY_RESULT, &elapsed_time);
-			technique.average_gpu_duration.append(elapsed_time);
-			impl->query_in_flight = false; // Reset query status
-		}
+		const GLuint *const slot_queries = impl->timestamp_queries.data() + slot * num_timestamps;
+
+		// Queries complete in order, so all time stamps of a frame are available once the last one is
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(slot_queries[num_timestamps - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+			break;
+
+		for (size_t i = 0; i < num_timestamps; ++i)
+			glGetQueryObjectui64v(slot_queries[i], GL_QUERY_RESULT, &impl->timestamps[i]);
+
+		// Time stamps are in nanoseconds
+		technique.append_gpu_timestamps(impl->timestamps.data(), 1'000'000'000);
 	}
 
-	if (!impl->query_in_flight)
-		glBeginQuery(GL_TIME_ELAPSED, impl->query);
+	// Skip time measurement this frame if the queries of all frames are still in flight
+	const GLuint *timestamp_query = nullptr;
+	if (size_t slot; impl->queries.push(slot))
+	{
+		timestamp_query = impl->timestamp_queries.data() + slot * num_timestamps;
+
+		glQueryCounter(*timestamp_query++, GL_TIMESTAMP);
+	}
 
 	// Set up global states
 	glDisable(GL_CULL_FACE);
@@ -958,6 +965,8 @@ void reshade::opengl::runtime_gl::render_technique(technique &technique)
 	// Set up shader constants
 	if (_effect_ubos[technique.effect_index] != 0)
 	{
+		RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, upload_constants);
+
 		glBindBufferBase(GL_UNIFORM_BUFFER, 0, _effect_ubos[technique.effect_index]);
 		glBufferSubData(GL_UNIFORM_BUFFER, 0, _effects[technique.effect_index].uniform_data_storage.size(), _effects[technique.effect_index].uniform_data_storage.data());
 	}
@@ -973,11 +982,12 @@ void reshade::opengl::runtime_gl::render_technique(technique &technique)
 	}
 
 	bool is_effect_stencil_cleared = false;
-	bool needs_implicit_backbuffer_copy = true; // First pass always needs the back buffer updated
 
-	for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
+	for (const reshadefx::scheduled_pass &scheduled : technique.schedule.passes)
 	{
-		if (needs_implicit_backbuffer_copy)
+		const size_t pass_index = scheduled.pass_index;
+
+		if (scheduled.copy_backbuffer)
 		{
 			// Copy back buffer of previous pass to texture
 			glDisable(GL_FRAMEBUFFER_SRGB);
@@ -1036,7 +1046,7 @@ void reshade::opengl::runtime_gl::render_technique(technique &technique)
 			(pass_info.color_write_mask & (1 << 2)) != 0,
 			(pass_info.color_write_mask & (1 << 3)) != 0);
 
-		if (pass_info.clear_render_targets)
+		if (scheduled.clear_render_targets)
 		{
 			for (GLuint k = 0; k < 8; k++)
 			{
@@ -1070,17 +1080,12 @@ void reshade::opengl::runtime_gl::render_technique(technique &technique)
 		_vertices += pass_info.num_vertices;
 		_drawcalls += 1;
 
-		needs_implicit_backbuffer_copy = false;
-		for (GLuint texture_id : pass_data.draw_textures)
+		for (GLuint k = 0; k < 8 && pass_data.draw_textures[k] != 0; ++k)
 		{
-			if (texture_id == 0)
-				break;
+			if ((scheduled.generate_mipmaps & (1 << k)) == 0)
+				continue; // The schedule never requests this for the back buffer
 
-			if (texture_id == _tex[TEX_BACK_SRGB])
-			{
-				needs_implicit_backbuffer_copy = true;
-				break;
-			}
+			const GLuint texture_id = pass_data.draw_textures[k];
 
 			// Regenerate mipmaps of any textures bound as render target
 			for (GLuint s_slot = 0; s_slot < impl->samplers.size(); ++s_slot)
@@ -1094,12 +1099,10 @@ void reshade::opengl::runtime_gl::render_technique(technique &technique)
 				}
 			}
 		}
-	}
 
-	if (!impl->query_in_flight)
-		glEndQuery(GL_TIME_ELAPSED);
-
-	impl->query_in_flight = true;
+		if (timestamp_query != nullptr)
+			glQueryCounter(*timestamp_query++, GL_TIMESTAMP);
+	}
 }
 
 #if RESHADE_GUI
@@ -1251,11 +1254,16 @@ void reshade::opengl::runtime_gl::draw_depth_debug_menu()
 	ImGui::Separator();
 	ImGui::Spacing();
 
-	for (const auto &[depth_source, snapshot] : _buffer_detection.depth_buffer_counters())
+	const auto &tracker = _buffer_detection.depth_buffer_tracker();
+
+	for (uint32_t slot = 0; slot < tracker.resources().size(); ++slot)
 	{
-		if (snapshot.format == GL_NONE)
+		const auto &snapshot = tracker.counters(slot);
+		if (!snapshot.in_use || tracker.data(slot).format == GL_NONE)
 			continue; // Skip invalid entries
 
+		const GLuint depth_source = static_cast<GLuint>(snapshot.handle);
+
 		char label[512] = "";
 		sprintf_s(label, "%s0x%08x", (depth_source == _depth_source && !_has_high_network_activity ? "> " : "  "), depth_source);
 
@@ -1265,13 +1273,16 @@ void reshade::opengl::runtime_gl::draw_depth_debug_menu()
 
 		ImGui::SameLine();
 		ImGui::Text("| %4ux%-4u | %5u draw calls ==> %8u vertices |%s",
-			snapshot.width, snapshot.height, snapshot.stats.drawcalls, snapshot.stats.vertices,
+			snapshot.desc.width, snapshot.desc.height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices,
 			(depth_source & 0x80000000) != 0 ? " RBO" : depth_source != 0 ? " FBO" : "");
 	}
 
 	ImGui::Spacing();
 	ImGui::Separator();
 	ImGui::Spacing();
+
+	if (ImGui::Button("Record trace of next frame", ImVec2(-1, 0)))
+		start_depth_trace();
 }
 
 void reshade::opengl::runtime_gl::update_depth_texture_bindings(buffer_detection::depthstencil_info info)
@@ -8,6 +8,9 @@
 #include "runtime.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "runtime_preset_index.hpp"
+#include "runtime_capture.hpp"
+#include "depth_selection.hpp"
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
 #include "effect_preprocessor.hpp"
@@ -25,6 +28,17 @@ extern volatile long g_network_traffic;
 extern std::filesystem::path g_reshade_dll_path;
 extern std::filesystem::path g_target_executable_path;
 
+struct reshade::screenshot_write
+{
+	std::vector<uint8_t> pixels;
+	unsigned int width = 0, height = 0;
+	unsigned int format = 0;
+	bool success = false;
+	std::filesystem::path path;
+	std::filesystem::path preset_path;
+	std::filesystem::path preset_copy_path;
+};
+
 static inline auto absolute_path(std::filesystem::path path)
 {
 	std::error_code ec;
@@ -101,7 +115,15 @@ reshade::runtime::runtime() :
 	_screenshot_key_data(),
 	_prev_preset_key_data(),
 	_next_preset_key_data(),
-	_screenshot_path(g_target_executable_path.parent_path())
+	_preset_index(std::make_unique<preset_index>()),
+	_current_preset_bindings(std::make_shared<preset_bindings>()),
+	_transition_preset_bindings(std::make_unique<preset_bindings>()),
+	_screenshot_path(g_target_executable_path.parent_path()),
+	_screenshot_readback(*this, 4),
+	_capture_key_data(),
+	_capture_file(std::make_unique<capture_file>()),
+	_frame_stats_key_data(),
+	_trace_key_data()
 {
 	// Default shortcut PrtScrn
 	_screenshot_key_data[0] = 0x2C;
@@ -118,14 +140,25 @@ reshade::runtime::runtime() :
 
 	_needs_update = check_for_update(_latest_version);
 
+	// Keep compiled shaders in the temporary directory, so that they are reused across applications and sessions
+	std::error_code ec;
+	if (const std::filesystem::path temp_path = std::filesystem::temp_directory_path(ec); !ec)
+		_permutation_cache = std::make_unique<permutation_cache>(temp_path / L"ReShade" / L"ShaderCache");
+	else
+		_permutation_cache = std::make_unique<permutation_cache>(std::filesystem::path());
+
 #if RESHADE_GUI
 	init_ui();
 #endif
 	load_config();
+
+	// Start indexing the preset directory in the background, so that the first preset switch does not have to wait for it
+	_preset_index->refresh(absolute_path(_current_preset_path.parent_path()));
 }
 reshade::runtime::~runtime()
 {
 	assert(_worker_threads.empty());
+	assert(!_screenshot_write_thread.joinable());
 	assert(!_is_initialized && _techniques.empty());
 
 #if RESHADE_GUI
@@ -159,8 +192,26 @@ void reshade::runtime::on_reset()
 	if (!_is_initialized)
 		return;
 
+	// Finish writing any screenshots still in flight, before the readback resources are destroyed
+	_screenshot_readback.poll(true);
+	_readback_data.clear();
+	finish_screenshots(true);
+
+	// The frame dimensions may change after a reset, so end the capture here
+	if (_capture_file->is_open())
+	{
+		_capture_file->close();
+		_is_capturing_frames = false;
+
+		LOG(INFO) << "Stopped frame capture after " << _capture_file->frames_started() << " frames.";
+	}
+
 	unload_effects();
 
+	// Finish writing the configuration and presets now, the background writer thread would be terminated at process exit
+	if (!ini_file::flush_cache_and_wait())
+		_preset_save_success = false;
+
 #if RESHADE_GUI
 	if (_imgui_font_atlas != nullptr)
 		destroy_texture(*_imgui_font_atlas);
@@ -173,6 +224,32 @@ void reshade::runtime::on_reset()
 }
 void reshade::runtime::on_present()
 {
+	RESHADE_TRACE_SCOPE("present");
+
+	// Write screenshots whose copy has finished on the GPU in the meantime
+	_screenshot_readback.poll();
+	finish_screenshots(false);
+
+	if (_is_capturing_frames)
+		capture_frame(); // Capture before the overlay is drawn
+	else if (_capture_file->is_open() && _capture_file->frames_in_flight() == 0)
+	{
+		// Only close the capture file once all frames that were started were written to it
+		LOG(INFO) << "Finished frame capture with " << _capture_file->frames_started() << " frames.";
+
+		_capture_file->close();
+	}
+
+#if RESHADE_DEPTH
+	// The runtime already selected the depth buffer for this frame at this point, so the trace contains the entire frame including the selection
+	if (_depth_trace_frames != 0 && --_depth_trace_frames == 0)
+	{
+		depth_selection::trace_writer::stop();
+
+		LOG(INFO) << "Finished recording depth-stencil trace.";
+	}
+#endif
+
 	// Get current time and date
 	time_t t = std::time(nullptr); tm tm;
 	localtime_s(&tm, &t);
@@ -186,6 +263,10 @@ void reshade::runtime::on_present()
 	_last_frame_duration = current_time - _last_present_time;
 	_last_present_time = current_time;
 
+	// The first frame duration is measured from the creation of the runtime, so skip it
+	if (_framecount > 1)
+		_frame_times.record(std::chrono::duration_cast<std::chrono::nanoseconds>(_last_frame_duration).count());
+
 #ifdef NDEBUG
 	// Lock input so it cannot be modified by other threads while we are reading it here
 	const auto input_lock = _input->lock();
@@ -193,7 +274,9 @@ void reshade::runtime::on_present()
 
 #if RESHADE_GUI
 	// Draw overlay
-	draw_ui();
+	{ RESHADE_TRACE_SCOPE("draw_ui");
+		draw_ui();
+	}
 
 	if (_should_save_screenshot && _screenshot_save_ui && _show_menu)
 		save_screenshot(L" ui");
@@ -211,8 +294,22 @@ void reshade::runtime::on_present()
 		if (_input->is_key_pressed(_screenshot_key_data))
 			_should_save_screenshot = true; // Notify 'update_and_render_effects' that we want to save a screenshot next frame
 
+		if (_input->is_key_pressed(_capture_key_data))
+		{
+			if (_capture_file->is_open())
+				_is_capturing_frames = false; // The file is closed in a later frame, once all pending frames were written
+			else
+				start_frame_capture();
+		}
+
+		if (_input->is_key_pressed(_frame_stats_key_data))
+			save_frame_statistics();
+
+		if (_input->is_key_pressed(_trace_key_data) && !trace::is_recording())
+			start_trace();
+
 		// Do not allow the next shortcuts while effects are being loaded or compiled (since they affect that state)
-		if (!is_loading() && _reload_compile_queue.empty())
+		if (!is_loading() && _reload_compile_queue.empty() && _skipped_effects_loading.empty())
 		{
 			if (_input->is_key_pressed(_reload_key_data))
 				load_effects();
@@ -226,12 +323,13 @@ void reshade::runtime::on_present()
 					_last_preset_switching_time = current_time;
 					_is_in_between_presets_transition = true;
 					save_config();
+					load_current_preset();
 				}
 			}
 
 			// Continuously update preset values while a transition is in progress
 			if (_is_in_between_presets_transition)
-				load_current_preset();
+				update_preset_transition();
 		}
 	}
 
@@ -258,13 +356,167 @@ void reshade::runtime::on_present()
 	// Reset frame statistics
 	g_network_traffic = 0;
 	_drawcalls = _vertices = 0;
+
+	// Runtimes render effects right before calling this, so this covers both the effects and the overlay
+	_frame_overhead_times.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - _frame_overhead_start_time).count());
+
+#if RESHADE_CPU_TIMERS
+	_cpu_timers.end_frame();
+#endif
+
+	if (_trace_frames != 0 && --_trace_frames == 0)
+		finish_trace();
+}
+
+bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t index, const ini_file *preset)
+{
+#if RESHADE_CPU_TIMERS
+	_cpu_timers.clear_effect(index);
+#endif
+	RESHADE_CPU_TIMER(_cpu_timers, index, cpu_timer_table::NO_ROW, load);
+
+	// Only pay for the file name when it is actually recorded
+	const std::string trace_detail = trace::is_recording() ? path.filename().u8string() : std::string();
+	RESHADE_TRACE_SCOPE("load_effect", trace_detail.c_str());
+
+	parse_effect(path, _effects[index], preset); // Safe to access this multi-threaded, since this is the only call working on this effect
+	finish_loading_effect(index);
+
+	const bool success = _effects[index].compile_sucess;
+	_reload_remaining_effects--;
+
+	return success;
+}
+bool reshade::runtime::load_effect_metadata(const std::filesystem::path &path, size_t index, const std::vector<std::string> &technique_list)
+{
+	permutation_cache::effect_metadata metadata;
+	if (!_permutation_cache->find_metadata(effect_metadata_key(path), metadata))
+		return false;
+
+	// Effects with techniques that are enabled in the preset or by default are needed right away
+	for (const reshadefx::technique_info &info : metadata.techniques)
+	{
+		if (std::find(technique_list.begin(), technique_list.end(), info.name) != technique_list.end() ||
+			technique(info).annotation_as_int("enabled"))
+			return false;
+	}
+
+	effect &effect = _effects[index];
+	effect.source_file = path;
+	effect.compile_sucess = true;
+	effect.skipped = true;
+	effect.included_files.assign(metadata.source_files.begin() + 1, metadata.source_files.end());
+	effect.module.techniques = std::move(metadata.techniques);
+
+	finish_loading_effect(index);
+
+	_reload_remaining_effects--;
+
+	return true;
+}
+void reshade::runtime::load_skipped_effect(size_t index)
+{
+	_skipped_effects_loading.push_back(index);
+
+	// Only parse the effect in the worker thread, like a background reload does, so that the application keeps rendering meanwhile
+	_worker_threads.emplace_back([this, index, source_file = _effects[index].source_file, preset = load_spec_constant_preset()]() {
+		effect new_effect;
+		{	const std::string trace_detail = trace::is_recording() ? source_file.filename().u8string() : std::string();
+			RESHADE_TRACE_SCOPE("load_effect", trace_detail.c_str());
+
+			parse_effect(source_file, new_effect, preset.get());
+		}
+
+		const std::lock_guard<std::mutex> lock(_reload_mutex);
+		_skipped_effects_ready.emplace_back(index, std::move(new_effect));
+	});
+}
+bool reshade::runtime::finish_loading_skipped_effect()
+{
+	size_t index;
+	effect new_effect;
+	{	const std::lock_guard<std::mutex> lock(_reload_mutex);
+		if (_skipped_effects_ready.empty())
+			return false;
+		index = _skipped_effects_ready.back().first;
+		new_effect = std::move(_skipped_effects_ready.back().second);
+		_skipped_effects_ready.pop_back();
+	}
+
+	_skipped_effects_loading.erase(std::remove(_skipped_effects_loading.begin(), _skipped_effects_loading.end(), index), _skipped_effects_loading.end());
+
+	// All worker threads have finished once the last result arrived (background reloads do not start while effects are compiled here)
+	if (_skipped_effects_loading.empty())
+	{
+		for (std::thread &thread : _worker_threads)
+			thread.join();
+		_worker_threads.clear();
+	}
+
+	// The effect may have been loaded another way in the meantime (e.g. by the code editor), in which case the result is outdated
+	if (!_effects[index].skipped)
+		return true;
+
+	swap_effect(index, std::move(new_effect));
+
+	if (_effects[index].skipped)
+	{
+		// Compiling failed, so the techniques that were enabled cannot be rendered
+		for (technique &tech : _techniques)
+			if (tech.effect_index == index)
+				disable_technique(tech);
+
+		_effects[index].compile_sucess = false;
+		return true;
+	}
+
+	// The effect had no variables before, so all compiled presets are outdated and the values from the current preset have to be applied now
+	const auto bindings = std::make_shared<preset_bindings>();
+	compile_preset(ini_file::load_cache(_current_preset_path), *bindings);
+	_compiled_presets.clear();
+	_compiled_presets[_current_preset_path.wstring()] = bindings;
+	_current_preset_bindings = bindings;
+
+	for (const preset_bindings::uniform_binding &binding : _current_preset_bindings->uniforms)
+	{
+		if (binding.effect_index != index)
+			continue;
+
+		effect &effect = _effects[index];
+		std::memcpy(effect.uniform_data_storage.data() + binding.offset, _current_preset_bindings->uniform_data[index].data() + binding.offset, binding.size);
+		std::memcpy(effect.uniforms[binding.uniform_index].toggle_key_data, binding.toggle_key_data, sizeof(binding.toggle_key_data));
+	}
+
+	return true;
+}
+uint64_t reshade::runtime::effect_metadata_key(const std::filesystem::path &path) const
+{
+	// This has to cover all the macros and include paths that are set up in 'parse_effect'
+	std::string definitions;
+	for (const std::string &definition : _global_preprocessor_definitions)
+		definitions += definition + '\n';
+	for (const std::string &definition : _preset_preprocessor_definitions)
+		definitions += definition + '\n';
+	std::string search_paths;
+	for (const std::filesystem::path &search_path : _effect_search_paths)
+		search_paths += search_path.u8string() + '\n';
+
+	return permutation_cache::hash(path.u8string(), definitions, search_paths, g_target_executable_path.stem().u8string(),
+		VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION, _performance_mode, _vendor_id, _device_id, _renderer_id, _width, _height, _color_bit_depth);
 }
+std::shared_ptr<const reshade::ini_file> reshade::runtime::load_spec_constant_preset() const
+{
+	// Specialization constants are only used in performance mode
+	if (!_performance_mode || _current_preset_path.empty())
+		return nullptr;
 
-bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t index)
+	return ini_file::load_cache_snapshot(_current_preset_path);
+}
+void reshade::runtime::parse_effect(const std::filesystem::path &path, effect &effect, const ini_file *preset)
 {
-	effect &effect = _effects[index]; // Safe to access this multi-threaded, since this is the only call working on this effect
 	effect.source_file = path;
 	effect.compile_sucess = true;
+	effect.skipped = false;
 
 	{ // Load, pre-process and compile the source file
 		reshadefx::preprocessor pp;
@@ -308,7 +560,7 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 				pp.add_macro_definition(definition);
 		}
 
-		if (!pp.append_file(path))
+		if (RESHADE_TRACE_SCOPE("preprocess"); !pp.append_file(path))
 		{
 			effect.compile_sucess = false;
 		}
@@ -325,25 +577,43 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 		else
 			shader_model = 60;
 
-		std::unique_ptr<reshadefx::codegen> codegen;
-		if ((_renderer_id & 0xF0000) == 0)
-			codegen.reset(reshadefx::create_codegen_hlsl(shader_model, !_no_debug_info, _performance_mode));
-		else if (_renderer_id < 0x20000)
-			codegen.reset(reshadefx::create_codegen_glsl(!_no_debug_info, _performance_mode));
-		else // Vulkan uses SPIR-V input
-			codegen.reset(reshadefx::create_codegen_spirv(true, !_no_debug_info, _performance_mode, true));
+		// The pre-processed source code already reflects the effective set of preprocessor definitions, so together with the code generation settings it identifies a permutation of the effect
+		const uint64_t permutation_key = permutation_cache::hash(pp.output(), _renderer_id, shader_model, _no_debug_info, _performance_mode);
 
-		reshadefx::parser parser;
-
-		// Compile the pre-processed source code (try the compile even if the preprocessor step failed to get additional error information)
-		if (!parser.parse(std::move(pp.output()), codegen.get()))
+		// Skip parsing and code generation if this permutation was compiled before (e.g. before a preprocessor definition was toggled back)
+		std::string parser_errors;
+		if (!effect.compile_sucess || !_permutation_cache->find_module(permutation_key, effect.module, parser_errors))
 		{
-			LOG(ERROR) << "Failed to compile " << path << ":\n" << pp.errors() << parser.errors();
-			effect.compile_sucess = false;
+			std::unique_ptr<reshadefx::codegen> codegen;
+			if ((_renderer_id & 0xF0000) == 0)
+				codegen.reset(reshadefx::create_codegen_hlsl(shader_model, !_no_debug_info, _performance_mode));
+			else if (_renderer_id < 0x20000)
+				codegen.reset(reshadefx::create_codegen_glsl(!_no_debug_info, _performance_mode));
+			else // Vulkan uses SPIR-V input
+				codegen.reset(reshadefx::create_codegen_spirv(true, !_no_debug_info, _performance_mode, true));
+
+			reshadefx::parser parser;
+
+			// Compile the pre-processed source code (try the compile even if the preprocessor step failed to get additional error information)
+			if (RESHADE_TRACE_SCOPE("parse"); !parser.parse(std::move(pp.output()), codegen.get()))
+			{
+				LOG(ERROR) << "Failed to compile " << path << ":\n" << pp.errors() << parser.errors();
+				effect.compile_sucess = false;
+			}
+
+			parser_errors = std::move(parser.errors());
+
+			// Write result to effect module
+			{ RESHADE_TRACE_SCOPE("write_result");
+				codegen->write_result(effect.module);
+			}
+
+			if (effect.compile_sucess)
+				_permutation_cache->insert_module(permutation_key, effect.module, parser_errors);
 		}
 
 		// Append preprocessor and parser errors to the error list
-		effect.errors = std::move(pp.errors()) + std::move(parser.errors());
+		effect.errors = std::move(pp.errors()) + std::move(parser_errors);
 
 		// Keep track of used preprocessor definitions (so they can be displayed in the GUI)
 		for (const auto &definition : pp.used_macro_definitions())
@@ -358,14 +628,27 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 		effect.included_files = pp.included_files();
 		std::sort(effect.included_files.begin(), effect.included_files.end()); // Sort file names alphabetically
 
-		// Write result to effect module
-		codegen->write_result(effect.module);
+		// Remember the techniques of this effect, so that compiling it can be skipped during the next load if none of them are enabled (see 'load_effect_metadata')
+		if (effect.compile_sucess)
+		{
+			permutation_cache::effect_metadata metadata;
+			metadata.source_files.push_back(path);
+			metadata.source_files.insert(metadata.source_files.end(), effect.included_files.begin(), effect.included_files.end());
+
+			for (const reshadefx::technique_info &info : effect.module.techniques)
+			{
+				reshadefx::technique_info &technique = metadata.techniques.emplace_back();
+				technique.name = info.name;
+				technique.annotations = info.annotations;
+			}
+
+			_permutation_cache->insert_metadata(effect_metadata_key(path), metadata);
+		}
 	}
 
 	// Fill all specialization constants with values from the current preset
-	if (_performance_mode && !_current_preset_path.empty() && effect.compile_sucess)
+	if (_performance_mode && preset != nullptr && effect.compile_sucess)
 	{
-		const ini_file preset(_current_preset_path); // ini_file::load_cache is not thread-safe, so load from file here
 		const std::string section(path.filename().u8string());
 
 		for (reshadefx::uniform_info &constant : effect.module.spec_constants)
@@ -375,14 +658,14 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 			switch (constant.type.base)
 			{
 			case reshadefx::type::t_int:
-				preset.get(section, constant.name, constant.initializer_value.as_int);
+				preset->get(section, constant.name, constant.initializer_value.as_int);
 				break;
 			case reshadefx::type::t_bool:
 			case reshadefx::type::t_uint:
-				preset.get(section, constant.name, constant.initializer_value.as_uint);
+				preset->get(section, constant.name, constant.initializer_value.as_uint);
 				break;
 			case reshadefx::type::t_float:
-				preset.get(section, constant.name, constant.initializer_value.as_float);
+				preset->get(section, constant.name, constant.initializer_value.as_float);
 				break;
 			}
 
@@ -415,6 +698,11 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 			effect.preamble += '\n';
 		}
 	}
+}
+void reshade::runtime::finish_loading_effect(size_t index)
+{
+	effect &effect = _effects[index];
+	const std::filesystem::path &path = effect.source_file;
 
 	// Create space for all variables (aligned to 16 bytes)
 	effect.uniform_data_storage.resize((effect.module.total_uniform_size + 15) & ~15);
@@ -504,16 +792,8 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 				[&texture](const auto &item) { return item.annotation_as_int("pooled") && item.matches_description(texture); });
 				existing_texture != _textures.end())
 			{
-				// Overwrite referenced texture in samplers with the pooled one
-				for (auto &sampler_info : effect.module.samplers)
-					if (sampler_info.texture_name == texture.unique_name)
-						sampler_info.texture_name = existing_texture->unique_name;
-				// Overwrite referenced texture in render targets with the pooled one
-				for (auto &technique_info : effect.module.techniques)
-					for (auto &pass_info : technique_info.passes)
-						for (auto &target_name : pass_info.render_target_names)
-							if (target_name == texture.unique_name)
-								target_name = existing_texture->unique_name;
+				// Overwrite referenced texture in samplers and render targets with the pooled one
+				reshadefx::rename_texture_references(effect.module, texture.unique_name, existing_texture->unique_name);
 
 				existing_texture->shared = true;
 				continue;
@@ -530,9 +810,35 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 		new_textures.push_back(std::move(texture));
 	}
 
+	// Let transient textures that opted in with a "transient" annotation share a single texture with the others in their alias slot, the same way as pooled textures above
+	// Only textures this effect creates itself are considered (those in 'new_textures'), since textures shared with previously loaded effects may be observed outside of the technique
+	for (const reshadefx::technique_info &technique_info : effect.module.techniques)
+	{
+		const reshadefx::pass_schedule schedule = reshadefx::compile_pass_graph(effect.module, technique_info);
+		if (schedule.num_alias_slots == schedule.transient_textures.size())
+			continue; // Every transient texture has a slot of its own, so there is nothing to share
+
+		for (const auto &[unique_name, owner_name] : reshadefx::find_texture_aliases(effect.module, schedule))
+		{
+			const auto it = std::find_if(new_textures.begin(), new_textures.end(),
+				[&unique_name = unique_name](const texture &item) { return item.unique_name == unique_name; });
+			if (it == new_textures.end() || std::none_of(new_textures.begin(), new_textures.end(),
+				[&owner_name = owner_name](const texture &item) { return item.unique_name == owner_name; }))
+				continue;
+
+			// Lifetimes in a slot never overlap, so this texture can use the one that was first in the slot instead of creating its own
+			reshadefx::rename_texture_references(effect.module, unique_name, owner_name);
+			new_textures.erase(it);
+		}
+	}
+
 	for (technique technique : effect.module.techniques)
 	{
 		technique.effect_index = index;
+		technique.schedule = reshadefx::compile_pass_graph(effect.module, technique);
+#if RESHADE_CPU_TIMERS
+		technique.cpu_timer_row = _cpu_timers.allocate_technique_row();
+#endif
 
 		technique.hidden = technique.annotation_as_int("hidden") != 0;
 		technique.timeout = technique.annotation_as_int("timeout");
@@ -544,7 +850,9 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 		new_techniques.push_back(std::move(technique));
 	}
 
-	if (effect.compile_sucess)
+	if (effect.skipped)
+		LOG(INFO) << "Skipped compiling " << path << ", since none of its techniques are enabled.";
+	else if (effect.compile_sucess)
 		if (effect.errors.empty())
 			LOG(INFO) << "Successfully loaded " << path << '.';
 		else
@@ -555,34 +863,50 @@ bool reshade::runtime::load_effect(const std::filesystem::path &path, size_t ind
 		std::move(new_techniques.begin(), new_techniques.end(), std::back_inserter(_techniques));
 
 		_last_reload_successful &= effect.compile_sucess;
-		_reload_remaining_effects--;
 	}
-
-	return effect.compile_sucess;
 }
 bool reshade::runtime::load_effects()
 {
-	// Clear out any previous effects
-	unload_effects();
+	// Record everything up to the point where the last texture was loaded (see 'update_and_render_effects')
+	if (_trace_reload && !trace::is_recording())
+	{
+		trace::start();
+		_is_tracing_reload = true;
+	}
+
+	RESHADE_TRACE_SCOPE("load_effects");
 
-#if RESHADE_GUI
-	_show_splash = true; // Always show splash bar when reloading everything
-#endif
 	_last_reload_successful = true;
 
 	// Reload preprocessor definitions from current preset before compiling
+	std::vector<std::string> technique_list;
 	if (!_current_preset_path.empty())
 	{
 		_preset_preprocessor_definitions.clear();
 
 		const ini_file &preset = ini_file::load_cache(_current_preset_path);
 		preset.get({}, "PreprocessorDefinitions", _preset_preprocessor_definitions);
+		preset.get({}, "Techniques", technique_list);
 	}
 
+	// The cached preset may be changed or reloaded by this thread at any time, so give the worker threads their own copy to read from
+	const std::shared_ptr<const ini_file> preset_snapshot = load_spec_constant_preset();
+
 	// Build a list of effect files by walking through the effect search paths
 	const std::vector<std::filesystem::path> effect_files =
 		find_files(_effect_search_paths, { L".fx" });
 
+	// Keep rendering the current effects while their new versions are compiled, if possible
+	if (_reload_in_background && load_effects_in_background(effect_files, preset_snapshot))
+		return true;
+
+	// Clear out any previous effects
+	unload_effects();
+
+#if RESHADE_GUI
+	_show_splash = true; // Always show splash bar when reloading everything
+#endif
+
 	_reload_total_effects = effect_files.size();
 	_reload_remaining_effects = _reload_total_effects;
 
@@ -597,23 +921,252 @@ bool reshade::runtime::load_effects()
 	const size_t num_splits = std::min<size_t>(effect_files.size(), std::max<size_t>(std::thread::hardware_concurrency(), 2u) - 1);
 
 	// Keep track of the spawned threads, so the runtime cannot be destroyed while they are still running
+	// Effects that are not used by the current preset are only compiled once one of their techniques is enabled
 	for (size_t n = 0; n < num_splits; ++n)
-		_worker_threads.emplace_back([this, effect_files, num_splits, n]() {
+		_worker_threads.emplace_back([this, effect_files, technique_list, preset_snapshot, num_splits, n]() {
 			for (size_t i = 0; i < effect_files.size(); ++i)
-				if (i * num_splits / effect_files.size() == n)
-					load_effect(effect_files[i], i);
+				if (i * num_splits / effect_files.size() == n &&
+					(!_load_effects_on_demand || !load_effect_metadata(effect_files[i], i, technique_list)))
+					load_effect(effect_files[i], i, preset_snapshot.get());
 		});
 
 	return _last_reload_successful;
 }
-void reshade::runtime::load_textures()
+bool reshade::runtime::load_effects_in_background(const std::vector<std::filesystem::path> &effect_files, const std::shared_ptr<const ini_file> &preset)
+{
+	// Effects are replaced one by one at the same index, so this only works if the list of effect files did not change
+	if (_effects.empty() || _effects.size() != effect_files.size() ||
+		_reload_remaining_effects != std::numeric_limits<size_t>::max() || !_reload_compile_queue.empty() || !_skipped_effects_loading.empty())
+		return false;
+	for (size_t i = 0; i < effect_files.size(); ++i)
+		if (_effects[i].source_file != effect_files[i])
+			return false;
+
+	// Wait for a previous background reload to finish before discarding the rest of its results
+	for (std::thread &thread : _worker_threads)
+		thread.join();
+	_worker_threads.clear();
+
+#if RESHADE_GUI
+	_show_splash = false; // The current effects keep rendering, so there is nothing to wait for
+#endif
+
+	_background_effects.clear();
+	_background_effects.resize(effect_files.size());
+	for (size_t i = 0; i < effect_files.size(); ++i)
+		_background_effects[i].skipped = _effects[i].skipped; // Effects that were not compiled yet are not compiled in the background either
+	_background_ready_effects.clear();
+	_background_remaining_effects = effect_files.size();
+
+	LOG(INFO) << "Reloading " << effect_files.size() << " effects in the background ...";
+
+	const size_t num_splits = std::min<size_t>(effect_files.size(), std::max<size_t>(std::thread::hardware_concurrency(), 2u) - 1);
+
+	// Only parse the effects in the worker threads, everything that touches the global texture and technique lists happens in 'swap_effect' on the render thread
+	for (size_t n = 0; n < num_splits; ++n)
+		_worker_threads.emplace_back([this, effect_files, preset, num_splits, n]() {
+			for (size_t i = 0; i < effect_files.size(); ++i)
+			{
+				if (i * num_splits / effect_files.size() != n)
+					continue;
+
+				if (!_background_effects[i].skipped)
+				{
+					const std::string trace_detail = trace::is_recording() ? effect_files[i].filename().u8string() : std::string();
+					RESHADE_TRACE_SCOPE("load_effect", trace_detail.c_str());
+
+					parse_effect(effect_files[i], _background_effects[i], preset.get());
+				}
+
+				const std::lock_guard<std::mutex> lock(_reload_mutex);
+				_background_ready_effects.push_back(i);
+			}
+		});
+
+	return true;
+}
+bool reshade::runtime::swap_effect(size_t index, effect &&new_effect)
+{
+	if (new_effect.skipped)
+		return false; // Keep the techniques loaded from the metadata cache
+
+	if (!new_effect.compile_sucess)
+	{
+		// Keep rendering the current version, but show why the new one failed
+		_effects[index].errors = std::move(new_effect.errors);
+		_last_reload_successful = false;
+		return false;
+	}
+
+	// Remember the state of the current version, so that it can be carried over to the new one (or restored if that fails to initialize)
+	// The effect is moved instead of copied, since it is installed again as is in the failure case. Its variables are kept separately, since installing a version resets them.
+	effect old_effect = std::move(_effects[index]);
+	const std::vector<uniform> old_uniforms = std::move(old_effect.uniforms);
+	const std::vector<unsigned char> old_uniform_data = std::move(old_effect.uniform_data_storage);
+	std::unordered_map<std::string, size_t> technique_order; // Maps technique names to their position in the list
+	std::vector<std::string> enabled_techniques;
+	for (const technique &technique : _techniques)
+	{
+		technique_order.emplace(technique.name, technique_order.size());
+		if (technique.effect_index == index && technique.enabled)
+			enabled_techniques.push_back(technique.name);
+	}
+
+	bool initialized = false;
+	const auto install = [&](effect &&version) {
+		unload_effect(index);
+#if RESHADE_CPU_TIMERS
+		_cpu_timers.clear_effect(index);
+#endif
+
+		_effects[index] = std::move(version);
+		_effects[index].uniforms.clear();
+		finish_loading_effect(index);
+
+		effect &effect = _effects[index];
+
+		// Carry over the values of all variables that still exist with the same type
+		for (uniform &variable : effect.uniforms)
+		{
+			if (const auto it = std::find_if(old_uniforms.begin(), old_uniforms.end(),
+				[&variable](const uniform &item) { return item.name == variable.name && item.type == variable.type && item.size == variable.size; });
+				it != old_uniforms.end())
+			{
+				std::memcpy(effect.uniform_data_storage.data() + variable.offset, old_uniform_data.data() + it->offset, variable.size);
+				std::memcpy(variable.toggle_key_data, it->toggle_key_data, sizeof(variable.toggle_key_data));
+			}
+		}
+
+		for (technique &technique : _techniques)
+		{
+			if (technique.effect_index != index)
+				continue;
+
+			if (std::find(enabled_techniques.begin(), enabled_techniques.end(), technique.name) != enabled_techniques.end())
+				enable_technique(technique);
+			else
+				disable_technique(technique);
+		}
+
+		// New techniques were appended to the list, so restore the previous order (techniques that did not exist before go to the end)
+		const auto position = [&technique_order](const technique &technique) {
+			const auto it = technique_order.find(technique.name);
+			return it != technique_order.end() ? it->second : technique_order.size();
+		};
+		std::stable_sort(_techniques.begin(), _techniques.end(),
+			[&position](const technique &lhs, const technique &rhs) { return position(lhs) < position(rhs); });
+
+		// Initialize right away instead of going through the compile queue, so that there is no frame without this effect
+		_reload_compile_queue.erase(std::remove(_reload_compile_queue.begin(), _reload_compile_queue.end(), index), _reload_compile_queue.end());
+
+		if (!effect.rendering || effect.skipped)
+			return true; // Initialized later when one of its techniques is enabled
+
+		initialized = true;
+
+		if (!compile_effect(index))
+			return false;
+
+		load_textures(index);
+		return true;
+	};
+
+	if (!install(std::move(new_effect)))
+	{
+		LOG(WARN) << "Restoring previous version of " << old_effect.source_file << '.';
+
+		std::string errors = std::move(_effects[index].errors);
+		install(std::move(old_effect));
+		_effects[index].errors = std::move(errors);
+	}
+
+	// Compiled presets reference techniques and variables by index, so they are no longer valid
+	_compiled_presets.clear();
+	_current_preset_bindings = std::make_shared<preset_bindings>();
+	_transition_preset_bindings->clear();
+
+	return initialized;
+}
+bool reshade::runtime::compile_effect(size_t index)
+{
+	effect &effect = _effects[index];
+
+	RESHADE_CPU_TIMER(_cpu_timers, index, cpu_timer_table::NO_ROW, load);
+
+	const std::string trace_detail = trace::is_recording() ? effect.source_file.filename().u8string() : std::string();
+	RESHADE_TRACE_SCOPE("init_effect", trace_detail.c_str());
+
+	// Create textures now, since they are referenced when building samplers in the 'init_effect' call below
+	bool success = true;
+	for (texture &texture : _textures)
+	{
+		if (texture.impl == nullptr && (texture.effect_index == index || texture.shared))
+		{
+			if (!init_texture(texture))
+			{
+				success = false;
+				effect.errors += "Failed to create texture " + texture.unique_name;
+				break;
+			}
+		}
+	}
+
+	// Compile the effect with the back-end implementation
+	if (success && !init_effect(index))
+	{
+		// De-duplicate error lines (D3DCompiler sometimes repeats the same error multiple times)
+		for (size_t cur_line_offset = 0, next_line_offset, end_offset;
+			(next_line_offset = effect.errors.find('\n', cur_line_offset)) != std::string::npos && (end_offset = effect.errors.find('\n', next_line_offset + 1)) != std::string::npos; cur_line_offset = next_line_offset + 1)
+		{
+			const std::string_view cur_line(effect.errors.c_str() + cur_line_offset, next_line_offset - cur_line_offset);
+			const std::string_view next_line(effect.errors.c_str() + next_line_offset + 1, end_offset - next_line_offset - 1);
+
+			if (cur_line == next_line)
+			{
+				effect.errors.erase(next_line_offset, end_offset - next_line_offset);
+				next_line_offset = cur_line_offset - 1;
+			}
+		}
+
+		if (effect.errors.empty())
+			LOG(ERROR) << "Failed initializing " << effect.source_file << '.';
+		else
+			LOG(ERROR) << "Failed initializing " << effect.source_file << ":\n" << effect.errors;
+
+		success = false;
+	}
+
+	if (!success) // Something went wrong, do clean up
+	{
+		// Destroy all textures belonging to this effect
+		for (texture &tex : _textures)
+			if (tex.effect_index == index && !tex.shared)
+				destroy_texture(tex);
+		// Disable all techniques belonging to this effect
+		for (technique &tech : _techniques)
+			if (tech.effect_index == index)
+				disable_technique(tech);
+
+		effect.compile_sucess = false;
+		_last_reload_successful = false;
+	}
+
+	return success;
+}
+void reshade::runtime::load_textures(size_t effect_index)
 {
 	LOG(INFO) << "Loading image files for textures ...";
 
+	RESHADE_TRACE_SCOPE("load_textures");
+
 	for (const texture &texture : _textures)
 	{
 		if (texture.impl == nullptr || texture.impl_reference != texture_reference::none)
 			continue; // Ignore textures that are not created yet and those that are handled in the runtime implementation
+		if (effect_index != std::numeric_limits<size_t>::max() && texture.effect_index != effect_index)
+			continue;
+
+		RESHADE_TRACE_SCOPE("load_texture", texture.unique_name.c_str());
 
 		std::filesystem::path source_path = std::filesystem::u8path(
 			texture.annotation_as_string("source"));
@@ -665,7 +1218,8 @@ void reshade::runtime::load_textures()
 		stbi_image_free(filedata);
 	}
 
-	_textures_loaded = true;
+	if (effect_index == std::numeric_limits<size_t>::max())
+		_textures_loaded = true;
 }
 
 void reshade::runtime::unload_effect(size_t index)
@@ -688,8 +1242,15 @@ void reshade::runtime::unload_effect(size_t index)
 		}), _textures.end());
 	// Clean up techniques belonging to this effect
 	_techniques.erase(std::remove_if(_techniques.begin(), _techniques.end(),
-		[index](const technique &tech) {
-			return tech.effect_index == index;
+		[this, index](const technique &tech) {
+			if (tech.effect_index == index) {
+#if RESHADE_CPU_TIMERS
+				// Give the row back, so that reloading the effect does not use up the table
+				_cpu_timers.free_technique_row(tech.cpu_timer_row);
+#endif
+				return true;
+			}
+			return false;
 		}), _techniques.end());
 
 	// Do not clear source file, so that an 'unload_effect' immediately followed by a 'load_effect' which accesses that works
@@ -717,6 +1278,13 @@ void reshade::runtime::unload_effects()
 		thread.join();
 	_worker_threads.clear();
 
+	// Discard the results of a background reload that has not finished yet
+	_background_effects.clear();
+	_background_ready_effects.clear();
+	_background_remaining_effects = 0;
+	_skipped_effects_loading.clear();
+	_skipped_effects_ready.clear();
+
 	// Destroy all textures
 	for (texture &tex : _textures)
 		destroy_texture(tex);
@@ -727,10 +1295,24 @@ void reshade::runtime::unload_effects()
 
 	// Reset the effect list after all resources have been destroyed
 	_effects.clear();
+
+#if RESHADE_CPU_TIMERS
+	// Effect indices and technique rows are assigned again during the next load
+	_cpu_timers.clear();
+#endif
+
+	// Compiled presets reference effects by index, so they are no longer valid
+	_compiled_presets.clear();
+	_current_preset_bindings = std::make_shared<preset_bindings>();
+	_transition_preset_bindings->clear();
 }
 
 void reshade::runtime::update_and_render_effects()
 {
+	_frame_overhead_start_time = std::chrono::high_resolution_clock::now();
+
+	RESHADE_TRACE_SCOPE("update_and_render_effects");
+
 	// Delay first load to the first render call to avoid loading while the application is still initializing
 	if (_framecount == 0 && !_no_reload_on_init)
 		load_effects();
@@ -763,75 +1345,73 @@ void reshade::runtime::update_and_render_effects()
 	}
 	else
 	{
-		if (!_reload_compile_queue.empty())
+		if (_background_remaining_effects != 0)
 		{
-			// Pop an effect from the queue
-			const size_t effect_index = _reload_compile_queue.back();
-			_reload_compile_queue.pop_back();
-			effect &effect = _effects[effect_index];
-
-			// Create textures now, since they are referenced when building samplers in the 'init_effect' call below
-			bool success = true;
-			for (texture &texture : _textures)
+			// Swap in the effects that finished loading in the background, but initialize at most one of them per frame to spread out the cost
+			for (bool initialized = false; !initialized && _background_remaining_effects != 0; _background_remaining_effects--)
 			{
-				if (texture.impl == nullptr && (texture.effect_index == effect_index || texture.shared))
-				{
-					if (!init_texture(texture))
-					{
-						success = false;
-						effect.errors += "Failed to create texture " + texture.unique_name;
+				size_t effect_index;
+				{	const std::lock_guard<std::mutex> lock(_reload_mutex);
+					if (_background_ready_effects.empty())
 						break;
-					}
+					effect_index = _background_ready_effects.back();
+					_background_ready_effects.pop_back();
 				}
+
+				initialized = swap_effect(effect_index, std::move(_background_effects[effect_index]));
 			}
 
-			// Compile the effect with the back-end implementation
-			if (success && !init_effect(effect_index))
+			if (_background_remaining_effects == 0)
 			{
-				// De-duplicate error lines (D3DCompiler sometimes repeats the same error multiple times)
-				for (size_t cur_line_offset = 0, next_line_offset, end_offset;
-					(next_line_offset = effect.errors.find('\n', cur_line_offset)) != std::string::npos && (end_offset = effect.errors.find('\n', next_line_offset + 1)) != std::string::npos; cur_line_offset = next_line_offset + 1)
-				{
-					const std::string_view cur_line(effect.errors.c_str() + cur_line_offset, next_line_offset - cur_line_offset);
-					const std::string_view next_line(effect.errors.c_str() + next_line_offset + 1, end_offset - next_line_offset - 1);
-
-					if (cur_line == next_line)
-					{
-						effect.errors.erase(next_line_offset, end_offset - next_line_offset);
-						next_line_offset = cur_line_offset - 1;
-					}
-				}
+				_background_effects.clear();
 
-				if (effect.errors.empty())
-					LOG(ERROR) << "Failed initializing " << effect.source_file << '.';
-				else
-					LOG(ERROR) << "Failed initializing " << effect.source_file << ":\n" << effect.errors;
+				// Finish like a normal reload in the next frame, which joins the worker threads and applies the current preset again
+				_reload_remaining_effects = 0;
 
-				success = false;
+				if (_is_tracing_reload)
+				{
+					_is_tracing_reload = false;
+					finish_trace();
+				}
 			}
-
-			if (!success) // Something went wrong, do clean up
+		}
+		else if (!_reload_compile_queue.empty() || !_skipped_effects_loading.empty())
+		{
+			if (finish_loading_skipped_effect())
 			{
-				// Destroy all textures belonging to this effect
-				for (texture &tex : _textures)
-					if (tex.effect_index == effect_index && !tex.shared)
-						destroy_texture(tex);
-				// Disable all techniques belonging to this effect
-				for (technique &tech : _techniques)
-					if (tech.effect_index == effect_index)
-						disable_technique(tech);
-
-				effect.compile_sucess = false;
-				_last_reload_successful = false;
+				// An effect has changed, need to reload textures
+				_textures_loaded = false;
 			}
+			else if (!_reload_compile_queue.empty())
+			{
+				// Pop an effect from the queue
+				const size_t effect_index = _reload_compile_queue.back();
+				_reload_compile_queue.pop_back();
+
+				if (_effects[effect_index].skipped)
+				{
+					load_skipped_effect(effect_index);
+				}
+				else
+				{
+					compile_effect(effect_index);
 
-			// An effect has changed, need to reload textures
-			_textures_loaded = false;
+					// An effect has changed, need to reload textures
+					_textures_loaded = false;
+				}
+			}
 		}
 		else if (!_textures_loaded)
 		{
 			// Now that all effects were compiled, load all textures
 			load_textures();
+
+			// This was the last step of the reload, so finish a trace of it
+			if (_is_tracing_reload)
+			{
+				_is_tracing_reload = false;
+				finish_trace();
+			}
 		}
 	}
 
@@ -854,6 +1434,9 @@ void reshade::runtime::update_and_render_effects()
 		if (!effect.rendering)
 			continue;
 
+		RESHADE_CPU_TIMER(_cpu_timers, &effect - _effects.data(), cpu_timer_table::NO_ROW, update_uniforms);
+		RESHADE_TRACE_SCOPE("update_uniforms");
+
 		for (uniform &variable : effect.uniforms)
 		{
 			if (!_ignore_shortcuts && variable.toggle_key_data[0] != 0 && _input->is_key_pressed(variable.toggle_key_data))
@@ -1042,7 +1625,11 @@ void reshade::runtime::update_and_render_effects()
 			continue; // Ignore techniques that are not fully loaded or currently disabled
 
 		const auto time_technique_started = std::chrono::high_resolution_clock::now();
-		render_technique(technique);
+		{
+			RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, render_technique);
+			RESHADE_TRACE_SCOPE("render_technique", technique.name.c_str());
+			render_technique(technique);
+		}
 		const auto time_technique_finished = std::chrono::high_resolution_clock::now();
 
 		technique.average_cpu_duration.append(std::chrono::duration_cast<std::chrono::nanoseconds>(time_technique_finished - time_technique_started).count());
@@ -1063,7 +1650,8 @@ void reshade::runtime::enable_technique(technique &technique)
 
 	// Queue effect file for compilation if it was not fully loaded yet
 	if (technique.impl == nullptr && // Avoid adding the same effect multiple times to the queue if it contains multiple techniques that were enabled simultaneously
-		std::find(_reload_compile_queue.begin(), _reload_compile_queue.end(), technique.effect_index) == _reload_compile_queue.end())
+		std::find(_reload_compile_queue.begin(), _reload_compile_queue.end(), technique.effect_index) == _reload_compile_queue.end() &&
+		std::find(_skipped_effects_loading.begin(), _skipped_effects_loading.end(), technique.effect_index) == _skipped_effects_loading.end())
 	{
 		_reload_total_effects++;
 		_reload_compile_queue.push_back(technique.effect_index);
@@ -1078,7 +1666,7 @@ void reshade::runtime::disable_technique(technique &technique)
 	technique.enabled = false;
 	technique.timeleft = 0;
 	technique.average_cpu_duration.clear();
-	technique.average_gpu_duration.clear();
+	technique.clear_gpu_durations();
 
 	if (status_changed) // Decrease rendering reference count
 		_effects[technique.effect_index].rendering--;
@@ -1104,6 +1692,9 @@ void reshade::runtime::load_config()
 	config.get("INPUT", "KeyReload", _reload_key_data);
 	config.get("INPUT", "KeyEffects", _effects_key_data);
 	config.get("INPUT", "KeyScreenshot", _screenshot_key_data);
+	config.get("INPUT", "KeyFrameCapture", _capture_key_data);
+	config.get("INPUT", "KeyFrameStatistics", _frame_stats_key_data);
+	config.get("INPUT", "KeyTrace", _trace_key_data);
 	config.get("INPUT", "KeyPreviousPreset", _prev_preset_key_data);
 	config.get("INPUT", "KeyNextPreset", _next_preset_key_data);
 
@@ -1117,9 +1708,15 @@ void reshade::runtime::load_config()
 	config.get("GENERAL", "ScreenshotSaveUI", _screenshot_save_ui);
 	config.get("GENERAL", "ScreenshotSaveBefore", _screenshot_save_before);
 	config.get("GENERAL", "ScreenshotIncludePreset", _screenshot_include_preset);
+	config.get("GENERAL", "CaptureFrameCount", _capture_frame_count);
+	config.get("GENERAL", "CaptureContinuous", _capture_continuous);
+	config.get("GENERAL", "TraceFrameCount", _trace_frame_count);
+	config.get("GENERAL", "TraceReload", _trace_reload);
 
 	config.get("GENERAL", "NoDebugInfo", _no_debug_info);
 	config.get("GENERAL", "NoReloadOnInit", _no_reload_on_init);
+	config.get("GENERAL", "ReloadInBackground", _reload_in_background);
+	config.get("GENERAL", "LoadEffectsOnDemand", _load_effects_on_demand);
 
 	if (!config.get("GENERAL", "CurrentPresetPath", _current_preset_path))
 	{
@@ -1148,6 +1745,9 @@ void reshade::runtime::save_config() const
 	config.set("INPUT", "KeyReload", _reload_key_data);
 	config.set("INPUT", "KeyEffects", _effects_key_data);
 	config.set("INPUT", "KeyScreenshot", _screenshot_key_data);
+	config.set("INPUT", "KeyFrameCapture", _capture_key_data);
+	config.set("INPUT", "KeyFrameStatistics", _frame_stats_key_data);
+	config.set("INPUT", "KeyTrace", _trace_key_data);
 	config.set("INPUT", "KeyPreviousPreset", _prev_preset_key_data);
 	config.set("INPUT", "KeyNextPreset", _next_preset_key_data);
 
@@ -1162,9 +1762,15 @@ void reshade::runtime::save_config() const
 	config.set("GENERAL", "ScreenshotSaveUI", _screenshot_save_ui);
 	config.set("GENERAL", "ScreenshotSaveBefore", _screenshot_save_before);
 	config.set("GENERAL", "ScreenshotIncludePreset", _screenshot_include_preset);
+	config.set("GENERAL", "CaptureFrameCount", _capture_frame_count);
+	config.set("GENERAL", "CaptureContinuous", _capture_continuous);
+	config.set("GENERAL", "TraceFrameCount", _trace_frame_count);
+	config.set("GENERAL", "TraceReload", _trace_reload);
 
 	config.set("GENERAL", "NoDebugInfo", _no_debug_info);
 	config.set("GENERAL", "NoReloadOnInit", _no_reload_on_init);
+	config.set("GENERAL", "ReloadInBackground", _reload_in_background);
+	config.set("GENERAL", "LoadEffectsOnDemand", _load_effects_on_demand);
 
 	for (const auto &callback : _save_config_callables)
 		callback(config);
@@ -1205,35 +1811,75 @@ void reshade::runtime::load_current_preset()
 			       (std::find(sorted_technique_list.begin(), sorted_technique_list.end(), rhs.name) - sorted_technique_list.begin());
 		});
 
-	// Compute times since the transition has started and how much is left till it should end
-	auto transition_time = std::chrono::duration_cast<std::chrono::microseconds>(_last_present_time - _last_preset_switching_time).count();
-	auto transition_ms_left = _preset_transition_delay - transition_time / 1000;
-	auto transition_ms_left_from_last_frame = transition_ms_left + std::chrono::duration_cast<std::chrono::microseconds>(_last_frame_duration).count() / 1000;
+	if (_is_in_between_presets_transition)
+	{
+		// Keep the current values as starting point of the transition
+		_transition_preset_bindings->clear();
+		_transition_preset_bindings->uniform_data.reserve(_effects.size());
+		for (const effect &effect : _effects)
+			_transition_preset_bindings->uniform_data.push_back(effect.uniform_data_storage);
+	}
 
-	if (_is_in_between_presets_transition && transition_ms_left <= 0)
-		_is_in_between_presets_transition = false;
+	// Switching back and forth between presets should not look up every value by name again, so reuse the bindings compiled the last time, unless the preset was edited or reloaded from disk since
+	std::shared_ptr<const preset_bindings> &bindings = _compiled_presets[_current_preset_path.wstring()];
+	if (bindings == nullptr || bindings->modified_at != preset.modified_at())
+	{
+		const auto new_bindings = std::make_shared<preset_bindings>();
+		compile_preset(preset, *new_bindings);
+		bindings = new_bindings;
+	}
 
-	for (effect &effect : _effects)
+	_current_preset_bindings = bindings;
+	apply_preset(*_current_preset_bindings);
+
+	if (_is_in_between_presets_transition)
+		update_preset_transition();
+}
+void reshade::runtime::compile_preset(const ini_file &preset, preset_bindings &bindings)
+{
+	std::vector<std::string> technique_list;
+	preset.get({}, "Techniques", technique_list);
+
+	bindings.clear();
+	bindings.modified_at = preset.modified_at();
+	bindings.uniform_data.reserve(_effects.size());
+	bindings.techniques.reserve(_techniques.size());
+
+	for (size_t effect_index = 0; effect_index < _effects.size(); ++effect_index)
 	{
-		for (uniform &variable : effect.uniforms)
+		effect &effect = _effects[effect_index];
+		const std::string section = effect.source_file.filename().u8string();
+
+		// Apply preset values to the uniform storage of the effect and afterwards move the result into the binding table, which avoids having to duplicate the value conversion logic
+		std::vector<unsigned char> current_data = effect.uniform_data_storage;
+
+		for (size_t uniform_index = 0; uniform_index < effect.uniforms.size(); ++uniform_index)
 		{
+			uniform &variable = effect.uniforms[uniform_index];
+
 			if (variable.special != special_uniform::none)
 				continue;
 
-			unsigned int components = variable.type.components();
-			const std::string section = effect.source_file.filename().u8string();
-			reshadefx::constant values, values_old;
+			preset_bindings::uniform_binding &binding = bindings.uniforms.emplace_back();
+			binding.effect_index = effect_index;
+			binding.uniform_index = uniform_index;
+			binding.offset = variable.offset;
+			binding.size = variable.size;
+			binding.interpolate = variable.type.base == reshadefx::type::t_float;
+			std::memcpy(binding.toggle_key_data, variable.toggle_key_data, sizeof(binding.toggle_key_data));
 
 			if (variable.supports_toggle_key())
 			{
 				// Load shortcut key, but first reset it, since it may not exist in the preset file
-				std::memset(variable.toggle_key_data, 0, sizeof(variable.toggle_key_data));
-				preset.get(section, "Key" + variable.name, variable.toggle_key_data);
+				std::memset(binding.toggle_key_data, 0, sizeof(binding.toggle_key_data));
+				preset.get(section, "Key" + variable.name, binding.toggle_key_data);
 			}
 
-			if (!_is_in_between_presets_transition)
-				// Reset values to defaults before loading from a new preset
-				reset_uniform_value(variable);
+			// Reset values to defaults before loading from a new preset
+			reset_uniform_value(variable);
+
+			const unsigned int components = variable.type.components();
+			reshadefx::constant values;
 
 			switch (variable.type.base)
 			{
@@ -1250,38 +1896,88 @@ void reshade::runtime::load_current_preset()
 				break;
 			case reshadefx::type::t_float:
 				get_uniform_value(variable, values.as_float, components);
-				values_old = values;
 				preset.get(section, variable.name, values.as_float);
-				if (_is_in_between_presets_transition)
-				{
-					// Perform smooth transition on floating point values
-					for (unsigned int i = 0; i < components; i++)
-					{
-						const auto transition_ratio = (values.as_float[i] - values_old.as_float[i]) / transition_ms_left_from_last_frame;
-						values.as_float[i] = values.as_float[i] - transition_ratio * transition_ms_left;
-					}
-				}
 				set_uniform_value(variable, values.as_float, components);
 				break;
 			}
 		}
+
+		bindings.uniform_data.push_back(std::move(effect.uniform_data_storage));
+		effect.uniform_data_storage = std::move(current_data);
 	}
 
-	for (technique &technique : _techniques)
+	for (const technique &technique : _techniques)
 	{
+		preset_bindings::technique_binding &binding = bindings.techniques.emplace_back();
+
 		// Ignore preset if "enabled" annotation is set
-		if (technique.annotation_as_int("enabled")
-			|| std::find(technique_list.begin(), technique_list.end(), technique.name) != technique_list.end())
+		binding.enabled = technique.annotation_as_int("enabled")
+			|| std::find(technique_list.begin(), technique_list.end(), technique.name) != technique_list.end();
+
+		// Reset toggle key to the value set via annotation first, since it may not exist in the preset
+		binding.toggle_key_data[0] = technique.annotation_as_int("toggle");
+		binding.toggle_key_data[1] = technique.annotation_as_int("togglectrl");
+		binding.toggle_key_data[2] = technique.annotation_as_int("toggleshift");
+		binding.toggle_key_data[3] = technique.annotation_as_int("togglealt");
+		preset.get({}, "Key" + technique.name, binding.toggle_key_data);
+	}
+}
+void reshade::runtime::apply_preset(const preset_bindings &bindings)
+{
+	if (bindings.uniform_data.size() != _effects.size() || bindings.techniques.size() != _techniques.size())
+		return; // Effects were reloaded since the preset was compiled
+
+	for (const preset_bindings::uniform_binding &binding : bindings.uniforms)
+	{
+		effect &effect = _effects[binding.effect_index];
+		std::memcpy(effect.uniform_data_storage.data() + binding.offset, bindings.uniform_data[binding.effect_index].data() + binding.offset, binding.size);
+		std::memcpy(effect.uniforms[binding.uniform_index].toggle_key_data, binding.toggle_key_data, sizeof(binding.toggle_key_data));
+	}
+
+	for (size_t technique_index = 0; technique_index < _techniques.size(); ++technique_index)
+	{
+		technique &technique = _techniques[technique_index];
+		const preset_bindings::technique_binding &binding = bindings.techniques[technique_index];
+
+		if (binding.enabled)
 			enable_technique(technique);
 		else
 			disable_technique(technique);
 
-		// Reset toggle key to the value set via annotation first, since it may not exist in the preset
-		technique.toggle_key_data[0] = technique.annotation_as_int("toggle");
-		technique.toggle_key_data[1] = technique.annotation_as_int("togglectrl");
-		technique.toggle_key_data[2] = technique.annotation_as_int("toggleshift");
-		technique.toggle_key_data[3] = technique.annotation_as_int("togglealt");
-		preset.get({}, "Key" + technique.name, technique.toggle_key_data);
+		std::memcpy(technique.toggle_key_data, binding.toggle_key_data, sizeof(binding.toggle_key_data));
+	}
+}
+void reshade::runtime::update_preset_transition()
+{
+	const preset_bindings &source = *_transition_preset_bindings;
+	const preset_bindings &target = *_current_preset_bindings;
+
+	// Compute time since the transition has started
+	const auto transition_ms = std::chrono::duration_cast<std::chrono::milliseconds>(_last_present_time - _last_preset_switching_time).count();
+
+	if (transition_ms >= _preset_transition_delay ||
+		source.uniform_data.size() != _effects.size() || target.uniform_data.size() != _effects.size())
+	{
+		// Transition has ended, so make sure the final values are set exactly
+		apply_preset(target);
+		_is_in_between_presets_transition = false;
+		return;
+	}
+
+	const float ratio = static_cast<float>(transition_ms) / static_cast<float>(_preset_transition_delay);
+
+	// Perform smooth transition on floating point values (all others were already set to their final value when the preset was applied)
+	for (const preset_bindings::uniform_binding &binding : target.uniforms)
+	{
+		if (!binding.interpolate)
+			continue;
+
+		const auto source_values = reinterpret_cast<const float *>(source.uniform_data[binding.effect_index].data() + binding.offset);
+		const auto target_values = reinterpret_cast<const float *>(target.uniform_data[binding.effect_index].data() + binding.offset);
+		const auto values = reinterpret_cast<float *>(_effects[binding.effect_index].uniform_data_storage.data() + binding.offset);
+
+		for (uint32_t i = 0; i < binding.size / sizeof(float); ++i)
+			values[i] = source_values[i] + (target_values[i] - source_values[i]) * ratio;
 	}
 }
 void reshade::runtime::save_current_preset() const
@@ -1376,24 +2072,30 @@ bool reshade::runtime::switch_to_next_preset(const std::filesystem::path &filter
 	size_t current_preset_index = std::numeric_limits<size_t>::max();
 	std::vector<std::filesystem::path> preset_paths;
 
-	for (const auto &entry : std::filesystem::directory_iterator(search_path, std::filesystem::directory_options::skip_permission_denied, ec))
+	// Only need to compare file names below if the current preset is in the searched directory
+	const bool is_current_directory = std::filesystem::equivalent(search_path, _current_preset_path.parent_path(), ec);
+	const std::wstring current_preset_name = _current_preset_path.filename();
+
+	// Keep the snapshot alive while iterating, since it may be the only reference to it (the index can replace its own one on the background thread)
+	const preset_index::snapshot entries = _preset_index->entries(search_path);
+	for (const preset_index::entry &entry : *entries)
 	{
 		// Skip anything that is not a valid preset file
-		if (!check_preset_path(entry.path()))
+		if (entry.is_directory || !entry.is_valid)
 			continue;
 
 		// Keep track of the index of the current preset in the list of found preset files that is being build
-		if (std::filesystem::equivalent(entry, _current_preset_path, ec)) {
+		if (is_current_directory && _wcsicmp(entry.path.filename().c_str(), current_preset_name.c_str()) == 0) {
 			current_preset_index = preset_paths.size();
-			preset_paths.push_back(entry);
+			preset_paths.push_back(entry.path);
 			continue;
 		}
 
-		const std::wstring preset_name = entry.path().stem();
+		const std::wstring preset_name = entry.path.stem();
 		// Only add those files that are matching the filter text
 		if (filter_text.empty() || std::search(preset_name.begin(), preset_name.end(), filter_text.native().begin(), filter_text.native().end(),
 			[](wchar_t c1, wchar_t c2) { return towlower(c1) == towlower(c2); }) != preset_name.end())
-			preset_paths.push_back(entry);
+			preset_paths.push_back(entry.path);
 	}
 
 	if (preset_paths.begin() == preset_paths.end())
@@ -1433,42 +2135,249 @@ void reshade::runtime::save_screenshot(const std::wstring &postfix, const bool s
 
 	LOG(INFO) << "Saving screenshot to " << screenshot_path << " ...";
 
-	_screenshot_save_success = false; // Default to a save failure unless it is reported to succeed below
+	const auto write = std::make_shared<screenshot_write>();
+	write->path = screenshot_path;
+	write->preset_path = _screenshot_include_preset && should_save_preset ? _current_preset_path : std::filesystem::path();
+	write->preset_copy_path = least + L".ini";
+	write->format = _screenshot_format;
+	write->pixels.resize(size_t(_width) * _height * 4);
+
+	// Only start copying the frame here and write it to disk once the copy has finished a few frames later (see 'on_present'), so that this does not have to wait for the GPU
+	// The readback converts the frame straight into the buffer of the screenshot, which is then handed over to the worker thread for encoding
+	_screenshot_readback.push(_width, _height, [this, write](const uint8_t *pixels, unsigned int width, unsigned int height) {
+		write->width = width;
+		write->height = height;
+		write->success = pixels != nullptr;
+
+		const std::lock_guard<std::mutex> lock(_screenshot_write_mutex);
+
+		_screenshot_write_queue.push_back(write);
+
+		// The worker thread exits once the queue is drained, so start a new one if there is none running anymore
+		if (!_screenshot_write_thread_running)
+		{
+			if (_screenshot_write_thread.joinable())
+				_screenshot_write_thread.join();
+
+			_screenshot_write_thread_running = true;
+			_screenshot_write_thread = std::thread(&runtime::write_screenshots, this);
+		}
+	}, write->pixels.data());
+}
+void reshade::runtime::write_screenshots()
+{
+	std::unique_lock<std::mutex> lock(_screenshot_write_mutex);
 
-	if (std::vector<uint8_t> data(_width * _height * 4); capture_screenshot(data.data()))
+	while (!_screenshot_write_queue.empty())
 	{
-		if (FILE *file; _wfopen_s(&file, screenshot_path.c_str(), L"wb") == 0)
+		const std::shared_ptr<screenshot_write> write = std::move(_screenshot_write_queue.front());
+		_screenshot_write_queue.erase(_screenshot_write_queue.begin());
+
+		lock.unlock();
+
+		if (write->success)
 		{
-			const auto write_callback = [](void *context, void *data, int size) {
-				fwrite(data, 1, size, static_cast<FILE *>(context));
-			};
+			write->success = false; // Default to a save failure unless it is reported to succeed below
 
-			switch (_screenshot_format)
+			if (FILE *file; _wfopen_s(&file, write->path.c_str(), L"wb") == 0)
 			{
-			case 0:
-				_screenshot_save_success = stbi_write_bmp_to_func(write_callback, file, _width, _height, 4, data.data()) != 0;
-				break;
-			case 1:
-				_screenshot_save_success = stbi_write_png_to_func(write_callback, file, _width, _height, 4, data.data(), 0) != 0;
-				break;
+				const auto write_callback = [](void *context, void *data, int size) {
+					fwrite(data, 1, size, static_cast<FILE *>(context));
+				};
+
+				switch (write->format)
+				{
+				case 0:
+					write->success = stbi_write_bmp_to_func(write_callback, file, write->width, write->height, 4, write->pixels.data()) != 0;
+					break;
+				case 1:
+					write->success = stbi_write_png_to_func(write_callback, file, write->width, write->height, 4, write->pixels.data(), 0) != 0;
+					break;
+				}
+
+				fclose(file);
 			}
+		}
 
-			fclose(file);
+		// Release the image data right away, the result is only picked up during the next present
+		write->pixels.clear();
+		write->pixels.shrink_to_fit();
+
+		lock.lock();
+
+		_screenshot_write_results.push_back(write);
+	}
+
+	_screenshot_write_thread_running = false;
+}
+void reshade::runtime::finish_screenshots(bool wait)
+{
+	if (wait && _screenshot_write_thread.joinable())
+		_screenshot_write_thread.join();
+
+	std::vector<std::shared_ptr<screenshot_write>> results;
+	{	const std::lock_guard<std::mutex> lock(_screenshot_write_mutex);
+		results.swap(_screenshot_write_results);
+	}
+
+	for (const std::shared_ptr<screenshot_write> &write : results)
+	{
+		_screenshot_save_success = write->success;
+		_last_screenshot_file = write->path;
+		_last_screenshot_time = std::chrono::high_resolution_clock::now();
+
+		if (!write->success)
+		{
+			LOG(ERROR) << "Failed to write screenshot to " << write->path << '!';
+		}
+		else if (!write->preset_path.empty() && ini_file::flush_cache(write->preset_path))
+		{
+			// Preset was flushed to disk, so can just copy it over to the new location
+			std::error_code ec; std::filesystem::copy_file(write->preset_path, write->preset_copy_path, std::filesystem::copy_options::overwrite_existing, ec);
 		}
 	}
+}
 
-	_last_screenshot_file = screenshot_path;
-	_last_screenshot_time = std::chrono::high_resolution_clock::now();
+void reshade::runtime::start_frame_capture()
+{
+	const int hour = _date[3] / 3600;
+	const int minute = (_date[3] - hour * 3600) / 60;
+	const int seconds = _date[3] - hour * 3600 - minute * 60;
+
+	char filename[30];
+	sprintf_s(filename, " %.4d-%.2d-%.2d %.2d-%.2d-%.2d.rsframes", _date[0], _date[1], _date[2], hour, minute, seconds);
+
+	const std::filesystem::path capture_path = (_screenshot_path.is_relative() ? g_target_executable_path.parent_path() / _screenshot_path : _screenshot_path) / g_target_executable_path.stem().concat(filename);
+
+	// The whole file is allocated up front, so capturing does not need to allocate or grow anything while running
+	if (!_capture_file->open(capture_path, _width, _height, std::max(_capture_frame_count, 1u)))
+		return;
+
+	LOG(INFO) << "Capturing " << (_capture_continuous ? "the last " : "") << _capture_file->capacity() << " frames to " << capture_path << " ...";
 
-	if (!_screenshot_save_success)
+	_is_capturing_frames = true;
+	_capture_start_time = std::chrono::high_resolution_clock::now();
+}
+#if RESHADE_DEPTH
+void reshade::runtime::start_depth_trace()
+{
+	if (_depth_trace_frames != 0)
+		return; // Already recording
+
+	const int hour = _date[3] / 3600;
+	const int minute = (_date[3] - hour * 3600) / 60;
+	const int seconds = _date[3] - hour * 3600 - minute * 60;
+
+	char filename[30];
+	sprintf_s(filename, " %.4d-%.2d-%.2d %.2d-%.2d-%.2d.rsdepth", _date[0], _date[1], _date[2], hour, minute, seconds);
+
+	const std::filesystem::path trace_path = (_screenshot_path.is_relative() ? g_target_executable_path.parent_path() / _screenshot_path : _screenshot_path) / g_target_executable_path.stem().concat(filename);
+
+	if (!depth_selection::trace_writer::start(trace_path))
+	{
+		LOG(ERROR) << "Failed to open " << trace_path << " for recording depth-stencil trace!";
+		return;
+	}
+
+	LOG(INFO) << "Recording depth-stencil trace of the next frame to " << trace_path << " ...";
+
+	// This is called while the overlay is drawn, so the rest of this frame is only recorded to capture the state at its end
+	_depth_trace_frames = 1;
+}
+#endif
+
+void reshade::runtime::capture_frame()
+{
+	const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - _capture_start_time).count();
+
+	uint8_t *const data = _capture_file->begin_frame(timestamp);
+	if (data == nullptr)
 	{
-		LOG(ERROR) << "Failed to write screenshot to " << screenshot_path << '!';
+		LOG(ERROR) << "Failed to map next frame of capture file! Stopping capture.";
+		_is_capturing_frames = false;
+		return;
 	}
-	else if (_screenshot_include_preset && should_save_preset && ini_file::flush_cache(_current_preset_path))
+
+	// Convert the frame directly into the mapped file, so that no further copy is needed (writing it to disk is left to the system)
+	_screenshot_readback.push(_width, _height, [this, data](const uint8_t *pixels, unsigned int, unsigned int) {
+		_capture_file->end_frame(data, pixels != nullptr);
+	}, data);
+
+	// A burst ends once every frame slot was written, while a continuous capture keeps overwriting the oldest frames until it is stopped
+	if (!_capture_continuous && _capture_file->frames_started() >= _capture_file->capacity())
+		_is_capturing_frames = false;
+}
+void reshade::runtime::save_frame_statistics()
+{
+	const int hour = _date[3] / 3600;
+	const int minute = (_date[3] - hour * 3600) / 60;
+	const int seconds = _date[3] - hour * 3600 - minute * 60;
+
+	char filename[40];
+	sprintf_s(filename, " %.4d-%.2d-%.2d %.2d-%.2d-%.2d frametimes.csv", _date[0], _date[1], _date[2], hour, minute, seconds);
+
+	const std::filesystem::path statistics_path = (_screenshot_path.is_relative() ? g_target_executable_path.parent_path() / _screenshot_path : _screenshot_path) / g_target_executable_path.stem().concat(filename);
+
+	if (!write_frame_statistics_csv(statistics_path, _frame_times, _frame_overhead_times))
 	{
-		// Preset was flushed to disk, so can just copy it over to the new location
-		std::error_code ec; std::filesystem::copy_file(_current_preset_path, least + L".ini", std::filesystem::copy_options::overwrite_existing, ec);
+		LOG(ERROR) << "Failed to write frame statistics to " << statistics_path << '!';
+		return;
 	}
+
+	LOG(INFO) << "Saved frame statistics of " << _frame_times.count() << " frames to " << statistics_path << '.';
+}
+void reshade::runtime::start_trace()
+{
+	LOG(INFO) << "Recording trace of the next " << _trace_frame_count << " frames ...";
+
+	trace::start();
+	_trace_frames = std::max(_trace_frame_count, 1u);
+}
+void reshade::runtime::finish_trace()
+{
+	trace::stop();
+	_trace_frames = 0;
+
+	const int hour = _date[3] / 3600;
+	const int minute = (_date[3] - hour * 3600) / 60;
+	const int seconds = _date[3] - hour * 3600 - minute * 60;
+
+	char filename[40];
+	sprintf_s(filename, " %.4d-%.2d-%.2d %.2d-%.2d-%.2d trace.json", _date[0], _date[1], _date[2], hour, minute, seconds);
+
+	const std::filesystem::path trace_path = (_screenshot_path.is_relative() ? g_target_executable_path.parent_path() / _screenshot_path : _screenshot_path) / g_target_executable_path.stem().concat(filename);
+
+	if (!trace::write(trace_path))
+	{
+		LOG(ERROR) << "Failed to write trace to " << trace_path << '!';
+		return;
+	}
+
+	if (const size_t num_dropped_events = trace::num_dropped_events(); num_dropped_events != 0)
+		LOG(WARN) << "Trace is missing " << num_dropped_events << " events, because they did not fit into the buffer of their thread.";
+
+	LOG(INFO) << "Saved trace to " << trace_path << '.';
+}
+
+bool reshade::runtime::begin_readback(unsigned int slot)
+{
+	// Capture the frame right away, so it is available once the readback is completed
+	if (slot >= _readback_data.size())
+		_readback_data.resize(slot + 1);
+
+	_readback_data[slot].resize(_width * _height * 4);
+	return capture_screenshot(_readback_data[slot].data());
+}
+bool reshade::runtime::is_readback_complete(unsigned int) const
+{
+	return true;
+}
+bool reshade::runtime::finish_readback(unsigned int slot, uint8_t *buffer)
+{
+	assert(slot < _readback_data.size());
+
+	std::memcpy(buffer, _readback_data[slot].data(), _readback_data[slot].size());
+	return true;
 }
 
 static inline bool force_floating_point_value(const reshadefx::type &type, uint32_t renderer_id)
@@ -10,7 +10,13 @@
 #include <atomic>
 #include <chrono>
 #include <functional>
+#include <unordered_map>
 #include <filesystem>
+#include "runtime_readback.hpp"
+#include "runtime_frame_stats.hpp"
+#include "runtime_permutation_cache.hpp"
+#include "cpu_timer.hpp"
+#include "trace_recorder.hpp"
 
 #if RESHADE_GUI
 #include "imgui_editor.hpp"
@@ -26,12 +32,16 @@ namespace reshade
 	struct uniform;
 	struct texture;
 	struct technique;
+	struct preset_bindings;
+	class preset_index;
+	class capture_file;
+	struct screenshot_write;
 
 	/// <summary>
 	/// Platform independent base class for the main ReShade runtime.
 	/// This class needs to be implemented for all supported rendering APIs.
 	/// </summary>
-	class runtime
+	class runtime : protected readback_queue::backend
 	{
 	public:
 		/// <summary>
@@ -151,7 +161,8 @@ namespace reshade
 		/// </summary>
 		/// <param name="path">The path to an effect source code file.</param>
 		/// <param name="index">The ID of the effect.</param>
-		bool load_effect(const std::filesystem::path &path, size_t index);
+		/// <param name="preset">A snapshot of the current preset to read specialization constants from, or <c>nullptr</c> if there is none.</param>
+		bool load_effect(const std::filesystem::path &path, size_t index, const ini_file *preset);
 		/// <summary>
 		/// Load all effects found in the effect search paths.
 		/// </summary>
@@ -174,7 +185,8 @@ namespace reshade
 		/// <summary>
 		/// Load image files and update textures with image data.
 		/// </summary>
-		void load_textures();
+		/// <param name="effect_index">The ID of the effect to load the textures of, or the maximum value to load those of all effects.</param>
+		void load_textures(size_t effect_index = std::numeric_limits<size_t>::max());
 
 		/// <summary>
 		/// Apply post-processing effects to the frame.
@@ -193,6 +205,31 @@ namespace reshade
 		virtual void render_imgui_draw_data(ImDrawData *draw_data) = 0;
 #endif
 
+		/// <summary>
+		/// Record a copy of the current frame image into a readback slot (see <see cref="readback_queue"/>).
+		/// The default implementation captures the frame synchronously via <see cref="capture_screenshot"/>, so runtimes only need to override this if they can copy asynchronously.
+		/// </summary>
+		/// <param name="slot">The index of the readback slot to copy to.</param>
+		bool begin_readback(unsigned int slot) override;
+		/// <summary>
+		/// Check whether the copy into a readback slot has finished, without blocking.
+		/// </summary>
+		/// <param name="slot">The index of the readback slot to check.</param>
+		bool is_readback_complete(unsigned int slot) const override;
+		/// <summary>
+		/// Wait for the copy into a readback slot to finish and convert it to 32bpp RGBA image data.
+		/// </summary>
+		/// <param name="slot">The index of the readback slot to read from.</param>
+		/// <param name="buffer">The 32bpp RGBA buffer to write the image data to.</param>
+		bool finish_readback(unsigned int slot, uint8_t *buffer) override;
+
+#if RESHADE_DEPTH
+		/// <summary>
+		/// Record all events of the depth-stencil trackers during the next frame to a trace file, which can be replayed offline with the 'depth_replay' tool.
+		/// </summary>
+		void start_depth_trace();
+#endif
+
 		bool _is_initialized = false;
 		bool _has_high_network_activity = false;
 		bool _has_depth_texture = false;
@@ -212,6 +249,7 @@ namespace reshade
 		std::vector<effect> _effects;
 		std::vector<texture> _textures;
 		std::vector<technique> _techniques;
+		std::unique_ptr<permutation_cache> _permutation_cache;
 
 	private:
 		/// <summary>
@@ -224,7 +262,69 @@ namespace reshade
 		/// <summary>
 		/// Checks whether runtime is currently loading effects.
 		/// </summary>
-		bool is_loading() const { return _reload_remaining_effects != std::numeric_limits<size_t>::max(); }
+		bool is_loading() const { return _reload_remaining_effects != std::numeric_limits<size_t>::max() || _background_remaining_effects != 0; }
+
+		/// <summary>
+		/// Load, pre-process and compile an effect source file into the specified effect, without touching any other runtime state.
+		/// </summary>
+		/// <param name="path">The path to an effect source code file.</param>
+		/// <param name="effect">The effect to fill with the compilation results.</param>
+		/// <param name="preset">A snapshot of the current preset to read specialization constants from, or <c>nullptr</c> if there is none.</param>
+		void parse_effect(const std::filesystem::path &path, effect &effect, const ini_file *preset);
+		/// <summary>
+		/// Load only the techniques of an effect from the metadata cache if none of them are enabled, so that compiling it can be delayed until they are.
+		/// </summary>
+		/// <param name="path">The path to an effect source code file.</param>
+		/// <param name="index">The ID of the effect.</param>
+		/// <param name="technique_list">The techniques that are enabled in the current preset.</param>
+		/// <returns><c>true</c> if the effect was skipped, <c>false</c> if there is no up-to-date metadata or the effect is needed right away and has to be loaded with <see cref="load_effect"/>.</returns>
+		bool load_effect_metadata(const std::filesystem::path &path, size_t index, const std::vector<std::string> &technique_list);
+		/// <summary>
+		/// Start compiling an effect that was skipped during loading in a worker thread, because one of its techniques was enabled now.
+		/// The current version of the effect (with only its technique list) stays in place until <see cref="finish_loading_skipped_effect"/> swaps in the result.
+		/// </summary>
+		/// <param name="index">The ID of the effect.</param>
+		void load_skipped_effect(size_t index);
+		/// <summary>
+		/// Swap in an effect that finished compiling in a worker thread after <see cref="load_skipped_effect"/> and apply the variable values of the current preset to it.
+		/// </summary>
+		/// <returns><c>true</c> if an effect was swapped in, <c>false</c> if none has finished compiling yet.</returns>
+		bool finish_loading_skipped_effect();
+		/// <summary>
+		/// Hash everything that affects the result of pre-processing an effect, which decides the techniques it has.
+		/// </summary>
+		/// <param name="path">The path to an effect source code file.</param>
+		uint64_t effect_metadata_key(const std::filesystem::path &path) const;
+		/// <summary>
+		/// Get a copy of the current preset that <see cref="parse_effect"/> can read specialization constants from on any thread, or <c>nullptr</c> if it does not need one.
+		/// </summary>
+		std::shared_ptr<const ini_file> load_spec_constant_preset() const;
+		/// <summary>
+		/// Create the uniforms, textures and techniques of an effect that was compiled with <see cref="parse_effect"/> and add them to the runtime.
+		/// </summary>
+		/// <param name="index">The ID of the effect.</param>
+		void finish_loading_effect(size_t index);
+		/// <summary>
+		/// Create the textures of an effect and initialize it with the back-end implementation, cleaning up again if that fails.
+		/// </summary>
+		/// <param name="index">The ID of the effect.</param>
+		bool compile_effect(size_t index);
+
+		/// <summary>
+		/// Start compiling new versions of all effects in worker threads, while the current versions keep rendering.
+		/// </summary>
+		/// <param name="effect_files">The list of effect files found in the effect search paths.</param>
+		/// <param name="preset">A snapshot of the current preset to read specialization constants from, or <c>nullptr</c> if there is none.</param>
+		/// <returns><c>true</c> if the reload was started, <c>false</c> if the list of effect files changed or other effects are still being loaded and everything has to be reloaded instead.</returns>
+		bool load_effects_in_background(const std::vector<std::filesystem::path> &effect_files, const std::shared_ptr<const ini_file> &preset);
+		/// <summary>
+		/// Replace an effect with a new version that was compiled in the background, carrying over variable values and technique states.
+		/// If the new version fails to compile or initialize, the current version is kept.
+		/// </summary>
+		/// <param name="index">The ID of the effect.</param>
+		/// <param name="new_effect">The new version of the effect.</param>
+		/// <returns><c>true</c> if the effect had to be initialized with the back-end implementation, <c>false</c> otherwise.</returns>
+		bool swap_effect(size_t index, effect &&new_effect);
 
 		/// <summary>
 		/// Enable a technique so it is rendered.
@@ -251,6 +351,22 @@ namespace reshade
 		/// </summary>
 		void save_current_preset() const;
 
+		/// <summary>
+		/// Resolve all values of a preset against the loaded effects, so that it can be applied without any lookups.
+		/// </summary>
+		/// <param name="preset">The preset file to read values from.</param>
+		/// <param name="bindings">The binding table to fill.</param>
+		void compile_preset(const ini_file &preset, preset_bindings &bindings);
+		/// <summary>
+		/// Apply a previously compiled preset to all effects and techniques.
+		/// </summary>
+		/// <param name="bindings">The binding table to apply.</param>
+		void apply_preset(const preset_bindings &bindings);
+		/// <summary>
+		/// Blend uniform values towards the current preset while a transition is in progress.
+		/// </summary>
+		void update_preset_transition();
+
 		/// <summary>
 		/// Find next preset is the directory and switch to it.
 		/// </summary>
@@ -263,6 +379,38 @@ namespace reshade
 		/// Create a copy of the current frame and write it to an image file on disk.
 		/// </summary>
 		void save_screenshot(const std::wstring &postfix = std::wstring(), bool should_save_preset = false);
+		/// <summary>
+		/// Encode and write the screenshots whose readback has completed to disk. This runs on a worker thread, so that encoding large frames does not cause a hitch.
+		/// </summary>
+		void write_screenshots();
+		/// <summary>
+		/// Report the results of screenshots that were written by the worker thread.
+		/// </summary>
+		/// <param name="wait">Set to <c>true</c> to wait for all queued screenshots to be written first.</param>
+		void finish_screenshots(bool wait);
+
+		/// <summary>
+		/// Create a new capture file and start streaming raw frames into it (see <see cref="capture_file"/>).
+		/// </summary>
+		void start_frame_capture();
+		/// <summary>
+		/// Copy the current frame into the next slot of the capture file.
+		/// </summary>
+		void capture_frame();
+
+		/// <summary>
+		/// Write the frame time and runtime overhead histograms recorded so far to a CSV file next to the screenshots.
+		/// </summary>
+		void save_frame_statistics();
+
+		/// <summary>
+		/// Start recording a trace of the work done by the runtime for the configured number of frames.
+		/// </summary>
+		void start_trace();
+		/// <summary>
+		/// Stop recording the current trace and write it to a JSON file next to the screenshots, which can be opened in Perfetto or "chrome://tracing".
+		/// </summary>
+		void finish_trace();
 
 		// === Status ===
 		int _date[4] = {};
@@ -293,6 +441,13 @@ namespace reshade
 		std::atomic<size_t> _reload_remaining_effects = 0;
 		std::mutex _reload_mutex;
 		std::vector<std::thread> _worker_threads;
+		bool _reload_in_background = false;
+		bool _load_effects_on_demand = true;
+		size_t _background_remaining_effects = 0;
+		std::vector<effect> _background_effects;
+		std::vector<size_t> _background_ready_effects; // Protected by '_reload_mutex'
+		std::vector<size_t> _skipped_effects_loading; // Effects that are compiled in a worker thread after they were skipped during loading
+		std::vector<std::pair<size_t, effect>> _skipped_effects_ready; // Protected by '_reload_mutex'
 		std::vector<std::string> _global_preprocessor_definitions;
 		std::vector<std::string> _preset_preprocessor_definitions;
 		std::vector<std::filesystem::path> _effect_search_paths;
@@ -310,6 +465,42 @@ namespace reshade
 		std::filesystem::path _screenshot_path;
 		std::filesystem::path _last_screenshot_file;
 		std::chrono::high_resolution_clock::time_point _last_screenshot_time;
+		readback_queue _screenshot_readback;
+		std::vector<std::vector<uint8_t>> _readback_data;
+		std::thread _screenshot_write_thread;
+		std::mutex _screenshot_write_mutex;
+		bool _screenshot_write_thread_running = false; // Protected by '_screenshot_write_mutex'
+		std::vector<std::shared_ptr<screenshot_write>> _screenshot_write_queue; // Protected by '_screenshot_write_mutex'
+		std::vector<std::shared_ptr<screenshot_write>> _screenshot_write_results; // Protected by '_screenshot_write_mutex'
+
+		// === Frame Capture ===
+		bool _is_capturing_frames = false;
+		bool _capture_continuous = false;
+		unsigned int _capture_frame_count = 300;
+		unsigned int _capture_key_data[4];
+		std::unique_ptr<capture_file> _capture_file;
+		std::chrono::high_resolution_clock::time_point _capture_start_time;
+
+		// === Frame Statistics ===
+		unsigned int _frame_stats_key_data[4];
+		frame_time_histogram _frame_times;
+		frame_time_histogram _frame_overhead_times;
+		std::chrono::high_resolution_clock::time_point _frame_overhead_start_time;
+#if RESHADE_CPU_TIMERS
+		cpu_timer_table _cpu_timers;
+#endif
+
+		// === Trace ===
+		bool _trace_reload = false;
+		bool _is_tracing_reload = false;
+		unsigned int _trace_frames = 0;
+		unsigned int _trace_frame_count = 60;
+		unsigned int _trace_key_data[4];
+
+#if RESHADE_DEPTH
+		// === Depth Trace ===
+		unsigned int _depth_trace_frames = 0;
+#endif
 
 		// === Preset Switching ===
 		bool _preset_save_success = true;
@@ -318,6 +509,10 @@ namespace reshade
 		unsigned int _next_preset_key_data[4];
 		unsigned int _preset_transition_delay = 1000;
 		std::filesystem::path _current_preset_path;
+		std::unique_ptr<preset_index> _preset_index;
+		std::shared_ptr<const preset_bindings> _current_preset_bindings;
+		std::unique_ptr<preset_bindings> _transition_preset_bindings;
+		std::unordered_map<std::wstring, std::shared_ptr<const preset_bindings>> _compiled_presets;
 		std::chrono::high_resolution_clock::time_point _last_preset_switching_time;
 
 #if RESHADE_GUI
@@ -347,6 +542,7 @@ namespace reshade
 		bool _show_clock = false;
 		bool _show_fps = false;
 		bool _show_frametime = false;
+		bool _show_frametime_lows = false;
 		bool _show_splash = true;
 		bool _show_code_editor = false;
 		bool _show_screenshot_message = true;
@@ -384,6 +580,7 @@ namespace reshade
 		// === User Interface - Statistics ===
 		void *_preview_texture = nullptr;
 		unsigned int _preview_size[3] = { 0, 0, 0xFFFFFFFF };
+		bool _show_pass_timings = false;
 
 		// === User Interface - Log ===
 		bool _log_wordwrap = false;
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "dll_log.hpp"
+#include "runtime_capture.hpp"
+#include <cassert>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <Windows.h>
+
+static inline uint64_t align_up(uint64_t size, uint64_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+bool reshade::capture_file::open(const std::filesystem::path &path, unsigned int width, unsigned int height, unsigned int capacity)
+{
+	assert(!is_open() && capacity != 0);
+
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+
+	// Frame slots may have to be mapped individually (so that captures can exceed the address space of 32-bit processes), which requires their offsets to be a multiple of the allocation granularity
+	const uint64_t granularity = system_info.dwAllocationGranularity;
+	const uint64_t frame_offset = align_up(sizeof(capture_file_header) + sizeof(capture_frame_header) * capacity, granularity);
+	const uint64_t frame_size = uint64_t(width) * height * 4;
+	const uint64_t frame_stride = align_up(frame_size, granularity);
+	const uint64_t file_size = frame_offset + frame_stride * capacity;
+
+	_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		_file = nullptr;
+		LOG(ERROR) << "Failed to create capture file " << path << " with error code " << GetLastError() << '!';
+		return false;
+	}
+
+	// Creating the mapping extends the file to its full size up front, so that no allocation happens while capturing
+	_mapping = CreateFileMappingW(_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(file_size >> 32), static_cast<DWORD>(file_size), nullptr);
+	if (_mapping == nullptr)
+	{
+		LOG(ERROR) << "Failed to allocate " << file_size << " bytes for capture file " << path << " with error code " << GetLastError() << '!';
+		close();
+		return false;
+	}
+
+	// The header and frame table stay mapped while the file is open
+	_header = static_cast<capture_file_header *>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(frame_offset)));
+	if (_header == nullptr)
+	{
+		LOG(ERROR) << "Failed to map capture file " << path << " with error code " << GetLastError() << '!';
+		close();
+		return false;
+	}
+
+	// Map all frame slots once up front, so that capturing does not have to create and destroy a view (and fault in its pages again) every frame
+	if (const uint64_t frames_size = frame_stride * capacity; frames_size <= std::numeric_limits<SIZE_T>::max())
+		_frames = static_cast<uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_WRITE, static_cast<DWORD>(frame_offset >> 32), static_cast<DWORD>(frame_offset), static_cast<SIZE_T>(frames_size)));
+	if (_frames == nullptr)
+		LOG(WARN) << "Capture file " << path << " does not fit into the address space, mapping frames individually instead.";
+
+	std::memcpy(_header->magic, capture_file_header::expected_magic, sizeof(_header->magic));
+	_header->version = capture_file_header::expected_version;
+	_header->width = width;
+	_header->height = height;
+	_header->frame_capacity = capacity;
+	_header->frame_offset = frame_offset;
+	_header->frame_stride = frame_stride;
+	_header->frame_count = 0;
+
+	_capacity = capacity;
+	_frame_size = frame_size;
+	_frames_started = 0;
+
+	return true;
+}
+
+void reshade::capture_file::close()
+{
+	// Unmap any frames that were never finished, so that the handles can be closed below
+	while (!_in_flight.empty())
+		end_frame(_in_flight.front().data, false);
+
+	if (_frames != nullptr)
+	{
+		UnmapViewOfFile(_frames);
+		_frames = nullptr;
+	}
+
+	if (_header != nullptr)
+	{
+		_header->frame_count = _frames_started;
+
+		UnmapViewOfFile(_header);
+		_header = nullptr;
+	}
+
+	if (_mapping != nullptr)
+	{
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+	}
+	if (_file != nullptr)
+	{
+		CloseHandle(_file);
+		_file = nullptr;
+	}
+
+	_capacity = 0;
+}
+
+uint8_t *reshade::capture_file::begin_frame(uint64_t timestamp)
+{
+	assert(is_open());
+
+	const uint32_t slot = static_cast<uint32_t>(_frames_started % _capacity);
+
+	uint8_t *view = nullptr;
+	if (_frames != nullptr)
+	{
+		view = _frames + _header->frame_stride * slot;
+	}
+	else
+	{
+		const uint64_t offset = _header->frame_offset + _header->frame_stride * slot;
+
+		view = static_cast<uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), static_cast<SIZE_T>(_frame_size)));
+		if (view == nullptr)
+			return nullptr;
+	}
+
+	// Invalidate the slot until the new frame was written, since it may still contain an older frame
+	const auto table = reinterpret_cast<capture_frame_header *>(_header + 1);
+	table[slot].sequence = 0;
+
+	frame &frame = _in_flight.emplace_back();
+	frame.data = view;
+	frame.slot = slot;
+	frame.info.sequence = ++_frames_started;
+	frame.info.timestamp = timestamp;
+
+	return frame.data;
+}
+
+void reshade::capture_file::end_frame(uint8_t *data, bool success)
+{
+	const auto it = std::find_if(_in_flight.begin(), _in_flight.end(), [data](const frame &frame) { return frame.data == data; });
+	assert(it != _in_flight.end());
+
+	if (success)
+	{
+		const auto table = reinterpret_cast<capture_frame_header *>(_header + 1);
+		table[it->slot] = it->info;
+		_header->frame_count = _frames_started;
+	}
+
+	if (_frames == nullptr)
+		UnmapViewOfFile(it->data);
+
+	_in_flight.erase(it);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace reshade
+{
+	/// <summary>
+	/// Header at the start of a raw frame capture file (*.rsframes).
+	/// It is followed by a table of <see cref="capture_frame_header"/> entries (one per frame slot) and then the frame slots, each holding <c>width * height * 4</c> bytes of 32bpp RGBA image data.
+	/// All values are stored little-endian. The file layout is independent of the platform, so that it can be read by the offline encoder ('tools/capture_encode.cpp').
+	/// </summary>
+	struct capture_file_header
+	{
+		static constexpr char expected_magic[4] = { 'R', 'S', 'F', 'C' };
+		static constexpr uint32_t expected_version = 1;
+
+		char magic[4];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t frame_capacity; // Number of frame slots in the file
+		uint32_t reserved;
+		uint64_t frame_offset; // Offset of the first frame slot in bytes from the start of the file
+		uint64_t frame_stride; // Distance between two frame slots in bytes
+		uint64_t frame_count; // Number of frames that were captured, which can exceed the capacity (in which case the oldest frames were overwritten)
+	};
+
+	/// <summary>
+	/// Entry in the frame table of a raw frame capture file, describing the contents of a frame slot.
+	/// </summary>
+	struct capture_frame_header
+	{
+		uint64_t sequence; // One-based index of the frame in the capture, or zero if the slot does not contain a valid frame
+		uint64_t timestamp; // Time since the capture was started in nanoseconds
+	};
+
+	/// <summary>
+	/// Writes frames into a preallocated, memory-mapped capture file.
+	/// Frame slots are used as a ring, so once all slots were written, the next frame overwrites the oldest one.
+	/// </summary>
+	class capture_file
+	{
+	public:
+		capture_file() = default;
+		~capture_file() { close(); }
+
+		capture_file(const capture_file &) = delete;
+		capture_file &operator=(const capture_file &) = delete;
+
+		/// <summary>
+		/// Create and preallocate a new capture file, replacing any existing file at the specified path.
+		/// </summary>
+		/// <param name="path">The path to the file to create.</param>
+		/// <param name="width">The frame width in pixels.</param>
+		/// <param name="height">The frame height in pixels.</param>
+		/// <param name="capacity">The number of frame slots to allocate.</param>
+		bool open(const std::filesystem::path &path, unsigned int width, unsigned int height, unsigned int capacity);
+		/// <summary>
+		/// Write the final frame count and close the file. All frames have to be finished via <see cref="end_frame"/> before.
+		/// </summary>
+		void close();
+
+		bool is_open() const { return _header != nullptr; }
+
+		unsigned int capacity() const { return _capacity; }
+		/// <summary>
+		/// Return the number of frames started via <see cref="begin_frame"/> since the file was opened.
+		/// </summary>
+		uint64_t frames_started() const { return _frames_started; }
+		/// <summary>
+		/// Return the number of frames started via <see cref="begin_frame"/> that were not finished yet.
+		/// </summary>
+		size_t frames_in_flight() const { return _in_flight.size(); }
+
+		/// <summary>
+		/// Return a pointer to write the image data of the next frame to, or <c>nullptr</c> on failure.
+		/// </summary>
+		/// <param name="timestamp">The time since the capture was started in nanoseconds.</param>
+		uint8_t *begin_frame(uint64_t timestamp);
+		/// <summary>
+		/// Mark a frame slot previously returned by <see cref="begin_frame"/> as written.
+		/// </summary>
+		/// <param name="data">The pointer returned by <see cref="begin_frame"/>.</param>
+		/// <param name="success">Set to <c>false</c> if the image data could not be written, so that the slot is skipped when reading the file.</param>
+		void end_frame(uint8_t *data, bool success);
+
+	private:
+		struct frame
+		{
+			uint8_t *data;
+			uint32_t slot;
+			capture_frame_header info;
+		};
+
+		void *_file = nullptr;
+		void *_mapping = nullptr;
+		capture_file_header *_header = nullptr;
+		uint8_t *_frames = nullptr; // All frame slots, if they could be mapped at once, otherwise they are mapped individually in 'begin_frame'
+		unsigned int _capacity = 0;
+		uint64_t _frame_size = 0;
+		uint64_t _frames_started = 0;
+		std::vector<frame> _in_flight;
+	};
+}
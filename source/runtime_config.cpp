@@ -4,11 +4,128 @@
  */
 
 #include "runtime_config.hpp"
+#include <mutex>
+#include <thread>
 #include <fstream>
 #include <sstream>
+#include <shared_mutex>
+#include <condition_variable>
 
+struct pending_write
+{
+	std::filesystem::path path;
+	std::string data;
+	std::filesystem::file_time_type modified_at;
+	std::filesystem::file_time_type written_at;
+	bool success = true;
+};
+
+static std::shared_mutex s_ini_cache_mutex;
 static std::unordered_map<std::wstring, reshade::ini_file> g_ini_cache;
 
+// Files waiting to be written by the background writer thread (at most one entry per path, so that multiple modifications are coalesced into one write)
+static std::mutex s_write_mutex;
+static std::condition_variable s_write_condition;
+static std::vector<pending_write> s_write_queue;
+static std::vector<pending_write> s_write_results;
+static pending_write s_write_in_progress;
+static bool s_write_thread_running = false;
+
+static bool write_file_atomic(const std::filesystem::path &path, const std::string &data)
+{
+	std::error_code ec;
+	std::filesystem::path temp_path = path;
+	temp_path += L".tmp";
+
+	{	std::ofstream file(temp_path);
+		if (!file.is_open() || file.fail())
+			return false;
+
+		file.rdbuf()->pubsetbuf(nullptr, 0);
+
+		file.imbue(std::locale("en-us.UTF-8"));
+		file.write(data.data(), data.size());
+
+		if (file.flush(); file.fail())
+		{
+			file.close();
+			std::filesystem::remove(temp_path, ec);
+			return false;
+		}
+	}
+
+	// Replace the target file in one go, so that it is never left in a partially written state
+	if (std::filesystem::rename(temp_path, path, ec); ec)
+	{
+		std::filesystem::remove(temp_path, ec);
+		return false;
+	}
+
+	return true;
+}
+static void process_pending_write(pending_write &write)
+{
+	std::error_code ec;
+	if (const std::filesystem::file_time_type modified_at = std::filesystem::last_write_time(write.path, ec);
+		ec.value() == 0 && modified_at >= write.modified_at)
+	{
+		// File exists and was modified on disk and may have different data, so cannot save (leave write time empty, so that the file is reloaded)
+		return;
+	}
+
+	write.success = write_file_atomic(write.path, write.data);
+
+	if (const std::filesystem::file_time_type written_at = std::filesystem::last_write_time(write.path, ec); ec.value() == 0)
+		write.written_at = written_at;
+
+	assert(!write.success || std::filesystem::file_size(write.path, ec) > 0);
+}
+static void write_thread_main()
+{
+	std::unique_lock<std::mutex> lock(s_write_mutex);
+
+	while (!s_write_queue.empty())
+	{
+		// Keep the write around until it finished, so that it is not lost if this thread is terminated in the middle of it
+		s_write_in_progress = std::move(s_write_queue.front());
+		s_write_queue.erase(s_write_queue.begin());
+
+		lock.unlock();
+
+		process_pending_write(s_write_in_progress);
+
+		lock.lock();
+		s_write_results.push_back(std::move(s_write_in_progress));
+		s_write_in_progress = {};
+		s_write_condition.notify_all();
+	}
+
+	// Thread exits once the queue is drained, a new one is spawned by the next flush that has something to write
+	s_write_thread_running = false;
+	s_write_condition.notify_all();
+}
+
+// The writer thread is terminated without finishing its queue when the process exits, so write what is left synchronously when this module is unloaded
+static struct pending_write_finalizer
+{
+	~pending_write_finalizer()
+	{
+		// The terminated thread may have owned the lock, in which case the queue cannot be accessed safely anymore
+		if (!s_write_mutex.try_lock())
+			return;
+
+		if (!s_write_in_progress.path.empty())
+			process_pending_write(s_write_in_progress);
+		for (pending_write &write : s_write_queue)
+			process_pending_write(write);
+
+		s_write_in_progress = {};
+		s_write_queue.clear();
+
+		s_write_mutex.unlock();
+	}
+} s_write_finalizer;
+
 reshade::ini_file::ini_file(const std::filesystem::path &path)
 	: _path(path)
 {
@@ -46,6 +163,10 @@ void reshade::ini_file::load()
 	if (condition == condition::blocked || condition == condition::unknown)
 		return;
 
+	// The file was deleted, so the data changes even though nothing is loaded
+	if (condition == condition::not_found && !_sections.empty())
+		_modified_at = std::filesystem::file_time_type::clock::now();
+
 	_sections.clear();
 	_modified = false;
 
@@ -108,15 +229,22 @@ bool reshade::ini_file::save()
 	if (!_modified)
 		return true;
 
-	std::error_code ec;
-	std::filesystem::file_time_type modified_at = std::filesystem::last_write_time(_path, ec);
-	if (ec.value() == 0 && modified_at >= _modified_at)
-	{
-		// File exists and was modified on disk and may have different data, so cannot save
-		_modified = false;
-		return true;
-	}
+	pending_write write;
+	write.path = _path;
+	write.modified_at = _modified_at;
+	serialize(write.data);
 
+	process_pending_write(write);
+
+	// Reset state to avoid cache flushing to repeatedly save the file, even if saving failed
+	_modified = false;
+	if (write.written_at != std::filesystem::file_time_type())
+		_modified_at = write.written_at;
+
+	return write.success;
+}
+void reshade::ini_file::serialize(std::string &result) const
+{
 	std::stringstream data;
 	std::vector<std::string> section_names, key_names;
 
@@ -170,56 +298,161 @@ bool reshade::ini_file::save()
 		data << '\n';
 	}
 
-	std::ofstream file(_path);
-	if (!file.is_open() || file.fail())
-	{
-		// Reset state to avoid cache flushing to repeatedly save the file
-		_modified = false;
-		return false;
-	}
-
-	file.rdbuf()->pubsetbuf(nullptr, 0);
-
-	const std::string str = data.str();
-	file.imbue(std::locale("en-us.UTF-8"));
-	file.write(str.data(), str.size());
+	result = data.str();
+}
 
-	// Keep the modified flag if saving was not successful, so to try again later
-	if (_modified = file.fail(); _modified)
-		std::filesystem::last_write_time(_path, modified_at, ec);
-	else if (modified_at = std::filesystem::last_write_time(_path, ec); ec.value() == 0)
-		_modified_at = modified_at;
+std::shared_ptr<const reshade::ini_file> reshade::ini_file::load_cache_snapshot(const std::filesystem::path &path)
+{
+	const ini_file &cached = load_cache(path);
 
-	assert(std::filesystem::file_size(_path, ec) > 0);
+	const std::shared_lock<std::shared_mutex> lock(s_ini_cache_mutex);
 
-	return true;
+	const auto snapshot = std::make_shared<ini_file>(cached);
+	snapshot->_modified = false; // Only the cached instance may write the file
+	snapshot->_write_pending = false;
+	return snapshot;
 }
+std::vector<std::pair<std::filesystem::path, std::filesystem::file_time_type>> reshade::ini_file::cache_modification_times()
+{
+	const std::shared_lock<std::shared_mutex> lock(s_ini_cache_mutex);
 
+	std::vector<std::pair<std::filesystem::path, std::filesystem::file_time_type>> result;
+	result.reserve(g_ini_cache.size());
+	for (const auto &file : g_ini_cache)
+		result.emplace_back(file.second._path, file.second._modified_at);
+	return result;
+}
 reshade::ini_file &reshade::ini_file::load_cache(const std::filesystem::path &path)
 {
+	const auto now = std::filesystem::file_time_type::clock::now();
+
+	{	const std::shared_lock<std::shared_mutex> lock(s_ini_cache_mutex);
+
+		// Don't need to reload file when it was just loaded or there are still modifications pending (either in memory or not yet written by the background writer thread)
+		if (const auto it = g_ini_cache.find(path); it != g_ini_cache.end() &&
+			(it->second._modified || it->second._write_pending || (now - it->second._modified_at) < std::chrono::seconds(1)))
+			return it->second;
+	}
+
+	const std::unique_lock<std::shared_mutex> lock(s_ini_cache_mutex);
+
 	const auto it = g_ini_cache.try_emplace(path, path);
-	if (it.second || (std::filesystem::file_time_type::clock::now() - it.first->second._modified_at) < std::chrono::seconds(1))
-		return it.first->second; // Don't need to reload file when it was just loaded or there are still modifications pending
-	else
-		return it.first->second.load(), it.first->second;
+	if (!it.second && !it.first->second._modified && !it.first->second._write_pending)
+		it.first->second.load(); // This only reads the file again if it was changed on disk
+	return it.first->second;
 }
 
 bool reshade::ini_file::flush_cache()
+{
+	return flush_cache(std::chrono::seconds(1));
+}
+bool reshade::ini_file::flush_cache_and_wait()
+{
+	const bool success = flush_cache(std::chrono::seconds(0));
+
+	{	std::unique_lock<std::mutex> write_lock(s_write_mutex);
+		s_write_condition.wait(write_lock, []() { return !s_write_thread_running; });
+	}
+
+	// Apply the results of the writes that were just waited on
+	return flush_cache(std::chrono::seconds(0)) && success;
+}
+bool reshade::ini_file::flush_cache(std::chrono::seconds min_age)
 {
 	bool success = true;
+	bool spawn_write_thread = false;
 	const auto now = std::filesystem::file_time_type::clock::now();
 
-	// Save all files that were modified in one second intervals
+	const std::unique_lock<std::shared_mutex> cache_lock(s_ini_cache_mutex);
+	const std::unique_lock<std::mutex> write_lock(s_write_mutex);
+
+	// Apply results of writes that finished since the last flush
+	for (pending_write &write : s_write_results)
+	{
+		success &= write.success;
+
+		const auto it = g_ini_cache.find(write.path);
+		if (it == g_ini_cache.end())
+			continue;
+
+		// Update modification time so the file is not read again right after it was written, unless there were changes in the meantime
+		if (!it->second._modified && write.written_at != std::filesystem::file_time_type())
+			it->second._modified_at = write.written_at;
+
+		// The file may only be read again once the last write of it finished
+		if (s_write_in_progress.path != write.path && std::find_if(s_write_queue.begin(), s_write_queue.end(),
+			[&write](const pending_write &item) { return item.path == write.path; }) == s_write_queue.end())
+			it->second._write_pending = false;
+	}
+	s_write_results.clear();
+
+	// Hand all files that were modified in one second intervals over to the background writer thread
 	for (auto &file : g_ini_cache)
 	{
-		if (file.second._modified && (now - file.second._modified_at) > std::chrono::seconds(1))
-			success &= file.second.save();
+		if (!file.second._modified || (min_age.count() != 0 && (now - file.second._modified_at) <= min_age))
+			continue;
+
+		pending_write write;
+		write.path = file.second._path;
+		write.modified_at = file.second._modified_at;
+		file.second.serialize(write.data);
+		file.second._modified = false;
+		file.second._write_pending = true;
+
+		// Replace any write of the same file that is still pending
+		if (const auto it = std::find_if(s_write_queue.begin(), s_write_queue.end(),
+			[&write](const pending_write &item) { return item.path == write.path; }); it != s_write_queue.end())
+			*it = std::move(write);
+		else
+			s_write_queue.push_back(std::move(write));
+
+		spawn_write_thread = true;
+	}
+
+	if (spawn_write_thread && !s_write_thread_running)
+	{
+		s_write_thread_running = true;
+		std::thread(write_thread_main).detach();
 	}
 
 	return success;
 }
 bool reshade::ini_file::flush_cache(const std::filesystem::path &path)
 {
+	const std::unique_lock<std::shared_mutex> cache_lock(s_ini_cache_mutex);
+
 	const auto it = g_ini_cache.find(path);
-	return it != g_ini_cache.end() && it->second.save();
+	if (it == g_ini_cache.end())
+		return false;
+
+	std::unique_lock<std::mutex> write_lock(s_write_mutex);
+
+	// Wait for the background writer thread in case it is currently writing this file
+	s_write_condition.wait(write_lock, [&path]() { return s_write_in_progress.path != path; });
+
+	// Write out any pending data for this file right away, since the caller expects it on disk after this call
+	if (const auto write = std::find_if(s_write_queue.begin(), s_write_queue.end(),
+		[&path](const pending_write &item) { return item.path == path; }); write != s_write_queue.end())
+	{
+		pending_write pending = std::move(*write);
+		s_write_queue.erase(write);
+		write_lock.unlock();
+
+		process_pending_write(pending);
+
+		if (!it->second._modified && pending.written_at != std::filesystem::file_time_type())
+			it->second._modified_at = pending.written_at;
+		it->second._write_pending = false;
+		if (!pending.success)
+			return false;
+	}
+	else
+	{
+		write_lock.unlock();
+
+		// A write that finished in the meantime has its result applied by the next flush, but the file is on disk already
+		it->second._write_pending = false;
+	}
+
+	return it->second.save();
 }
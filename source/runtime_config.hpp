@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <string>
 #include <cassert>
@@ -155,20 +157,54 @@ namespace reshade
 			_modified_at = std::filesystem::file_time_type::clock::now();
 		}
 
+		/// <summary>
+		/// Gets the time of the last change to the data, either by a modification in memory or by loading it from disk.
+		/// </summary>
+		std::filesystem::file_time_type modified_at() const { return _modified_at; }
+
 		/// <summary>
 		/// Gets the specified INI file from cache or opens it when it was not cached yet.
+		/// This may be called from multiple threads, but modifying the same file concurrently from multiple threads is not supported.
 		/// WARNING: Reference is only valid until the next 'load_cache' call.
 		/// </summary>
 		/// <param name="path">The path to the INI file to access.</param>
 		/// <returns>A reference to the cached data. This reference is valid until the next call to <see cref="load_cache"/>.</returns>
 		static reshade::ini_file &load_cache(const std::filesystem::path &path);
+		/// <summary>
+		/// Gets a copy of the specified INI file from cache, which stays valid and unchanged and can therefore be read from other threads.
+		/// This has to be called on the thread that modifies the file, the copy never writes anything back to disk.
+		/// </summary>
+		/// <param name="path">The path to the INI file to access.</param>
+		static std::shared_ptr<const reshade::ini_file> load_cache_snapshot(const std::filesystem::path &path);
+		/// <summary>
+		/// Gets the paths of all INI files in the cache, together with the time of their last change (see <see cref="modified_at"/>), without opening or copying any of them.
+		/// This has to be called on the thread that modifies the files. A time that differs from the one of the file on disk means that the cached data has changes which were not written yet (or that the file changed on disk since it was loaded).
+		/// </summary>
+		static std::vector<std::pair<std::filesystem::path, std::filesystem::file_time_type>> cache_modification_times();
 
+		/// <summary>
+		/// Queues all cached INI files that were modified more than a second ago for writing on a background thread.
+		/// </summary>
+		/// <returns><c>false</c> if any of the writes that completed since the last call failed, <c>true</c> otherwise.</returns>
 		static bool flush_cache();
+		/// <summary>
+		/// Writes all cached INI files with pending modifications and waits for the background writer thread to finish.
+		/// Call this before shutting down, since the background writer thread does not survive process termination.
+		/// </summary>
+		/// <returns><c>false</c> if any of the writes failed, <c>true</c> otherwise.</returns>
+		static bool flush_cache_and_wait();
+		/// <summary>
+		/// Writes the specified INI file to disk immediately if it has pending modifications.
+		/// </summary>
+		/// <param name="path">The path to the INI file to save.</param>
 		static bool flush_cache(const std::filesystem::path &path);
 
 	private:
 		void load();
 		bool save();
+		void serialize(std::string &data) const;
+
+		static bool flush_cache(std::chrono::seconds min_age);
 
 		template <typename T>
 		static const T convert(const std::vector<std::string> &values, size_t i) = delete;
@@ -238,6 +274,7 @@ namespace reshade
 		using section = std::unordered_map<std::string, value>;
 
 		bool _modified = false;
+		bool _write_pending = false; // Set while the background writer thread has a write of this file queued or in progress
 		std::filesystem::path _path;
 		std::filesystem::file_time_type _modified_at;
 		std::unordered_map<std::string, section> _sections;
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "runtime_frame_stats.hpp"
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+void reshade::frame_time_histogram::clear()
+{
+	for (std::atomic<uint64_t> &count : _counts)
+		count.store(0, std::memory_order_relaxed);
+	_count.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t reshade::frame_time_histogram::percentile(double percent) const
+{
+	// Sum the buckets instead of using the total count, since durations may be recorded concurrently and the two would not match then
+	uint64_t total = 0;
+	for (const std::atomic<uint64_t> &count : _counts)
+		total += count.load(std::memory_order_relaxed);
+	if (total == 0)
+		return 0;
+
+	// Round the percentage to parts per million before computing the rank with integers, since e.g. '99.9 / 100.0 * 1000' is slightly more than 999 in floating-point and would select the wrong rank
+	const uint64_t parts_per_million = static_cast<uint64_t>(std::llround(std::min(std::max(percent, 0.0), 100.0) * 10'000));
+	const uint64_t rank = std::max<uint64_t>((parts_per_million * total + 999'999) / 1'000'000, 1);
+
+	uint64_t accumulated = 0;
+	for (size_t index = 0; index < NUM_BUCKETS; ++index)
+	{
+		accumulated += _counts[index].load(std::memory_order_relaxed);
+		if (accumulated >= rank)
+			// The largest duration recorded is a tighter bound than the end of the bucket containing it
+			return std::min(bucket_upper_bound(index), max());
+	}
+
+	return max();
+}
+
+bool reshade::write_frame_statistics_csv(const std::filesystem::path &path, const frame_time_histogram &frame_times, const frame_time_histogram &overhead_times)
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+
+	file << std::fixed << std::setprecision(4);
+
+	file << "metric,samples,mean_ms,p50_ms,p90_ms,p99_ms,p99.9_ms,max_ms\n";
+	for (const auto &[name, histogram] : { std::make_pair("frame_time", &frame_times), std::make_pair("runtime_overhead", &overhead_times) })
+	{
+		file << name << ',' << histogram->count() << ','
+			<< histogram->mean() * 1e-6 << ','
+			<< histogram->percentile(50) * 1e-6 << ','
+			<< histogram->percentile(90) * 1e-6 << ','
+			<< histogram->percentile(99) * 1e-6 << ','
+			<< histogram->percentile(99.9) * 1e-6 << ','
+			<< histogram->max() * 1e-6 << '\n';
+	}
+
+	file << '\n';
+
+	file << "bucket_lower_ms,bucket_upper_ms,frame_time_count,runtime_overhead_count\n";
+	for (size_t index = 0; index < frame_time_histogram::NUM_BUCKETS; ++index)
+	{
+		const uint64_t frame_count = frame_times.bucket_count(index);
+		const uint64_t overhead_count = overhead_times.bucket_count(index);
+		if (frame_count == 0 && overhead_count == 0)
+			continue;
+
+		file << frame_time_histogram::bucket_lower_bound(index) * 1e-6 << ',';
+		if (index + 1 < frame_time_histogram::NUM_BUCKETS)
+			file << frame_time_histogram::bucket_upper_bound(index) * 1e-6;
+		else
+			file << "inf";
+		file << ',' << frame_count << ',' << overhead_count << '\n';
+	}
+
+	return file.good();
+}
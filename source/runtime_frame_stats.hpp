@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+namespace reshade
+{
+	/// <summary>
+	/// Counts durations in buckets of logarithmically increasing size, similar to a HDR histogram, so that percentiles can be computed over an unlimited number of samples with fixed memory.
+	/// Every power of two is split into the same number of linear sub-buckets, which keeps the error of any reported value below 1 / <see cref="SUB_BUCKETS"/> of it.
+	/// Recording is a few relaxed atomic operations without any allocation or lock, so it can be done every frame (and from any thread) while another thread reads the statistics.
+	/// </summary>
+	class frame_time_histogram
+	{
+	public:
+		static constexpr unsigned int SUB_BUCKET_BITS = 7;
+		static constexpr unsigned int SUB_BUCKETS = 1 << (SUB_BUCKET_BITS - 1);
+		static constexpr unsigned int MAX_VALUE_BITS = 36; // Durations above ~68 seconds are counted in the last bucket
+		static constexpr size_t NUM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+		frame_time_histogram() { clear(); }
+
+		frame_time_histogram(const frame_time_histogram &) = delete;
+		frame_time_histogram &operator=(const frame_time_histogram &) = delete;
+
+		/// <summary>
+		/// Adds a duration to the histogram.
+		/// </summary>
+		/// <param name="nanoseconds">The duration in nanoseconds.</param>
+		void record(uint64_t nanoseconds)
+		{
+			_counts[bucket_index(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+			_count.fetch_add(1, std::memory_order_relaxed);
+			_sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+			for (uint64_t max = _max.load(std::memory_order_relaxed); nanoseconds > max && !_max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed);)
+				continue;
+		}
+
+		/// <summary>
+		/// Removes all recorded durations.
+		/// </summary>
+		void clear();
+
+		uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+		uint64_t mean() const { const uint64_t count = _count.load(std::memory_order_relaxed); return count != 0 ? _sum.load(std::memory_order_relaxed) / count : 0; }
+		uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+		/// <summary>
+		/// Gets the duration that the specified percentage of all recorded durations is smaller than or equal to.
+		/// The result is the upper bound of the bucket that contains it, so it never understates the duration.
+		/// </summary>
+		/// <param name="percent">The percentage between 0 and 100, e.g. 99.9 for the duration that only 0.1% of all durations exceed.</param>
+		uint64_t percentile(double percent) const;
+
+		/// <summary>
+		/// Gets the number of durations recorded in the bucket at the specified <paramref name="index"/>.
+		/// </summary>
+		uint64_t bucket_count(size_t index) const { return _counts[index].load(std::memory_order_relaxed); }
+		/// <summary>
+		/// Gets the smallest duration counted in the bucket at the specified <paramref name="index"/>.
+		/// </summary>
+		static uint64_t bucket_lower_bound(size_t index)
+		{
+			if (index < 2 * SUB_BUCKETS)
+				return index;
+			const unsigned int shift = static_cast<unsigned int>(index / SUB_BUCKETS) - 1;
+			return static_cast<uint64_t>(index - shift * SUB_BUCKETS) << shift;
+		}
+		/// <summary>
+		/// Gets the largest duration counted in the bucket at the specified <paramref name="index"/>.
+		/// </summary>
+		static uint64_t bucket_upper_bound(size_t index)
+		{
+			return index + 1 < NUM_BUCKETS ? bucket_lower_bound(index + 1) - 1 : UINT64_MAX;
+		}
+
+	private:
+		static size_t bucket_index(uint64_t value)
+		{
+			if (value >= (uint64_t(1) << MAX_VALUE_BITS))
+				return NUM_BUCKETS - 1;
+			if (value < 2 * SUB_BUCKETS)
+				return static_cast<size_t>(value);
+
+			unsigned int msb = 0;
+			for (uint64_t v = value; v >>= 1;)
+				msb++;
+
+			// Keep the highest bits of the value, which selects one of the sub-buckets of its power of two
+			const unsigned int shift = msb - (SUB_BUCKET_BITS - 1);
+			return shift * SUB_BUCKETS + static_cast<size_t>(value >> shift);
+		}
+
+		std::atomic<uint64_t> _counts[NUM_BUCKETS];
+		std::atomic<uint64_t> _count;
+		std::atomic<uint64_t> _sum;
+		std::atomic<uint64_t> _max;
+	};
+
+	/// <summary>
+	/// Writes a summary and all non-empty buckets of the frame time and overhead histograms to a CSV file.
+	/// </summary>
+	/// <param name="path">The path of the file to write.</param>
+	/// <param name="frame_times">The histogram of present-to-present durations.</param>
+	/// <param name="overhead_times">The histogram of the CPU time spent in the runtime each frame.</param>
+	/// <returns><c>true</c> if the file was written successfully, <c>false</c> otherwise.</returns>
+	bool write_frame_statistics_csv(const std::filesystem::path &path, const frame_time_histogram &frame_times, const frame_time_histogram &overhead_times);
+}
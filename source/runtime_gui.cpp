@@ -10,6 +10,7 @@
 #include "runtime.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "runtime_preset_index.hpp"
 #include "input.hpp"
 #include "imgui_widgets.hpp"
 #include <cassert>
@@ -90,6 +91,7 @@ void reshade::runtime::init_ui()
 		config.get("GENERAL", "ShowClock", _show_clock);
 		config.get("GENERAL", "ShowFPS", _show_fps);
 		config.get("GENERAL", "ShowFrameTime", _show_frametime);
+		config.get("GENERAL", "ShowFrameTimeLows", _show_frametime_lows);
 		config.get("GENERAL", "ShowScreenshotMessage", _show_screenshot_message);
 		config.get("GENERAL", "FPSPosition", _fps_pos);
 		config.get("GENERAL", "ClockFormat", _clock_format);
@@ -327,6 +329,7 @@ void reshade::runtime::init_ui()
 		config.set("GENERAL", "ShowClock", _show_clock);
 		config.set("GENERAL", "ShowFPS", _show_fps);
 		config.set("GENERAL", "ShowFrameTime", _show_frametime);
+		config.set("GENERAL", "ShowFrameTimeLows", _show_frametime_lows);
 		config.set("GENERAL", "ShowScreenshotMessage", _show_screenshot_message);
 		config.set("GENERAL", "FPSPosition", _fps_pos);
 		config.set("GENERAL", "ClockFormat", _clock_format);
@@ -432,7 +435,7 @@ void reshade::runtime::build_font_atlas()
 
 void reshade::runtime::draw_ui()
 {
-	const bool show_splash = _show_splash && (is_loading() || !_reload_compile_queue.empty() || (_last_present_time - _last_reload_time) < std::chrono::seconds(5));
+	const bool show_splash = _show_splash && (is_loading() || !_reload_compile_queue.empty() || !_skipped_effects_loading.empty() || (_last_present_time - _last_reload_time) < std::chrono::seconds(5));
 	// Do not show this message in the same frame the screenshot is taken (so that it won't show up on the UI screenshot)
 	const bool show_screenshot_message = (_show_screenshot_message || !_screenshot_save_success) && !_should_save_screenshot && (_last_present_time - _last_screenshot_time) < std::chrono::seconds(_screenshot_save_success ? 3 : 5);
 
@@ -540,12 +543,12 @@ void reshade::runtime::draw_ui()
 					"This might take a while. The application could become unresponsive for some time.",
 					_reload_remaining_effects.load());
 			}
-			else if (!_reload_compile_queue.empty())
+			else if (!_reload_compile_queue.empty() || !_skipped_effects_loading.empty())
 			{
 				ImGui::Text(
 					"Compiling (%zu effects remaining) ... "
 					"This might take a while. The application could become unresponsive for some time.",
-					_reload_compile_queue.size());
+					_reload_compile_queue.size() + _skipped_effects_loading.size());
 			}
 			else if (_tutorial_index == 0)
 			{
@@ -578,10 +581,10 @@ void reshade::runtime::draw_ui()
 		ImGui::PopStyleColor(2);
 		ImGui::PopStyleVar();
 	}
-	else if (_show_clock || _show_fps || _show_frametime)
+	else if (_show_clock || _show_fps || _show_frametime || _show_frametime_lows)
 	{
 		float window_height = _imgui_context->FontBaseSize * _fps_scale + _imgui_context->Style.ItemSpacing.y;
-		window_height *= (_show_clock ? 1 : 0) + (_show_fps ? 1 : 0) + (_show_frametime ? 1 : 0);
+		window_height *= (_show_clock ? 1 : 0) + (_show_fps ? 1 : 0) + (_show_frametime ? 1 : 0) + (_show_frametime_lows ? 2 : 0);
 		window_height += _imgui_context->Style.FramePadding.y * 4.0f;
 
 		ImVec2 fps_window_pos(5, 5);
@@ -632,6 +635,20 @@ void reshade::runtime::draw_ui()
 				ImGui::SetCursorPosX(ImGui::GetWindowContentRegionWidth() - ImGui::CalcTextSize(temp).x);
 			ImGui::TextUnformatted(temp);
 		}
+		if (_show_frametime_lows)
+		{
+			// The 1% low is the frame rate of the frame time that only 1% of all frames exceed
+			const uint64_t low_frame_times[2] = { _frame_times.percentile(99), _frame_times.percentile(99.9) };
+
+			ImFormatString(temp, sizeof(temp), "%.0f fps 1%% low", low_frame_times[0] != 0 ? 1e9f / low_frame_times[0] : 0.0f);
+			if (_fps_pos % 2)
+				ImGui::SetCursorPosX(ImGui::GetWindowContentRegionWidth() - ImGui::CalcTextSize(temp).x);
+			ImGui::TextUnformatted(temp);
+			ImFormatString(temp, sizeof(temp), "%.0f fps 0.1%% low", low_frame_times[1] != 0 ? 1e9f / low_frame_times[1] : 0.0f);
+			if (_fps_pos % 2)
+				ImGui::SetCursorPosX(ImGui::GetWindowContentRegionWidth() - ImGui::CalcTextSize(temp).x);
+			ImGui::TextUnformatted(temp);
+		}
 
 		ImGui::End();
 		ImGui::PopStyleColor();
@@ -1048,6 +1065,13 @@ void reshade::runtime::draw_ui_settings()
 		modified |= imgui_key_input("Effect Reload Key", _reload_key_data, *_input);
 		_ignore_shortcuts |= ImGui::IsItemActive();
 
+		modified |= ImGui::Checkbox("Reload effects in the background", &_reload_in_background);
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Keeps rendering the current effects while their new versions are compiled and replaces them one by one afterwards.\nOnly applies when no effect files were added or removed, otherwise everything is reloaded as usual.");
+		modified |= ImGui::Checkbox("Compile effects only when they are used", &_load_effects_on_demand);
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Effects without any technique enabled in the current preset are not compiled during loading, but only once one of their techniques is enabled.\nThis uses the technique list remembered from the last time an effect was compiled, so the first load still compiles everything.");
+
 		modified |= imgui_key_input("Previous Preset Key", _prev_preset_key_data, *_input);
 		_ignore_shortcuts |= ImGui::IsItemActive();
 		modified |= imgui_key_input("Next Preset Key", _next_preset_key_data, *_input);
@@ -1081,6 +1105,27 @@ void reshade::runtime::draw_ui_settings()
 		modified |= ImGui::Checkbox("Include current preset", &_screenshot_include_preset);
 		modified |= ImGui::Checkbox("Save before and after images", &_screenshot_save_before);
 		modified |= ImGui::Checkbox("Save separate user interface image", &_screenshot_save_ui);
+
+		ImGui::Spacing();
+
+		modified |= imgui_key_input("Frame Capture Key", _capture_key_data, *_input);
+		_ignore_shortcuts |= ImGui::IsItemActive();
+
+		modified |= ImGui::SliderInt("Frames to capture", reinterpret_cast<int *>(&_capture_frame_count), 1, 3600);
+		modified |= ImGui::Checkbox("Capture continuously and keep only the last frames", &_capture_continuous);
+
+		ImGui::Spacing();
+
+		modified |= imgui_key_input("Frame Statistics Key", _frame_stats_key_data, *_input);
+		_ignore_shortcuts |= ImGui::IsItemActive();
+
+		ImGui::Spacing();
+
+		modified |= imgui_key_input("Trace Key", _trace_key_data, *_input);
+		_ignore_shortcuts |= ImGui::IsItemActive();
+
+		modified |= ImGui::SliderInt("Frames to trace", reinterpret_cast<int *>(&_trace_frame_count), 1, 600);
+		modified |= ImGui::Checkbox("Trace every reload of effects", &_trace_reload);
 	}
 
 	if (ImGui::CollapsingHeader("User Interface", ImGuiTreeNodeFlags_DefaultOpen))
@@ -1239,6 +1284,7 @@ void reshade::runtime::draw_ui_settings()
 		modified |= ImGui::Checkbox("Show Clock", &_show_clock);
 		ImGui::SameLine(0, 10); modified |= ImGui::Checkbox("Show FPS", &_show_fps);
 		ImGui::SameLine(0, 10); modified |= ImGui::Checkbox("Show Frame Time", &_show_frametime);
+		ImGui::SameLine(0, 10); modified |= ImGui::Checkbox("Show 1% Lows", &_show_frametime_lows);
 		modified |= ImGui::Combo("Clock Format", &_clock_format, "HH:MM\0HH:MM:SS\0");
 		modified |= ImGui::SliderFloat("FPS Text Size", &_fps_scale, 0.2f, 2.5f, "%.1f");
 		modified |= ImGui::ColorEdit4("FPS Text Color", _fps_col, ImGuiColorEditFlags_AlphaBar | ImGuiColorEditFlags_AlphaPreview);
@@ -1269,8 +1315,9 @@ void reshade::runtime::draw_ui_statistics()
 		{
 			cpu_digits = std::max(cpu_digits, technique.average_cpu_duration >= 100'000'000 ? 3u : technique.average_cpu_duration >= 10'000'000 ? 2u : 1u);
 			post_processing_time_cpu += technique.average_cpu_duration;
-			gpu_digits = std::max(gpu_digits, technique.average_gpu_duration >= 100'000'000 ? 3u : technique.average_gpu_duration >= 10'000'000 ? 2u : 1u);
-			post_processing_time_gpu += technique.average_gpu_duration;
+			const uint64_t average_gpu_duration = technique.gpu_duration.mean();
+			gpu_digits = std::max(gpu_digits, average_gpu_duration >= 100'000'000 ? 3u : average_gpu_duration >= 10'000'000 ? 2u : 1u);
+			post_processing_time_gpu += average_gpu_duration;
 		}
 	}
 
@@ -1330,8 +1377,66 @@ void reshade::runtime::draw_ui_statistics()
 		ImGui::EndGroup();
 	}
 
+	if (ImGui::CollapsingHeader("Frame Times", ImGuiTreeNodeFlags_DefaultOpen))
+	{
+		const struct { const char *name; const frame_time_histogram &histogram; } rows[] = {
+			{ "Frame time:", _frame_times },
+			{ "ReShade overhead:", _frame_overhead_times },
+		};
+
+		ImGui::BeginGroup();
+
+		ImGui::NewLine();
+		for (const auto &row : rows)
+			ImGui::TextUnformatted(row.name);
+		ImGui::TextUnformatted("Frame rate:");
+
+		ImGui::EndGroup();
+		ImGui::SameLine(ImGui::GetWindowWidth() * 0.33333333f);
+		ImGui::BeginGroup();
+
+		ImGui::TextUnformatted("Mean / Median / Max");
+		for (const auto &row : rows)
+			ImGui::Text("%.3f / %.3f / %.3f ms", row.histogram.mean() * 1e-6f, row.histogram.percentile(50) * 1e-6f, row.histogram.max() * 1e-6f);
+		ImGui::Text("%.0f fps average", _frame_times.mean() != 0 ? 1e9f / _frame_times.mean() : 0.0f);
+
+		ImGui::EndGroup();
+		ImGui::SameLine(ImGui::GetWindowWidth() * 0.66666666f);
+		ImGui::BeginGroup();
+
+		ImGui::TextUnformatted("99th / 99.9th percentile");
+		for (const auto &row : rows)
+			ImGui::Text("%.3f / %.3f ms", row.histogram.percentile(99) * 1e-6f, row.histogram.percentile(99.9) * 1e-6f);
+		if (const uint64_t low_frame_times[2] = { _frame_times.percentile(99), _frame_times.percentile(99.9) }; low_frame_times[1] != 0)
+			ImGui::Text("%.0f / %.0f fps low", 1e9f / low_frame_times[0], 1e9f / low_frame_times[1]);
+		else
+			ImGui::NewLine();
+
+		ImGui::EndGroup();
+
+		const float button_width = (ImGui::GetContentRegionAvail().x - _imgui_context->Style.ItemSpacing.x) / 2;
+		if (ImGui::Button("Reset", ImVec2(button_width, 0)))
+		{
+			_frame_times.clear();
+			_frame_overhead_times.clear();
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Save to CSV file", ImVec2(button_width, 0)))
+			save_frame_statistics();
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Writes the frame time histogram of %llu frames next to the screenshots.", _frame_times.count());
+	}
+
 	if (ImGui::CollapsingHeader("Techniques", ImGuiTreeNodeFlags_DefaultOpen) && !is_loading() && _effects_enabled)
 	{
+		ImGui::Checkbox("Show timings of individual passes", &_show_pass_timings);
+
+		// Passes get a row below their technique in every column
+		const auto num_pass_rows = [this](const technique &technique) {
+			return _show_pass_timings && technique.passes.size() > 1 ? technique.passes.size() : 0;
+		};
+
 		ImGui::BeginGroup();
 
 		for (const auto &technique : _techniques)
@@ -1343,6 +1448,9 @@ void reshade::runtime::draw_ui_statistics()
 				ImGui::Text("%s (%zu passes)", technique.name.c_str(), technique.passes.size());
 			else
 				ImGui::TextUnformatted(technique.name.c_str());
+
+			for (size_t pass_index = 0; pass_index < num_pass_rows(technique); ++pass_index)
+				ImGui::TextDisabled("  Pass %zu", pass_index);
 		}
 
 		ImGui::EndGroup();
@@ -1355,8 +1463,23 @@ void reshade::runtime::draw_ui_statistics()
 				continue;
 
 			if (technique.average_cpu_duration != 0)
+			{
 				ImGui::Text("%*.3f ms CPU (%.0f%%)", cpu_digits + 4, technique.average_cpu_duration * 1e-6f, 100 * (technique.average_cpu_duration * 1e-6f) / (post_processing_time_cpu * 1e-6f));
+
+#if RESHADE_CPU_TIMERS
+				if (ImGui::IsItemHovered())
+					ImGui::SetTooltip("Recording commands: %.3f ms\nof which uploading constants: %.3f ms",
+						_cpu_timers.technique_time(technique.cpu_timer_row, cpu_timer_category::render_technique) * 1e-6f,
+						_cpu_timers.technique_time(technique.cpu_timer_row, cpu_timer_category::upload_constants) * 1e-6f);
+#endif
+			}
 			else
+			{
+				ImGui::NewLine();
+			}
+
+			// CPU time is only measured for the technique as a whole
+			for (size_t pass_index = 0; pass_index < num_pass_rows(technique); ++pass_index)
 				ImGui::NewLine();
 		}
 
@@ -1370,14 +1493,98 @@ void reshade::runtime::draw_ui_statistics()
 				continue;
 
 			// GPU timings are not available for all APIs
-			if (technique.average_gpu_duration != 0)
-				ImGui::Text("%*.3f ms GPU (%.0f%%)", gpu_digits + 4, technique.average_gpu_duration * 1e-6f, 100 * (technique.average_gpu_duration * 1e-6f) / (post_processing_time_gpu * 1e-6f));
+			if (const uint64_t average_gpu_duration = technique.gpu_duration.mean(); average_gpu_duration != 0)
+			{
+				ImGui::Text("%*.3f ms GPU (%.0f%%)", gpu_digits + 4, average_gpu_duration * 1e-6f, 100 * (average_gpu_duration * 1e-6f) / (post_processing_time_gpu * 1e-6f));
+
+				if (ImGui::IsItemHovered())
+					ImGui::SetTooltip("Min: %.3f ms\nMax: %.3f ms\n95th percentile: %.3f ms\n(over the last %zu frames)",
+						technique.gpu_duration.min() * 1e-6f, technique.gpu_duration.max() * 1e-6f, technique.gpu_duration.percentile(95) * 1e-6f, technique.gpu_duration.count());
+			}
+			else
+			{
+				ImGui::NewLine();
+			}
+
+			for (size_t pass_index = 0; pass_index < num_pass_rows(technique); ++pass_index)
+			{
+				// Passes that were removed from the schedule have no samples
+				if (pass_index < technique.pass_gpu_durations.size() && technique.pass_gpu_durations[pass_index].count() != 0)
+				{
+					const duration_statistics<120> &pass_duration = technique.pass_gpu_durations[pass_index];
+					ImGui::TextDisabled("%*.3f ms GPU (95th percentile %.3f ms)", gpu_digits + 4, pass_duration.mean() * 1e-6f, pass_duration.percentile(95) * 1e-6f);
+				}
+				else
+				{
+					ImGui::NewLine();
+				}
+			}
+		}
+
+		ImGui::EndGroup();
+	}
+
+#if RESHADE_CPU_TIMERS
+	if (ImGui::CollapsingHeader("CPU Overhead per Effect", ImGuiTreeNodeFlags_DefaultOpen) && !is_loading() && _effects_enabled)
+	{
+		ImGui::BeginGroup();
+
+		for (const effect &effect : _effects)
+		{
+			if (!effect.rendering)
+				continue;
+
+			ImGui::TextUnformatted(effect.source_file.filename().u8string().c_str());
+
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("Loading and compiling took %.3f ms", _cpu_timers.effect_time(&effect - _effects.data(), cpu_timer_category::load) * 1e-6f);
+		}
+
+		ImGui::EndGroup();
+		ImGui::SameLine(ImGui::GetWindowWidth() * 0.33333333f);
+		ImGui::BeginGroup();
+
+		for (const effect &effect : _effects)
+		{
+			if (!effect.rendering)
+				continue;
+
+			const size_t effect_index = &effect - _effects.data();
+
+			// Uniform updates are done outside of rendering the techniques, so add both
+			ImGui::Text("%*.3f ms CPU", cpu_digits + 4, (_cpu_timers.effect_time(effect_index, cpu_timer_category::update_uniforms) + _cpu_timers.effect_time(effect_index, cpu_timer_category::render_technique)) * 1e-6f);
+
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("Updating uniforms: %.3f ms\nRecording commands: %.3f ms\nof which uploading constants: %.3f ms",
+					_cpu_timers.effect_time(effect_index, cpu_timer_category::update_uniforms) * 1e-6f,
+					_cpu_timers.effect_time(effect_index, cpu_timer_category::render_technique) * 1e-6f,
+					_cpu_timers.effect_time(effect_index, cpu_timer_category::upload_constants) * 1e-6f);
+		}
+
+		ImGui::EndGroup();
+		ImGui::SameLine(ImGui::GetWindowWidth() * 0.66666666f);
+		ImGui::BeginGroup();
+
+		for (const effect &effect : _effects)
+		{
+			if (!effect.rendering)
+				continue;
+
+			uint64_t effect_gpu_duration = 0;
+			for (const technique &technique : _techniques)
+				if (technique.enabled && technique.effect_index == static_cast<size_t>(&effect - _effects.data()))
+					effect_gpu_duration += technique.gpu_duration.mean();
+
+			// GPU timings are not available for all APIs
+			if (effect_gpu_duration != 0)
+				ImGui::Text("%*.3f ms GPU", gpu_digits + 4, effect_gpu_duration * 1e-6f);
 			else
 				ImGui::NewLine();
 		}
 
 		ImGui::EndGroup();
 	}
+#endif
 
 	if (ImGui::CollapsingHeader("Render Targets & Textures", ImGuiTreeNodeFlags_DefaultOpen) && !is_loading())
 	{
@@ -1523,7 +1730,7 @@ void reshade::runtime::draw_ui_statistics()
 void reshade::runtime::draw_ui_log()
 {
 	if (ImGui::Button("Clear Log"))
-		reshade::log::lines.clear();
+		reshade::log::clear_history();
 
 	ImGui::SameLine();
 	ImGui::Checkbox("Word Wrap", &_log_wordwrap);
@@ -1534,11 +1741,9 @@ void reshade::runtime::draw_ui_log()
 
 	if (ImGui::BeginChild("log", ImVec2(0, 0), true, _log_wordwrap ? 0 : ImGuiWindowFlags_AlwaysHorizontalScrollbar))
 	{
-		std::vector<std::string> lines;
-		lines.reserve(reshade::log::lines.size());
-		for (auto &line : reshade::log::lines)
-			if (filter.PassFilter(line.c_str()))
-				lines.push_back(line);
+		std::vector<std::string> lines = reshade::log::history();
+		lines.erase(std::remove_if(lines.begin(), lines.end(),
+			[](const std::string &line) { return !filter.PassFilter(line.c_str()); }), lines.end());
 
 		ImGuiListClipper clipper(static_cast<int>(lines.size()), ImGui::GetTextLineHeightWithSpacing());
 
@@ -1710,7 +1915,7 @@ void reshade::runtime::draw_code_editor()
 			_reload_total_effects = 1;
 			_reload_remaining_effects = 1;
 			unload_effect(_selected_effect);
-			load_effect(_effects[_selected_effect].source_file, _selected_effect);
+			load_effect(_effects[_selected_effect].source_file, _selected_effect, load_spec_constant_preset().get());
 
 			// Re-open current file so that errors are updated
 			open_file_in_code_editor(_selected_effect, _editor_file);
@@ -1951,36 +2156,40 @@ void reshade::runtime::draw_preset_explorer()
 					_current_browse_path = _current_browse_path.lexically_proximate(reshade_container_path);
 			}
 
-			std::vector<std::filesystem::directory_entry> preset_paths;
-			for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(preset_container_path, std::filesystem::directory_options::skip_permission_denied, ec))
-				if (entry.is_directory(ec))
-					if (ImGui::Selectable(("<DIR> " + entry.path().filename().u8string()).c_str()))
-						if (std::filesystem::equivalent(reshade_container_path, entry, ec))
+			// Use the preset index instead of walking the directory every frame
+			const preset_index::snapshot entries = _preset_index->entries(preset_container_path);
+			const bool is_current_directory = std::filesystem::equivalent(preset_container_path, _current_preset_path.parent_path(), ec);
+
+			std::vector<const preset_index::entry *> preset_paths;
+			for (const preset_index::entry &entry : *entries)
+				if (entry.is_directory)
+					if (ImGui::Selectable(("<DIR> " + entry.path.filename().u8string()).c_str()))
+						if (std::filesystem::equivalent(reshade_container_path, entry.path, ec))
 							_current_browse_path.clear();
-						else if (std::equal(reshade_container_path.begin(), reshade_container_path.end(), entry.path().begin()))
-							_current_browse_path = entry.path().lexically_proximate(reshade_container_path);
+						else if (std::equal(reshade_container_path.begin(), reshade_container_path.end(), entry.path.begin()))
+							_current_browse_path = entry.path.lexically_proximate(reshade_container_path);
 						else
-							_current_browse_path = entry;
+							_current_browse_path = entry.path;
 					else {}
-				else if (entry.path().extension() == L".ini" || entry.path().extension() == L".txt")
-					preset_paths.push_back(entry);
+				else
+					preset_paths.push_back(&entry);
 
 			if (is_loading())
 				ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true),
 				ImGui::PushStyleColor(ImGuiCol_Text, _imgui_context->Style.Colors[ImGuiCol_TextDisabled]);
 
-			for (const std::filesystem::directory_entry &entry : preset_paths)
+			for (const preset_index::entry *entry : preset_paths)
 			{
-				const bool is_current_preset = std::filesystem::equivalent(entry, _current_preset_path, ec);
+				const bool is_current_preset = is_current_directory && _wcsicmp(entry->path.filename().c_str(), _current_preset_path.filename().c_str()) == 0;
 
 				if (!is_current_preset && !presets_filter_text.empty())
-					if (const std::wstring preset_name(entry.path().stem()), &filter_text = presets_filter_text.native();
+					if (const std::wstring preset_name(entry->path.stem()), &filter_text = presets_filter_text.native();
 						std::search(preset_name.begin(), preset_name.end(), filter_text.begin(), filter_text.end(), [](const wchar_t c1, const wchar_t c2) { return towlower(c1) == towlower(c2); }) == preset_name.end())
 						continue;
 
-				if (ImGui::Selectable(entry.path().filename().u8string().c_str(), static_cast<bool>(is_current_preset)))
-					if (reshade::ini_file::load_cache(entry).has("", "Techniques"))
-						condition = condition::select, _current_preset_path = entry;
+				if (ImGui::Selectable(entry->path.filename().u8string().c_str(), static_cast<bool>(is_current_preset)))
+					if (entry->is_valid)
+						condition = condition::select, _current_preset_path = entry->path;
 					else
 						condition = condition::pass;
 
@@ -2549,7 +2758,7 @@ void reshade::runtime::draw_variable_editor()
 			_reload_total_effects = 1;
 			_reload_remaining_effects = 1;
 			unload_effect(effect_index);
-			if (!load_effect(_effects[effect_index].source_file, effect_index) &&
+			if (!load_effect(_effects[effect_index].source_file, effect_index, load_spec_constant_preset().get()) &&
 				modified_definition != _preset_preprocessor_definitions.end())
 			{
 				// The preprocessor definition that was just modified caused the shader to not compile, so reset to default and try again
@@ -2558,7 +2767,7 @@ void reshade::runtime::draw_variable_editor()
 				_reload_total_effects = 1;
 				_reload_remaining_effects = 1;
 				unload_effect(effect_index);
-				if (load_effect(_effects[effect_index].source_file, effect_index))
+				if (load_effect(_effects[effect_index].source_file, effect_index, load_spec_constant_preset().get()))
 				{
 					_last_reload_successful = reload_successful_before;
 					ImGui::OpenPopup("##pperror"); // Notify the user about this
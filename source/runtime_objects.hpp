@@ -6,6 +6,12 @@
 #pragma once
 
 #include "effect_module.hpp"
+#include "effect_pass_graph.hpp"
+#include <limits>
+#include <filesystem>
+#include <unordered_map>
+#include <cassert>
+#include <algorithm>
 
 namespace reshade
 {
@@ -66,6 +72,114 @@ namespace reshade
 		T _average, _tick_sum, _tick_list[SAMPLES];
 	};
 
+	/// <summary>
+	/// Keeps the most recent duration samples (in nanoseconds) and computes statistics over them.
+	/// </summary>
+	template <size_t SAMPLES>
+	class duration_statistics
+	{
+	public:
+		void clear()
+		{
+			_index = 0;
+			_count = 0;
+			_sum = 0;
+		}
+		void append(uint64_t value)
+		{
+			if (_count == SAMPLES)
+				_sum -= _samples[_index];
+			else
+				_count++;
+
+			_sum += _samples[_index] = value;
+			_index = (_index + 1) % SAMPLES;
+		}
+
+		size_t count() const { return _count; }
+
+		uint64_t mean() const { return _count != 0 ? _sum / _count : 0; }
+		uint64_t min() const { return _count != 0 ? *std::min_element(_samples, _samples + _count) : 0; }
+		uint64_t max() const { return _count != 0 ? *std::max_element(_samples, _samples + _count) : 0; }
+		/// <summary>
+		/// Gets the smallest sample that is greater than or equal to the specified percentage of all samples (nearest-rank method).
+		/// </summary>
+		uint64_t percentile(unsigned int percent) const
+		{
+			if (_count == 0)
+				return 0;
+
+			uint64_t sorted[SAMPLES];
+			std::copy_n(_samples, _count, sorted);
+
+			const size_t rank = std::max<size_t>((std::min(percent, 100u) * _count + 99) / 100, 1);
+			std::nth_element(sorted, sorted + rank - 1, sorted + _count);
+			return sorted[rank - 1];
+		}
+
+	private:
+		size_t _index = 0;
+		size_t _count = 0;
+		uint64_t _sum = 0;
+		uint64_t _samples[SAMPLES] = {}; // Only the first '_count' samples are valid until the window was filled once
+	};
+
+	/// <summary>
+	/// Tracks which of a fixed number of query slots are in flight on the GPU, so that new queries can be issued every frame while the results of previous frames are still pending.
+	/// Results are read back in the order they were issued as soon as they are available, so they arrive a few frames late, but no frame is skipped unless all slots are in flight.
+	/// </summary>
+	template <size_t SLOTS>
+	class query_ring
+	{
+	public:
+		static constexpr size_t num_slots = SLOTS;
+
+		void clear() { _read = _write = 0; }
+
+		/// <summary>
+		/// Gets the slot with the oldest pending results.
+		/// </summary>
+		/// <param name="slot">Set to the slot index.</param>
+		/// <returns><c>true</c> if there are pending results, <c>false</c> otherwise.</returns>
+		bool oldest_pending(size_t &slot) const
+		{
+			if (_read == _write)
+				return false;
+			slot = _read % SLOTS;
+			return true;
+		}
+		/// <summary>
+		/// Marks the results of the oldest pending slot as read, so that it can be issued again.
+		/// </summary>
+		void pop()
+		{
+			assert(_read != _write);
+			_read++;
+		}
+
+		/// <summary>
+		/// Gets a free slot to issue new queries to and marks it as pending.
+		/// </summary>
+		/// <param name="slot">Set to the slot index.</param>
+		/// <returns><c>true</c> if a slot was available, <c>false</c> if all slots are in flight.</returns>
+		bool push(size_t &slot)
+		{
+			if (_write - _read == SLOTS)
+				return false;
+			slot = _write++ % SLOTS;
+			return true;
+		}
+
+	private:
+		size_t _read = 0;
+		size_t _write = 0;
+	};
+
+	/// <summary>
+	/// Number of frames of GPU timestamp queries that can be in flight per technique.
+	/// </summary>
+	constexpr size_t NUM_GPU_QUERY_FRAMES = 8;
+
 	struct texture final : reshadefx::texture_info
 	{
 		texture() {}
@@ -173,19 +287,85 @@ namespace reshade
 
 		void *impl = nullptr;
 		size_t effect_index = std::numeric_limits<size_t>::max();
+		size_t cpu_timer_row = std::numeric_limits<size_t>::max(); // Row in the CPU timer table of the runtime, if CPU timers are enabled
+		reshadefx::pass_schedule schedule;
 		bool hidden = false;
 		bool enabled = false;
 		int32_t timeout = 0;
 		int64_t timeleft = 0;
 		uint32_t toggle_key_data[4] = {};
 		moving_average<uint64_t, 60> average_cpu_duration;
-		moving_average<uint64_t, 60> average_gpu_duration;
+		duration_statistics<120> gpu_duration;
+		std::vector<duration_statistics<120>> pass_gpu_durations; // Indexed like the pass list, passes that are not part of the schedule have no samples
+
+		/// <summary>
+		/// Records the GPU timestamps taken before the first pass of the schedule and after every pass of it in a single frame.
+		/// </summary>
+		/// <param name="timestamps">Array of one more timestamp than there are scheduled passes.</param>
+		/// <param name="frequency">The number of timestamp ticks per second.</param>
+		void append_gpu_timestamps(const uint64_t *timestamps, uint64_t frequency)
+		{
+			if (frequency == 0)
+				return;
+
+			const auto ticks_to_nanoseconds = [frequency](uint64_t begin, uint64_t end) -> uint64_t {
+				// Some drivers do not guarantee timestamps to be monotonic between passes
+				const uint64_t ticks = end > begin ? end - begin : 0;
+				// Split the conversion to avoid overflow for large tick counts
+				return (ticks / frequency) * 1'000'000'000 + (ticks % frequency) * 1'000'000'000 / frequency;
+			};
+
+			const size_t num_scheduled_passes = schedule.passes.size();
+
+			gpu_duration.append(ticks_to_nanoseconds(timestamps[0], timestamps[num_scheduled_passes]));
+
+			pass_gpu_durations.resize(passes.size());
+			for (size_t i = 0; i < num_scheduled_passes; ++i)
+				pass_gpu_durations[schedule.passes[i].pass_index].append(ticks_to_nanoseconds(timestamps[i], timestamps[i + 1]));
+		}
+		void clear_gpu_durations()
+		{
+			gpu_duration.clear();
+			for (duration_statistics<120> &pass_duration : pass_gpu_durations)
+				pass_duration.clear();
+		}
+	};
+
+	struct preset_bindings final
+	{
+		struct uniform_binding
+		{
+			size_t effect_index;
+			size_t uniform_index;
+			uint32_t offset;
+			uint32_t size;
+			bool interpolate; // Floating-point values are blended during preset transitions
+			uint32_t toggle_key_data[4];
+		};
+		struct technique_binding
+		{
+			bool enabled;
+			uint32_t toggle_key_data[4];
+		};
+
+		void clear()
+		{
+			uniforms.clear();
+			techniques.clear();
+			uniform_data.clear();
+		}
+
+		std::vector<uniform_binding> uniforms;
+		std::vector<technique_binding> techniques; // Indexed the same as the technique list of the runtime
+		std::vector<std::vector<unsigned char>> uniform_data; // Uniform storage of each effect with all preset values applied
+		std::filesystem::file_time_type modified_at; // Modification time of the preset at the time it was compiled
 	};
 
 	struct effect final
 	{
 		unsigned int rendering = 0;
 		bool compile_sucess = false;
+		bool skipped = false; // Only the techniques were loaded from the metadata cache, the effect is compiled once one of them is enabled
 		std::string errors;
 		std::string preamble;
 		reshadefx::module module;
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "runtime_permutation_cache.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+
+// Binary files start with this header, followed by the warnings and the shader binary
+struct binary_file_header
+{
+	uint32_t magic = 0x43505352; // "RSPC"
+	uint32_t version = 1;
+	uint64_t key = 0;
+	uint32_t warnings_size = 0;
+	uint32_t data_size = 0;
+};
+
+// Metadata files start with this header, followed by the source files with their modification time and the techniques
+struct metadata_file_header
+{
+	uint32_t magic = 0x4d455352; // "RSEM"
+	uint32_t version = 1;
+	uint64_t key = 0;
+};
+
+static void write_string(std::ostream &stream, const std::string &string)
+{
+	const uint32_t size = static_cast<uint32_t>(string.size());
+	stream.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	stream.write(string.data(), size);
+}
+static bool read_string(std::istream &stream, std::string &string)
+{
+	uint32_t size = 0;
+	if (!stream.read(reinterpret_cast<char *>(&size), sizeof(size)) || size > 0x10000)
+		return false;
+	string.resize(size);
+	return !!stream.read(string.data(), size);
+}
+
+reshade::permutation_cache::permutation_cache(std::filesystem::path disk_path) :
+	_modules(MAX_MODULE_MEMORY),
+	_binaries(MAX_BINARY_MEMORY),
+	_disk_path(std::move(disk_path))
+{
+}
+
+bool reshade::permutation_cache::find_module(uint64_t key, reshadefx::module &module, std::string &warnings)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	const std::shared_ptr<const module_entry> entry = _modules.find(key);
+	lock.unlock();
+
+	if (entry == nullptr)
+		return false;
+
+	// Copy outside the lock, since modules can be large and effects are loaded on multiple threads
+	module = entry->module;
+	warnings = entry->warnings;
+	return true;
+}
+void reshade::permutation_cache::insert_module(uint64_t key, const reshadefx::module &module, const std::string &warnings)
+{
+	const auto entry = std::make_shared<module_entry>();
+	entry->module = module;
+	entry->warnings = warnings;
+
+	// Only an estimate, the generated code usually makes up most of a module
+	const size_t size = sizeof(module_entry) + module.hlsl.size() + module.spirv.size() * sizeof(uint32_t) + warnings.size() +
+		(module.textures.size() + module.samplers.size() + module.uniforms.size() + module.techniques.size()) * 256;
+
+	const std::lock_guard<std::mutex> lock(_mutex);
+	_modules.insert(key, entry, size);
+}
+
+bool reshade::permutation_cache::find_binary(uint64_t key, std::vector<uint8_t> &data, std::string &warnings)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (const std::shared_ptr<const binary_entry> entry = _binaries.find(key); entry != nullptr)
+	{
+		lock.unlock();
+
+		data = entry->data;
+		warnings = entry->warnings;
+		return true;
+	}
+
+	if (_disk_path.empty())
+		return false;
+
+	scan_disk();
+
+	if (std::find_if(_disk_files.begin(), _disk_files.end(), [key](const disk_file &file) { return file.key == key && !file.metadata; }) == _disk_files.end())
+		return false; // Avoid trying to open files that do not exist
+
+	lock.unlock();
+
+	std::ifstream file(binary_path(key), std::ios::in | std::ios::binary | std::ios::ate);
+	const uint64_t file_size = file ? static_cast<uint64_t>(file.tellg()) : 0;
+	file.seekg(0);
+
+	// Check the sizes in the header against the file size before allocating anything, since the file may be truncated or corrupted (or was written by something else entirely)
+	binary_file_header header, expected_header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		header.magic != expected_header.magic || header.version != expected_header.version || header.key != key ||
+		sizeof(header) + uint64_t(header.warnings_size) + uint64_t(header.data_size) != file_size)
+	{
+		// Delete the file, so that the binary is compiled and written again instead of failing to read every time
+		lock.lock();
+		remove_disk_file(key, false);
+		return false;
+	}
+
+	const auto entry = std::make_shared<binary_entry>();
+	entry->warnings.resize(header.warnings_size);
+	entry->data.resize(header.data_size);
+	if (!file.read(entry->warnings.data(), entry->warnings.size()) ||
+		!file.read(reinterpret_cast<char *>(entry->data.data()), entry->data.size()))
+	{
+		lock.lock();
+		remove_disk_file(key, false);
+		return false;
+	}
+
+	data = entry->data;
+	warnings = entry->warnings;
+
+	lock.lock();
+
+	_binaries.insert(key, entry, entry->data.size() + entry->warnings.size());
+	touch_disk_file(key, false, sizeof(header) + header.warnings_size + header.data_size);
+
+	return true;
+}
+void reshade::permutation_cache::insert_binary(uint64_t key, const void *data, size_t size, const std::string &warnings)
+{
+	const auto entry = std::make_shared<binary_entry>();
+	entry->data.assign(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+	entry->warnings = warnings;
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_binaries.insert(key, entry, entry->data.size() + entry->warnings.size());
+
+	if (_disk_path.empty())
+		return;
+
+	scan_disk();
+
+	lock.unlock();
+
+	binary_file_header header;
+	header.key = key;
+	header.warnings_size = static_cast<uint32_t>(warnings.size());
+	header.data_size = static_cast<uint32_t>(size);
+
+	// Write to a temporary file first and rename it afterwards, so that other processes sharing the directory never see a partially written file
+	const std::filesystem::path path = binary_path(key);
+	std::filesystem::path temp_path = path;
+	temp_path += L".tmp";
+
+	{	std::ofstream file(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char *>(&header), sizeof(header)) ||
+			!file.write(warnings.data(), warnings.size()) ||
+			!file.write(static_cast<const char *>(data), size))
+			return;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(temp_path, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(temp_path, ec);
+		return;
+	}
+
+	lock.lock();
+
+	touch_disk_file(key, false, sizeof(header) + warnings.size() + size);
+	evict_disk_files();
+}
+
+bool reshade::permutation_cache::find_metadata(uint64_t key, effect_metadata &metadata)
+{
+	if (_disk_path.empty())
+		return false;
+
+	std::ifstream file(metadata_path(key), std::ios::in | std::ios::binary);
+	if (!file)
+		return false;
+
+	metadata_file_header header, expected_header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		header.magic != expected_header.magic || header.version != expected_header.version || header.key != key)
+		return false;
+
+	uint32_t num_source_files = 0;
+	if (!file.read(reinterpret_cast<char *>(&num_source_files), sizeof(num_source_files)))
+		return false;
+
+	metadata.source_files.clear();
+	for (uint32_t i = 0; i < num_source_files; ++i)
+	{
+		std::string path;
+		int64_t last_write_time = 0;
+		if (!read_string(file, path) || !file.read(reinterpret_cast<char *>(&last_write_time), sizeof(last_write_time)))
+			return false;
+
+		// Any modification could add or remove techniques, so the entry is out of date then
+		std::error_code ec;
+		metadata.source_files.push_back(std::filesystem::u8path(path));
+		if (std::filesystem::last_write_time(metadata.source_files.back(), ec).time_since_epoch().count() != last_write_time || ec)
+			return false;
+	}
+
+	uint32_t num_techniques = 0;
+	if (!file.read(reinterpret_cast<char *>(&num_techniques), sizeof(num_techniques)))
+		return false;
+
+	metadata.techniques.resize(num_techniques);
+	for (reshadefx::technique_info &technique : metadata.techniques)
+	{
+		uint32_t num_annotations = 0;
+		if (!read_string(file, technique.name) || !file.read(reinterpret_cast<char *>(&num_annotations), sizeof(num_annotations)))
+			return false;
+
+		technique.passes.clear();
+		technique.annotations.resize(num_annotations);
+		for (reshadefx::annotation &annotation : technique.annotations)
+		{
+			if (!file.read(reinterpret_cast<char *>(&annotation.type), sizeof(annotation.type)) ||
+				!read_string(file, annotation.name) ||
+				!file.read(reinterpret_cast<char *>(annotation.value.as_uint), sizeof(annotation.value.as_uint)) ||
+				!read_string(file, annotation.value.string_data))
+				return false;
+		}
+	}
+
+	const uint64_t size = static_cast<uint64_t>(file.tellg());
+
+	const std::lock_guard<std::mutex> lock(_mutex);
+	scan_disk();
+	touch_disk_file(key, true, size);
+
+	return true;
+}
+void reshade::permutation_cache::insert_metadata(uint64_t key, const effect_metadata &metadata)
+{
+	if (_disk_path.empty())
+		return;
+
+	// Avoid rewriting all files every time effects are loaded
+	if (effect_metadata existing_metadata; find_metadata(key, existing_metadata))
+		return;
+
+	std::error_code ec;
+	std::vector<int64_t> last_write_times;
+	for (const std::filesystem::path &source_file : metadata.source_files)
+	{
+		last_write_times.push_back(std::filesystem::last_write_time(source_file, ec).time_since_epoch().count());
+		if (ec)
+			return; // Cannot tell later whether the file was modified
+	}
+
+	{	const std::lock_guard<std::mutex> lock(_mutex);
+		scan_disk(); // This creates the directory if it does not exist yet
+	}
+
+	const std::filesystem::path path = metadata_path(key);
+	std::filesystem::path temp_path = path;
+	temp_path += L".tmp";
+
+	{	std::ofstream file(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+		metadata_file_header header;
+		header.key = key;
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+		const uint32_t num_source_files = static_cast<uint32_t>(metadata.source_files.size());
+		file.write(reinterpret_cast<const char *>(&num_source_files), sizeof(num_source_files));
+		for (size_t i = 0; i < metadata.source_files.size(); ++i)
+		{
+			write_string(file, metadata.source_files[i].u8string());
+			file.write(reinterpret_cast<const char *>(&last_write_times[i]), sizeof(last_write_times[i]));
+		}
+
+		const uint32_t num_techniques = static_cast<uint32_t>(metadata.techniques.size());
+		file.write(reinterpret_cast<const char *>(&num_techniques), sizeof(num_techniques));
+		for (const reshadefx::technique_info &technique : metadata.techniques)
+		{
+			const uint32_t num_annotations = static_cast<uint32_t>(technique.annotations.size());
+			write_string(file, technique.name);
+			file.write(reinterpret_cast<const char *>(&num_annotations), sizeof(num_annotations));
+			for (const reshadefx::annotation &annotation : technique.annotations)
+			{
+				file.write(reinterpret_cast<const char *>(&annotation.type), sizeof(annotation.type));
+				write_string(file, annotation.name);
+				file.write(reinterpret_cast<const char *>(annotation.value.as_uint), sizeof(annotation.value.as_uint));
+				write_string(file, annotation.value.string_data);
+			}
+		}
+
+		if (!file)
+		{
+			file.close();
+			std::filesystem::remove(temp_path, ec);
+			return;
+		}
+	}
+
+	const uint64_t size = std::filesystem::file_size(temp_path, ec);
+
+	std::filesystem::rename(temp_path, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(temp_path, ec);
+		return;
+	}
+
+	const std::lock_guard<std::mutex> lock(_mutex);
+
+	touch_disk_file(key, true, size);
+	evict_disk_files();
+}
+
+std::filesystem::path reshade::permutation_cache::binary_path(uint64_t key) const
+{
+	char filename[24];
+	sprintf_s(filename, "%016llx.bin", static_cast<unsigned long long>(key));
+	return _disk_path / filename;
+}
+std::filesystem::path reshade::permutation_cache::metadata_path(uint64_t key) const
+{
+	char filename[24];
+	sprintf_s(filename, "%016llx.meta", static_cast<unsigned long long>(key));
+	return _disk_path / filename;
+}
+
+void reshade::permutation_cache::scan_disk()
+{
+	if (_disk_scanned)
+		return;
+	_disk_scanned = true;
+
+	std::error_code ec;
+	std::filesystem::create_directories(_disk_path, ec);
+
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(_disk_path, std::filesystem::directory_options::skip_permission_denied, ec))
+	{
+		const std::filesystem::path extension = entry.path().extension();
+		if (extension != L".bin" && extension != L".meta")
+			continue;
+
+		const std::string stem = entry.path().stem().u8string();
+		char *stem_end = nullptr;
+		const uint64_t key = std::strtoull(stem.c_str(), &stem_end, 16);
+		if (stem.size() != 16 || stem_end != stem.c_str() + stem.size())
+			continue;
+
+		disk_file &file = _disk_files.emplace_back();
+		file.key = key;
+		file.metadata = extension == L".meta";
+		file.size = entry.file_size(ec);
+		file.last_used = entry.last_write_time(ec);
+		_disk_size += file.size;
+	}
+}
+
+void reshade::permutation_cache::touch_disk_file(uint64_t key, bool metadata, uint64_t size)
+{
+	const auto now = std::filesystem::file_time_type::clock::now();
+
+	// Update the modification time of the file, so that the order of use is known again in the next session
+	std::error_code ec;
+	std::filesystem::last_write_time(metadata ? metadata_path(key) : binary_path(key), now, ec);
+
+	if (const auto it = std::find_if(_disk_files.begin(), _disk_files.end(), [key, metadata](const disk_file &file) { return file.key == key && file.metadata == metadata; });
+		it != _disk_files.end())
+	{
+		_disk_size -= it->size;
+		it->size = size;
+		it->last_used = now;
+	}
+	else
+	{
+		_disk_files.push_back({ key, metadata, size, now });
+	}
+
+	_disk_size += size;
+}
+
+void reshade::permutation_cache::remove_disk_file(uint64_t key, bool metadata)
+{
+	std::error_code ec;
+	std::filesystem::remove(metadata ? metadata_path(key) : binary_path(key), ec);
+
+	if (const auto it = std::find_if(_disk_files.begin(), _disk_files.end(), [key, metadata](const disk_file &file) { return file.key == key && file.metadata == metadata; });
+		it != _disk_files.end())
+	{
+		_disk_size -= it->size;
+		_disk_files.erase(it);
+	}
+}
+
+void reshade::permutation_cache::evict_disk_files()
+{
+	if (_disk_size <= MAX_DISK_SPACE)
+		return;
+
+	// Evict the least recently used files until the directory fits into its budget again
+	std::sort(_disk_files.begin(), _disk_files.end(),
+		[](const disk_file &lhs, const disk_file &rhs) { return lhs.last_used > rhs.last_used; });
+
+	std::error_code ec;
+	while (_disk_size > MAX_DISK_SPACE && _disk_files.size() > 1)
+	{
+		const disk_file &file = _disk_files.back();
+		std::filesystem::remove(file.metadata ? metadata_path(file.key) : binary_path(file.key), ec);
+		_disk_size -= file.size;
+		_disk_files.pop_back();
+	}
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include "effect_module.hpp"
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+namespace reshade
+{
+	/// <summary>
+	/// Keeps the results of compiling effects around, so that permutations of an effect that were compiled before (e.g. before a preprocessor definition was toggled back, or in a different preset) do not have to be compiled again.
+	/// Entries are identified by a hash of everything the result depends on, which for modules is the pre-processed source code (and thus already reflects the effective set of preprocessor definitions).
+	/// Code generation results are kept in memory only, while compiled shader binaries are kept in memory and in a directory on disk (together with the metadata of effects). Both are bounded in size and evict the least recently used entries first.
+	/// All methods may be called from any thread.
+	/// </summary>
+	class permutation_cache
+	{
+	public:
+		static constexpr size_t MAX_MODULE_MEMORY = 64 * 1024 * 1024;
+		static constexpr size_t MAX_BINARY_MEMORY = 64 * 1024 * 1024;
+		static constexpr uint64_t MAX_DISK_SPACE = 256 * 1024 * 1024; // Shared by shader binaries and effect metadata
+
+		/// <summary>
+		/// The information about an effect that is needed to list its techniques without compiling it.
+		/// </summary>
+		struct effect_metadata
+		{
+			std::vector<std::filesystem::path> source_files; // The effect file followed by all files it includes
+			std::vector<reshadefx::technique_info> techniques; // Passes are not stored
+		};
+
+		/// <summary>
+		/// Hashes the specified values (strings and arithmetic types) into a key for the cache.
+		/// </summary>
+		template <typename... Args>
+		static uint64_t hash(const Args &... args)
+		{
+			uint64_t value = 14695981039346656037ull;
+			(hash_append(value, args), ...);
+			return value;
+		}
+
+		/// <param name="disk_path">The directory to keep shader binaries in, or an empty path to keep everything in memory only.</param>
+		explicit permutation_cache(std::filesystem::path disk_path);
+
+		permutation_cache(const permutation_cache &) = delete;
+		permutation_cache &operator=(const permutation_cache &) = delete;
+
+		/// <summary>
+		/// Looks up the result of code generation for an effect.
+		/// </summary>
+		/// <param name="key">The hash of the pre-processed source code and the code generation settings.</param>
+		/// <param name="module">Receives a copy of the cached module.</param>
+		/// <param name="warnings">Receives the warnings the parser reported when the module was generated.</param>
+		/// <returns><c>true</c> if the module was found in the cache, <c>false</c> otherwise.</returns>
+		bool find_module(uint64_t key, reshadefx::module &module, std::string &warnings);
+		/// <summary>
+		/// Adds the result of a successful code generation for an effect to the cache.
+		/// </summary>
+		void insert_module(uint64_t key, const reshadefx::module &module, const std::string &warnings);
+
+		/// <summary>
+		/// Looks up a compiled shader binary, first in memory and then on disk.
+		/// </summary>
+		/// <param name="key">The hash of the source code, entry point, target profile and compiler flags.</param>
+		/// <param name="data">Receives the shader binary.</param>
+		/// <param name="warnings">Receives the warnings the compiler reported when the binary was compiled.</param>
+		/// <returns><c>true</c> if the binary was found in the cache, <c>false</c> otherwise.</returns>
+		bool find_binary(uint64_t key, std::vector<uint8_t> &data, std::string &warnings);
+		/// <summary>
+		/// Adds a successfully compiled shader binary to the cache in memory and on disk.
+		/// </summary>
+		void insert_binary(uint64_t key, const void *data, size_t size, const std::string &warnings);
+
+		/// <summary>
+		/// Looks up the metadata of an effect on disk. Entries are only returned if none of the source files were modified since they were added.
+		/// </summary>
+		/// <param name="key">The hash of the effect path and everything else that affects pre-processing.</param>
+		/// <param name="metadata">Receives the metadata of the effect.</param>
+		/// <returns><c>true</c> if up-to-date metadata was found in the cache, <c>false</c> otherwise.</returns>
+		bool find_metadata(uint64_t key, effect_metadata &metadata);
+		/// <summary>
+		/// Adds the metadata of a successfully compiled effect to the cache on disk, unless an up-to-date entry exists already.
+		/// </summary>
+		void insert_metadata(uint64_t key, const effect_metadata &metadata);
+
+	private:
+		static void hash_append(uint64_t &value, std::string_view string)
+		{
+			hash_append(value, string.size());
+			for (const char c : string)
+				value = (value ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+		}
+		template <typename T>
+		static std::enable_if_t<std::is_arithmetic_v<T>> hash_append(uint64_t &value, T number)
+		{
+			for (size_t i = 0; i < sizeof(number); ++i)
+				value = (value ^ reinterpret_cast<const unsigned char *>(&number)[i]) * 1099511628211ull;
+		}
+
+		/// <summary>
+		/// Entries are immutable once inserted, so that lookups can copy them without holding the lock.
+		/// </summary>
+		template <typename T>
+		class lru_list
+		{
+		public:
+			explicit lru_list(size_t max_size) : _max_size(max_size) {}
+
+			std::shared_ptr<const T> find(uint64_t key)
+			{
+				const auto it = _lookup.find(key);
+				if (it == _lookup.end())
+					return nullptr;
+				// Move the entry to the front, since it is now the most recently used one
+				_entries.splice(_entries.begin(), _entries, it->second);
+				return it->second->value;
+			}
+			void insert(uint64_t key, std::shared_ptr<const T> value, size_t size)
+			{
+				if (const auto it = _lookup.find(key); it != _lookup.end())
+				{
+					_size -= it->second->size;
+					_entries.erase(it->second);
+				}
+
+				_entries.push_front({ key, size, std::move(value) });
+				_lookup[key] = _entries.begin();
+				_size += size;
+
+				// Always keep the newest entry, even if it exceeds the limit by itself
+				while (_size > _max_size && _entries.size() > 1)
+				{
+					_size -= _entries.back().size;
+					_lookup.erase(_entries.back().key);
+					_entries.pop_back();
+				}
+			}
+
+		private:
+			struct entry
+			{
+				uint64_t key;
+				size_t size;
+				std::shared_ptr<const T> value;
+			};
+
+			size_t _size = 0;
+			const size_t _max_size;
+			std::list<entry> _entries;
+			std::unordered_map<uint64_t, typename std::list<entry>::iterator> _lookup;
+		};
+
+		struct module_entry
+		{
+			reshadefx::module module;
+			std::string warnings;
+		};
+		struct binary_entry
+		{
+			std::vector<uint8_t> data;
+			std::string warnings;
+		};
+		struct disk_file
+		{
+			uint64_t key;
+			bool metadata; // Metadata and binaries use different keys, but those may still be the same by chance
+			uint64_t size;
+			std::filesystem::file_time_type last_used;
+		};
+
+		std::filesystem::path binary_path(uint64_t key) const;
+		std::filesystem::path metadata_path(uint64_t key) const;
+		void scan_disk();
+		void touch_disk_file(uint64_t key, bool metadata, uint64_t size);
+		void remove_disk_file(uint64_t key, bool metadata);
+		void evict_disk_files();
+
+		std::mutex _mutex;
+		lru_list<module_entry> _modules;
+		lru_list<binary_entry> _binaries;
+		const std::filesystem::path _disk_path;
+		bool _disk_scanned = false;
+		uint64_t _disk_size = 0;
+		std::vector<disk_file> _disk_files;
+	};
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "runtime_config.hpp"
+#include "runtime_preset_index.hpp"
+#include <algorithm>
+
+reshade::preset_index::~preset_index()
+{
+	if (std::unique_lock<std::mutex> lock(_mutex); _thread.joinable())
+	{
+		_queue.clear(); // Abort any pending scans
+		lock.unlock();
+
+		_thread.join();
+	}
+}
+
+reshade::preset_index::snapshot reshade::preset_index::entries(const std::filesystem::path &directory)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	// A directory that was only queued for a refresh has no entries until the background scan finished, so treat it the same as one that was not scanned yet
+	if (const auto it = _directories.find(directory); it != _directories.end() && it->second.entries != nullptr)
+	{
+		const snapshot result = it->second.entries;
+		const auto last_scan_time = it->second.last_scan_time;
+		lock.unlock();
+
+		// Refresh the directory in the background from time to time, in case files were added, removed or changed
+		if ((std::chrono::steady_clock::now() - last_scan_time) > std::chrono::seconds(1))
+			refresh(directory);
+
+		return apply_cached_changes(directory, result);
+	}
+
+	lock.unlock();
+
+	// Directory was not scanned yet, so need to do that right away (this never returns a null snapshot, even if the directory does not exist)
+	snapshot result = scan(directory, nullptr);
+
+	lock.lock();
+
+	directory_data &data = _directories[directory];
+	data.entries = result;
+	data.last_scan_time = std::chrono::steady_clock::now();
+
+	lock.unlock();
+
+	return apply_cached_changes(directory, result);
+}
+
+void reshade::preset_index::refresh(const std::filesystem::path &directory)
+{
+	const std::lock_guard<std::mutex> lock(_mutex);
+
+	// Mark directory as scanned, to avoid queuing it again until the scan has finished
+	_directories[directory].last_scan_time = std::chrono::steady_clock::now();
+
+	if (std::find(_queue.begin(), _queue.end(), directory) != _queue.end())
+		return;
+
+	_queue.push_back(directory);
+
+	if (!_thread_running)
+	{
+		// Previous thread has exited already, but still need to join it prior to replacing it
+		if (_thread.joinable())
+			_thread.join();
+
+		_thread_running = true;
+		_thread = std::thread(&preset_index::thread_main, this);
+	}
+}
+
+reshade::preset_index::snapshot reshade::preset_index::scan(const std::filesystem::path &directory, const snapshot &previous)
+{
+	std::error_code ec;
+	const auto result = std::make_shared<std::vector<entry>>();
+
+	for (const std::filesystem::directory_entry &dir_entry : std::filesystem::directory_iterator(directory, std::filesystem::directory_options::skip_permission_denied, ec))
+	{
+		entry &new_entry = result->emplace_back();
+		new_entry.path = dir_entry.path();
+
+		if (dir_entry.is_directory(ec))
+		{
+			new_entry.is_directory = true;
+			continue;
+		}
+
+		if (new_entry.path.extension() != L".ini" && new_entry.path.extension() != L".txt")
+		{
+			result->pop_back();
+			continue;
+		}
+
+		new_entry.modified_at = dir_entry.last_write_time(ec);
+
+		// Only parse files that were not indexed before or changed since
+		if (previous != nullptr)
+		{
+			if (const auto it = std::find_if(previous->begin(), previous->end(),
+				[&new_entry](const entry &item) { return item.path == new_entry.path; });
+				it != previous->end() && it->modified_at == new_entry.modified_at)
+			{
+				new_entry = *it;
+				continue;
+			}
+		}
+
+		// Do not go through the INI cache here, to avoid keeping all files in memory that were only browsed (changes to cached files are applied in 'apply_cached_changes' instead)
+		const ini_file preset(new_entry.path);
+		new_entry.is_valid = preset.get({}, "Techniques", new_entry.techniques);
+	}
+
+	return result;
+}
+
+reshade::preset_index::snapshot reshade::preset_index::apply_cached_changes(const std::filesystem::path &directory, const snapshot &entries)
+{
+	std::shared_ptr<std::vector<entry>> result;
+
+	// Scans only see what is on disk, so presets that were changed in the INI cache but not written yet (e.g. the current one while it is edited) have to be read through the cache instead
+	// The cache usually only contains a few files, so look for those in the entries instead of the other way around, and only touch the disk for files whose data differs from what was scanned
+	for (const auto &[path, modified_at] : ini_file::cache_modification_times())
+	{
+		const auto it = std::find_if(entries->begin(), entries->end(),
+			[&path = path](const entry &item) { return !item.is_directory && _wcsicmp(item.path.filename().c_str(), path.filename().c_str()) == 0; });
+		if (it == entries->end() || it->modified_at == modified_at)
+			continue;
+
+		if (std::error_code ec; !std::filesystem::equivalent(path.parent_path(), directory, ec))
+			continue;
+
+		if (result == nullptr)
+			result = std::make_shared<std::vector<entry>>(*entries);
+
+		entry &updated_entry = (*result)[std::distance(entries->begin(), it)];
+		updated_entry.techniques.clear();
+		updated_entry.is_valid = ini_file::load_cache_snapshot(path)->get({}, "Techniques", updated_entry.techniques);
+	}
+
+	return result != nullptr ? result : entries;
+}
+
+void reshade::preset_index::thread_main()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (!_queue.empty())
+	{
+		const std::filesystem::path directory = _queue.front();
+		const snapshot previous = _directories[directory].entries;
+
+		lock.unlock();
+
+		snapshot result = scan(directory, previous);
+
+		lock.lock();
+
+		_queue.erase(std::remove(_queue.begin(), _queue.end(), directory), _queue.end());
+
+		directory_data &data = _directories[directory];
+		data.entries = std::move(result);
+		data.last_scan_time = std::chrono::steady_clock::now();
+	}
+
+	_thread_running = false;
+}
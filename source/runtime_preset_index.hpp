@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+
+namespace reshade
+{
+	/// <summary>
+	/// Keeps track of the preset files in directories, so that they do not have to be enumerated and parsed again every time a directory is browsed.
+	/// </summary>
+	class preset_index
+	{
+	public:
+		struct entry
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type modified_at;
+			bool is_directory = false;
+			bool is_valid = false; // Set for preset files that contain a list of techniques
+			std::vector<std::string> techniques;
+		};
+
+		using snapshot = std::shared_ptr<const std::vector<entry>>;
+
+		~preset_index();
+
+		/// <summary>
+		/// Get all entries in the specified directory.
+		/// The directory is scanned synchronously the first time it is requested, afterwards this returns the last known state and refreshes it on a background thread.
+		/// Presets with changes in the INI cache that were not written to disk yet are read from the cache, so this has to be called on the thread that modifies them.
+		/// </summary>
+		/// <param name="directory">The absolute path to the directory.</param>
+		snapshot entries(const std::filesystem::path &directory);
+
+		/// <summary>
+		/// Queue the specified directory to be (re-)scanned on the background thread.
+		/// </summary>
+		/// <param name="directory">The absolute path to the directory.</param>
+		void refresh(const std::filesystem::path &directory);
+
+	private:
+		struct directory_data
+		{
+			snapshot entries;
+			std::chrono::steady_clock::time_point last_scan_time;
+		};
+
+		static snapshot scan(const std::filesystem::path &directory, const snapshot &previous);
+		static snapshot apply_cached_changes(const std::filesystem::path &directory, const snapshot &entries);
+		void thread_main();
+
+		std::mutex _mutex;
+		std::thread _thread;
+		bool _thread_running = false;
+		std::vector<std::filesystem::path> _queue;
+		std::unordered_map<std::wstring, directory_data> _directories;
+	};
+}
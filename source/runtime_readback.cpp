@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "runtime_readback.hpp"
+#include <cassert>
+
+reshade::readback_queue::readback_queue(backend &backend, unsigned int num_slots) :
+	_backend(backend), _num_slots(num_slots)
+{
+	assert(num_slots != 0);
+	_pending.reserve(num_slots);
+}
+
+reshade::readback_queue::~readback_queue()
+{
+	poll(true);
+}
+
+bool reshade::readback_queue::push(unsigned int width, unsigned int height, completion_callback callback, uint8_t *destination)
+{
+	// Slots are handed out in ring order and completed in the same order, so the next slot is free as soon as fewer than all slots are pending
+	if (_pending.size() == _num_slots)
+		complete_oldest();
+
+	const unsigned int slot = _next_slot;
+
+	if (!_backend.begin_readback(slot))
+	{
+		callback(nullptr, width, height);
+		return false;
+	}
+
+	_next_slot = (slot + 1) % _num_slots;
+	_pending.push_back({ slot, width, height, std::move(callback), destination });
+
+	return true;
+}
+
+void reshade::readback_queue::poll(bool wait)
+{
+	// Complete in order, so callbacks see frames in the sequence they were captured
+	while (!_pending.empty() && (wait || _backend.is_readback_complete(_pending.front().slot)))
+		complete_oldest();
+}
+
+void reshade::readback_queue::complete_oldest()
+{
+	assert(!_pending.empty());
+
+	// Remove request before calling the callback, so that it may start another readback
+	request req = std::move(_pending.front());
+	_pending.erase(_pending.begin());
+
+	uint8_t *pixels = req.destination;
+	if (pixels == nullptr)
+	{
+		_pixels.resize(size_t(req.width) * req.height * 4);
+		pixels = _pixels.data();
+	}
+
+	const bool success = _backend.finish_readback(req.slot, pixels);
+
+	req.callback(success ? pixels : nullptr, req.width, req.height);
+}
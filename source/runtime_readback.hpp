@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+namespace reshade
+{
+	/// <summary>
+	/// Copies frame images into a ring of host-visible readback slots and completes them a few frames later, once the GPU has finished the copy.
+	/// This keeps capturing (e.g. screenshots) from stalling the pipeline until the GPU caught up with the current frame.
+	/// </summary>
+	class readback_queue
+	{
+	public:
+		/// <summary>
+		/// Graphics API specific part of a readback, which is implemented by the runtimes.
+		/// </summary>
+		class backend
+		{
+		public:
+			/// <summary>
+			/// Record a copy of the current frame image into the specified readback slot, without waiting for it to finish.
+			/// </summary>
+			/// <param name="slot">The index of the readback slot to copy to.</param>
+			virtual bool begin_readback(unsigned int slot) = 0;
+			/// <summary>
+			/// Check whether the copy into the specified readback slot has finished. This must not block.
+			/// </summary>
+			/// <param name="slot">The index of the readback slot to check.</param>
+			virtual bool is_readback_complete(unsigned int slot) const = 0;
+			/// <summary>
+			/// Wait for the copy into the specified readback slot to finish and convert its contents to 32bpp RGBA image data.
+			/// </summary>
+			/// <param name="slot">The index of the readback slot to read from.</param>
+			/// <param name="buffer">The 32bpp RGBA buffer to write the image data to.</param>
+			virtual bool finish_readback(unsigned int slot, uint8_t *buffer) = 0;
+		};
+
+		/// <summary>
+		/// Function called with the 32bpp RGBA image data once a readback has completed, or with <c>nullptr</c> if it failed.
+		/// </summary>
+		using completion_callback = std::function<void(const uint8_t *pixels, unsigned int width, unsigned int height)>;
+
+		readback_queue(backend &backend, unsigned int num_slots);
+		/// <summary>
+		/// Completes all pending readbacks, so every callback is called exactly once. The backend therefore has to outlive the queue (or all readbacks have to be completed before it is destroyed).
+		/// </summary>
+		~readback_queue();
+
+		readback_queue(const readback_queue &) = delete;
+		readback_queue &operator=(const readback_queue &) = delete;
+
+		/// <summary>
+		/// Return the number of readbacks that were started but not completed yet.
+		/// </summary>
+		size_t num_pending() const { return _pending.size(); }
+
+		/// <summary>
+		/// Start a readback of the current frame into the next slot. If all slots are in use, the oldest readback is completed first, which may block.
+		/// </summary>
+		/// <param name="width">The frame width in pixels.</param>
+		/// <param name="height">The frame height in pixels.</param>
+		/// <param name="callback">The function to call once the readback has completed.</param>
+		/// <param name="destination">Optional buffer with space for <paramref name="width"/> * <paramref name="height"/> * 4 bytes to write the image data to directly, instead of an internal buffer. It has to stay valid until the callback was called.</param>
+		/// <returns><c>true</c> if the copy was started, <c>false</c> if it failed (in which case the callback was already called).</returns>
+		bool push(unsigned int width, unsigned int height, completion_callback callback, uint8_t *destination = nullptr);
+
+		/// <summary>
+		/// Complete all readbacks whose copy has finished, in the order they were started.
+		/// </summary>
+		/// <param name="wait">Set to <c>true</c> to wait for and complete all pending readbacks.</param>
+		void poll(bool wait = false);
+
+	private:
+		struct request
+		{
+			unsigned int slot;
+			unsigned int width, height;
+			completion_callback callback;
+			uint8_t *destination;
+		};
+
+		void complete_oldest();
+
+		backend &_backend;
+		unsigned int _num_slots;
+		unsigned int _next_slot = 0;
+		std::vector<request> _pending;
+		std::vector<uint8_t> _pixels;
+	};
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "runtime_staging_ring.hpp"
+#include <cassert>
+
+reshade::staging_ring::staging_ring(backend &backend, uint64_t min_size) :
+	_backend(backend), _min_size(min_size)
+{
+	assert(min_size != 0);
+}
+
+uint8_t *reshade::staging_ring::allocate(uint64_t size, uint64_t alignment, unsigned int frame, uint64_t &offset)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+	assert(frame < 32);
+
+	offset = (_offset + alignment - 1) & ~(alignment - 1);
+
+	if (offset + size > _size)
+	{
+		// Not enough space left, so wait for all frames that still read from the staging buffer before wrapping around
+		// This includes the frame the copy is recorded in, since its earlier copies would otherwise be overwritten before they execute
+		if (_frames_in_flight != 0)
+		{
+			_backend.wait_for_staging_frames(_frames_in_flight);
+			_frames_in_flight = 0;
+		}
+
+		offset = 0;
+		_offset = 0;
+
+		// Grow staging buffer if the data does not even fit when it is empty
+		if (size > _size)
+		{
+			uint64_t new_size = _size > _min_size ? _size : _min_size;
+			while (new_size < size)
+				new_size *= 2;
+
+			_data = _backend.resize_staging_buffer(new_size);
+			_size = _data != nullptr ? new_size : 0;
+			if (_data == nullptr)
+				return nullptr;
+		}
+	}
+
+	_offset = offset + size;
+	_frames_in_flight |= 1u << frame;
+
+	return _data + offset;
+}
+
+void reshade::staging_ring::release_frame(unsigned int frame)
+{
+	_frames_in_flight &= ~(1u << frame);
+
+	// Rewind once no frame in flight uses the staging buffer anymore
+	if (_frames_in_flight == 0)
+		_offset = 0;
+}
+
+void reshade::staging_ring::reset()
+{
+	_data = nullptr;
+	_size = 0;
+	_offset = 0;
+	_frames_in_flight = 0;
+}
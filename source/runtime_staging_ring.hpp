@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace reshade
+{
+	/// <summary>
+	/// Hands out upload memory from a persistently mapped staging buffer, which is shared by all command frames in flight.
+	/// Allocations are made linearly and the buffer is rewound once no frame in flight reads from it anymore. If it runs out of space before that, it waits for those frames and wraps around (growing the buffer if a single allocation does not fit).
+	/// </summary>
+	class staging_ring
+	{
+	public:
+		/// <summary>
+		/// Graphics API specific part of the staging buffer, which is implemented by the runtimes.
+		/// </summary>
+		class backend
+		{
+		public:
+			/// <summary>
+			/// Wait for the GPU to finish reading from the staging buffer in the specified command frames. Copies that are still being recorded for one of them have to be executed first.
+			/// </summary>
+			/// <param name="frame_mask">Bit mask of the command frames to wait for.</param>
+			virtual void wait_for_staging_frames(uint32_t frame_mask) = 0;
+			/// <summary>
+			/// Replace the staging buffer with a new persistently mapped one. The GPU no longer reads from the old one at this point.
+			/// </summary>
+			/// <param name="size">The size of the new buffer in bytes.</param>
+			/// <returns>Pointer to the mapped memory of the new buffer, or <c>nullptr</c> if it could not be created.</returns>
+			virtual uint8_t *resize_staging_buffer(uint64_t size) = 0;
+		};
+
+		/// <param name="min_size">The size in bytes the staging buffer has at least once it was created.</param>
+		staging_ring(backend &backend, uint64_t min_size);
+
+		staging_ring(const staging_ring &) = delete;
+		staging_ring &operator=(const staging_ring &) = delete;
+
+		/// <summary>
+		/// Return the current size of the staging buffer in bytes.
+		/// </summary>
+		uint64_t size() const { return _size; }
+		/// <summary>
+		/// Return the bit mask of command frames that read from the staging buffer.
+		/// </summary>
+		uint32_t frames_in_flight() const { return _frames_in_flight; }
+
+		/// <summary>
+		/// Allocate staging memory for a copy recorded in the specified command frame. This may block if the buffer has to wrap around.
+		/// </summary>
+		/// <param name="size">The number of bytes to allocate.</param>
+		/// <param name="alignment">The required alignment of the allocation offset. Has to be a power of two.</param>
+		/// <param name="frame">The index of the command frame the copy is recorded in.</param>
+		/// <param name="offset">Set to the offset of the allocation in the staging buffer.</param>
+		/// <returns>Pointer to the mapped memory of the allocation, or <c>nullptr</c> if the staging buffer could not be grown.</returns>
+		uint8_t *allocate(uint64_t size, uint64_t alignment, unsigned int frame, uint64_t &offset);
+
+		/// <summary>
+		/// Mark the memory read by the specified command frame as free again. Call this once its fence was signaled.
+		/// </summary>
+		/// <param name="frame">The index of the command frame that finished executing.</param>
+		void release_frame(unsigned int frame);
+
+		/// <summary>
+		/// Forget about the staging buffer after it was destroyed, so the next allocation creates a new one.
+		/// </summary>
+		void reset();
+
+	private:
+		backend &_backend;
+		uint64_t _min_size;
+		uint8_t *_data = nullptr;
+		uint64_t _size = 0;
+		uint64_t _offset = 0;
+		uint32_t _frames_in_flight = 0;
+	};
+}
@@ -0,0 +1,718 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "text_buffer.hpp"
+#include <cassert>
+#include <tuple>
+#include <algorithm>
+
+static void append_run(std::vector<text_buffer::color_run> &runs, size_t length, uint8_t color)
+{
+	if (length == 0)
+		return;
+
+	if (!runs.empty() && runs.back().color == color)
+		runs.back().length += static_cast<uint32_t>(length);
+	else
+		runs.push_back({ static_cast<uint32_t>(length), color });
+}
+// Removes empty runs and joins adjacent runs of the same color, which edits in the middle of a line can leave behind
+static void compact_runs(std::vector<text_buffer::color_run> &runs)
+{
+	size_t count = 0;
+	for (const text_buffer::color_run &run : runs)
+	{
+		if (run.length == 0)
+			continue;
+
+		if (count != 0 && runs[count - 1].color == run.color)
+			runs[count - 1].length += run.length;
+		else
+			runs[count++] = run;
+	}
+	runs.resize(count);
+}
+// Moves the runs after a column to the end of another run list
+static void move_runs(std::vector<text_buffer::color_run> &runs, size_t column, std::vector<text_buffer::color_run> &target)
+{
+	auto it = runs.begin();
+	for (; it != runs.end() && column >= it->length; ++it)
+		column -= it->length;
+	if (it == runs.end())
+		return;
+
+	if (column != 0)
+	{
+		append_run(target, it->length - column, it->color);
+		it->length = static_cast<uint32_t>(column);
+		++it;
+	}
+
+	for (auto tail = it; tail != runs.end(); ++tail)
+		append_run(target, tail->length, tail->color);
+
+	runs.erase(it, runs.end());
+}
+// Inserts a run of characters of the same color at a column, splitting the run that contains it if necessary
+static void insert_run(std::vector<text_buffer::color_run> &runs, size_t column, size_t length, uint8_t color)
+{
+	if (length == 0)
+		return;
+
+	auto it = runs.begin();
+	for (; it != runs.end() && column > it->length; ++it)
+		column -= it->length;
+
+	if (it == runs.end())
+	{
+		runs.push_back({ static_cast<uint32_t>(length), color });
+	}
+	else if (it->color == color)
+	{
+		it->length += static_cast<uint32_t>(length);
+	}
+	else if (column == 0)
+	{
+		runs.insert(it, { static_cast<uint32_t>(length), color });
+	}
+	else if (column == it->length)
+	{
+		runs.insert(it + 1, { static_cast<uint32_t>(length), color });
+	}
+	else
+	{
+		const text_buffer::color_run tail = { static_cast<uint32_t>(it->length - column), it->color };
+		it->length = static_cast<uint32_t>(column);
+		runs.insert(it + 1, { { static_cast<uint32_t>(length), color }, tail });
+	}
+
+	compact_runs(runs);
+}
+// Removes a range of characters from the runs
+static void erase_runs(std::vector<text_buffer::color_run> &runs, size_t column, size_t length)
+{
+	auto it = runs.begin();
+	for (; it != runs.end() && column >= it->length; ++it)
+		column -= it->length;
+
+	for (; it != runs.end() && length != 0; ++it, column = 0)
+	{
+		const size_t removed = std::min<size_t>(length, it->length - column);
+		it->length -= static_cast<uint32_t>(removed);
+		length -= removed;
+	}
+
+	compact_runs(runs);
+}
+
+text_buffer::text_buffer()
+{
+	_line_root = create_line(0);
+}
+
+size_t text_buffer::size() const
+{
+	return total_length(_root);
+}
+
+size_t text_buffer::offset(size_t line, size_t column) const
+{
+	if (line >= line_count())
+		return size();
+	if (line == 0)
+		return column;
+
+	// Find the line break that ends the previous line
+	size_t base = 0;
+	size_t index = line;
+	for (uint32_t root = _root; root != nil;)
+	{
+		const node &n = _nodes[root];
+
+		if (const size_t left_breaks = total_breaks(n.left); index <= left_breaks)
+		{
+			root = n.left;
+			continue;
+		}
+		else
+		{
+			index -= left_breaks;
+			base += total_length(n.left);
+		}
+
+		if (index <= n.breaks)
+			return base + (find_break(n.data.source, n.data.offset, index - 1) - n.data.offset) + 1 + column;
+
+		index -= n.breaks;
+		base += n.data.length;
+		root = n.right;
+	}
+
+	assert(false);
+	return size();
+}
+
+char text_buffer::at(size_t line, size_t column) const
+{
+	size_t position = offset(line, column);
+
+	for (uint32_t root = _root; root != nil;)
+	{
+		const node &n = _nodes[root];
+
+		if (const size_t left_length = total_length(n.left); position < left_length)
+		{
+			root = n.left;
+			continue;
+		}
+		else
+		{
+			position -= left_length;
+		}
+
+		if (position < n.data.length)
+			return source_data(n.data.source)[n.data.offset + position];
+
+		position -= n.data.length;
+		root = n.right;
+	}
+
+	return '\0';
+}
+
+void text_buffer::get_line(size_t line, std::string &text) const
+{
+	const size_t length = line_length(line);
+
+	text.clear();
+	text.reserve(length);
+
+	const size_t beg = offset(line, 0);
+	const auto callback = [this, &text](const piece &data) {
+		text.append(source_data(data.source) + data.offset, data.length);
+	};
+	visit(_root, 0, beg, beg + length, callback);
+}
+
+std::string text_buffer::get_text(size_t beg_line, size_t beg_column, size_t end_line, size_t end_column) const
+{
+	const size_t beg = offset(beg_line, beg_column);
+	const size_t end = std::min(offset(end_line, end_column), size());
+
+	std::string text;
+	if (beg >= end)
+		return text;
+	text.reserve(end - beg);
+
+	const auto callback = [this, &text](const piece &data) {
+		text.append(source_data(data.source) + data.offset, data.length);
+	};
+	visit(_root, 0, beg, end, callback);
+
+	return text;
+}
+
+std::vector<text_buffer::piece> text_buffer::get_pieces(size_t beg_line, size_t beg_column, size_t end_line, size_t end_column) const
+{
+	const size_t beg = offset(beg_line, beg_column);
+	const size_t end = std::min(offset(end_line, end_column), size());
+
+	std::vector<piece> pieces;
+	const auto callback = [&pieces](const piece &data) {
+		// Join pieces that are contiguous in the same source buffer
+		if (!pieces.empty() && pieces.back().source == data.source && pieces.back().offset + pieces.back().length == data.offset)
+			pieces.back().length += data.length;
+		else
+			pieces.push_back(data);
+	};
+	visit(_root, 0, beg, end, callback);
+
+	return pieces;
+}
+
+void text_buffer::set_text(const std::string &text)
+{
+	_original.clear();
+	_original.reserve(text.size());
+	_original_breaks.clear();
+	_added.clear();
+	_added_breaks.clear();
+
+	_root = nil;
+	_nodes.clear();
+	_free_nodes.clear();
+
+	for (const char c : text)
+	{
+		if (c == '\r')
+			continue;
+		if (c == '\n')
+			_original_breaks.push_back(_original.size());
+
+		_original.push_back(c);
+	}
+
+	if (!_original.empty())
+		_root = create_node({ 0, 0, _original.size() });
+
+	_line_root = nil;
+	_lines.clear();
+	_lines.reserve(_original_breaks.size() + 1);
+	_free_lines.clear();
+
+	// Build the line tree in one go (as a cartesian tree of the line priorities), which is linear in the number of lines, instead of merging every line into it
+	std::vector<uint32_t> right_spine;
+	for (size_t line = 0, line_beg = 0; line <= _original_breaks.size(); ++line)
+	{
+		const size_t line_end = line < _original_breaks.size() ? _original_breaks[line] : _original.size();
+		const uint32_t index = create_line(line_end - line_beg);
+		line_beg = line_end + 1;
+
+		uint32_t last = nil;
+		while (!right_spine.empty() && _lines[right_spine.back()].priority < _lines[index].priority)
+		{
+			last = right_spine.back();
+			right_spine.pop_back();
+			update_line(last);
+		}
+
+		_lines[index].left = last;
+		if (!right_spine.empty())
+			_lines[right_spine.back()].right = index;
+		right_spine.push_back(index);
+	}
+
+	while (!right_spine.empty())
+	{
+		_line_root = right_spine.back();
+		right_spine.pop_back();
+		update_line(_line_root);
+	}
+}
+
+std::pair<size_t, size_t> text_buffer::insert(size_t line, size_t column, const char *text, size_t length)
+{
+	const size_t added_offset = _added.size();
+
+	for (size_t i = 0; i < length; ++i)
+	{
+		if (text[i] == '\r')
+			continue;
+		if (text[i] == '\n')
+			_added_breaks.push_back(_added.size());
+
+		_added.push_back(text[i]);
+	}
+
+	return insert_piece(line, column, { 1, added_offset, _added.size() - added_offset });
+}
+std::pair<size_t, size_t> text_buffer::insert(size_t line, size_t column, const std::vector<piece> &pieces)
+{
+	for (const piece &data : pieces)
+		std::tie(line, column) = insert_piece(line, column, data);
+
+	return { line, column };
+}
+
+void text_buffer::erase(size_t beg_line, size_t beg_column, size_t end_line, size_t end_column)
+{
+	assert(beg_line < line_count() && end_line < line_count());
+
+	const size_t beg = offset(beg_line, beg_column);
+	const size_t end = offset(end_line, end_column);
+	if (beg >= end)
+		return;
+
+	const auto [left, rest] = split(_root, beg);
+	const auto [middle, right] = split(rest, end - beg);
+	destroy_tree(middle);
+	_root = merge(left, right);
+
+	line_node &first = _lines[find_line(beg_line)];
+
+	if (beg_line == end_line)
+	{
+		first.length -= end_column - beg_column;
+		erase_runs(first.colors, beg_column, end_column - beg_column);
+		return;
+	}
+
+	// Join the remaining parts of the first and last line
+	line_node &last = _lines[find_line(end_line)];
+
+	erase_runs(first.colors, beg_column, first.length - beg_column);
+	move_runs(last.colors, end_column, first.colors);
+	first.length = beg_column + (last.length - end_column);
+
+	const auto [lines_before, lines_rest] = split_lines(_line_root, beg_line + 1);
+	const auto [lines_removed, lines_after] = split_lines(lines_rest, end_line - beg_line);
+	destroy_lines(lines_removed);
+	_line_root = merge_lines(lines_before, lines_after);
+}
+
+uint8_t text_buffer::color_at(size_t line, size_t column) const
+{
+	for (const color_run &run : line_colors(line))
+	{
+		if (column < run.length)
+			return run.color;
+		column -= run.length;
+	}
+
+	return 0;
+}
+
+void text_buffer::set_color(size_t line, size_t column, size_t length, uint8_t color)
+{
+	line_node &info = _lines[find_line(line)];
+	if (column >= info.length)
+		return;
+	length = std::min(length, info.length - column);
+
+	erase_runs(info.colors, column, length);
+	insert_run(info.colors, column, length, color);
+}
+
+size_t text_buffer::count_breaks(uint32_t source, size_t offset, size_t length) const
+{
+	const std::vector<size_t> &breaks = source == 0 ? _original_breaks : _added_breaks;
+
+	return std::lower_bound(breaks.begin(), breaks.end(), offset + length) - std::lower_bound(breaks.begin(), breaks.end(), offset);
+}
+size_t text_buffer::find_break(uint32_t source, size_t offset, size_t index) const
+{
+	const std::vector<size_t> &breaks = source == 0 ? _original_breaks : _added_breaks;
+
+	return *(std::lower_bound(breaks.begin(), breaks.end(), offset) + index);
+}
+
+uint32_t text_buffer::next_priority()
+{
+	// Xorshift random number generator for the tree priorities
+	_seed ^= _seed << 13;
+	_seed ^= _seed >> 17;
+	_seed ^= _seed << 5;
+
+	return _seed;
+}
+
+uint32_t text_buffer::create_node(const piece &data)
+{
+	uint32_t index;
+	if (!_free_nodes.empty())
+	{
+		index = _free_nodes.back();
+		_free_nodes.pop_back();
+	}
+	else
+	{
+		index = static_cast<uint32_t>(_nodes.size());
+		_nodes.emplace_back();
+	}
+
+	node &n = _nodes[index];
+	n.data = data;
+	n.breaks = count_breaks(data.source, data.offset, data.length);
+	n.priority = next_priority();
+	n.left = nil;
+	n.right = nil;
+	update_node(index);
+
+	return index;
+}
+void text_buffer::destroy_tree(uint32_t root)
+{
+	if (root == nil)
+		return;
+
+	destroy_tree(_nodes[root].left);
+	destroy_tree(_nodes[root].right);
+
+	_free_nodes.push_back(root);
+}
+void text_buffer::update_node(uint32_t root)
+{
+	node &n = _nodes[root];
+	n.total_length = total_length(n.left) + n.data.length + total_length(n.right);
+	n.total_breaks = total_breaks(n.left) + n.breaks + total_breaks(n.right);
+}
+
+std::pair<uint32_t, uint32_t> text_buffer::split(uint32_t root, size_t offset)
+{
+	if (root == nil)
+		return { nil, nil };
+
+	if (const size_t left_length = total_length(_nodes[root].left); offset <= left_length)
+	{
+		const auto [left, right] = split(_nodes[root].left, offset);
+		_nodes[root].left = right;
+		update_node(root);
+		return { left, root };
+	}
+	else
+	{
+		offset -= left_length;
+	}
+
+	const piece data = _nodes[root].data;
+
+	if (offset >= data.length)
+	{
+		const auto [left, right] = split(_nodes[root].right, offset - data.length);
+		_nodes[root].right = left;
+		update_node(root);
+		return { root, right };
+	}
+
+	// The split position is inside this piece, so cut it in two
+	const uint32_t right = _nodes[root].right;
+
+	_nodes[root].data.length = offset;
+	_nodes[root].breaks = count_breaks(data.source, data.offset, offset);
+	_nodes[root].right = nil;
+	update_node(root);
+
+	const uint32_t tail = create_node({ data.source, data.offset + offset, data.length - offset });
+
+	return { root, merge(tail, right) };
+}
+uint32_t text_buffer::merge(uint32_t left, uint32_t right)
+{
+	if (left == nil)
+		return right;
+	if (right == nil)
+		return left;
+
+	if (_nodes[left].priority > _nodes[right].priority)
+	{
+		_nodes[left].right = merge(_nodes[left].right, right);
+		update_node(left);
+		return left;
+	}
+	else
+	{
+		_nodes[right].left = merge(left, _nodes[right].left);
+		update_node(right);
+		return right;
+	}
+}
+bool text_buffer::extend_last(uint32_t root, const piece &data)
+{
+	if (root == nil)
+		return false;
+
+	node &n = _nodes[root];
+
+	if (n.right != nil)
+	{
+		if (!extend_last(n.right, data))
+			return false;
+	}
+	else
+	{
+		if (n.data.source != data.source || n.data.offset + n.data.length != data.offset)
+			return false;
+
+		n.data.length += data.length;
+		n.breaks += count_breaks(data.source, data.offset, data.length);
+	}
+
+	update_node(root);
+	return true;
+}
+
+template <typename F>
+void text_buffer::visit(uint32_t root, size_t base, size_t beg, size_t end, F &callback) const
+{
+	if (root == nil || end <= base || beg >= base + _nodes[root].total_length)
+		return;
+
+	const node &n = _nodes[root];
+
+	visit(n.left, base, beg, end, callback);
+
+	const size_t piece_beg = base + total_length(n.left);
+	const size_t piece_end = piece_beg + n.data.length;
+	const size_t clip_beg = std::max(beg, piece_beg);
+	const size_t clip_end = std::min(end, piece_end);
+
+	if (clip_beg < clip_end)
+		callback(piece { n.data.source, n.data.offset + (clip_beg - piece_beg), clip_end - clip_beg });
+
+	visit(n.right, piece_end, beg, end, callback);
+}
+
+uint32_t text_buffer::create_line(size_t length)
+{
+	uint32_t index;
+	if (!_free_lines.empty())
+	{
+		index = _free_lines.back();
+		_free_lines.pop_back();
+	}
+	else
+	{
+		index = static_cast<uint32_t>(_lines.size());
+		_lines.emplace_back();
+	}
+
+	line_node &n = _lines[index];
+	n.length = length;
+	n.colors.clear(); // Keep the memory of a previously destroyed line around
+	append_run(n.colors, length, 0);
+	n.state = 0;
+	n.total_lines = 1;
+	n.priority = next_priority();
+	n.left = nil;
+	n.right = nil;
+
+	return index;
+}
+void text_buffer::destroy_lines(uint32_t root)
+{
+	if (root == nil)
+		return;
+
+	destroy_lines(_lines[root].left);
+	destroy_lines(_lines[root].right);
+
+	_free_lines.push_back(root);
+}
+void text_buffer::update_line(uint32_t root)
+{
+	line_node &n = _lines[root];
+	n.total_lines = total_lines(n.left) + 1 + total_lines(n.right);
+}
+
+uint32_t text_buffer::find_line(size_t line) const
+{
+	assert(line < line_count());
+
+	for (uint32_t root = _line_root;;)
+	{
+		const line_node &n = _lines[root];
+
+		if (const size_t left_lines = total_lines(n.left); line < left_lines)
+		{
+			root = n.left;
+		}
+		else if (line == left_lines)
+		{
+			return root;
+		}
+		else
+		{
+			line -= left_lines + 1;
+			root = n.right;
+		}
+	}
+}
+
+std::pair<uint32_t, uint32_t> text_buffer::split_lines(uint32_t root, size_t count)
+{
+	if (root == nil)
+		return { nil, nil };
+
+	if (const size_t left_lines = total_lines(_lines[root].left); count <= left_lines)
+	{
+		const auto [left, right] = split_lines(_lines[root].left, count);
+		_lines[root].left = right;
+		update_line(root);
+		return { left, root };
+	}
+	else
+	{
+		const auto [left, right] = split_lines(_lines[root].right, count - left_lines - 1);
+		_lines[root].right = left;
+		update_line(root);
+		return { root, right };
+	}
+}
+uint32_t text_buffer::merge_lines(uint32_t left, uint32_t right)
+{
+	if (left == nil)
+		return right;
+	if (right == nil)
+		return left;
+
+	if (_lines[left].priority > _lines[right].priority)
+	{
+		_lines[left].right = merge_lines(_lines[left].right, right);
+		update_line(left);
+		return left;
+	}
+	else
+	{
+		_lines[right].left = merge_lines(left, _lines[right].left);
+		update_line(right);
+		return right;
+	}
+}
+
+std::pair<size_t, size_t> text_buffer::insert_piece(size_t line, size_t column, const piece &data)
+{
+	assert(line < line_count() && column <= line_length(line));
+
+	if (data.length == 0)
+		return { line, column };
+
+	const auto [left, right] = split(_root, offset(line, column));
+
+	// Typing appends to the end of the added text buffer, so in the common case the previous piece can simply be extended
+	uint32_t root = left;
+	if (!extend_last(root, data))
+		root = merge(root, create_node(data));
+
+	_root = merge(root, right);
+
+	return insert_lines(line, column, source_data(data.source) + data.offset, data.length);
+}
+
+std::pair<size_t, size_t> text_buffer::insert_lines(size_t line, size_t column, const char *text, size_t length)
+{
+	const char *const text_end = text + length;
+	const char *segment_end = std::find(text, text_end, '\n');
+
+	const uint32_t first = find_line(line);
+
+	if (segment_end == text_end)
+	{
+		_lines[first].length += length;
+		insert_run(_lines[first].colors, column, length, 0);
+
+		return { line, column + length };
+	}
+
+	// The last inserted line gets the remainder of the line the text was inserted into
+	std::vector<color_run> tail_colors;
+	move_runs(_lines[first].colors, column, tail_colors);
+	const size_t tail_length = _lines[first].length - column;
+
+	const size_t first_length = segment_end - text;
+	_lines[first].length = column + first_length;
+	append_run(_lines[first].colors, first_length, 0);
+
+	uint32_t new_lines = nil;
+	size_t num_new_lines = 0;
+	uint32_t last = nil;
+	while (segment_end != text_end)
+	{
+		const char *const segment_beg = segment_end + 1;
+		segment_end = std::find(segment_beg, text_end, '\n');
+
+		last = create_line(segment_end - segment_beg);
+		new_lines = merge_lines(new_lines, last);
+		num_new_lines++;
+	}
+
+	_lines[last].length += tail_length;
+	for (const color_run &run : tail_colors)
+		append_run(_lines[last].colors, run.length, run.color);
+
+	const auto [lines_before, lines_after] = split_lines(_line_root, line + 1);
+	_line_root = merge_lines(merge_lines(lines_before, new_lines), lines_after);
+
+	return { line + num_new_lines, _lines[last].length - tail_length };
+}
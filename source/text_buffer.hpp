@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+/// <summary>
+/// Text storage for the code editor.
+/// Text is kept in a piece table (a balanced tree of references into an immutable original buffer and an append-only buffer of added text),
+/// with line breaks indexed per buffer, so that finding the position of a line and splitting or joining pieces are logarithmic in the size of the text.
+/// Line lengths, syntax colors (as run-length encoded spans) and lexer states are kept in a second balanced tree ordered by line number, so that inserting or removing lines is logarithmic in the number of lines too.
+/// Edits within a line only touch the color runs of that line (see 'tools/text_buffer_benchmark.cpp').
+/// </summary>
+class text_buffer
+{
+public:
+	/// <summary>
+	/// A span of characters in one of the two source buffers.
+	/// Since source buffers are never modified, pieces stay valid and can be used to cheaply restore text (e.g. for undo).
+	/// </summary>
+	struct piece
+	{
+		uint32_t source; // 0 = original text, 1 = added text
+		size_t offset;
+		size_t length;
+	};
+
+	/// <summary>
+	/// A span of characters in a line that share the same color.
+	/// </summary>
+	struct color_run
+	{
+		uint32_t length;
+		uint8_t color;
+	};
+
+	text_buffer();
+
+	/// <summary>
+	/// Returns the total number of characters (including line breaks).
+	/// </summary>
+	size_t size() const;
+	/// <summary>
+	/// Returns the number of lines (there is always at least one).
+	/// </summary>
+	size_t line_count() const { return total_lines(_line_root); }
+	/// <summary>
+	/// Returns the number of characters in the specified line (excluding the line break).
+	/// </summary>
+	size_t line_length(size_t line) const { return _lines[find_line(line)].length; }
+
+	/// <summary>
+	/// Converts a line and column position to a character offset.
+	/// </summary>
+	size_t offset(size_t line, size_t column) const;
+
+	/// <summary>
+	/// Returns the character at the specified position.
+	/// </summary>
+	char at(size_t line, size_t column) const;
+	/// <summary>
+	/// Copies the characters of the specified line (excluding the line break) into <paramref name="text"/>.
+	/// </summary>
+	void get_line(size_t line, std::string &text) const;
+	/// <summary>
+	/// Returns the text between two positions.
+	/// </summary>
+	std::string get_text(size_t beg_line, size_t beg_column, size_t end_line, size_t end_column) const;
+	/// <summary>
+	/// Returns references to the text between two positions.
+	/// </summary>
+	std::vector<piece> get_pieces(size_t beg_line, size_t beg_column, size_t end_line, size_t end_column) const;
+
+	/// <summary>
+	/// Replaces the entire text. Carriage return characters are removed.
+	/// </summary>
+	void set_text(const std::string &text);
+	/// <summary>
+	/// Inserts text at the specified position and returns the position after the inserted text.
+	/// </summary>
+	std::pair<size_t, size_t> insert(size_t line, size_t column, const char *text, size_t length);
+	std::pair<size_t, size_t> insert(size_t line, size_t column, const std::string &text) { return insert(line, column, text.data(), text.size()); }
+	/// <summary>
+	/// Inserts text previously retrieved via <see cref="get_pieces"/> and returns the position after the inserted text.
+	/// </summary>
+	std::pair<size_t, size_t> insert(size_t line, size_t column, const std::vector<piece> &pieces);
+	/// <summary>
+	/// Removes the text between two positions.
+	/// </summary>
+	void erase(size_t beg_line, size_t beg_column, size_t end_line, size_t end_column);
+
+	/// <summary>
+	/// Returns the color of the character at the specified position.
+	/// </summary>
+	uint8_t color_at(size_t line, size_t column) const;
+	/// <summary>
+	/// Returns the color runs of the specified line. The run lengths add up to the line length.
+	/// </summary>
+	const std::vector<color_run> &line_colors(size_t line) const { return _lines[find_line(line)].colors; }
+	/// <summary>
+	/// Sets the color of a range of characters in a single line.
+	/// </summary>
+	void set_color(size_t line, size_t column, size_t length, uint8_t color);
+
+	/// <summary>
+	/// Returns a user-defined state value associated with the beginning of the specified line (e.g. the lexer state for syntax coloring).
+	/// Lines created by an insertion start out with a state of zero.
+	/// </summary>
+	uint8_t line_state(size_t line) const { return _lines[find_line(line)].state; }
+	void set_line_state(size_t line, uint8_t state) { _lines[find_line(line)].state = state; }
+
+private:
+	static constexpr uint32_t nil = 0xFFFFFFFF;
+
+	struct node
+	{
+		piece data;
+		size_t breaks;
+		size_t total_length;
+		size_t total_breaks;
+		uint32_t priority;
+		uint32_t left, right;
+	};
+	struct line_node
+	{
+		size_t length;
+		std::vector<color_run> colors;
+		uint8_t state;
+		size_t total_lines;
+		uint32_t priority;
+		uint32_t left, right;
+	};
+
+	const char *source_data(uint32_t source) const { return source == 0 ? _original.data() : _added.data(); }
+	size_t count_breaks(uint32_t source, size_t offset, size_t length) const;
+	size_t find_break(uint32_t source, size_t offset, size_t index) const;
+
+	uint32_t next_priority();
+
+	uint32_t create_node(const piece &data);
+	void destroy_tree(uint32_t root);
+	void update_node(uint32_t root);
+	size_t total_length(uint32_t root) const { return root != nil ? _nodes[root].total_length : 0; }
+	size_t total_breaks(uint32_t root) const { return root != nil ? _nodes[root].total_breaks : 0; }
+	std::pair<uint32_t, uint32_t> split(uint32_t root, size_t offset);
+	uint32_t merge(uint32_t left, uint32_t right);
+	bool extend_last(uint32_t root, const piece &data);
+	template <typename F>
+	void visit(uint32_t root, size_t base, size_t beg, size_t end, F &callback) const;
+
+	uint32_t create_line(size_t length);
+	void destroy_lines(uint32_t root);
+	void update_line(uint32_t root);
+	size_t total_lines(uint32_t root) const { return root != nil ? _lines[root].total_lines : 0; }
+	uint32_t find_line(size_t line) const;
+	std::pair<uint32_t, uint32_t> split_lines(uint32_t root, size_t count);
+	uint32_t merge_lines(uint32_t left, uint32_t right);
+
+	std::pair<size_t, size_t> insert_piece(size_t line, size_t column, const piece &data);
+	std::pair<size_t, size_t> insert_lines(size_t line, size_t column, const char *text, size_t length);
+
+	std::string _original;
+	std::string _added;
+	std::vector<size_t> _original_breaks;
+	std::vector<size_t> _added_breaks;
+
+	uint32_t _root = nil;
+	uint32_t _seed = 0x9E3779B9;
+	std::vector<node> _nodes;
+	std::vector<uint32_t> _free_nodes;
+
+	uint32_t _line_root = nil;
+	std::vector<line_node> _lines;
+	std::vector<uint32_t> _free_lines;
+};
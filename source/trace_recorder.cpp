@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#include "trace_recorder.hpp"
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+	constexpr size_t MAX_EVENTS_PER_THREAD = 16384;
+	constexpr size_t MAX_DETAIL_LENGTH = 63;
+
+	struct event
+	{
+		const char *name;
+		uint64_t begin;
+		uint64_t end;
+		char detail[MAX_DETAIL_LENGTH + 1];
+	};
+
+	/// <summary>
+	/// Events of a single thread. Only the owning thread appends to it, other threads only read the events up to the published count.
+	/// Buffers are never freed, but handed to a new thread once their previous owner exited, so that threads created for every reload do not keep adding buffers.
+	/// </summary>
+	struct thread_buffer
+	{
+		std::unique_ptr<event[]> events = std::make_unique<event[]>(MAX_EVENTS_PER_THREAD);
+		std::atomic<size_t> count = 0;
+		std::atomic<uint32_t> generation = 0;
+		std::atomic<bool> in_use = true;
+		unsigned int thread_index = 0;
+	};
+
+	struct thread_registration
+	{
+		~thread_registration()
+		{
+			if (buffer != nullptr)
+				buffer->in_use.store(false, std::memory_order_release);
+		}
+
+		thread_buffer *buffer = nullptr;
+	};
+
+	std::mutex s_buffers_mutex;
+	std::vector<std::unique_ptr<thread_buffer>> s_buffers;
+	std::atomic<uint32_t> s_generation = 0;
+	std::atomic<uint64_t> s_start_time = 0;
+	std::atomic<size_t> s_num_dropped_events = 0;
+	thread_local thread_registration t_registration;
+
+	thread_buffer *acquire_thread_buffer()
+	{
+		const std::lock_guard<std::mutex> lock(s_buffers_mutex);
+
+		for (const std::unique_ptr<thread_buffer> &buffer : s_buffers)
+		{
+			bool in_use = false;
+			if (buffer->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+				return buffer.get();
+		}
+
+		thread_buffer *const buffer = s_buffers.emplace_back(std::make_unique<thread_buffer>()).get();
+		buffer->thread_index = static_cast<unsigned int>(s_buffers.size());
+		return buffer;
+	}
+
+	void write_json_string(std::ostream &stream, const char *string)
+	{
+		stream << '\"';
+		for (; *string != '\0'; ++string)
+		{
+			switch (const char c = *string)
+			{
+			case '\"':
+			case '\\':
+				stream << '\\' << c;
+				break;
+			case '\n':
+				stream << "\\n";
+				break;
+			case '\t':
+				stream << "\\t";
+				break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+					stream << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xF] << "0123456789abcdef"[c & 0xF];
+				else
+					stream << c;
+				break;
+			}
+		}
+		stream << '\"';
+	}
+}
+
+std::atomic<bool> reshade::trace::g_is_recording = false;
+
+void reshade::trace::start()
+{
+	// Threads notice the new generation on their next event and discard what they recorded before then
+	s_generation.fetch_add(1, std::memory_order_relaxed);
+	s_start_time.store(timestamp(), std::memory_order_relaxed);
+	s_num_dropped_events.store(0, std::memory_order_relaxed);
+	g_is_recording.store(true, std::memory_order_release);
+}
+void reshade::trace::stop()
+{
+	g_is_recording.store(false, std::memory_order_release);
+}
+
+bool reshade::trace::write(const std::filesystem::path &path)
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+
+	file << std::fixed << std::setprecision(3);
+
+	const uint32_t generation = s_generation.load(std::memory_order_relaxed);
+	const uint64_t start_time = s_start_time.load(std::memory_order_relaxed);
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	{
+		const std::lock_guard<std::mutex> lock(s_buffers_mutex);
+
+		for (const std::unique_ptr<thread_buffer> &buffer : s_buffers)
+		{
+			// Buffers that have not been written to since recording started still contain events from a previous recording
+			if (buffer->generation.load(std::memory_order_acquire) != generation)
+				continue;
+
+			const size_t count = buffer->count.load(std::memory_order_acquire);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const event &e = buffer->events[i];
+
+				if (!first)
+					file << ',';
+				first = false;
+
+				// Chrome trace events use microseconds
+				file << "\n{\"ph\":\"X\",\"cat\":\"reshade\",\"name\":";
+				write_json_string(file, e.name);
+				file << ",\"pid\":1,\"tid\":" << buffer->thread_index
+					<< ",\"ts\":" << (e.begin - start_time) * 1e-3
+					<< ",\"dur\":" << (e.end - e.begin) * 1e-3;
+				if (e.detail[0] != '\0')
+				{
+					file << ",\"args\":{\"detail\":";
+					write_json_string(file, e.detail);
+					file << '}';
+				}
+				file << '}';
+			}
+		}
+	}
+
+	file << "\n]}\n";
+
+	return file.good();
+}
+
+size_t reshade::trace::num_dropped_events()
+{
+	return s_num_dropped_events.load(std::memory_order_relaxed);
+}
+
+uint64_t reshade::trace::timestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t reshade::trace::begin_event()
+{
+	if (t_registration.buffer == nullptr)
+		t_registration.buffer = acquire_thread_buffer();
+
+	return timestamp();
+}
+
+void reshade::trace::add_event(const char *name, const char *detail, uint64_t begin, uint64_t end)
+{
+	thread_buffer *buffer = t_registration.buffer;
+	if (buffer == nullptr)
+		buffer = t_registration.buffer = acquire_thread_buffer();
+
+	// Events of a scope that began before recording was restarted would start before the new time origin, so skip those
+	if (begin < s_start_time.load(std::memory_order_relaxed))
+		return;
+
+	size_t count = buffer->count.load(std::memory_order_relaxed);
+
+	if (const uint32_t generation = s_generation.load(std::memory_order_relaxed);
+		buffer->generation.load(std::memory_order_relaxed) != generation)
+	{
+		count = 0;
+		buffer->count.store(0, std::memory_order_relaxed);
+		buffer->generation.store(generation, std::memory_order_release);
+	}
+
+	if (count >= MAX_EVENTS_PER_THREAD)
+	{
+		s_num_dropped_events.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	event &e = buffer->events[count];
+	e.name = name;
+	e.begin = begin;
+	e.end = end;
+
+	size_t detail_length = 0;
+	if (detail != nullptr)
+		for (; detail_length < MAX_DETAIL_LENGTH && detail[detail_length] != '\0'; ++detail_length)
+			e.detail[detail_length] = detail[detail_length];
+	// Do not cut a UTF-8 sequence in half when truncating, which would make the JSON invalid
+	if (detail != nullptr && detail[detail_length] != '\0')
+		while (detail_length > 0 && (static_cast<unsigned char>(detail[detail_length]) & 0xC0) == 0x80)
+			--detail_length;
+	e.detail[detail_length] = '\0';
+
+	// Publish the event to the writer only once it is complete
+	buffer->count.store(count + 1, std::memory_order_release);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+namespace reshade::trace
+{
+	/// <summary>
+	/// Set while events are recorded. Only read this through <see cref="is_recording"/>.
+	/// </summary>
+	extern std::atomic<bool> g_is_recording;
+
+	/// <summary>
+	/// Checks whether events are currently recorded. This is a single relaxed load, so that scopes cost next to nothing while no trace is recorded.
+	/// </summary>
+	inline bool is_recording() { return g_is_recording.load(std::memory_order_relaxed); }
+
+	/// <summary>
+	/// Discards all previously recorded events and starts recording new ones.
+	/// </summary>
+	void start();
+	/// <summary>
+	/// Stops recording events. Scopes that are still open are not recorded.
+	/// </summary>
+	void stop();
+
+	/// <summary>
+	/// Writes all events recorded since the last call to <see cref="start"/> to a file in the Chrome trace event format (which can be viewed in Perfetto or "chrome://tracing").
+	/// This may be called while other threads are still recording events, in which case only those finished up to this point are written.
+	/// </summary>
+	/// <param name="path">The path of the JSON file to write.</param>
+	/// <returns><c>true</c> if the file was written successfully, <c>false</c> otherwise.</returns>
+	bool write(const std::filesystem::path &path);
+
+	/// <summary>
+	/// Gets the number of events that were dropped since the last call to <see cref="start"/>, because the buffer of their thread was full.
+	/// </summary>
+	size_t num_dropped_events();
+
+	/// <summary>
+	/// Gets the current time in the time base used for events.
+	/// </summary>
+	uint64_t timestamp();
+
+	/// <summary>
+	/// Gets the current time as the begin of an event of the calling thread.
+	/// This binds a buffer to the thread first, so that the buffer of a thread that exits while the event is in progress cannot be handed to this one, which would make its events overlap those of the previous owner.
+	/// </summary>
+	uint64_t begin_event();
+
+	/// <summary>
+	/// Adds an event covering the specified time span to the buffer of the calling thread. This never locks, except for the first event of a thread.
+	/// </summary>
+	/// <param name="name">The name of the event. This has to be a string literal (or otherwise outlive the recording), since only the pointer is stored.</param>
+	/// <param name="detail">Optional text to attach to the event (e.g. a file name). It is copied and truncated to a short length.</param>
+	/// <param name="begin">The time the event started at, as returned by <see cref="begin_event"/>.</param>
+	/// <param name="end">The time the event ended at.</param>
+	void add_event(const char *name, const char *detail, uint64_t begin, uint64_t end);
+
+	/// <summary>
+	/// Records an event for the time between its construction and destruction, if recording was active at construction and still is at destruction.
+	/// </summary>
+	class scope
+	{
+	public:
+		explicit scope(const char *name, const char *detail = nullptr) :
+			_name(name), _detail(detail), _begin(is_recording() ? begin_event() : 0) {}
+		~scope()
+		{
+			if (_begin != 0 && is_recording())
+				add_event(_name, _detail, _begin, timestamp());
+		}
+
+		scope(const scope &) = delete;
+		scope &operator=(const scope &) = delete;
+
+	private:
+		const char *_name;
+		const char *_detail;
+		uint64_t _begin;
+	};
+}
+
+#define RESHADE_TRACE_SCOPE_NAME_(line) trace_scope_##line
+#define RESHADE_TRACE_SCOPE_NAME(line) RESHADE_TRACE_SCOPE_NAME_(line)
+/// <summary>
+/// Records an event with the specified name (and optionally detail text) for the rest of the current scope while a trace is recorded.
+/// </summary>
+#define RESHADE_TRACE_SCOPE(...) const reshade::trace::scope RESHADE_TRACE_SCOPE_NAME(__LINE__)(__VA_ARGS__)
@@ -3,118 +3,151 @@
  * License: https://github.com/crosire/reshade#license
  */
 
-#include "dll_log.hpp"
 #include "buffer_detection.hpp"
-#include <cmath>
+#include "lockfree_epoch.hpp"
 #include <cassert>
+#include <utility>
+#include <algorithm>
 
 void reshade::vulkan::buffer_detection::reset()
 {
-	_stats.vertices = 0;
-	_stats.drawcalls = 0;
-#if RESHADE_DEPTH
-	_counters_per_used_depth_image.clear();
-#endif
+	_tracker.reset();
 }
 
+void reshade::vulkan::buffer_detection::take_snapshot(snapshot &out) const
+{
+	_tracker.take_snapshot(out);
+}
+void reshade::vulkan::buffer_detection::merge(const snapshot &source)
+{
+	_tracker.merge(source);
+}
 void reshade::vulkan::buffer_detection::merge(const buffer_detection &source)
 {
-	_stats.vertices += source._stats.vertices;
-	_stats.drawcalls += source._stats.drawcalls;
-
-#if RESHADE_DEPTH
-	for (const auto &[depthstencil, snapshot] : source._counters_per_used_depth_image)
-	{
-		auto &target_snapshot = _counters_per_used_depth_image[depthstencil];
-		target_snapshot.stats.vertices += snapshot.stats.vertices;
-		target_snapshot.stats.drawcalls += snapshot.stats.drawcalls;
-
-		target_snapshot.image = snapshot.image;
-		target_snapshot.image_info = snapshot.image_info;
-	}
-#endif
+	_tracker.merge(source._tracker);
 }
 
 void reshade::vulkan::buffer_detection::on_draw(uint32_t vertices)
 {
-	_stats.vertices += vertices;
-	_stats.drawcalls += 1;
-
-#if RESHADE_DEPTH
-	if (_current_depthstencil == VK_NULL_HANDLE)
-		// This is a draw call with no depth-stencil bound
-		return;
-
-	auto &counters = _counters_per_used_depth_image[_current_depthstencil];
-	counters.stats.vertices += vertices;
-	counters.stats.drawcalls += 1;
-#endif
+	_tracker.on_draw(vertices);
 }
 
 #if RESHADE_DEPTH
 void reshade::vulkan::buffer_detection::on_set_depthstencil(VkImage depthstencil, VkImageLayout layout, const VkImageCreateInfo &create_info)
 {
-	_current_depthstencil = depthstencil;
-
 	if (depthstencil == VK_NULL_HANDLE)
+	{
+		_tracker.bind(_tracker.npos);
 		return;
+	}
 
 	assert(layout != VK_IMAGE_LAYOUT_UNDEFINED);
 	assert((create_info.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0);
 
-	auto &counters = _counters_per_used_depth_image[depthstencil];
+	VkImageCreateInfo image_info = create_info;
+	// Keep track of the layout this image likely ends up in
+	image_info.initialLayout = layout;
+
+	_tracker.bind(_tracker.add((uint64_t)depthstencil, { create_info.extent.width, create_info.extent.height, static_cast<uint32_t>(create_info.samples) }, image_info));
+}
+#endif
+
+reshade::vulkan::buffer_detection_context::~buffer_detection_context()
+{
+	const auto free_list = [](submission *next) {
+		while (next != nullptr)
+			delete std::exchange(next, next->next.load(std::memory_order_relaxed));
+	};
+
+	// Free all nodes, including statistics that were submitted but never merged
+	free_list(_submitted.exchange(nullptr, std::memory_order_acquire));
+	free_list(_free_submissions.exchange(nullptr, std::memory_order_acquire));
+	for (const retired_batch &batch : _retired_submissions)
+		free_list(batch.first);
+}
+
+void reshade::vulkan::buffer_detection_context::push(std::atomic<submission *> &list, submission *first, submission *last)
+{
+	submission *head = list.load(std::memory_order_relaxed);
+	do
+		last->next.store(head, std::memory_order_relaxed);
+	while (!list.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void reshade::vulkan::buffer_detection_context::submit(const buffer_detection &source)
+{
+	if (source.total_drawcalls() == 0)
+		return; // Nothing to merge
+
+	// Take a node from the pool
+	// Merged nodes only return to it once every thread that was in here at the time left its epoch guard (see 'flush_submitted'), so the head read here cannot be taken and put back before the exchange (no ABA problem)
+	submission *node = _free_submissions.load(std::memory_order_acquire);
+	while (node != nullptr && !_free_submissions.compare_exchange_weak(node, node->next.load(std::memory_order_relaxed), std::memory_order_acquire, std::memory_order_acquire))
+		continue;
 
-	if (VK_NULL_HANDLE == counters.image)
+	if (node == nullptr)
+		node = new submission();
+
+	source.take_snapshot(node->stats);
+
+	// Push onto the list of pending submissions
+	push(_submitted, node, node);
+}
+
+void reshade::vulkan::buffer_detection_context::flush_submitted()
+{
+	// Return nodes merged by earlier calls to the pool once no thread can still be looking at them in 'submit'
+	if (!_retired_submissions.empty())
 	{
-		// This is a new entry in the map, so update data
-		counters.image = depthstencil;
-		counters.image_info = create_info;
-		// Keep track of the layout this image likely ends up in
-		counters.image_info.initialLayout = layout;
+		const uint64_t oldest_epoch = lockfree_epoch::oldest_epoch();
+
+		_retired_submissions.erase(std::remove_if(_retired_submissions.begin(), _retired_submissions.end(),
+			[this, oldest_epoch](const retired_batch &batch) {
+				if (batch.epoch >= oldest_epoch)
+					return false;
+				push(_free_submissions, batch.first, batch.last);
+				return true;
+			}), _retired_submissions.end());
 	}
+
+	// Take the entire list at once, so that submissions happening at the same time simply start a new one
+	submission *const first = _submitted.exchange(nullptr, std::memory_order_acquire);
+	if (first == nullptr)
+		return;
+
+	submission *last = first;
+	for (submission *next = first; next != nullptr; next = next->next.load(std::memory_order_relaxed))
+	{
+		merge(next->stats);
+
+		last = next;
+	}
+
+	_retired_submissions.push_back({ lockfree_epoch::retire(), first, last });
 }
 
+#if RESHADE_DEPTH
 reshade::vulkan::buffer_detection::depthstencil_info reshade::vulkan::buffer_detection_context::find_best_depth_texture(VkExtent2D dimensions, VkImage override) const
 {
+	uint32_t best_slot;
+
 	if (override != VK_NULL_HANDLE)
 	{
-		const auto source_it = _counters_per_used_depth_image.find(override);
-		if (source_it != _counters_per_used_depth_image.end())
-			return source_it->second;
-		else
-			return {};
+		best_slot = _tracker.find((uint64_t)override);
 	}
-
-	depthstencil_info best_snapshot;
-
-	for (const auto &[image, snapshot] : _counters_per_used_depth_image)
+	else
 	{
-		if (snapshot.stats.drawcalls == 0 || snapshot.stats.vertices == 0)
-			continue; // Skip unused
-		if (snapshot.image_info.samples != VK_SAMPLE_COUNT_1_BIT)
-			continue; // Ignore MSAA textures, since they would need to be resolved first
-
-		if (dimensions.width != 0 && dimensions.height != 0)
-		{
-			const float w = static_cast<float>(dimensions.width);
-			const float w_ratio = w / snapshot.image_info.extent.width;
-			const float h = static_cast<float>(dimensions.height);
-			const float h_ratio = h / snapshot.image_info.extent.height;
-			const float aspect_ratio = (w / h) - (static_cast<float>(snapshot.image_info.extent.width) / snapshot.image_info.extent.height);
-
-			if (std::fabs(aspect_ratio) > 0.1f || w_ratio > 1.85f || h_ratio > 1.85f || w_ratio < 0.5f || h_ratio < 0.5f)
-				continue; // Not a good fit
-		}
-
-		const auto curr_weight = snapshot.stats.vertices * (1.2f - static_cast<float>(snapshot.stats.drawcalls) / _stats.drawcalls);
-		const auto best_weight = best_snapshot.stats.vertices * (1.2f - static_cast<float>(best_snapshot.stats.drawcalls) / _stats.vertices);
-		if (curr_weight >= best_weight)
-		{
-			assert(snapshot.image != VK_NULL_HANDLE);
-			best_snapshot = snapshot;
-		}
+		depth_selection::selection_options options;
+		options.width = dimensions.width;
+		options.height = dimensions.height;
+		options.heuristic = depth_selection::selection_heuristic::weighted_vertices;
+
+		best_slot = _tracker.find_best(options);
 	}
 
-	return best_snapshot;
+	if (best_slot == _tracker.npos)
+		return {};
+
+	return { (VkImage)_tracker.counters(best_slot).handle, _tracker.data(best_slot) };
 }
 #endif
@@ -5,30 +5,39 @@
 
 #pragma once
 
-#include <map>
+#include <atomic>
+#include <vector>
 #include <vulkan.h>
+#include "depth_selection.hpp"
 
 namespace reshade::vulkan
 {
 	class buffer_detection
 	{
 	public:
-		struct draw_stats
-		{
-			uint32_t vertices = 0;
-			uint32_t drawcalls = 0;
-		};
 		struct depthstencil_info
 		{
-			draw_stats stats;
 			VkImage image = VK_NULL_HANDLE;
 			VkImageCreateInfo image_info = {};
 		};
 
+		/// <summary>
+		/// The statistics recorded into a command buffer, which are merged into the device when the command buffer is presented.
+		/// </summary>
+		using snapshot = depth_selection::tracker<VkImageCreateInfo>::snapshot;
+
 		void reset();
 
+		/// <summary>
+		/// Copy all statistics that changed since the last reset into a snapshot (replacing its contents, but reusing its storage).
+		/// </summary>
+		void take_snapshot(snapshot &out) const;
+		void merge(const snapshot &source);
 		void merge(const buffer_detection &source);
 
+		uint32_t total_vertices() const { return _tracker.total_vertices(); }
+		uint32_t total_drawcalls() const { return _tracker.total_drawcalls(); }
+
 		void on_draw(uint32_t vertices);
 
 #if RESHADE_DEPTH
@@ -36,24 +45,53 @@ namespace reshade::vulkan
 #endif
 
 	protected:
-#if RESHADE_DEPTH
-		VkImage _current_depthstencil = VK_NULL_HANDLE;
-		// Use "std::map" instead of "std::unordered_map" so that the iteration order is guaranteed
-		std::map<VkImage, depthstencil_info> _counters_per_used_depth_image;
-#endif
-		draw_stats _stats;
+		// Image information (with the layout the image likely ends up in) is stored alongside the counters of each depth-stencil image
+		depth_selection::tracker<VkImageCreateInfo> _tracker;
 	};
 
 	class buffer_detection_context : public buffer_detection
 	{
 	public:
-		uint32_t total_vertices() const { return _stats.vertices; }
-		uint32_t total_drawcalls() const { return _stats.drawcalls; }
+		~buffer_detection_context();
+
+		/// <summary>
+		/// Queue the statistics of a submitted command buffer to be merged into this context.
+		/// This is lock-free and can be called from any thread (e.g. from multiple queues submitting at the same time), but only while holding a <see cref="lockfree_epoch::guard"/>.
+		/// Only the resources that changed are copied, into a node that is reused from earlier frames, so this does not allocate once the pool has grown to the number of command buffers submitted per frame.
+		/// </summary>
+		/// <param name="source">The statistics of the submitted command buffer.</param>
+		void submit(const buffer_detection &source);
+		/// <summary>
+		/// Merge all statistics queued via <see cref="submit"/> into this context.
+		/// This must only be called from one thread at a time (the one presenting).
+		/// </summary>
+		void flush_submitted();
 
 #if RESHADE_DEPTH
-		const auto &depth_buffer_counters() const { return _counters_per_used_depth_image; }
+		const auto &depth_buffer_tracker() const { return _tracker; }
 
 		depthstencil_info find_best_depth_texture(VkExtent2D dimensions = {}, VkImage override = VK_NULL_HANDLE) const;
 #endif
+
+	private:
+		struct submission
+		{
+			std::atomic<submission *> next = nullptr;
+			snapshot stats;
+		};
+		struct retired_batch
+		{
+			uint64_t epoch;
+			submission *first;
+			submission *last;
+		};
+
+		static void push(std::atomic<submission *> &list, submission *first, submission *last);
+
+		std::atomic<submission *> _submitted = nullptr;
+		// Nodes that were merged already and can be reused by 'submit'
+		std::atomic<submission *> _free_submissions = nullptr;
+		// Nodes merged by 'flush_submitted' that another thread in 'submit' may still be looking at, so they cannot be reused yet
+		std::vector<retired_batch> _retired_submissions;
 	};
 }
@@ -5,53 +5,134 @@
 
 #pragma once
 
+#include "lockfree_epoch.hpp"
+#include <mutex>
+#include <thread>
 #include <atomic>
 #include <utility>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <algorithm>
 
 /// <summary>
-/// A simple lock-free linear search table.
-/// The key values "one" and "zero" hold a special meaning (see <see cref="no_value"/> and <see cref="update_value"/>), so do not use them.
+/// A lock-free hash table with open addressing (linear probing), which maps keys to separately allocated values.
+/// The table keeps its load factor below one half by migrating all entries to a new level once too many slots were used, sized for the number of entries at that time (so it either grows, or is rehashed at the same size if most used slots were only erased).
+/// Only the index entry (key and value pointer) is migrated, values are never moved, so references to them stay valid. Look ups therefore only have to search a single level, or two while a migration is in progress.
+/// Look ups and erases are lock-free, adding a key only takes a lock when it has to migrate the table.
+/// Erased values and levels that were migrated are destroyed later, once no thread holds a <see cref="lockfree_epoch::guard"/> anymore that may still be using them.
 /// </summary>
-template <typename TKey, typename TValue, size_t MAX_ENTRIES>
+/// <typeparam name="INITIAL_CAPACITY">Number of entries in the first level (rounded up to the next power of two). The table is never rehashed to a smaller capacity than this.</typeparam>
+template <typename TKey, typename TValue, size_t INITIAL_CAPACITY>
 class lockfree_table
 {
+	static constexpr size_t RECLAIM_INTERVAL = 32; // Number of erases after which values that are no longer in use are destroyed
+
+	enum slot_state : uint32_t
+	{
+		empty = 0, // Entry was never used (lookups can stop probing here)
+		updating, // Entry is currently being written or erased by another thread
+		occupied,
+		erased, // Entry was used before, but is free again
+		migrating, // Entry is currently being copied to the next level, its value can still be used
+		moved, // Entry was copied to the next level (or was free when its level was migrated), so it must not be used anymore
+	};
+
+	struct value_node
+	{
+		template <typename... Args>
+		explicit value_node(TKey key, Args &&... args) : value(std::forward<Args>(args)...), key(key) {}
+
+		TValue value;
+		const TKey key;
+		uint64_t retire_epoch = 0;
+		value_node *next_retired = nullptr;
+	};
+
+	struct slot
+	{
+		std::atomic<uint32_t> state;
+		std::atomic<TKey> key;
+		std::atomic<value_node *> value;
+	};
+
+	struct table_level
+	{
+		explicit table_level(size_t capacity_log2) :
+			capacity_log2(capacity_log2), slots(new slot[size_t(1) << capacity_log2])
+		{
+			for (size_t i = 0; i < capacity(); ++i)
+				slots[i].state.store(empty, std::memory_order_relaxed);
+		}
+		~table_level()
+		{
+			delete[] slots;
+		}
+
+		size_t capacity() const { return size_t(1) << capacity_log2; }
+
+		const size_t capacity_log2;
+		slot *const slots;
+		std::atomic<size_t> num_used = 0; // Number of entries that are no longer empty
+		std::atomic<table_level *> next = nullptr; // Level the entries of this one are migrated to
+		bool is_migrated = false; // Protected by '_migrate_mutex'
+		uint64_t retire_epoch = 0;
+		table_level *next_retired = nullptr;
+	};
+
 public:
+	lockfree_table()
+	{
+		table_level *const level = new table_level(capacity_log2_for(INITIAL_CAPACITY));
+		_first.store(level, std::memory_order_relaxed);
+		_newest.store(level, std::memory_order_relaxed);
+	}
 	~lockfree_table()
 	{
-		clear(); // Free all pointers
+		// No other thread can access the table anymore at this point, so destroy everything right away
+		// Each value is referenced by exactly one occupied entry in the levels that are still in use (entries that were moved leave it to their copy)
+		for (table_level *level = _first.load(std::memory_order_relaxed), *next; level != nullptr; level = next)
+		{
+			next = level->next.load(std::memory_order_relaxed);
+
+			for (size_t i = 0; i < level->capacity(); ++i)
+				if (level->slots[i].state.load(std::memory_order_relaxed) == occupied)
+					delete level->slots[i].value.load(std::memory_order_relaxed);
+
+			delete level;
+		}
+
+		for (value_node *node = _retired_values.load(std::memory_order_relaxed), *next; node != nullptr; node = next)
+		{
+			next = node->next_retired;
+			delete node;
+		}
+		for (table_level *level = _retired_levels.load(std::memory_order_relaxed), *next; level != nullptr; level = next)
+		{
+			next = level->next_retired;
+			delete level;
+		}
 	}
 
-	/// <summary>
-	/// Special key indicating that the entry is empty.
-	/// </summary>
-	static constexpr TKey no_value = (TKey)0;
-	/// <summary>
-	/// Special key indicating that the entry is currently being updated.
-	/// </summary>
-	static constexpr TKey update_value = (TKey)1;
+	lockfree_table(const lockfree_table &) = delete;
+	lockfree_table &operator=(const lockfree_table &) = delete;
 
 	/// <summary>
 	/// Gets the value associated with the specified <paramref name="key"/>.
 	/// This is a weak look up and may fail if another thread is erasing a value at the same time.
 	/// </summary>
 	/// <param name="key">The key to look up.</param>
-	/// <returns>A reference to the associated value.</returns>
+	/// <returns>A reference to the associated value, which stays valid while the calling thread holds a <see cref="lockfree_epoch::guard"/>, or until the key is erased otherwise.</returns>
 	TValue &at(TKey key) const
 	{
-		assert(key != no_value && key != update_value);
-
-		size_t start_index = 0;
-		// If the table is really big, reduce search time by using hash as start index
-		if constexpr (MAX_ENTRIES > 512)
-			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
+		// Levels may be freed once they were migrated, so keep them alive while searching
+		const lockfree_epoch::guard guard;
 
-		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
+		if (const slot *const entry = find(key); entry != nullptr)
 		{
-			if (_data[i].first.load(std::memory_order_acquire) == key)
-			{
-				// The pointer is guaranteed to be value at this point, or else key would have been in update mode
-				return *_data[i].second;
-			}
+			// The entry may have been erased and reused for another key after it was found, so check the value actually belongs to this key
+			if (value_node *const node = entry->value.load(std::memory_order_acquire); node != nullptr && node->key == key)
+				return node->value;
 		}
 
 		assert(false);
@@ -65,35 +146,7 @@ public:
 	/// <returns>A reference to the newly added value.</returns>
 	TValue &emplace(TKey key)
 	{
-		assert(key != no_value && key != update_value);
-
-		size_t start_index = 0;
-		if constexpr (MAX_ENTRIES > 512)
-			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
-
-		// Create a pointer to the new value
-		TValue *new_value = new TValue();
-
-		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
-		{
-			// Load and check before doing an expensive CAS
-			if (TKey test_key = _data[i].first.load(std::memory_order_relaxed);
-				test_key == no_value && // Check if the entry is empty and then do the CAS to occupy it
-				_data[i].first.compare_exchange_strong(test_key, update_value, std::memory_order_relaxed))
-			{
-				_data[i].second = new_value;
-
-				// Now that the new value is stored, make this entry available
-				_data[i].first.store(key, std::memory_order_release);
-
-				return *new_value;
-			}
-		}
-
-		delete new_value;
-
-		assert(false);
-		return _default; // Fall back if table is full
+		return add(new value_node(key));
 	}
 	/// <summary>
 	/// Adds the specified key-value pair to the table.
@@ -103,33 +156,7 @@ public:
 	/// <returns>A reference to the newly added value.</returns>
 	TValue &emplace(TKey key, const TValue &value)
 	{
-		assert(key != no_value && key != update_value);
-
-		size_t start_index = 0;
-		if constexpr (MAX_ENTRIES > 512)
-			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
-
-		// Create a pointer to the new value using copy construction
-		TValue *new_value = new TValue(value);
-
-		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
-		{
-			if (TKey test_key = _data[i].first.load(std::memory_order_relaxed);
-				test_key == no_value &&
-				_data[i].first.compare_exchange_strong(test_key, update_value, std::memory_order_relaxed))
-			{
-				_data[i].second = new_value;
-
-				_data[i].first.store(key, std::memory_order_release);
-
-				return *new_value;
-			}
-		}
-
-		delete new_value;
-
-		assert(false);
-		return _default; // Fall back if table is full
+		return add(new value_node(key, value));
 	}
 
 	/// <summary>
@@ -139,31 +166,15 @@ public:
 	/// <returns><c>true</c> if the key existed and was removed, <c>false</c> otherwise.</returns>
 	bool erase(TKey key)
 	{
-		if (key == no_value || key == update_value) // Cannot remove special keys
-			return false;
+		const lockfree_epoch::guard guard;
 
-		size_t start_index = 0;
-		if constexpr (MAX_ENTRIES > 512)
-			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
-
-		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
-		{
-			// Load and check before doing an expensive CAS
-			if (TKey test_key = _data[i].first.load(std::memory_order_relaxed);
-				test_key == key)
-			{
-				// Get the value before freeing the entry up for other threads to fill again
-				TValue *const old_value = _data[i].second;
+		slot *const entry = acquire_occupied_slot(key);
+		if (entry == nullptr)
+			return false;
 
-				if (_data[i].first.compare_exchange_strong(test_key, no_value, std::memory_order_relaxed))
-				{
-					delete old_value;
-					return true;
-				}
-			}
-		}
+		retire(entry);
 
-		return false;
+		return true;
 	}
 	/// <summary>
 	/// Removes and returns the value associated with the specified <paramref name="key"/> from the table.
@@ -173,55 +184,316 @@ public:
 	/// <returns><c>true</c> if the key existed and was removed, <c>false</c> otherwise.</returns>
 	bool erase(TKey key, TValue &value)
 	{
-		if (key == no_value || key == update_value)
+		const lockfree_epoch::guard guard;
+
+		slot *const entry = acquire_occupied_slot(key);
+		if (entry == nullptr)
 			return false;
 
-		size_t start_index = 0;
-		if constexpr (MAX_ENTRIES > 512)
-			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
+		// Move value to output argument (no other thread can modify this entry at this point, the moved-from value is destroyed once no other thread can be reading it anymore)
+		value = std::move(entry->value.load(std::memory_order_relaxed)->value);
+
+		retire(entry);
+
+		return true;
+	}
+
+	/// <summary>
+	/// Clears the entire table and destroys all values once they are no longer in use.
+	/// Note that another thread may add new values while this operation is in progress, so do not rely on it.
+	/// </summary>
+	void clear()
+	{
+		const lockfree_epoch::guard guard;
+
+		for (table_level *level = _first.load(std::memory_order_seq_cst); level != nullptr; level = level->next.load(std::memory_order_acquire))
+		{
+			for (size_t i = 0; i < level->capacity(); ++i)
+			{
+				slot &entry = level->slots[i];
+
+				// Skip entries that are in update mode or being migrated, since we can assume the thread updating will finish them (and migrated entries are found again in the next level)
+				if (uint32_t state = occupied;
+					entry.state.compare_exchange_strong(state, updating, std::memory_order_acquire))
+					retire(&entry);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Destroys all erased values and migrated levels that are no longer in use by any thread.
+	/// This is done automatically every few erases and after every migration.
+	/// </summary>
+	void reclaim()
+	{
+		const uint64_t oldest_epoch = lockfree_epoch::oldest_epoch();
+
+		// Take the entire lists, so that other threads reclaiming at the same time work on different entries
+		for (value_node *node = _retired_values.exchange(nullptr, std::memory_order_acquire), *next; node != nullptr; node = next)
+		{
+			next = node->next_retired;
 
-		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
+			if (node->retire_epoch < oldest_epoch)
+				delete node;
+			else
+				push_retired(_retired_values, node);
+		}
+		for (table_level *level = _retired_levels.exchange(nullptr, std::memory_order_acquire), *next; level != nullptr; level = next)
 		{
-			if (TKey test_key = _data[i].first.load(std::memory_order_relaxed);
-				test_key == key)
+			next = level->next_retired;
+
+			if (level->retire_epoch < oldest_epoch)
+				delete level;
+			else
+				push_retired(_retired_levels, level);
+		}
+	}
+
+private:
+	static size_t capacity_log2_for(size_t capacity)
+	{
+		size_t capacity_log2 = 0;
+		while ((size_t(1) << capacity_log2) < capacity)
+			++capacity_log2;
+		return capacity_log2;
+	}
+
+	TValue &add(value_node *node)
+	{
+		const lockfree_epoch::guard guard;
+
+		slot *const entry = acquire_empty_slot(node->key);
+		if (entry == nullptr)
+		{
+			delete node;
+			return _default;
+		}
+
+		entry->value.store(node, std::memory_order_relaxed);
+
+		// Now that the new value is constructed, make this entry available
+		entry->state.store(occupied, std::memory_order_release);
+
+		_num_entries.fetch_add(1, std::memory_order_relaxed);
+
+		return node->value;
+	}
+
+	void retire(slot *entry)
+	{
+		value_node *const node = entry->value.load(std::memory_order_relaxed);
+
+		// The entry can be reused right away, since lookups that still find it check the key of its value
+		entry->state.store(erased, std::memory_order_release);
+
+		_num_entries.fetch_sub(1, std::memory_order_relaxed);
+
+		// Lookups no longer find this value, so any thread that still uses it must have entered its guard before this
+		node->retire_epoch = lockfree_epoch::retire();
+
+		push_retired(_retired_values, node);
+
+		if (_num_erases_since_reclaim.fetch_add(1, std::memory_order_relaxed) + 1 >= RECLAIM_INTERVAL)
+		{
+			_num_erases_since_reclaim.store(0, std::memory_order_relaxed);
+			reclaim();
+		}
+	}
+	template <typename T>
+	static void push_retired(std::atomic<T *> &list, T *item)
+	{
+		// Items are only ever pushed individually and taken all at once, so this is not affected by the ABA problem
+		item->next_retired = list.load(std::memory_order_relaxed);
+		while (!list.compare_exchange_weak(item->next_retired, item, std::memory_order_release, std::memory_order_relaxed))
+			continue;
+	}
+
+	static size_t start_index(TKey key, size_t capacity_log2)
+	{
+		// Mix the hash (Fibonacci hashing), since 'std::hash' may be the identity function for pointers, which would cluster aligned addresses
+		const uint64_t hash = static_cast<uint64_t>(std::hash<TKey>()(key)) * 11400714819323198485ull;
+		return capacity_log2 != 0 ? static_cast<size_t>(hash >> (64 - capacity_log2)) : 0;
+	}
+
+	slot *find(TKey key) const
+	{
+		// Search the oldest level first: An entry is only marked as moved after it was copied to the next level, so searching in this order cannot miss an entry that is being migrated
+		for (table_level *level = _first.load(std::memory_order_seq_cst); level != nullptr; level = level->next.load(std::memory_order_acquire))
+		{
+			const size_t mask = level->capacity() - 1;
+			const size_t start = start_index(key, level->capacity_log2);
+
+			for (size_t i = 0; i <= mask; ++i)
 			{
-				TValue *const old_value = _data[i].second;
+				slot &entry = level->slots[(start + i) & mask];
 
-				if (_data[i].first.compare_exchange_strong(test_key, no_value, std::memory_order_relaxed))
+				const uint32_t state = entry.state.load(std::memory_order_acquire);
+				if (state == empty)
+					break; // Keys are always added to the first free entry, so the key cannot be in this level past an empty entry
+				if ((state == occupied || state == migrating) && entry.key.load(std::memory_order_relaxed) == key)
+					return &entry;
+			}
+		}
+
+		return nullptr;
+	}
+
+	slot *acquire_empty_slot(TKey key)
+	{
+		while (true)
+		{
+			table_level *const level = _newest.load(std::memory_order_acquire);
+
+			// Keep the load factor below one half, so that probe sequences stay short
+			if (level->num_used.load(std::memory_order_relaxed) * 2 < level->capacity())
+			{
+				if (slot *const entry = acquire_empty_slot(level, key); entry != nullptr)
 				{
-					// Move value to output argument and delete its pointer (which is no longer in use now)
-					value = std::move(*old_value);
+					// Another thread may have started migrating this level in the meantime and may already have passed this entry, so give it up and add the key to the next level instead
+					// This and the migration both change the entry state and then load the other state, so at least one of them sees the change of the other
+					if (level->next.load(std::memory_order_seq_cst) == nullptr)
+						return entry;
 
-					delete old_value;
-					return true;
+					entry->state.store(moved, std::memory_order_release);
+					continue;
 				}
 			}
+
+			migrate(level);
+		}
+	}
+	slot *acquire_empty_slot(table_level *level, TKey key)
+	{
+		const size_t mask = level->capacity() - 1;
+		const size_t start = start_index(key, level->capacity_log2);
+
+		for (size_t i = 0; i <= mask; ++i)
+		{
+			slot &entry = level->slots[(start + i) & mask];
+
+			// Load and check before doing an expensive CAS
+			if (uint32_t state = entry.state.load(std::memory_order_relaxed);
+				(state == empty || state == erased) && // Check if the entry is free and then do the CAS to occupy it
+				entry.state.compare_exchange_strong(state, updating, std::memory_order_seq_cst))
+			{
+				if (state == empty)
+					level->num_used.fetch_add(1, std::memory_order_relaxed);
+
+				entry.key.store(key, std::memory_order_relaxed);
+				return &entry;
+			}
 		}
 
-		return false;
+		return nullptr;
 	}
 
-	/// <summary>
-	/// Clears the entire table and deletes all keys.
-	/// Note that another thread may add new values while this operation is in progress, so do not rely on it.
-	/// </summary>
-	void clear()
+	slot *acquire_occupied_slot(TKey key)
+	{
+		// Retry if the entry was modified by another thread between the lookup and the CAS
+		for (slot *entry; (entry = find(key)) != nullptr;)
+		{
+			if (uint32_t state = occupied;
+				!entry->state.compare_exchange_strong(state, updating, std::memory_order_acquire))
+			{
+				// Wait for the entry to be copied to the next level, where it is found on the next try
+				if (state == migrating)
+					std::this_thread::yield();
+				continue;
+			}
+
+			if (entry->key.load(std::memory_order_relaxed) == key)
+				return entry;
+
+			// Entry was reused for another key in the meantime, so put it back
+			entry->state.store(occupied, std::memory_order_release);
+		}
+
+		return nullptr;
+	}
+
+	void migrate(table_level *level)
+	{
+		{	const std::lock_guard<std::mutex> lock(_migrate_mutex);
+
+			// Another thread may have migrated this level while this one was waiting for the lock
+			if (level->next.load(std::memory_order_relaxed) == nullptr)
+				migrate_locked(level);
+		}
+
+		// Free the levels that were migrated if possible
+		reclaim();
+	}
+	void migrate_locked(table_level *level)
 	{
-		for (size_t i = 0; i < MAX_ENTRIES; ++i)
+		// Size the next level for four times the number of entries, so that it ends up between one quarter and one eighth full (this rehashes at the same size if most used entries were erased)
+		table_level *const next_level = new table_level(capacity_log2_for(std::max<size_t>(INITIAL_CAPACITY, 4 * _num_entries.load(std::memory_order_relaxed))));
+
+		// Make the next level visible before migrating, so that lookups find entries that were moved there, and new keys are added to it from now on
+		level->next.store(next_level, std::memory_order_seq_cst);
+		_newest.store(next_level, std::memory_order_release);
+
+		for (size_t i = 0; i < level->capacity(); ++i)
 		{
-			TValue *const old_value = _data[i].second;
+			slot &entry = level->slots[i];
 
-			// Clear this entry so it can be used again
-			if (TKey current_key = _data[i].first.exchange(no_value);
-				current_key != no_value && current_key != update_value) // If this in update mode, we can assume the thread updating will reset the key to its intended value
+			for (uint32_t state = entry.state.load(std::memory_order_seq_cst); state != moved;)
 			{
-				// Delete any value attached to the entry, but only if there was one to begin with
-				delete old_value;
+				switch (state)
+				{
+				case empty:
+				case erased:
+					// Make sure no thread that still sees this as the newest level adds a key to this entry
+					if (entry.state.compare_exchange_strong(state, moved, std::memory_order_seq_cst))
+						state = moved;
+					break;
+				case updating:
+					// Wait for the thread updating this entry to finish (which is quick, since it only adds or removes the entry)
+					std::this_thread::yield();
+					state = entry.state.load(std::memory_order_seq_cst);
+					break;
+				case occupied:
+					if (entry.state.compare_exchange_strong(state, migrating, std::memory_order_acquire))
+					{
+						const TKey key = entry.key.load(std::memory_order_relaxed);
+
+						// Add the entry to the newest level (which is only not the next one in the unlikely case that so many keys were added concurrently that it had to be migrated too)
+						slot *copy;
+						while ((copy = acquire_empty_slot(_newest.load(std::memory_order_relaxed), key)) == nullptr)
+							migrate_locked(_newest.load(std::memory_order_relaxed));
+
+						copy->value.store(entry.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+						copy->state.store(occupied, std::memory_order_release);
+
+						// Lookups search older levels first, so they find the copy now that this entry is marked as moved
+						entry.state.store(moved, std::memory_order_release);
+						state = moved;
+					}
+					break;
+				}
 			}
 		}
+
+		level->is_migrated = true;
+
+		// Stop searching levels that were migrated completely and free them once no thread can be searching them anymore (a level may still be in the middle of its migration if this was called during the migration of the previous one)
+		for (table_level *first = _first.load(std::memory_order_relaxed); first->is_migrated;)
+		{
+			table_level *const next = first->next.load(std::memory_order_relaxed);
+			_first.store(next, std::memory_order_seq_cst);
+
+			first->retire_epoch = lockfree_epoch::retire();
+			push_retired(_retired_levels, first);
+
+			first = next;
+		}
 	}
 
-private:
 	mutable TValue _default = {};
-	std::pair<std::atomic<TKey>, TValue *> _data[MAX_ENTRIES];
+	std::atomic<table_level *> _first; // Oldest level that may still hold entries
+	std::atomic<table_level *> _newest; // Level new keys are added to
+	std::atomic<size_t> _num_entries = 0;
+	std::atomic<size_t> _num_erases_since_reclaim = 0;
+	std::atomic<value_node *> _retired_values = nullptr;
+	std::atomic<table_level *> _retired_levels = nullptr;
+	std::mutex _migrate_mutex;
 };
@@ -8,9 +8,11 @@
 #include "runtime_vk.hpp"
 #include "runtime_config.hpp"
 #include "runtime_objects.hpp"
+#include "format_conversion.hpp"
 #include "format_utils.hpp"
 #include <imgui.h>
 #include <imgui_internal.h>
+#include <algorithm> // std::max
 
 #define check_result(call) \
 	if ((call) != VK_SUCCESS) \
@@ -51,6 +53,8 @@ namespace reshade::vulkan
 	struct vulkan_technique_data
 	{
 		uint32_t query_base_index = 0;
+		query_ring<NUM_GPU_QUERY_FRAMES> queries;
+		std::vector<uint64_t> timestamps;
 		std::vector<vulkan_pass_data> passes;
 	};
 
@@ -115,7 +119,7 @@ namespace reshade::vulkan
 }
 
 reshade::vulkan::runtime_vk::runtime_vk(VkDevice device, VkPhysicalDevice physical_device, uint32_t queue_family_index, const VkLayerInstanceDispatchTable &instance_table, const VkLayerDispatchTable &device_table) :
-	_device(device), _queue_family_index(queue_family_index), vk(device_table)
+	_device(device), _queue_family_index(queue_family_index), vk(device_table), _staging_ring(*this, 16 * 1024 * 1024)
 {
 	instance_table.GetPhysicalDeviceProperties(physical_device, &_device_props);
 	instance_table.GetPhysicalDeviceMemoryProperties(physical_device, &_memory_props);
@@ -457,6 +461,15 @@ void reshade::vulkan::runtime_vk::on_reset()
 	_swapchain_frames.clear();
 	_swapchain_images.clear();
 
+	for (readback_slot &info : _readback_slots)
+		vmaDestroyBuffer(_alloc, info.buffer, info.mem);
+	_readback_slots.clear();
+
+	vmaDestroyBuffer(_alloc, _staging_buffer, _staging_mem);
+	_staging_buffer = VK_NULL_HANDLE;
+	_staging_mem = VK_NULL_HANDLE;
+	_staging_ring.reset();
+
 	for (VkFence &fence : _cmd_fences)
 		vk.DestroyFence(_device, fence, nullptr),
 		fence = VK_NULL_HANDLE;
@@ -563,6 +576,10 @@ void reshade::vulkan::runtime_vk::on_present(VkQueue queue, uint32_t swapchain_i
 		vk.WaitForFences(_device, 1, &fence, VK_TRUE, UINT64_MAX);
 	}
 
+	// Any staging memory this command buffer read from is free again now (unless it has pending commands recorded outside of 'on_present'), so rewind the staging buffer once no other frame in flight uses it either
+	if (!_cmd_buffers[_cmd_index].second)
+		_staging_ring.release_frame(_cmd_index);
+
 #if RESHADE_DEPTH
 	update_depth_image_bindings(_has_high_network_activity ? buffer_detection::depthstencil_info {} :
 		_buffer_detection->find_best_depth_texture(_use_aspect_ratio_heuristics ? VkExtent2D { _width, _height } : VkExtent2D { 0, 0 }, _depth_image_override));
@@ -616,6 +633,11 @@ void reshade::vulkan::runtime_vk::on_present(VkQueue queue, uint32_t swapchain_i
 		cmd_info.second = false;
 	}
 
+	// Any readback copies recorded this frame were executed now, so their completion can be checked with the fence of this command frame
+	for (readback_slot &info : _readback_slots)
+		if (info.cmd_index == _cmd_index)
+			info.submitted = true;
+
 	_wait_stages.clear();
 	_wait_semaphores.clear();
 }
@@ -667,33 +689,17 @@ bool reshade::vulkan::runtime_vk::capture_screenshot(uint8_t *buffer) const
 
 	if (mapped_data != nullptr)
 	{
-		for (uint32_t y = 0; y < _height; y++, buffer += data_pitch, mapped_data += data_pitch)
+		// Buffer is tightly packed, so convert the entire image at once
+		if (_color_bit_depth == 10)
 		{
-			if (_color_bit_depth == 10)
-			{
-				for (uint32_t x = 0; x < data_pitch; x += 4)
-				{
-					const uint32_t rgba = *reinterpret_cast<const uint32_t *>(mapped_data + x);
-					// Divide by 4 to get 10-bit range (0-1023) into 8-bit range (0-255)
-					buffer[x + 0] = ((rgba & 0x3FF) / 4) & 0xFF;
-					buffer[x + 1] = (((rgba & 0xFFC00) >> 10) / 4) & 0xFF;
-					buffer[x + 2] = (((rgba & 0x3FF00000) >> 20) / 4) & 0xFF;
-					buffer[x + 3] = 0xFF;
-					if (_backbuffer_format >= VK_FORMAT_A2B10G10R10_UNORM_PACK32 && _backbuffer_format <= VK_FORMAT_A2B10G10R10_SINT_PACK32)
-						std::swap(buffer[x + 0], buffer[x + 2]);
-				}
-			}
-			else
-			{
-				std::memcpy(buffer, mapped_data, data_pitch);
-
-				for (uint32_t x = 0; x < data_pitch; x += 4)
-				{
-					buffer[x + 3] = 0xFF; // Clear alpha channel
-					if (_backbuffer_format >= VK_FORMAT_B8G8R8A8_UNORM && _backbuffer_format <= VK_FORMAT_B8G8R8A8_SRGB)
-						std::swap(buffer[x + 0], buffer[x + 2]); // Format is BGRA, but output should be RGBA, so flip channels
-				}
-			}
+			convert_rgb10a2_to_rgba8(buffer, mapped_data, size_t(_width) * _height,
+				_backbuffer_format >= VK_FORMAT_A2B10G10R10_UNORM_PACK32 && _backbuffer_format <= VK_FORMAT_A2B10G10R10_SINT_PACK32);
+		}
+		else
+		{
+			// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+			convert_rgbx8_to_rgba8(buffer, mapped_data, size_t(_width) * _height,
+				_backbuffer_format >= VK_FORMAT_B8G8R8A8_UNORM && _backbuffer_format <= VK_FORMAT_B8G8R8A8_SRGB);
 		}
 
 		vmaUnmapMemory(_alloc, intermediate_mem);
@@ -704,6 +710,91 @@ bool reshade::vulkan::runtime_vk::capture_screenshot(uint8_t *buffer) const
 	return mapped_data != nullptr;
 }
 
+bool reshade::vulkan::runtime_vk::begin_readback(unsigned int slot)
+{
+	if (slot >= _readback_slots.size())
+		_readback_slots.resize(slot + 1);
+	readback_slot &info = _readback_slots[slot];
+
+	// Buffers are kept until the next reset, at which point the frame dimensions may change
+	if (info.buffer == VK_NULL_HANDLE)
+	{
+		info.buffer = create_buffer(VkDeviceSize(_width) * _height * 4,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU,
+			0, VMA_ALLOCATION_CREATE_MAPPED_BIT, &info.mem);
+		if (info.buffer == VK_NULL_HANDLE)
+			return false;
+	}
+
+	if (!begin_command_buffer())
+		return false;
+	const VkCommandBuffer cmd_list = _cmd_buffers[_cmd_index].first;
+
+	transition_layout(vk, cmd_list, _swapchain_images[_swap_index], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	{
+		VkBufferImageCopy copy;
+		copy.bufferOffset = 0;
+		copy.bufferRowLength = _width;
+		copy.bufferImageHeight = _height;
+		copy.imageOffset = { 0, 0, 0 };
+		copy.imageExtent = { _width, _height, 1 };
+		copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+
+		vk.CmdCopyImageToBuffer(cmd_list, _swapchain_images[_swap_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, info.buffer, 1, &copy);
+	}
+	transition_layout(vk, cmd_list, _swapchain_images[_swap_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	// The copy is submitted with all other commands of this frame in 'on_present'
+	info.cmd_index = _cmd_index;
+	info.submitted = false;
+
+	return true;
+}
+bool reshade::vulkan::runtime_vk::is_readback_complete(unsigned int slot) const
+{
+	assert(slot < _readback_slots.size());
+	const readback_slot &info = _readback_slots[slot];
+
+	return info.submitted && vk.GetFenceStatus(_device, _cmd_fences[info.cmd_index]) == VK_SUCCESS;
+}
+bool reshade::vulkan::runtime_vk::finish_readback(unsigned int slot, uint8_t *buffer)
+{
+	assert(slot < _readback_slots.size());
+	const readback_slot &info = _readback_slots[slot];
+
+	if (!info.submitted)
+	{
+		// Copy was recorded this frame, so execute it right away (unless that already happened)
+		if (_cmd_buffers[_cmd_index].second)
+			execute_command_buffer();
+	}
+	else
+	{
+		const VkFence fence = _cmd_fences[info.cmd_index];
+		vk.WaitForFences(_device, 1, &fence, VK_TRUE, UINT64_MAX);
+	}
+
+	VmaAllocationInfo alloc_info;
+	vmaGetAllocationInfo(_alloc, info.mem, &alloc_info);
+	// Memory may not be host coherent, so make GPU writes visible
+	vmaInvalidateAllocation(_alloc, info.mem, 0, VK_WHOLE_SIZE);
+
+	const auto mapped_data = static_cast<const uint8_t *>(alloc_info.pMappedData);
+	if (_color_bit_depth == 10)
+	{
+		convert_rgb10a2_to_rgba8(buffer, mapped_data, size_t(_width) * _height,
+			_backbuffer_format >= VK_FORMAT_A2B10G10R10_UNORM_PACK32 && _backbuffer_format <= VK_FORMAT_A2B10G10R10_SINT_PACK32);
+	}
+	else
+	{
+		// Clear alpha channel and flip channels if format is BGRA, since output should be RGBA
+		convert_rgbx8_to_rgba8(buffer, mapped_data, size_t(_width) * _height,
+			_backbuffer_format >= VK_FORMAT_B8G8R8A8_UNORM && _backbuffer_format <= VK_FORMAT_B8G8R8A8_SRGB);
+	}
+
+	return true;
+}
+
 bool reshade::vulkan::runtime_vk::init_effect(size_t index)
 {
 	effect &effect = _effects[index];
@@ -827,7 +918,8 @@ bool reshade::vulkan::runtime_vk::init_effect(size_t index)
 	// Create query pool for time measurements
 	{   VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
 		create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-		create_info.queryCount = static_cast<uint32_t>(effect.module.techniques.size() * 2 * NUM_COMMAND_FRAMES);
+		for (const reshadefx::technique_info &technique_info : effect.module.techniques)
+			create_info.queryCount += static_cast<uint32_t>((technique_info.passes.size() + 1) * NUM_GPU_QUERY_FRAMES);
 
 		check_result(vk.CreateQueryPool(_device, &create_info, nullptr, &effect_data.query_pool)) false;
 	}
@@ -1029,7 +1121,7 @@ bool reshade::vulkan::runtime_vk::init_effect(size_t index)
 		std::memcpy(spec_data.data() + offset, &constant.initializer_value.as_uint[0], constant.size);
 	}
 
-	uint32_t technique_index = 0;
+	uint32_t query_base_index = 0;
 	for (technique &technique : _techniques)
 	{
 		if (technique.impl != nullptr || technique.effect_index != index)
@@ -1038,8 +1130,10 @@ bool reshade::vulkan::runtime_vk::init_effect(size_t index)
 		auto impl = new vulkan_technique_data();
 		technique.impl = impl;
 
-		// Offset index so that a query exists for each command frame and two subsequent ones are used for before/after stamps
-		impl->query_base_index = technique_index++ * 2 * NUM_COMMAND_FRAMES;
+		// Reserve queries for each frame that can be in flight, with one time stamp before the first pass and one after every pass
+		impl->query_base_index = query_base_index;
+		query_base_index += static_cast<uint32_t>((technique.passes.size() + 1) * NUM_GPU_QUERY_FRAMES);
+		impl->timestamps.resize(technique.schedule.passes.size() + 1);
 
 		impl->passes.resize(technique.passes.size());
 		for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
@@ -1553,12 +1647,9 @@ bool reshade::vulkan::runtime_vk::init_texture(texture &texture)
 	}
 #endif
 
-	// Transition to shader read image layout
+	// Transition to shader read image layout (this is submitted together with all other pending commands in 'on_present')
 	if (begin_command_buffer())
-	{
 		transition_layout(vk, _cmd_buffers[_cmd_index].first, impl->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		execute_command_buffer();
-	}
 
 	return true;
 }
@@ -1567,70 +1658,61 @@ void reshade::vulkan::runtime_vk::upload_texture(const texture &texture, const u
 	auto impl = static_cast<vulkan_tex_data *>(texture.impl);
 	assert(impl != nullptr && pixels != nullptr && texture.impl_reference == texture_reference::none);
 
-	// Allocate host memory for upload
-	vk_handle<VK_OBJECT_TYPE_BUFFER> intermediate(_device, vk);
-	VmaAllocation intermediate_mem = VK_NULL_HANDLE;
-
-	{   VkBufferCreateInfo create_info { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-		create_info.size = texture.width * texture.height * 4;
-		create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-
-		VmaAllocationCreateInfo alloc_info = {};
-		alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-
-		check_result(vmaCreateBuffer(_alloc, &create_info, &alloc_info, &intermediate, &intermediate_mem, nullptr));
-	}
-
-	// Fill upload buffer with pixel data
-	uint8_t *mapped_data = nullptr;
-	if (vmaMapMemory(_alloc, intermediate_mem, reinterpret_cast<void **>(&mapped_data)) == VK_SUCCESS)
+	uint32_t texel_size;
+	switch (texture.format)
 	{
-		switch (texture.format)
-		{
-		case reshadefx::texture_format::r8:
-			for (uint32_t y = 0; y < texture.height; ++y, mapped_data += texture.width * 1, pixels += texture.width * 4)
-				for (uint32_t x = 0; x < texture.width; ++x)
-					mapped_data[x] = pixels[x * 4];
-			break;
-		case reshadefx::texture_format::rg8:
-			for (uint32_t y = 0; y < texture.height; ++y, mapped_data += texture.width * 2, pixels += texture.width * 4)
-				for (uint32_t x = 0; x < texture.width; ++x)
-					mapped_data[x * 2 + 0] = pixels[x * 4 + 0],
-					mapped_data[x * 2 + 1] = pixels[x * 4 + 1];
-			break;
-		case reshadefx::texture_format::rgba8:
-			for (uint32_t y = 0; y < texture.height; ++y, mapped_data += texture.width * 4, pixels += texture.width * 4)
-				std::memcpy(mapped_data, pixels, texture.width * 4);
-			break;
-		default:
-			mapped_data = nullptr;
-			LOG(ERROR) << "Texture upload is not supported for format " << static_cast<unsigned int>(texture.format) << '!';
-			break;
-		}
-
-		vmaUnmapMemory(_alloc, intermediate_mem);
+	case reshadefx::texture_format::r8:
+		texel_size = 1;
+		break;
+	case reshadefx::texture_format::rg8:
+		texel_size = 2;
+		break;
+	case reshadefx::texture_format::rgba8:
+		texel_size = 4;
+		break;
+	default:
+		LOG(ERROR) << "Texture upload is not supported for format " << static_cast<unsigned int>(texture.format) << '!';
+		return;
 	}
 
-	if (mapped_data != nullptr && begin_command_buffer())
-	{
-		const VkCommandBuffer cmd_list = _cmd_buffers[_cmd_index].first;
+	// Fill staging buffer with pixel data
+	uint64_t staging_offset = 0;
+	uint8_t *const mapped_data = _staging_ring.allocate(uint64_t(texture.width) * texture.height * texel_size,
+		std::max<VkDeviceSize>(_device_props.limits.optimalBufferCopyOffsetAlignment, 4), _cmd_index, staging_offset);
+	if (mapped_data == nullptr)
+		return;
 
-		transition_layout(vk, cmd_list, impl->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		{ // Copy data from upload buffer into target texture
-			VkBufferImageCopy copy_region = {};
-			copy_region.imageExtent = { texture.width, texture.height, 1u };
-			copy_region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	switch (texture.format)
+	{
+	case reshadefx::texture_format::r8:
+		convert_rgba8_to_r8(mapped_data, pixels, size_t(texture.width) * texture.height);
+		break;
+	case reshadefx::texture_format::rg8:
+		convert_rgba8_to_rg8(mapped_data, pixels, size_t(texture.width) * texture.height);
+		break;
+	case reshadefx::texture_format::rgba8:
+		std::memcpy(mapped_data, pixels, size_t(texture.width) * texture.height * 4);
+		break;
+	}
 
-			vk.CmdCopyBufferToImage(cmd_list, intermediate, impl->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-		}
-		transition_layout(vk, cmd_list, impl->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// Only record the copy here, it is submitted together with all other pending commands in 'on_present'
+	// This way uploading many textures (e.g. while loading effects) costs a single submit and fence instead of a round-trip per texture
+	if (!begin_command_buffer())
+		return;
+	const VkCommandBuffer cmd_list = _cmd_buffers[_cmd_index].first;
 
-		generate_mipmaps(texture);
+	transition_layout(vk, cmd_list, impl->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	{ // Copy data from staging buffer into target texture
+		VkBufferImageCopy copy_region = {};
+		copy_region.bufferOffset = staging_offset;
+		copy_region.imageExtent = { texture.width, texture.height, 1u };
+		copy_region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
 
-		execute_command_buffer();
+		vk.CmdCopyBufferToImage(cmd_list, _staging_buffer, impl->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
 	}
+	transition_layout(vk, cmd_list, impl->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-	vmaFreeMemory(_alloc, intermediate_mem);
+	generate_mipmaps(texture);
 }
 void reshade::vulkan::runtime_vk::destroy_texture(texture &texture)
 {
@@ -1638,6 +1720,10 @@ void reshade::vulkan::runtime_vk::destroy_texture(texture &texture)
 		return;
 	auto impl = static_cast<vulkan_tex_data *>(texture.impl);
 
+	// Commands recorded in 'init_texture' or 'upload_texture' may still be pending, so execute those before the image is destroyed
+	if (_cmd_index < NUM_COMMAND_FRAMES && _cmd_buffers[_cmd_index].second)
+		execute_command_buffer();
+
 	vmaDestroyImage(_alloc, impl->image, impl->image_mem);
 	if (impl->view[0] != VK_NULL_HANDLE)
 		vk.DestroyImageView(_device, impl->view[0], nullptr);
@@ -1684,34 +1770,79 @@ void reshade::vulkan::runtime_vk::generate_mipmaps(const texture &texture)
 		transition_layout(vk, cmd_list, impl->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 });
 	}
 }
+void reshade::vulkan::runtime_vk::wait_for_staging_frames(uint32_t frame_mask)
+{
+	// Copies for the current frame that were not submitted yet are executed right away, which waits for them to finish
+	if ((frame_mask & (1u << _cmd_index)) != 0 && _cmd_buffers[_cmd_index].second)
+		execute_command_buffer();
+
+	// Fences are only reset right before a submit, so they are either signaled already or will be once the frame finished executing
+	uint32_t num_fences = 0;
+	VkFence fences[NUM_COMMAND_FRAMES];
+	for (uint32_t i = 0; i < NUM_COMMAND_FRAMES; ++i)
+		if ((frame_mask & (1u << i)) != 0)
+			fences[num_fences++] = _cmd_fences[i];
+
+	if (num_fences != 0)
+		vk.WaitForFences(_device, num_fences, fences, VK_TRUE, UINT64_MAX);
+}
+uint8_t *reshade::vulkan::runtime_vk::resize_staging_buffer(uint64_t size)
+{
+	vmaDestroyBuffer(_alloc, _staging_buffer, _staging_mem);
+	_staging_mem = VK_NULL_HANDLE;
+
+	_staging_buffer = create_buffer(size,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+		0, VMA_ALLOCATION_CREATE_MAPPED_BIT, &_staging_mem);
+	if (_staging_buffer == VK_NULL_HANDLE)
+		return nullptr;
+
+	// The buffer stays persistently mapped until it is destroyed
+	VmaAllocationInfo alloc_info;
+	vmaGetAllocationInfo(_alloc, _staging_mem, &alloc_info);
+	return static_cast<uint8_t *>(alloc_info.pMappedData);
+}
 
 void reshade::vulkan::runtime_vk::render_technique(technique &technique)
 {
 	const auto impl = static_cast<vulkan_technique_data *>(technique.impl);
 	vulkan_effect_data &effect_data = _effect_data[technique.effect_index];
 
-	// Evaluate queries from oldest frame in queue
-	if (uint64_t timestamps[2];
-		vk.GetQueryPoolResults(_device, effect_data.query_pool,
-			impl->query_base_index + ((_cmd_index + 1) % NUM_COMMAND_FRAMES) * 2, 2,
-		sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	const uint32_t num_timestamps = static_cast<uint32_t>(impl->timestamps.size());
+
+	// Evaluate queries of previous frames that finished by now
+	for (size_t slot; impl->queries.oldest_pending(slot); impl->queries.pop())
 	{
-		technique.average_gpu_duration.append(timestamps[1] - timestamps[0]);
+		if (vk.GetQueryPoolResults(_device, effect_data.query_pool, impl->query_base_index + static_cast<uint32_t>(slot) * num_timestamps, num_timestamps,
+			num_timestamps * sizeof(uint64_t), impl->timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+			break;
+
+		technique.append_gpu_timestamps(impl->timestamps.data(), static_cast<uint64_t>(1'000'000'000 / _device_props.limits.timestampPeriod));
 	}
 
 	if (!begin_command_buffer())
 		return;
 	const VkCommandBuffer cmd_list = _cmd_buffers[_cmd_index].first;
 
-	// Reset current queries and then write time stamp value
-	vk.CmdResetQueryPool(cmd_list, effect_data.query_pool, impl->query_base_index + _cmd_index * 2, 2);
-	vk.CmdWriteTimestamp(cmd_list, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, effect_data.query_pool, impl->query_base_index + _cmd_index * 2);
+	// Reset queries of this frame and then write time stamp value (skip if all queries are still in flight)
+	uint32_t query_index = std::numeric_limits<uint32_t>::max();
+	if (size_t slot; impl->queries.push(slot))
+	{
+		query_index = impl->query_base_index + static_cast<uint32_t>(slot) * num_timestamps;
+
+		vk.CmdResetQueryPool(cmd_list, effect_data.query_pool, query_index, num_timestamps);
+		vk.CmdWriteTimestamp(cmd_list, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, effect_data.query_pool, query_index++);
+	}
 
 	vk.CmdBindDescriptorSets(cmd_list, VK_PIPELINE_BIND_POINT_GRAPHICS, effect_data.pipeline_layout, 0, 2, effect_data.set, 0, nullptr);
 
 	// Setup shader constants
 	if (effect_data.ubo != VK_NULL_HANDLE)
+	{
+		RESHADE_CPU_TIMER(_cpu_timers, technique.effect_index, technique.cpu_timer_row, upload_constants);
+
 		vk.CmdUpdateBuffer(cmd_list, effect_data.ubo, 0, _effects[technique.effect_index].uniform_data_storage.size(), _effects[technique.effect_index].uniform_data_storage.data());
+	}
 
 #if RESHADE_DEPTH
 	if (_depth_image != VK_NULL_HANDLE)
@@ -1722,11 +1853,12 @@ void reshade::vulkan::runtime_vk::render_technique(technique &technique)
 #endif
 
 	bool is_effect_stencil_cleared = false;
-	bool needs_implicit_backbuffer_copy = true; // First pass always needs the back buffer updated
 
-	for (size_t pass_index = 0; pass_index < technique.passes.size(); ++pass_index)
+	for (const reshadefx::scheduled_pass &scheduled : technique.schedule.passes)
 	{
-		if (needs_implicit_backbuffer_copy)
+		const size_t pass_index = scheduled.pass_index;
+
+		if (scheduled.copy_backbuffer)
 		{
 			// Save back buffer of previous pass
 			const VkImageCopy copy_range = {
@@ -1754,18 +1886,15 @@ void reshade::vulkan::runtime_vk::render_technique(technique &technique)
 			transition_layout(vk, cmd_list, _effect_stencil, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, { aspect_flags_from_format(_effect_stencil_format), 0, 1, 0, 1 });
 		}
 
-		VkRenderPassBeginInfo begin_info = pass_data.begin_info;
-		if (begin_info.framebuffer == VK_NULL_HANDLE)
+		// Passes that continue the render pass of the previous one use a compatible render pass (same attachments), so can simply bind their pipeline in it
+		if (scheduled.begin_render_pass)
 		{
-			begin_info.framebuffer = _swapchain_frames[_swap_index * 2 + pass_info.srgb_write_enable];
-			needs_implicit_backbuffer_copy = true;
-		}
-		else
-		{
-			needs_implicit_backbuffer_copy = false;
-		}
+			VkRenderPassBeginInfo begin_info = pass_data.begin_info;
+			if (begin_info.framebuffer == VK_NULL_HANDLE)
+				begin_info.framebuffer = _swapchain_frames[_swap_index * 2 + pass_info.srgb_write_enable];
 
-		vk.CmdBeginRenderPass(cmd_list, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+			vk.CmdBeginRenderPass(cmd_list, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		}
 
 		// Setup states
 		vk.CmdBindPipeline(cmd_list, VK_PIPELINE_BIND_POINT_GRAPHICS, pass_data.pipeline);
@@ -1776,11 +1905,15 @@ void reshade::vulkan::runtime_vk::render_technique(technique &technique)
 		_vertices += pass_info.num_vertices;
 		_drawcalls += 1;
 
-		vk.CmdEndRenderPass(cmd_list);
+		if (scheduled.end_render_pass)
+			vk.CmdEndRenderPass(cmd_list);
 
 		// Generate mipmaps
 		for (uint32_t k = 0; k < 8 && !pass_info.render_target_names[k].empty(); ++k)
 		{
+			if ((scheduled.generate_mipmaps & (1 << k)) == 0)
+				continue;
+
 			const auto render_target_texture = std::find_if(_textures.begin(), _textures.end(),
 				[&render_target = pass_info.render_target_names[k]](const auto &item) {
 				return item.unique_name == render_target;
@@ -1788,6 +1921,9 @@ void reshade::vulkan::runtime_vk::render_technique(technique &technique)
 
 			generate_mipmaps(*render_target_texture);
 		}
+
+		if (query_index != std::numeric_limits<uint32_t>::max())
+			vk.CmdWriteTimestamp(cmd_list, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, effect_data.query_pool, query_index++);
 	}
 
 #if RESHADE_DEPTH
@@ -1799,8 +1935,6 @@ void reshade::vulkan::runtime_vk::render_technique(technique &technique)
 		transition_layout(vk, cmd_list, _depth_image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, _depth_image_layout, { _depth_image_aspect, 0, 1, 0, 1 });
 	}
 #endif
-
-	vk.CmdWriteTimestamp(cmd_list, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, effect_data.query_pool, impl->query_base_index + _cmd_index * 2 + 1);
 }
 
 bool reshade::vulkan::runtime_vk::begin_command_buffer() const
@@ -2320,12 +2454,20 @@ void reshade::vulkan::runtime_vk::draw_depth_debug_menu(buffer_detection_context
 	ImGui::Separator();
 	ImGui::Spacing();
 
-	for (const auto &[depth_image, snapshot] : tracker.depth_buffer_counters())
+	const auto &depth_buffers = tracker.depth_buffer_tracker();
+
+	for (uint32_t slot = 0; slot < depth_buffers.resources().size(); ++slot)
 	{
+		const auto &snapshot = depth_buffers.counters(slot);
+		if (!snapshot.in_use)
+			continue;
+
+		const VkImage depth_image = (VkImage)snapshot.handle;
+
 		char label[512] = "";
-		sprintf_s(label, "%s0x%016llx", (depth_image == _depth_image ? "> " : "  "), (uint64_t)depth_image);
+		sprintf_s(label, "%s0x%016llx", (depth_image == _depth_image ? "> " : "  "), snapshot.handle);
 
-		const bool msaa = snapshot.image_info.samples != VK_SAMPLE_COUNT_1_BIT;
+		const bool msaa = snapshot.desc.samples != VK_SAMPLE_COUNT_1_BIT;
 		if (msaa) // Disable widget for MSAA textures
 		{
 			ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
@@ -2338,7 +2480,7 @@ void reshade::vulkan::runtime_vk::draw_depth_debug_menu(buffer_detection_context
 
 		ImGui::SameLine();
 		ImGui::Text("| %4ux%-4u | %5u draw calls ==> %8u vertices |%s",
-			snapshot.image_info.extent.width, snapshot.image_info.extent.height, snapshot.stats.drawcalls, snapshot.stats.vertices, (msaa ? " MSAA" : ""));
+			snapshot.desc.width, snapshot.desc.height, snapshot.total_stats.drawcalls, snapshot.total_stats.vertices, (msaa ? " MSAA" : ""));
 
 		if (msaa)
 		{
@@ -2350,6 +2492,9 @@ void reshade::vulkan::runtime_vk::draw_depth_debug_menu(buffer_detection_context
 	ImGui::Spacing();
 	ImGui::Separator();
 	ImGui::Spacing();
+
+	if (ImGui::Button("Record trace of next frame", ImVec2(-1, 0)))
+		start_depth_trace();
 }
 
 void reshade::vulkan::runtime_vk::update_depth_image_bindings(buffer_detection::depthstencil_info info)
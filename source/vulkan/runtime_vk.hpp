@@ -6,6 +6,7 @@
 #pragma once
 
 #include "runtime.hpp"
+#include "runtime_staging_ring.hpp"
 #include "vk_handle.hpp"
 #include "buffer_detection.hpp"
 
@@ -16,7 +17,7 @@
 
 namespace reshade::vulkan
 {
-	class runtime_vk : public runtime
+	class runtime_vk : public runtime, protected staging_ring::backend
 	{
 		static const uint32_t NUM_IMGUI_BUFFERS = 5;
 		static const uint32_t NUM_COMMAND_FRAMES = 5;
@@ -43,9 +44,15 @@ namespace reshade::vulkan
 		void upload_texture(const texture &texture, const uint8_t *pixels) override;
 		void destroy_texture(texture &texture) override;
 		void generate_mipmaps(const texture &texture);
+		void wait_for_staging_frames(uint32_t frame_mask) override;
+		uint8_t *resize_staging_buffer(uint64_t size) override;
 
 		void render_technique(technique &technique) override;
 
+		bool begin_readback(unsigned int slot) override;
+		bool is_readback_complete(unsigned int slot) const override;
+		bool finish_readback(unsigned int slot, uint8_t *buffer) override;
+
 		bool begin_command_buffer() const;
 		void execute_command_buffer() const;
 		void wait_for_command_buffers();
@@ -89,6 +96,19 @@ namespace reshade::vulkan
 
 		std::vector<VmaAllocation> _allocations;
 
+		VkBuffer _staging_buffer = VK_NULL_HANDLE;
+		VmaAllocation _staging_mem = VK_NULL_HANDLE;
+		staging_ring _staging_ring;
+
+		struct readback_slot
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VmaAllocation mem = VK_NULL_HANDLE;
+			uint32_t cmd_index = 0;
+			bool submitted = false;
+		};
+		std::vector<readback_slot> _readback_slots;
+
 		VkImage _effect_stencil = VK_NULL_HANDLE;
 		VkFormat _effect_stencil_format = VK_FORMAT_UNDEFINED;
 		VkImageView _effect_stencil_view = VK_NULL_HANDLE;
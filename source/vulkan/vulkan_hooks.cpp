@@ -25,12 +25,21 @@ struct render_pass_data
 	VkImageLayout final_depthstencil_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 };
 
+struct framebuffer_data
+{
+	std::vector<VkImage> attachment_images;
+	// Copy of the image information of the attachments above, so that beginning a render pass does not have to look it up
+	std::vector<VkImageCreateInfo> attachment_image_infos;
+};
+
 struct command_buffer_data
 {
-	// State tracking for render passes
+	// Dispatch table of the device this command buffer was allocated from, so that recording commands does not have to look it up
+	const VkLayerDispatchTable *dispatch_table = nullptr;
+	// State tracking for render passes (the pointed to data stays valid while the render pass is being recorded)
 	uint32_t current_subpass = std::numeric_limits<uint32_t>::max();
-	VkRenderPass current_renderpass = VK_NULL_HANDLE;
-	VkFramebuffer current_framebuffer = VK_NULL_HANDLE;
+	const std::vector<render_pass_data> *current_renderpass = nullptr;
+	const framebuffer_data *current_framebuffer = nullptr;
 	reshade::vulkan::buffer_detection buffer_detection;
 };
 
@@ -40,9 +49,11 @@ static lockfree_table<VkSurfaceKHR, HWND, 16> s_surface_windows;
 static lockfree_table<VkSwapchainKHR, reshade::vulkan::runtime_vk *, 16> s_vulkan_runtimes;
 static lockfree_table<VkImage, VkImageCreateInfo, 4096> s_image_data;
 static lockfree_table<VkImageView, VkImage, 4096> s_image_view_mapping;
-static lockfree_table<VkFramebuffer, std::vector<VkImage>, 256> s_framebuffer_data;
+static lockfree_table<VkFramebuffer, framebuffer_data, 256> s_framebuffer_data;
 static lockfree_table<VkCommandBuffer, command_buffer_data, 4096> s_command_buffer_data;
 static lockfree_table<VkRenderPass, std::vector<render_pass_data>, 4096> s_renderpass_data;
+// Incremented whenever command buffers are allocated or freed, to invalidate the per-thread look up cache below
+static std::atomic<uint32_t> s_command_buffer_generation = 0;
 
 template <typename T>
 static T *find_layer_info(const void *structure_chain, VkStructureType type, VkLayerFunction function)
@@ -68,6 +79,26 @@ static inline void *dispatch_key_from_handle(const void *dispatch_handle)
 	return *(void **)dispatch_handle;
 }
 
+static command_buffer_data &get_command_buffer_data(VkCommandBuffer cmd)
+{
+	// A command buffer is only ever recorded by a single thread and applications usually record many commands in a row, so remember the last one each thread looked up
+	thread_local struct {
+		VkCommandBuffer handle;
+		uint32_t generation;
+		command_buffer_data *data;
+	} last_lookup = {};
+
+	if (const uint32_t generation = s_command_buffer_generation.load(std::memory_order_acquire);
+		last_lookup.handle != cmd || last_lookup.generation != generation || last_lookup.data == nullptr)
+	{
+		last_lookup.handle = cmd;
+		last_lookup.generation = generation;
+		last_lookup.data = &s_command_buffer_data.at(cmd);
+	}
+
+	return *last_lookup.data;
+}
+
 #define GET_DEVICE_DISPATCH_PTR(name, object) \
 	PFN_vk##name trampoline = s_device_dispatch.at(dispatch_key_from_handle(object)).dispatch_table.name; \
 	assert(trampoline != nullptr);
@@ -448,6 +479,7 @@ VkResult VKAPI_CALL vkCreateDevice(VkPhysicalDevice physicalDevice, const VkDevi
 	INIT_DEVICE_PROC(CmdWriteTimestamp);
 	INIT_DEVICE_PROC(CmdPushConstants);
 	INIT_DEVICE_PROC(CmdBeginRenderPass);
+	INIT_DEVICE_PROC(CmdNextSubpass);
 	INIT_DEVICE_PROC(CmdEndRenderPass);
 	INIT_DEVICE_PROC(CmdExecuteCommands);
 	// ---- Core 1_1 commands
@@ -477,6 +509,7 @@ void     VKAPI_CALL vkDestroyDevice(VkDevice device, const VkAllocationCallbacks
 	LOG(INFO) << "Redirecting vkDestroyDevice" << '(' << "device = " << device << ", pAllocator = " << pAllocator << ')' << " ...";
 
 	s_command_buffer_data.clear(); // Reset all command buffer data
+	s_command_buffer_generation.fetch_add(1, std::memory_order_release);
 
 	// Get function pointer before removing it next
 	GET_DEVICE_DISPATCH_PTR(DestroyDevice, device);
@@ -492,6 +525,9 @@ VkResult VKAPI_CALL vkCreateSwapchainKHR(VkDevice device, const VkSwapchainCreat
 
 	assert(pCreateInfo != nullptr && pSwapchain != nullptr);
 
+	// Keep the looked up device data alive while it is used below
+	const lockfree_epoch::guard epoch_guard;
+
 	auto &device_data = s_device_dispatch.at(dispatch_key_from_handle(device));
 
 	VkSwapchainCreateInfoKHR create_info = *pCreateInfo;
@@ -638,6 +674,8 @@ VkResult VKAPI_CALL vkQueueSubmit(VkQueue queue, uint32_t submitCount, const VkS
 {
 	assert(pSubmits != nullptr);
 
+	const lockfree_epoch::guard epoch_guard;
+
 	auto &device_data = s_device_dispatch.at(dispatch_key_from_handle(queue));
 
 	for (uint32_t i = 0; i < submitCount; ++i)
@@ -647,10 +685,10 @@ VkResult VKAPI_CALL vkQueueSubmit(VkQueue queue, uint32_t submitCount, const VkS
 			VkCommandBuffer cmd = pSubmits[i].pCommandBuffers[k];
 			assert(cmd != VK_NULL_HANDLE);
 
-			auto &command_buffer_data = s_command_buffer_data.at(cmd);
+			const auto &command_buffer_data = s_command_buffer_data.at(cmd);
 
-			// Merge command list trackers into device one
-			device_data.buffer_detection.merge(command_buffer_data.buffer_detection);
+			// Queue command list trackers to be merged into device one on the next present (this may be called from multiple threads at once for different queues)
+			device_data.buffer_detection.submit(command_buffer_data.buffer_detection);
 		}
 	}
 
@@ -661,8 +699,13 @@ VkResult VKAPI_CALL vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR *pPr
 {
 	assert(pPresentInfo != nullptr);
 
+	const lockfree_epoch::guard epoch_guard;
+
 	auto &device_data = s_device_dispatch.at(dispatch_key_from_handle(queue));
 
+	// Merge statistics of all command buffers submitted since the last present
+	device_data.buffer_detection.flush_submitted();
+
 	std::vector<VkSemaphore> wait_semaphores(
 		pPresentInfo->pWaitSemaphores, pPresentInfo->pWaitSemaphores + pPresentInfo->waitSemaphoreCount);
 
@@ -801,14 +844,23 @@ VkResult VKAPI_CALL vkCreateFramebuffer(VkDevice device, const VkFramebufferCrea
 	}
 
 	// Look up the depth-stencil images associated with their image views
-	std::vector<VkImage> attachment_images(pCreateInfo->attachmentCount);
+	const lockfree_epoch::guard epoch_guard;
+
+	framebuffer_data data;
+	data.attachment_images.resize(pCreateInfo->attachmentCount);
+	data.attachment_image_infos.resize(pCreateInfo->attachmentCount);
 	for (const auto &subpass_data : s_renderpass_data.at(pCreateInfo->renderPass))
-		if (subpass_data.depthstencil_attachment_index < pCreateInfo->attachmentCount)
-			attachment_images[subpass_data.depthstencil_attachment_index] = s_image_view_mapping.at(
-				pCreateInfo->pAttachments[subpass_data.depthstencil_attachment_index]);
+	{
+		if (const uint32_t index = subpass_data.depthstencil_attachment_index;
+			index < pCreateInfo->attachmentCount)
+		{
+			data.attachment_images[index] = s_image_view_mapping.at(pCreateInfo->pAttachments[index]);
+			data.attachment_image_infos[index] = s_image_data.at(data.attachment_images[index]);
+		}
+	}
 
 	// Keep track of depth-stencil image in this frame buffer
-	s_framebuffer_data.emplace(*pFramebuffer, std::move(attachment_images));
+	s_framebuffer_data.emplace(*pFramebuffer, std::move(data));
 
 	return VK_SUCCESS;
 }
@@ -830,8 +882,13 @@ VkResult VKAPI_CALL vkAllocateCommandBuffers(VkDevice device, const VkCommandBuf
 		return result;
 	}
 
+	const VkLayerDispatchTable &dispatch_table = s_device_dispatch.at(dispatch_key_from_handle(device)).dispatch_table;
+
 	for (uint32_t i = 0; i < pAllocateInfo->commandBufferCount; ++i)
-		s_command_buffer_data.emplace(pCommandBuffers[i]);
+		s_command_buffer_data.emplace(pCommandBuffers[i]).dispatch_table = &dispatch_table;
+
+	// Handles of freed command buffers may be reused, so make sure no thread keeps using a cached look up for them
+	s_command_buffer_generation.fetch_add(1, std::memory_order_release);
 
 	return VK_SUCCESS;
 }
@@ -840,6 +897,8 @@ void     VKAPI_CALL vkFreeCommandBuffers(VkDevice device, VkCommandPool commandP
 	for (uint32_t i = 0; i < commandBufferCount; ++i)
 		s_command_buffer_data.erase(pCommandBuffers[i]);
 
+	s_command_buffer_generation.fetch_add(1, std::memory_order_release);
+
 	GET_DEVICE_DISPATCH_PTR(FreeCommandBuffers, device);
 	trampoline(device, commandPool, commandBufferCount, pCommandBuffers);
 }
@@ -847,82 +906,78 @@ void     VKAPI_CALL vkFreeCommandBuffers(VkDevice device, VkCommandPool commandP
 VkResult VKAPI_CALL vkBeginCommandBuffer(VkCommandBuffer commandBuffer, const VkCommandBufferBeginInfo *pBeginInfo)
 {
 	// Begin does perform an implicit reset if command pool was created with VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
-	auto &data = s_command_buffer_data.at(commandBuffer);
+	auto &data = get_command_buffer_data(commandBuffer);
 	data.buffer_detection.reset();
 
-	GET_DEVICE_DISPATCH_PTR(BeginCommandBuffer, commandBuffer);
+	const PFN_vkBeginCommandBuffer trampoline = data.dispatch_table->BeginCommandBuffer;
+	assert(trampoline != nullptr);
 	return trampoline(commandBuffer, pBeginInfo);
 }
 
-
-void     VKAPI_CALL vkCmdBeginRenderPass(VkCommandBuffer commandBuffer, const VkRenderPassBeginInfo *pRenderPassBegin, VkSubpassContents contents)
-{
 #if RESHADE_DEPTH
-	auto &data = s_command_buffer_data.at(commandBuffer);
-	data.current_subpass = 0;
-	data.current_renderpass = pRenderPassBegin->renderPass;
-	data.current_framebuffer = pRenderPassBegin->framebuffer;
-
-	const auto &renderpass_data = s_renderpass_data.at(data.current_renderpass)[data.current_subpass];
-	const auto &framebuffer_data = s_framebuffer_data.at(data.current_framebuffer);
-	if (renderpass_data.depthstencil_attachment_index < framebuffer_data.size())
+static void update_subpass_depthstencil(command_buffer_data &data)
+{
+	const auto &renderpass_data = (*data.current_renderpass)[data.current_subpass];
+	const auto &framebuffer_data = *data.current_framebuffer;
+	if (renderpass_data.depthstencil_attachment_index < framebuffer_data.attachment_images.size())
 	{
-		const VkImage depthstencil = framebuffer_data[renderpass_data.depthstencil_attachment_index];
-		VkImageLayout depthstencil_layout = renderpass_data.final_depthstencil_layout;
-
 		data.buffer_detection.on_set_depthstencil(
-			depthstencil,
-			depthstencil_layout,
-			s_image_data.at(depthstencil));
+			framebuffer_data.attachment_images[renderpass_data.depthstencil_attachment_index],
+			renderpass_data.final_depthstencil_layout,
+			framebuffer_data.attachment_image_infos[renderpass_data.depthstencil_attachment_index]);
 	}
 	else
 	{
 		data.buffer_detection.on_set_depthstencil(VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED, {});
 	}
+}
+#endif
+
+void     VKAPI_CALL vkCmdBeginRenderPass(VkCommandBuffer commandBuffer, const VkRenderPassBeginInfo *pRenderPassBegin, VkSubpassContents contents)
+{
+	auto &data = get_command_buffer_data(commandBuffer);
+
+#if RESHADE_DEPTH
+	// Look up render pass and frame buffer only once here, instead of on every subpass
+	data.current_subpass = 0;
+	data.current_renderpass = &s_renderpass_data.at(pRenderPassBegin->renderPass);
+	data.current_framebuffer = &s_framebuffer_data.at(pRenderPassBegin->framebuffer);
+
+	update_subpass_depthstencil(data);
 #endif
 
-	GET_DEVICE_DISPATCH_PTR(CmdBeginRenderPass, commandBuffer);
+	const PFN_vkCmdBeginRenderPass trampoline = data.dispatch_table->CmdBeginRenderPass;
+	assert(trampoline != nullptr);
 	trampoline(commandBuffer, pRenderPassBegin, contents);
 }
 void     VKAPI_CALL vkCmdNextSubpass(VkCommandBuffer commandBuffer, VkSubpassContents contents)
 {
-	GET_DEVICE_DISPATCH_PTR(CmdNextSubpass, commandBuffer);
+	auto &data = get_command_buffer_data(commandBuffer);
+
+	const PFN_vkCmdNextSubpass trampoline = data.dispatch_table->CmdNextSubpass;
+	assert(trampoline != nullptr);
 	trampoline(commandBuffer, contents);
 
 #if RESHADE_DEPTH
-	auto &data = s_command_buffer_data.at(commandBuffer);
 	data.current_subpass++;
-	assert(data.current_renderpass != VK_NULL_HANDLE);
-	assert(data.current_framebuffer != VK_NULL_HANDLE);
-
-	const auto &renderpass_data = s_renderpass_data.at(data.current_renderpass)[data.current_subpass];
-	const auto &framebuffer_data = s_framebuffer_data.at(data.current_framebuffer);
-	if (renderpass_data.depthstencil_attachment_index < framebuffer_data.size())
-	{
-		const VkImage depthstencil = framebuffer_data[renderpass_data.depthstencil_attachment_index];
-		VkImageLayout depthstencil_layout = renderpass_data.final_depthstencil_layout;
+	assert(data.current_renderpass != nullptr);
+	assert(data.current_framebuffer != nullptr);
 
-		data.buffer_detection.on_set_depthstencil(
-			depthstencil,
-			depthstencil_layout,
-			s_image_data.at(depthstencil));
-	}
-	else
-	{
-		data.buffer_detection.on_set_depthstencil(VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED, {});
-	}
+	update_subpass_depthstencil(data);
 #endif
 }
 void     VKAPI_CALL vkCmdEndRenderPass(VkCommandBuffer commandBuffer)
 {
-	GET_DEVICE_DISPATCH_PTR(CmdEndRenderPass, commandBuffer);
+	auto &data = get_command_buffer_data(commandBuffer);
+
+	const PFN_vkCmdEndRenderPass trampoline = data.dispatch_table->CmdEndRenderPass;
+	assert(trampoline != nullptr);
 	trampoline(commandBuffer);
 
 #if RESHADE_DEPTH
-	auto &data = s_command_buffer_data.at(commandBuffer);
 	data.current_subpass = std::numeric_limits<uint32_t>::max();
-	data.current_renderpass = VK_NULL_HANDLE;
-	data.current_framebuffer = VK_NULL_HANDLE;
+	data.current_renderpass = nullptr;
+	data.current_framebuffer = nullptr;
 
 	data.buffer_detection.on_set_depthstencil(VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED, {});
 #endif
@@ -930,7 +985,9 @@ void     VKAPI_CALL vkCmdEndRenderPass(VkCommandBuffer commandBuffer)
 
 void     VKAPI_CALL vkCmdExecuteCommands(VkCommandBuffer commandBuffer, uint32_t commandBufferCount, const VkCommandBuffer *pCommandBuffers)
 {
-	auto &data = s_command_buffer_data.at(commandBuffer);
+	auto &data = get_command_buffer_data(commandBuffer);
+
+	const lockfree_epoch::guard epoch_guard;
 
 	for (uint32_t i = 0; i < commandBufferCount; ++i)
 	{
@@ -940,24 +997,30 @@ void     VKAPI_CALL vkCmdExecuteCommands(VkCommandBuffer commandBuffer, uint32_t
 		data.buffer_detection.merge(secondary_data.buffer_detection);
 	}
 
-	GET_DEVICE_DISPATCH_PTR(CmdExecuteCommands, commandBuffer);
+	const PFN_vkCmdExecuteCommands trampoline = data.dispatch_table->CmdExecuteCommands;
+	assert(trampoline != nullptr);
 	trampoline(commandBuffer, commandBufferCount, pCommandBuffers);
 }
 
 void     VKAPI_CALL vkCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance)
 {
-	GET_DEVICE_DISPATCH_PTR(CmdDraw, commandBuffer);
+	// This is called very often, so only use the per-command buffer data (no look ups in shared tables)
+	auto &data = get_command_buffer_data(commandBuffer);
+
+	const PFN_vkCmdDraw trampoline = data.dispatch_table->CmdDraw;
+	assert(trampoline != nullptr);
 	trampoline(commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
 
-	auto &data = s_command_buffer_data.at(commandBuffer);
 	data.buffer_detection.on_draw(vertexCount * instanceCount);
 }
 void     VKAPI_CALL vkCmdDrawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
 {
-	GET_DEVICE_DISPATCH_PTR(CmdDrawIndexed, commandBuffer);
+	auto &data = get_command_buffer_data(commandBuffer);
+
+	const PFN_vkCmdDrawIndexed trampoline = data.dispatch_table->CmdDrawIndexed;
+	assert(trampoline != nullptr);
 	trampoline(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 
-	auto &data = s_command_buffer_data.at(commandBuffer);
 	data.buffer_detection.on_draw(indexCount * instanceCount);
 }
 
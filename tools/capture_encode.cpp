@@ -0,0 +1,171 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Converts the raw frames of a capture file written by ReShade (*.rsframes) into image files.
+// This does not depend on any Windows API, so it can also be built on other platforms, e.g. with:
+//   g++ -std=c++17 -O2 -Isource -Ideps/stb -Ideps/stb_image_dds tools/capture_encode.cpp deps/stb_impl.c -o capture_encode -lpthread
+
+#include "runtime_capture.hpp"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <stb_image_write.h>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options] <filename>
+
+Options:
+  -h, --help                Print this help.
+
+  -o <path>                 Write images to the given directory instead of next to the capture file.
+  --format <value>          Image format to write. Can be png (default) or bmp.
+  --first <value>           Index of the first frame to write, relative to the oldest frame in the file.
+  --count <value>           Maximum number of frames to write.
+  -j <value>                Number of frames to encode in parallel. Defaults to the number of processors.
+	)", path);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filename = nullptr;
+	const char *output_path = nullptr;
+	bool write_bmp = false;
+	size_t first_frame = 0;
+	size_t max_frames = std::numeric_limits<size_t>::max();
+	unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		if (const char *arg = argv[i]; arg[0] == '-')
+		{
+			if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+			{
+				print_usage(argv[0]);
+				return 0;
+			}
+
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return 1;
+			}
+
+			if (0 == std::strcmp(arg, "-o"))
+				output_path = argv[++i];
+			else if (0 == std::strcmp(arg, "--format"))
+				write_bmp = 0 == std::strcmp(argv[++i], "bmp");
+			else if (0 == std::strcmp(arg, "--first"))
+				first_frame = std::strtoul(argv[++i], nullptr, 10);
+			else if (0 == std::strcmp(arg, "--count"))
+				max_frames = std::strtoul(argv[++i], nullptr, 10);
+			else if (0 == std::strcmp(arg, "-j"))
+				num_threads = std::max(static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10)), 1u);
+			else
+			{
+				print_usage(argv[0]);
+				return 1;
+			}
+		}
+		else
+		{
+			filename = arg;
+		}
+	}
+
+	if (filename == nullptr)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		fprintf(stderr, "error: could not open %s\n", filename);
+		return 1;
+	}
+
+	reshade::capture_file_header header = {};
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		std::memcmp(header.magic, reshade::capture_file_header::expected_magic, sizeof(header.magic)) != 0 ||
+		header.version != reshade::capture_file_header::expected_version)
+	{
+		fprintf(stderr, "error: %s is not a supported capture file\n", filename);
+		return 1;
+	}
+
+	std::vector<reshade::capture_frame_header> table(header.frame_capacity);
+	if (!file.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(reshade::capture_frame_header)))
+	{
+		fprintf(stderr, "error: %s is truncated\n", filename);
+		return 1;
+	}
+
+	// Slots are filled as a ring, so sort them by sequence number to get the frames in the order they were captured
+	std::vector<uint32_t> frames;
+	for (uint32_t slot = 0; slot < header.frame_capacity; ++slot)
+		if (table[slot].sequence != 0)
+			frames.push_back(slot);
+	std::sort(frames.begin(), frames.end(), [&table](uint32_t a, uint32_t b) { return table[a].sequence < table[b].sequence; });
+
+	frames.erase(frames.begin(), frames.begin() + std::min(first_frame, frames.size()));
+	frames.resize(std::min(max_frames, frames.size()));
+
+	printf("%s: %ux%u, %llu frames captured, %zu frames to write\n", filename, header.width, header.height, static_cast<unsigned long long>(header.frame_count), frames.size());
+
+	std::filesystem::path output_base = output_path != nullptr ? std::filesystem::path(output_path) : std::filesystem::path(filename).parent_path();
+	output_base /= std::filesystem::path(filename).stem();
+
+	const size_t frame_size = size_t(header.width) * header.height * 4;
+
+	std::atomic<size_t> next_frame = 0;
+	std::atomic<size_t> num_failed = 0;
+	std::vector<std::thread> threads;
+
+	// Each thread reads and encodes whole frames through its own file stream, since encoding takes much longer than reading
+	for (unsigned int i = 0; i < std::min<size_t>(num_threads, frames.size()); ++i)
+	{
+		threads.emplace_back([&]() {
+			std::ifstream frame_file(filename, std::ios::binary);
+			std::vector<uint8_t> pixels(frame_size);
+
+			for (size_t index; (index = next_frame++) < frames.size();)
+			{
+				const uint32_t slot = frames[index];
+
+				char postfix[32];
+				snprintf(postfix, sizeof(postfix), "_%.6zu%s", index, write_bmp ? ".bmp" : ".png");
+				const std::string image_path = output_base.string() + postfix;
+
+				bool success = false;
+				if (frame_file.seekg(header.frame_offset + header.frame_stride * slot) && frame_file.read(reinterpret_cast<char *>(pixels.data()), frame_size))
+				{
+					if (write_bmp)
+						success = stbi_write_bmp(image_path.c_str(), header.width, header.height, 4, pixels.data()) != 0;
+					else
+						success = stbi_write_png(image_path.c_str(), header.width, header.height, 4, pixels.data(), 0) != 0;
+				}
+
+				if (!success)
+				{
+					frame_file.clear();
+					fprintf(stderr, "error: failed to write frame %zu to %s\n", index, image_path.c_str());
+					num_failed++;
+				}
+			}
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	return num_failed == 0 ? 0 : 1;
+}
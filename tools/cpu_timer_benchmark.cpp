@@ -0,0 +1,150 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Measures the overhead of the scoped CPU timers used to account for the time the runtime spends per effect and technique ('RESHADE_CPU_TIMER'),
+// compared with timing the same scope through 'std::chrono::high_resolution_clock', and the cost of folding the table into per-frame averages at the end of every frame.
+// The timer and table do not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/cpu_timer_benchmark.cpp source/cpu_timer.cpp -o cpu_timer_benchmark
+
+#include "cpu_timer.hpp"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -n <value>                Number of timed scopes per measurement. Defaults to 10000000.
+  -e <value>                Number of effects in the table. Defaults to 200.
+	)", path);
+}
+
+// Stands in for the work done in a timed scope, so that the compiler cannot remove the loops
+static volatile uint64_t sink = 0;
+
+template <typename F>
+static double measure(size_t num_iterations, F body)
+{
+	const auto start_time = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < num_iterations; ++i)
+		body(i);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count() / num_iterations;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_iterations = 10000000;
+	size_t num_effects = 200;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-n"))
+			num_iterations = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-e"))
+			num_effects = std::min<size_t>(std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1), reshade::cpu_timer_table::MAX_EFFECTS);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	reshade::cpu_timer_table table;
+	for (size_t effect_index = 0; effect_index < num_effects; ++effect_index)
+	{
+		table.clear_effect(effect_index);
+		table.allocate_technique_row();
+	}
+
+	const double baseline = measure(num_iterations, [](size_t i) {
+		sink = sink + i;
+	});
+	const double chrono = measure(num_iterations, [](size_t i) {
+		const auto start_time = std::chrono::high_resolution_clock::now();
+		sink = sink + i;
+		sink = sink + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+	});
+	const double scoped = measure(num_iterations, [&table, num_effects](size_t i) {
+		const reshade::scoped_cpu_timer timer(table, i % num_effects, i % num_effects, reshade::cpu_timer_category::render_technique);
+		sink = sink + i;
+	});
+
+	printf("empty scope:               %6.2f ns\n", baseline);
+	printf("high_resolution_clock:     %6.2f ns (+%.2f ns)\n", chrono, chrono - baseline);
+	printf("scoped_cpu_timer:          %6.2f ns (+%.2f ns)\n", scoped, scoped - baseline);
+
+	// Give the table some time to calibrate the time stamp counter before converting to nanoseconds
+	const auto calibration_start_time = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - calibration_start_time < std::chrono::milliseconds(20))
+		continue;
+
+	const size_t num_frames = std::max<size_t>(num_iterations / 1000, 1);
+	const double end_frame = measure(num_frames, [&table](size_t) {
+		table.end_frame();
+	});
+
+	printf("end_frame (%4zu effects):  %6.2f ns\n", num_effects, end_frame);
+
+	// Check that the calibrated timer agrees with the system clock, by timing a busy wait as loading time (which is kept as a total)
+	table.clear_effect(0);
+	const auto wait_start_time = std::chrono::steady_clock::now();
+	{
+		const reshade::scoped_cpu_timer timer(table, 0, reshade::cpu_timer_table::NO_ROW, reshade::cpu_timer_category::load);
+		while (std::chrono::steady_clock::now() - wait_start_time < std::chrono::milliseconds(10))
+			continue;
+	}
+	const double expected_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start_time).count();
+	const double measured_ms = table.effect_time(0, reshade::cpu_timer_category::load) * 1e-6;
+
+	printf("busy wait:                 %6.3f ms (system clock %.3f ms)\n", measured_ms, expected_ms);
+
+	if (measured_ms < expected_ms * 0.9 || measured_ms > expected_ms * 1.1)
+	{
+		fprintf(stderr, "error: CPU timer does not match the system clock\n");
+		return 1;
+	}
+
+	// Check that reloading a single effect over and over again does not use up the technique rows, the same way the runtime releases them when an effect is unloaded
+	std::vector<size_t> rows(8, reshade::cpu_timer_table::NO_ROW);
+	for (size_t reload = 0; reload < 4 * reshade::cpu_timer_table::MAX_TECHNIQUES; ++reload)
+	{
+		for (size_t &row : rows)
+		{
+			table.free_technique_row(row);
+			row = table.allocate_technique_row();
+
+			if (row == reshade::cpu_timer_table::NO_ROW)
+			{
+				fprintf(stderr, "error: technique rows ran out after reloading an effect %zu times\n", reload);
+				return 1;
+			}
+		}
+	}
+
+	printf("reloads:                   %zu without running out of technique rows\n", 4 * reshade::cpu_timer_table::MAX_TECHNIQUES);
+
+	return 0;
+}
@@ -0,0 +1,441 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Replays a depth-stencil trace recorded by ReShade (*.rsdepth) through the depth-buffer selection engine.
+// Every selection in the trace is repeated and compared against the recorded result, so this can be used to regression-test changes to the heuristics.
+// Alternatively generates a synthetic frame to benchmark the per-draw call accounting (and merging of multiple deferred contexts) without a trace.
+// This does not depend on any Windows API, so it can also be built on other platforms, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/depth_replay.cpp source/depth_selection.cpp -o depth_replay -lpthread
+
+#include "depth_selection.hpp"
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace reshade::depth_selection;
+using namespace reshade::depth_selection::trace_format;
+
+struct record
+{
+	trace_record_header header;
+	size_t offset; // Offset of the record data in the data buffer
+};
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options] <filename>
+       %s [options] --synthetic <draws> [--contexts <value>]
+
+Options:
+  -h, --help                Print this help.
+
+  -v, --verbose             Print the result of every selection.
+  --iterations <value>      Number of times to replay the trace to measure performance. Defaults to 1.
+  --synthetic <draws>       Benchmark a synthetic frame with the given number of draw calls instead of replaying a trace.
+  --contexts <value>        Also record the synthetic frame on this many deferred contexts in parallel and verify that merging them matches.
+	)", path, path);
+}
+
+struct synthetic_frame
+{
+	// Simulate a typical frame: A handful of depth-stencil resources (shadow maps, the main scene, some post-processing), which are rebound every few draw calls and cleared once per pass
+	static constexpr uint32_t num_resources = 8;
+	static constexpr uint32_t draws_per_bind = 16;
+	static constexpr uint32_t binds_per_clear = 32;
+
+	explicit synthetic_frame(unsigned long num_draws)
+	{
+		std::mt19937 rng(42);
+		vertices.resize(num_draws);
+		for (uint32_t &count : vertices)
+			count = 3 * (1 + rng() % 2000);
+		bindings.resize(num_draws / draws_per_bind + 1);
+		for (uint32_t &binding : bindings)
+			binding = rng() % num_resources;
+	}
+
+	/// <summary>
+	/// Record the bind blocks in the range [first_bind, last_bind) into the specified tracker.
+	/// </summary>
+	void record(tracker<> &target, size_t first_bind, size_t last_bind, std::chrono::high_resolution_clock::duration &draw_duration) const
+	{
+		target.reset_unused();
+
+		uint32_t slots[num_resources];
+		for (uint32_t i = 0; i < num_resources; ++i)
+			slots[i] = target.add(0x1000 + i, { 1920u >> (i % 3), 1080u >> (i % 3) });
+
+		for (size_t bind = first_bind; bind < last_bind; ++bind)
+		{
+			const uint32_t slot = slots[bindings[bind]];
+			target.bind(slot);
+			if (bind % binds_per_clear == 0)
+				target.on_clear(slot);
+
+			const size_t first = bind * draws_per_bind;
+			const size_t last = std::min(first + draws_per_bind, vertices.size());
+
+			const auto draw_start_time = std::chrono::high_resolution_clock::now();
+			for (size_t i = first; i < last; ++i)
+				target.on_draw(vertices[i]);
+			draw_duration += std::chrono::high_resolution_clock::now() - draw_start_time;
+		}
+	}
+
+	std::vector<uint32_t> vertices;
+	std::vector<uint32_t> bindings;
+};
+
+static int run_synthetic(unsigned long num_draws, unsigned long iterations, unsigned int num_contexts)
+{
+	const synthetic_frame frame(num_draws);
+
+	selection_options options;
+	options.width = 1920;
+	options.height = 1080;
+
+	// Record the entire frame on a single tracker first, to have a reference to compare the merged result of multiple contexts against
+	tracker<> reference;
+	std::chrono::high_resolution_clock::duration draw_duration = {}, total_duration = {};
+	uint32_t best_slot = tracker<>::npos;
+
+	for (unsigned long iteration = 0; iteration < iterations; ++iteration)
+	{
+		const auto start_time = std::chrono::high_resolution_clock::now();
+
+		frame.record(reference, 0, frame.bindings.size(), draw_duration);
+		best_slot = reference.find_best(options);
+
+		total_duration += std::chrono::high_resolution_clock::now() - start_time;
+	}
+
+	const double total_ns = std::chrono::duration<double, std::nano>(total_duration).count() / iterations;
+	const double draw_ns = std::chrono::duration<double, std::nano>(draw_duration).count() / iterations;
+	printf("synthetic frame with %lu draw calls on %u resources: selected slot %u\n", num_draws, synthetic_frame::num_resources, best_slot);
+	printf("frame took %.3f ms per iteration (%.2f ns per draw call, %.2f ns per draw call including binds, clears and selection)\n",
+		total_ns / 1000000.0, draw_ns / num_draws, total_ns / num_draws);
+
+	if (num_contexts <= 1)
+		return 0;
+
+	// Then split the frame across multiple deferred contexts, which each record on their own thread and are merged into the immediate one via snapshots (like command lists)
+	tracker<> immediate;
+	std::vector<std::unique_ptr<tracker<>>> contexts;
+	std::vector<tracker<>::snapshot> command_lists(num_contexts);
+	for (unsigned int i = 0; i < num_contexts; ++i)
+		contexts.push_back(std::make_unique<tracker<>>());
+
+	std::chrono::high_resolution_clock::duration merge_duration = {};
+	size_t num_entries = 0;
+
+	for (unsigned long iteration = 0; iteration < iterations; ++iteration)
+	{
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i < num_contexts; ++i)
+		{
+			threads.emplace_back([&, i]() {
+				std::chrono::high_resolution_clock::duration context_draw_duration = {};
+				frame.record(*contexts[i], frame.bindings.size() * i / num_contexts, frame.bindings.size() * (i + 1) / num_contexts, context_draw_duration);
+				contexts[i]->take_snapshot(command_lists[i]);
+			});
+		}
+		for (std::thread &thread : threads)
+			thread.join();
+
+		const auto start_time = std::chrono::high_resolution_clock::now();
+
+		immediate.reset_unused();
+		for (const tracker<>::snapshot &command_list : command_lists)
+			immediate.merge(command_list);
+
+		merge_duration += std::chrono::high_resolution_clock::now() - start_time;
+	}
+
+	for (const tracker<>::snapshot &command_list : command_lists)
+		num_entries += command_list.entries.size();
+
+	// Clears only count draw calls of the context they happen on, so only compare the totals, which have to be the same regardless of how the frame was split up
+	size_t num_mismatches = 0;
+	if (immediate.total_vertices() != reference.total_vertices() || immediate.total_drawcalls() != reference.total_drawcalls())
+		num_mismatches++;
+	for (const resource_counters &counters : reference.resources())
+	{
+		if (!counters.in_use)
+			continue;
+
+		const uint32_t slot = immediate.find(counters.handle);
+		if (slot == tracker<>::npos ||
+			immediate.counters(slot).total_stats.vertices != counters.total_stats.vertices ||
+			immediate.counters(slot).total_stats.drawcalls != counters.total_stats.drawcalls)
+		{
+			printf("resource 0x%016llx: merged counters do not match\n", static_cast<unsigned long long>(counters.handle));
+			num_mismatches++;
+		}
+	}
+
+	const uint32_t merged_best_slot = immediate.find_best(options);
+	if ((merged_best_slot == tracker<>::npos) != (best_slot == tracker<>::npos) ||
+		(best_slot != tracker<>::npos && immediate.counters(merged_best_slot).handle != reference.counters(best_slot).handle))
+	{
+		printf("merged selection does not match\n");
+		num_mismatches++;
+	}
+
+	const double merge_ns = std::chrono::duration<double, std::nano>(merge_duration).count() / iterations;
+	printf("merging %u contexts took %.3f us per iteration (%.2f ns per snapshot entry)\n", num_contexts, merge_ns / 1000.0, num_entries == 0 ? 0.0 : merge_ns / num_entries);
+
+	return num_mismatches == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filename = nullptr;
+	bool verbose = false;
+	unsigned long iterations = 1;
+	unsigned long synthetic_draws = 0;
+	unsigned int synthetic_contexts = 1;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		if (const char *arg = argv[i]; arg[0] == '-')
+		{
+			if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+			{
+				print_usage(argv[0]);
+				return 0;
+			}
+			if (0 == std::strcmp(arg, "-v") || 0 == std::strcmp(arg, "--verbose"))
+			{
+				verbose = true;
+				continue;
+			}
+
+			if (i + 1 >= argc)
+			{
+				print_usage(argv[0]);
+				return 1;
+			}
+
+			if (0 == std::strcmp(arg, "--iterations"))
+				iterations = std::max(std::strtoul(argv[++i], nullptr, 10), 1ul);
+			else if (0 == std::strcmp(arg, "--synthetic"))
+				synthetic_draws = std::max(std::strtoul(argv[++i], nullptr, 10), 1ul);
+			else if (0 == std::strcmp(arg, "--contexts"))
+				synthetic_contexts = std::max(static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10)), 1u);
+			else
+			{
+				print_usage(argv[0]);
+				return 1;
+			}
+		}
+		else
+		{
+			filename = arg;
+		}
+	}
+
+	if (synthetic_draws != 0)
+		return run_synthetic(synthetic_draws, iterations, synthetic_contexts);
+
+	if (filename == nullptr)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		fprintf(stderr, "error: could not open %s\n", filename);
+		return 1;
+	}
+
+	trace_file_header header = {};
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		std::memcmp(header.magic, trace_file_header::expected_magic, sizeof(header.magic)) != 0 ||
+		header.version != trace_file_header::expected_version)
+	{
+		fprintf(stderr, "error: %s is not a supported trace file\n", filename);
+		return 1;
+	}
+
+	// Read the entire trace into memory first, so that file access does not show up in the timings
+	std::vector<record> records;
+	std::vector<uint8_t> data;
+	size_t num_draws = 0;
+	size_t num_selects = 0;
+
+	for (record rec; file.read(reinterpret_cast<char *>(&rec.header), sizeof(rec.header));)
+	{
+		rec.offset = data.size();
+		data.resize(rec.offset + rec.header.size);
+
+		if (!file.read(reinterpret_cast<char *>(data.data() + rec.offset), rec.header.size))
+		{
+			fprintf(stderr, "warning: %s is truncated\n", filename);
+			break;
+		}
+
+		num_draws += rec.header.type == record_draw;
+		num_selects += rec.header.type == record_select;
+
+		records.push_back(rec);
+	}
+
+	printf("%s: %zu records, %zu draw calls, %zu selections\n", filename, records.size(), num_draws, num_selects);
+
+	size_t num_mismatches = 0;
+	std::chrono::high_resolution_clock::duration total_duration = {};
+
+	for (unsigned long iteration = 0; iteration < iterations; ++iteration)
+	{
+		std::unordered_map<uint64_t, std::unique_ptr<tracker<>>> streams;
+		const auto stream = [&streams](uint64_t id) -> tracker<> & {
+			std::unique_ptr<tracker<>> &stream = streams[id];
+			if (stream == nullptr)
+				stream = std::make_unique<tracker<>>();
+			return *stream;
+		};
+
+		size_t frame = 0;
+
+		const auto start_time = std::chrono::high_resolution_clock::now();
+
+		for (const record &rec : records)
+		{
+			const uint8_t *const rec_data = data.data() + rec.offset;
+			tracker<> &target = stream(rec.header.stream);
+
+			switch (rec.header.type)
+			{
+			case record_state:
+			{
+				const auto &state = *reinterpret_cast<const state_record *>(rec_data);
+
+				// Put resources back into the same slots, so that selection iterates them in the same order
+				std::vector<resource_counters> resources;
+				for (size_t i = 0, offset = sizeof(state); i < state.num_resources; ++i)
+				{
+					const auto &resource = *reinterpret_cast<const state_resource_record *>(rec_data + offset);
+					offset += sizeof(resource);
+
+					if (resource.slot >= resources.size())
+						resources.resize(resource.slot + 1);
+
+					resource_counters &counters = resources[resource.slot];
+					counters.handle = resource.handle;
+					counters.desc = resource.desc;
+					counters.in_use = true;
+					counters.total_stats = resource.total_stats;
+					counters.current_stats = resource.current_stats;
+					counters.clears.resize(resource.num_clears);
+					std::memcpy(counters.clears.data(), rec_data + offset, resource.num_clears * sizeof(draw_stats));
+					offset += resource.num_clears * sizeof(draw_stats);
+				}
+
+				target.restore(state.stats, state.has_indirect_drawcalls != 0, std::move(resources), state.has_bound ? &state.bound : nullptr);
+				break;
+			}
+			case record_reset:
+				switch (reinterpret_cast<const reset_record *>(rec_data)->mode)
+				{
+				case reset_keep_resources:
+					target.reset_stats();
+					break;
+				case reset_keep_used_resources:
+					target.reset_unused();
+					break;
+				default:
+					target.reset();
+					break;
+				}
+				break;
+			case record_add:
+				target.add(reinterpret_cast<const add_record *>(rec_data)->handle, reinterpret_cast<const add_record *>(rec_data)->desc);
+				break;
+			case record_remove:
+				target.remove(reinterpret_cast<const handle_record *>(rec_data)->handle);
+				break;
+			case record_bind:
+				if (const auto &bind = *reinterpret_cast<const bind_record *>(rec_data); bind.has_bound)
+					target.bind(target.add(bind.handle, {}));
+				else
+					target.bind(tracker<>::npos);
+				break;
+			case record_draw:
+				target.on_draw(reinterpret_cast<const draw_record *>(rec_data)->vertices);
+				break;
+			case record_clear:
+			{
+				const auto &clear = *reinterpret_cast<const clear_record *>(rec_data);
+				target.on_clear(target.add(clear.handle, {}), clear.fallback_stats);
+				break;
+			}
+			case record_clear_with_stats:
+			{
+				const auto &clear = *reinterpret_cast<const clear_record *>(rec_data);
+				target.on_clear_with_stats(target.add(clear.handle, {}), clear.fallback_stats);
+				break;
+			}
+			case record_merge:
+				target.merge(stream(reinterpret_cast<const merge_record *>(rec_data)->source));
+				break;
+			case record_select:
+			{
+				const auto &select = *reinterpret_cast<const select_record *>(rec_data);
+
+				selection_options options;
+				options.width = select.width;
+				options.height = select.height;
+				options.heuristic = static_cast<selection_heuristic>(select.heuristic);
+				options.exact_dimensions = select.exact_dimensions != 0;
+
+				const uint32_t best_slot = target.find_best(options, select.has_fallback ? target.find(select.fallback) : tracker<>::npos);
+
+				const bool has_result = best_slot != tracker<>::npos;
+				const resource_handle result = has_result ? target.counters(best_slot).handle : 0;
+
+				if (iteration == 0)
+				{
+					const bool matches = has_result == (select.has_result != 0) && result == select.result;
+					if (!matches)
+						num_mismatches++;
+
+					if (verbose || !matches)
+						printf("frame %zu: selected %s0x%016llx, recorded %s0x%016llx%s\n", frame,
+							has_result ? "" : "none ", static_cast<unsigned long long>(result),
+							select.has_result ? "" : "none ", static_cast<unsigned long long>(select.result),
+							matches ? "" : " (mismatch)");
+				}
+
+				frame++;
+				break;
+			}
+			default:
+				fprintf(stderr, "error: unknown record type %u\n", rec.header.type);
+				return 1;
+			}
+		}
+
+		total_duration += std::chrono::high_resolution_clock::now() - start_time;
+	}
+
+	const double total_ns = std::chrono::duration<double, std::nano>(total_duration).count() / iterations;
+	printf("replay took %.3f ms per iteration (%.2f ns per record)\n", total_ns / 1000000.0, records.empty() ? 0.0 : total_ns / records.size());
+
+	if (num_mismatches != 0)
+	{
+		printf("%zu of %zu selections did not match the recorded result\n", num_mismatches, num_selects);
+		return 1;
+	}
+
+	return 0;
+}
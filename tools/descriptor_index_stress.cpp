@@ -0,0 +1,306 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Stress tests the descriptor heap index used to find the depth-stencil resource of a D3D12 descriptor handle, by looking up synthetic handle values from many threads while another thread keeps creating heaps and views.
+// Some heaps are released and created again at the same addresses (or with the same object address) all the time, which makes the index remove the old ones and free their memory later, while look ups may still be using them.
+// Compares it with the previous scheme (a hash map guarded by a global mutex) and verifies that every look up returns the value last stored for a handle and that the memory of released heaps is freed.
+// Does not depend on D3D12, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/descriptor_index_stress.cpp -o descriptor_index_stress -lpthread
+
+#include "d3d12/descriptor_heap_index.hpp"
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+
+static std::atomic<ptrdiff_t> s_num_live_allocations = 0;
+
+// Count every allocation, so that the test can check that the memory of released heaps is freed again
+// This must not be inlined with GCC, which would otherwise see the 'malloc' call in callers and then warn about the 'operator delete' calls freeing it (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void *operator new(size_t size)
+{
+	s_num_live_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *const p = std::malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+	if (p != nullptr)
+		s_num_live_allocations.fetch_sub(1, std::memory_order_relaxed);
+	std::free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+	if (p != nullptr)
+		s_num_live_allocations.fetch_sub(1, std::memory_order_relaxed);
+	std::free(p);
+}
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -t <value>                Maximum number of recording threads doing look ups. Defaults to the number of processors.
+  -n <value>                Number of look ups each thread does. Defaults to 2000000.
+  -p <value>                Number of descriptor heaps created up front. Defaults to 64.
+	)", path);
+}
+
+struct resource
+{
+	uintptr_t handle; // Handle of the view this resource was last bound to, used to verify look ups
+};
+
+// Synthetic descriptor heap layout, similar to what drivers hand out (heaps are spread over the address space and have a fixed descriptor increment)
+static constexpr size_t descriptor_increment = 32;
+static constexpr size_t descriptors_per_heap = 128;
+
+static uintptr_t heap_base(size_t heap_index)
+{
+	return uintptr_t(0x10000000) + heap_index * 0x13000;
+}
+
+// Heaps that are released and created again, with varying sizes, so that a new heap may overlap two old ones
+static constexpr size_t num_transient_heaps = 16;
+
+static uintptr_t transient_heap_base(size_t heap_index)
+{
+	return uintptr_t(0x08000000) + heap_index * descriptors_per_heap * descriptor_increment;
+}
+static const void *transient_heap_object(size_t generation, size_t heap_index)
+{
+	// Objects are reused too, but not necessarily for a heap at the same address
+	return reinterpret_cast<const void *>(0x1000 + ((generation + heap_index) % (num_transient_heaps + 3)) * 0x100);
+}
+
+static void create_transient_heap(reshade::d3d12::descriptor_heap_index<resource> &index, std::vector<resource> &transient_resources, size_t generation, size_t heap_index)
+{
+	// Every other generation covers the next heap too
+	const size_t num_descriptors = (generation % 2 != 0 && heap_index + 1 < num_transient_heaps ? 2 : 1) * descriptors_per_heap;
+	index.register_heap(transient_heap_object(generation, heap_index), transient_heap_base(heap_index), num_descriptors, descriptor_increment);
+
+	for (size_t i = 0; i < num_descriptors; ++i)
+	{
+		resource &res = transient_resources[heap_index * descriptors_per_heap + i];
+		index.set(res.handle, &res);
+	}
+}
+
+class locked_map
+{
+public:
+	void register_heap(const void *, uintptr_t, size_t, size_t) {}
+
+	bool set(uintptr_t handle, resource *value)
+	{
+		const std::lock_guard<std::mutex> lock(_mutex);
+		_resources_by_handle[handle] = value;
+		return true;
+	}
+	resource *get(uintptr_t handle) const
+	{
+		const std::lock_guard<std::mutex> lock(_mutex);
+		if (const auto it = _resources_by_handle.find(handle); it != _resources_by_handle.end())
+			return it->second;
+		return nullptr;
+	}
+
+private:
+	mutable std::mutex _mutex;
+	std::unordered_map<uintptr_t, resource *> _resources_by_handle;
+};
+
+template <typename TIndex>
+static bool run(const char *name, size_t num_threads, size_t num_lookups, size_t num_heaps)
+{
+	TIndex index;
+	std::vector<resource> resources(num_heaps * descriptors_per_heap);
+
+	for (size_t heap_index = 0; heap_index < num_heaps; ++heap_index)
+	{
+		index.register_heap(resources.data() + heap_index * descriptors_per_heap, heap_base(heap_index), descriptors_per_heap, descriptor_increment);
+
+		for (size_t i = 0; i < descriptors_per_heap; ++i)
+		{
+			resource &res = resources[heap_index * descriptors_per_heap + i];
+			res.handle = heap_base(heap_index) + i * descriptor_increment;
+			index.set(res.handle, &res);
+		}
+	}
+
+	// Resources stay alive for the entire run, so that only memory owned by the index can be freed while in use
+	std::vector<resource> transient_resources(num_transient_heaps * descriptors_per_heap);
+	for (size_t i = 0; i < transient_resources.size(); ++i)
+		transient_resources[i].handle = transient_heap_base(0) + i * descriptor_increment;
+
+	if constexpr (std::is_same_v<TIndex, reshade::d3d12::descriptor_heap_index<resource>>)
+		for (size_t heap_index = 0; heap_index < num_transient_heaps; ++heap_index)
+			create_transient_heap(index, transient_resources, 0, heap_index);
+
+	std::atomic<bool> is_running = true;
+	std::atomic<size_t> num_errors = 0;
+
+	// Keep creating new heaps and views while the recording threads are running, to exercise growing the index concurrently, and release and create the transient heaps again
+	std::thread creation_thread([&index, &is_running, &transient_resources, num_heaps]() {
+		std::vector<resource> new_resources(4096);
+		for (size_t i = 0; is_running.load(std::memory_order_relaxed); ++i)
+		{
+			if (i < new_resources.size())
+			{
+				const size_t heap_index = num_heaps + i;
+				index.register_heap(new_resources.data() + i, heap_base(heap_index), descriptors_per_heap, descriptor_increment);
+
+				resource &res = new_resources[i];
+				res.handle = heap_base(heap_index);
+				index.set(res.handle, &res);
+			}
+
+			if constexpr (std::is_same_v<TIndex, reshade::d3d12::descriptor_heap_index<resource>>)
+				create_transient_heap(index, transient_resources, 1 + i / num_transient_heaps, i % num_transient_heaps);
+
+			std::this_thread::yield();
+		}
+	});
+
+	const auto start_time = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t thread_index = 0; thread_index < num_threads; ++thread_index)
+	{
+		threads.emplace_back([&index, &num_errors, thread_index, num_lookups, num_heaps]() {
+			std::mt19937 random(static_cast<unsigned int>(thread_index));
+			std::uniform_int_distribution<size_t> heap_distribution(0, num_heaps - 1);
+			std::uniform_int_distribution<size_t> descriptor_distribution(0, descriptors_per_heap - 1);
+
+			std::uniform_int_distribution<size_t> transient_distribution(0, num_transient_heaps * descriptors_per_heap - 1);
+
+			for (size_t i = 0; i < num_lookups; ++i)
+			{
+				if (i % 4 == 0)
+				{
+					// Descriptors of transient heaps may be looked up while their heap is replaced, in which case there is no value for a short time
+					const uintptr_t handle = transient_heap_base(0) + transient_distribution(random) * descriptor_increment;
+
+					if (const resource *const res = index.get(handle); res != nullptr && res->handle != handle)
+						num_errors++;
+					continue;
+				}
+
+				const uintptr_t handle = heap_base(heap_distribution(random)) + descriptor_distribution(random) * descriptor_increment;
+
+				if (const resource *const res = index.get(handle); res == nullptr || res->handle != handle)
+					num_errors++;
+			}
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	const double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	is_running.store(false);
+	creation_thread.join();
+
+	printf("%-8s %3zu threads: %8.3f ms, %12.0f look ups/s", name, num_threads, duration * 1000, (num_threads * num_lookups) / duration);
+
+	if (num_errors != 0)
+	{
+		printf(", %zu look ups returned the wrong resource\n", num_errors.load());
+		return false;
+	}
+
+	if constexpr (std::is_same_v<TIndex, reshade::d3d12::descriptor_heap_index<resource>>)
+	{
+		// Once no look up is running anymore, releasing and creating heaps again must not use any more memory
+		const ptrdiff_t num_live_allocations_before = s_num_live_allocations.load();
+		for (size_t generation = 0; generation < 1000; ++generation)
+			for (size_t heap_index = 0; heap_index < num_transient_heaps; ++heap_index)
+				create_transient_heap(index, transient_resources, generation, heap_index);
+		const ptrdiff_t num_leaked_allocations = s_num_live_allocations.load() - num_live_allocations_before;
+
+		// The ranges removed by the last registration are only freed by the next one
+		if (num_leaked_allocations > 4)
+		{
+			printf(", %td allocations of released heaps were not freed\n", num_leaked_allocations);
+			return false;
+		}
+	}
+
+	printf("\n");
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	size_t num_lookups = 2000000;
+	size_t num_heaps = 64;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-t"))
+			max_threads = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-n"))
+			num_lookups = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-p"))
+			num_heaps = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+	{
+		success &= run<locked_map>("locked", num_threads, num_lookups, num_heaps);
+		success &= run<reshade::d3d12::descriptor_heap_index<resource>>("index", num_threads, num_lookups, num_heaps);
+	}
+
+	return success ? 0 : 1;
+}
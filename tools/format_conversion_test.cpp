@@ -0,0 +1,289 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the pixel format conversions the runtimes use for screenshots and texture uploads ('format_conversion.hpp') against the scalar loops they replaced.
+// Every conversion is run on all 2^32 possible input pixels, on all buffer lengths and alignments up to a few vectors (to cover the scalar tails) and in-place where that is allowed.
+// Afterwards measures the throughput of both for a 1920x1080 image. Exits with a non-zero code on any mismatch.
+// Does not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/format_conversion_test.cpp source/format_conversion.cpp -o format_conversion_test
+// Add '-DRESHADE_FORMAT_CONVERSION_SSE2=0' to check and measure the scalar code path of the conversions instead of the SSE2 one.
+
+#include "format_conversion.hpp"
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+  -q, --quick               Only check every 257th input pixel instead of all of them.
+  -n <value>                Number of iterations of the throughput measurement. Defaults to 100.
+	)", path);
+}
+
+// The loops the runtimes used before the shared conversions, one byte at a time
+static void reference_rgbx8_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap_rb)
+{
+	for (size_t i = 0; i < count * 4; i += 4)
+	{
+		const uint8_t r = src[i + 0], g = src[i + 1], b = src[i + 2];
+		dst[i + 0] = swap_rb ? b : r;
+		dst[i + 1] = g;
+		dst[i + 2] = swap_rb ? r : b;
+		dst[i + 3] = 0xFF;
+	}
+}
+static void reference_rgb10a2_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, bool swap_rb)
+{
+	for (size_t i = 0; i < count * 4; i += 4)
+	{
+		const uint32_t rgba = src[i + 0] | (src[i + 1] << 8) | (src[i + 2] << 16) | (static_cast<uint32_t>(src[i + 3]) << 24);
+		// Divide by 4 to get 10-bit range (0-1023) into 8-bit range (0-255)
+		const uint8_t r = ((rgba & 0x3FF) / 4) & 0xFF;
+		const uint8_t g = (((rgba & 0xFFC00) >> 10) / 4) & 0xFF;
+		const uint8_t b = (((rgba & 0x3FF00000) >> 20) / 4) & 0xFF;
+		dst[i + 0] = swap_rb ? b : r;
+		dst[i + 1] = g;
+		dst[i + 2] = swap_rb ? r : b;
+		dst[i + 3] = 0xFF;
+	}
+}
+static void reference_rgba8_to_r8(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = src[i * 4];
+}
+static void reference_rgba8_to_rg8(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		dst[i * 2 + 0] = src[i * 4 + 0],
+		dst[i * 2 + 1] = src[i * 4 + 1];
+}
+static void reference_rgba8_to_bgra8(uint8_t *dst, const uint8_t *src, size_t count, unsigned int channels)
+{
+	for (size_t i = 0; i < count * 4; i += 4)
+	{
+		const uint8_t r = src[i + 0], g = src[i + 1], b = src[i + 2], a = src[i + 3];
+		dst[i + 0] = channels >= 3 ? b : 0;
+		dst[i + 1] = channels >= 2 ? g : 0;
+		dst[i + 2] = r;
+		dst[i + 3] = channels >= 4 ? a : 0xFF;
+	}
+}
+
+struct conversion
+{
+	const char *name;
+	size_t dst_bytes_per_pixel;
+	bool in_place; // Whether source and destination may be the same buffer
+	void(*convert)(uint8_t *dst, const uint8_t *src, size_t count);
+	void(*reference)(uint8_t *dst, const uint8_t *src, size_t count);
+};
+
+static const conversion conversions[] = {
+	{ "rgbx8_to_rgba8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgbx8_to_rgba8(dst, src, count, false); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgbx8_to_rgba8(dst, src, count, false); } },
+	{ "bgrx8_to_rgba8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgbx8_to_rgba8(dst, src, count, true); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgbx8_to_rgba8(dst, src, count, true); } },
+	{ "rgb10a2_to_rgba8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgb10a2_to_rgba8(dst, src, count, false); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgb10a2_to_rgba8(dst, src, count, false); } },
+	{ "bgr10a2_to_rgba8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgb10a2_to_rgba8(dst, src, count, true); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgb10a2_to_rgba8(dst, src, count, true); } },
+	{ "rgba8_to_r8", 1, false,
+		reshade::convert_rgba8_to_r8,
+		reference_rgba8_to_r8 },
+	{ "rgba8_to_rg8", 2, false,
+		reshade::convert_rgba8_to_rg8,
+		reference_rgba8_to_rg8 },
+	{ "r8_to_bgra8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgba8_to_bgra8(dst, src, count, 1); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgba8_to_bgra8(dst, src, count, 1); } },
+	{ "rg8_to_bgra8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgba8_to_bgra8(dst, src, count, 2); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgba8_to_bgra8(dst, src, count, 2); } },
+	{ "rgb8_to_bgra8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgba8_to_bgra8(dst, src, count, 3); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgba8_to_bgra8(dst, src, count, 3); } },
+	{ "rgba8_to_bgra8", 4, true,
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reshade::convert_rgba8_to_bgra8(dst, src, count, 4); },
+		[](uint8_t *dst, const uint8_t *src, size_t count) { reference_rgba8_to_bgra8(dst, src, count, 4); } },
+};
+
+static void fill_pixels(std::vector<uint8_t> &pixels, uint64_t first_value, uint64_t step)
+{
+	for (size_t i = 0; i < pixels.size(); i += 4)
+	{
+		const uint32_t value = static_cast<uint32_t>(first_value + (i / 4) * step);
+		std::memcpy(pixels.data() + i, &value, 4);
+	}
+}
+
+// Runs a conversion on every possible input pixel (or every 'step'th one), in chunks that fit into the cache
+static bool check_all_values(const conversion &c, uint64_t step)
+{
+	const size_t chunk_size = 1 << 16;
+
+	std::vector<uint8_t> src(chunk_size * 4);
+	std::vector<uint8_t> dst(chunk_size * c.dst_bytes_per_pixel);
+	std::vector<uint8_t> expected(chunk_size * c.dst_bytes_per_pixel);
+
+	for (uint64_t first_value = 0; first_value < (1ull << 32); first_value += chunk_size * step)
+	{
+		const size_t count = static_cast<size_t>(std::min<uint64_t>(chunk_size, ((1ull << 32) - first_value + step - 1) / step));
+
+		fill_pixels(src, first_value, step);
+
+		c.convert(dst.data(), src.data(), count);
+		c.reference(expected.data(), src.data(), count);
+
+		if (std::memcmp(dst.data(), expected.data(), count * c.dst_bytes_per_pixel) != 0)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (std::memcmp(dst.data() + i * c.dst_bytes_per_pixel, expected.data() + i * c.dst_bytes_per_pixel, c.dst_bytes_per_pixel) == 0)
+					continue;
+
+				uint32_t input = 0, actual_output = 0, expected_output = 0;
+				std::memcpy(&input, src.data() + i * 4, 4);
+				std::memcpy(&actual_output, dst.data() + i * c.dst_bytes_per_pixel, c.dst_bytes_per_pixel);
+				std::memcpy(&expected_output, expected.data() + i * c.dst_bytes_per_pixel, c.dst_bytes_per_pixel);
+				printf("%-18s FAILED for input 0x%08x: 0x%08x instead of 0x%08x\n", c.name, input, actual_output, expected_output);
+				break;
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Runs a conversion on short buffers at every alignment, so that both the vector loops and the scalar tails are used, and checks that nothing outside the output is written
+static bool check_lengths(const conversion &c)
+{
+	const size_t max_count = 67;
+	const size_t guard_size = 16;
+
+	std::mt19937 random(1);
+
+	std::vector<uint8_t> src(max_count * 4 + guard_size * 2);
+	std::vector<uint8_t> dst(max_count * 4 + guard_size * 2);
+	std::vector<uint8_t> expected(max_count * 4 + guard_size * 2);
+
+	for (size_t count = 0; count <= max_count; ++count)
+	{
+		for (size_t alignment = 0; alignment < guard_size; ++alignment)
+		{
+			for (uint8_t &value : src)
+				value = static_cast<uint8_t>(random());
+			std::memset(dst.data(), 0xCD, dst.size());
+			std::memset(expected.data(), 0xCD, expected.size());
+
+			c.convert(dst.data() + alignment, src.data() + guard_size - alignment, count);
+			c.reference(expected.data() + alignment, src.data() + guard_size - alignment, count);
+
+			if (dst != expected)
+			{
+				printf("%-18s FAILED for %zu pixels at alignment %zu\n", c.name, count, alignment);
+				return false;
+			}
+
+			if (!c.in_place)
+				continue;
+
+			std::memcpy(dst.data(), src.data(), src.size());
+			c.convert(dst.data() + alignment, dst.data() + alignment, count);
+			std::memcpy(expected.data(), src.data(), src.size());
+			c.reference(expected.data() + alignment, expected.data() + alignment, count);
+
+			if (dst != expected)
+			{
+				printf("%-18s FAILED in-place for %zu pixels at alignment %zu\n", c.name, count, alignment);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void benchmark(const conversion &c, size_t num_iterations)
+{
+	const size_t count = 1920 * 1080;
+
+	std::vector<uint8_t> src(count * 4);
+	std::vector<uint8_t> dst(count * c.dst_bytes_per_pixel);
+	fill_pixels(src, 0x12345678, 0x9E3779B9);
+
+	const auto measure = [&](void(*convert)(uint8_t *, const uint8_t *, size_t)) {
+		convert(dst.data(), src.data(), count); // Warm up
+		const auto start_time = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < num_iterations; ++i)
+			convert(dst.data(), src.data(), count);
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count() / num_iterations;
+	};
+
+	const double convert_duration = measure(c.convert);
+	const double reference_duration = measure(c.reference);
+
+	printf("%-18s %7.3f ms (%6.2f GB/s), reference %7.3f ms (%6.2f GB/s), %5.2fx\n", c.name,
+		convert_duration * 1000, src.size() / convert_duration / 1e9,
+		reference_duration * 1000, src.size() / reference_duration / 1e9,
+		reference_duration / convert_duration);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t step = 1;
+	size_t num_iterations = 100;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (0 == std::strcmp(arg, "-q") || 0 == std::strcmp(arg, "--quick"))
+			step = 257;
+		else if (0 == std::strcmp(arg, "-n") && i + 1 < argc)
+			num_iterations = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	for (const conversion &c : conversions)
+	{
+		if (!check_all_values(c, step) || !check_lengths(c))
+		{
+			success = false;
+			continue;
+		}
+
+		printf("%-18s ok\n", c.name);
+	}
+
+	for (const conversion &c : conversions)
+		benchmark(c, num_iterations);
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the frame time histogram ('frame_time_histogram') against exact statistics: every bucket has to contain exactly the durations between its bounds (in particular around powers of two, where the bucket size doubles),
+// and the percentiles it reports for several frame time distributions have to be within the documented error of the exact nearest-rank percentiles of the recorded durations.
+// Exits with a non-zero code if any check fails. Does not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/frame_time_histogram_test.cpp source/runtime_frame_stats.cpp -o frame_time_histogram_test
+
+#include "runtime_frame_stats.hpp"
+#include <memory>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using reshade::frame_time_histogram;
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -n <value>                Number of durations recorded per distribution. Defaults to 1000000.
+	)", path);
+}
+
+// Finds the bucket a duration was recorded in, by recording it into an otherwise empty histogram
+static size_t find_bucket(frame_time_histogram &histogram, uint64_t value)
+{
+	histogram.clear();
+	histogram.record(value);
+	for (size_t index = 0; index < frame_time_histogram::NUM_BUCKETS; ++index)
+		if (histogram.bucket_count(index) != 0)
+			return index;
+	return frame_time_histogram::NUM_BUCKETS;
+}
+
+static bool test_bucket_bounds(frame_time_histogram &histogram)
+{
+	bool success = true;
+
+	// The buckets have to cover all durations without gaps or overlap
+	if (frame_time_histogram::bucket_lower_bound(0) != 0 || frame_time_histogram::bucket_upper_bound(frame_time_histogram::NUM_BUCKETS - 1) != UINT64_MAX)
+	{
+		printf("%-40s FAILED: first bucket starts at %llu, last bucket ends at %llu\n", "bucket coverage",
+			(unsigned long long)frame_time_histogram::bucket_lower_bound(0), (unsigned long long)frame_time_histogram::bucket_upper_bound(frame_time_histogram::NUM_BUCKETS - 1));
+		success = false;
+	}
+	for (size_t index = 0; index + 1 < frame_time_histogram::NUM_BUCKETS && success; ++index)
+	{
+		const uint64_t lower = frame_time_histogram::bucket_lower_bound(index);
+		const uint64_t upper = frame_time_histogram::bucket_upper_bound(index);
+		if (upper < lower || frame_time_histogram::bucket_lower_bound(index + 1) != upper + 1)
+		{
+			printf("%-40s FAILED: bucket %zu is [%llu, %llu], the next one starts at %llu\n", "bucket coverage", index,
+				(unsigned long long)lower, (unsigned long long)upper, (unsigned long long)frame_time_histogram::bucket_lower_bound(index + 1));
+			success = false;
+		}
+		// The size of a bucket is at most 1 / SUB_BUCKETS of the durations it contains, which bounds the error of reported percentiles
+		else if (lower >= 2 * frame_time_histogram::SUB_BUCKETS && (upper - lower + 1) * frame_time_histogram::SUB_BUCKETS > lower)
+		{
+			printf("%-40s FAILED: bucket %zu is [%llu, %llu], which is too large\n", "bucket coverage", index, (unsigned long long)lower, (unsigned long long)upper);
+			success = false;
+		}
+	}
+	if (success)
+		printf("%-40s ok\n", "bucket coverage");
+
+	// Durations around every power of two (and the bucket bounds themselves) have to be recorded in the bucket whose bounds contain them
+	bool round_trip = true;
+	for (unsigned int bit = 0; bit < 64 && round_trip; ++bit)
+	{
+		const uint64_t power = uint64_t(1) << bit;
+		for (const uint64_t value : { power - 1, power, power + 1, power + power / 2, power * 2 - 1 })
+		{
+			const size_t index = find_bucket(histogram, value);
+			if (index == frame_time_histogram::NUM_BUCKETS ||
+				value < frame_time_histogram::bucket_lower_bound(index) ||
+				value > frame_time_histogram::bucket_upper_bound(index))
+			{
+				printf("%-40s FAILED: %llu was recorded in bucket %zu\n", "bucket round-trip at powers of two", (unsigned long long)value, index);
+				round_trip = false;
+				break;
+			}
+		}
+	}
+	for (size_t index = 0; index < frame_time_histogram::NUM_BUCKETS && round_trip; ++index)
+	{
+		const size_t lower_index = find_bucket(histogram, frame_time_histogram::bucket_lower_bound(index));
+		const size_t upper_index = find_bucket(histogram, frame_time_histogram::bucket_upper_bound(index));
+		if (lower_index != index || upper_index != index)
+		{
+			printf("%-40s FAILED: bounds of bucket %zu were recorded in buckets %zu and %zu\n", "bucket round-trip at powers of two", index, lower_index, upper_index);
+			round_trip = false;
+		}
+	}
+	if (round_trip)
+		printf("%-40s ok\n", "bucket round-trip at powers of two");
+
+	return success && round_trip;
+}
+
+static bool test_percentiles(frame_time_histogram &histogram, const char *name, std::vector<uint64_t> values)
+{
+	histogram.clear();
+	for (const uint64_t value : values)
+		histogram.record(value);
+
+	std::sort(values.begin(), values.end());
+
+	bool success = histogram.count() == values.size() && histogram.max() == values.back();
+
+	// Percentages in tenths of a percent, so that the exact rank can be computed with integers
+	for (const unsigned int permille : { 0u, 1u, 10u, 100u, 500u, 900u, 950u, 990u, 999u, 1000u })
+	{
+		const size_t rank = std::max<size_t>((permille * values.size() + 999) / 1000, 1);
+		const uint64_t exact = values[rank - 1];
+		const uint64_t reported = histogram.percentile(permille / 10.0);
+
+		// The reported duration is the end of the bucket containing the exact one (or the maximum), so never less than it and at most one bucket size more
+		if (reported < exact || reported - exact > exact / frame_time_histogram::SUB_BUCKETS)
+		{
+			printf("%-40s FAILED: %.1f%% percentile is %llu instead of %llu\n", name, permille / 10.0, (unsigned long long)reported, (unsigned long long)exact);
+			success = false;
+		}
+	}
+
+	if (success)
+		printf("%-40s ok (p99 %.3f ms, p99.9 %.3f ms)\n", name, histogram.percentile(99) * 1e-6, histogram.percentile(99.9) * 1e-6);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_values = 1000000;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-n"))
+			num_values = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// The histogram is too large for the stack
+	const auto histogram = std::make_unique<frame_time_histogram>();
+
+	bool success = test_bucket_bounds(*histogram);
+
+	std::mt19937_64 random(1);
+	std::vector<uint64_t> values(num_values);
+
+	// Steady 60 FPS with a little jitter and occasional stutters
+	std::normal_distribution<double> jitter(16'666'666.0, 500'000.0);
+	for (uint64_t &value : values)
+		value = random() % 500 == 0 ? 50'000'000 + random() % 50'000'000 : static_cast<uint64_t>(std::max(jitter(random), 1.0));
+	success &= test_percentiles(*histogram, "percentiles of 60 FPS with stutters", values);
+
+	// Frame times spread over many powers of two, from microseconds to seconds
+	std::lognormal_distribution<double> spread(16.0, 2.0);
+	for (uint64_t &value : values)
+		value = static_cast<uint64_t>(std::min(spread(random), 1e10));
+	success &= test_percentiles(*histogram, "percentiles of a wide distribution", values);
+
+	// Small durations, which are counted exactly
+	for (uint64_t &value : values)
+		value = random() % (2 * frame_time_histogram::SUB_BUCKETS);
+	success &= test_percentiles(*histogram, "percentiles of exact buckets", values);
+
+	// Durations beyond the largest bucket, of which only the maximum is known
+	for (uint64_t &value : values)
+		value = (uint64_t(1) << frame_time_histogram::MAX_VALUE_BITS) + random() % 1'000'000'000;
+	values.back() = (uint64_t(1) << frame_time_histogram::MAX_VALUE_BITS) + 1'000'000'000;
+	histogram->clear();
+	for (const uint64_t value : values)
+		histogram->record(value);
+	if (histogram->percentile(50) != values.back() || histogram->percentile(100) != values.back())
+	{
+		printf("%-40s FAILED: 50%% percentile is %llu instead of the maximum %llu\n", "percentiles beyond the largest bucket", (unsigned long long)histogram->percentile(50), (unsigned long long)values.back());
+		success = false;
+	}
+	else
+	{
+		printf("%-40s ok\n", "percentiles beyond the largest bucket");
+	}
+
+	return success ? 0 : 1;
+}
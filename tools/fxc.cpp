@@ -6,6 +6,8 @@
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
 #include "effect_preprocessor.hpp"
+#include "effect_pass_graph.hpp"
+#include "trace_recorder.hpp"
 #include "version.h"
 #include <cstdlib>
 #include <cstring>
@@ -35,6 +37,8 @@ Options:
   --height                  Value of the 'BUFFER_HEIGHT' preprocessor macro.
   --invert-y                Insert code to invert the Y component of the output position in vertex shaders (only applies to SPIR-V).
   --spec-constants          Convert uniform variables to specialization constants.
+  --schedule                Print the compiled pass schedule of each technique.
+  --trace <file>            Write a Chrome trace (JSON) of the time spent in each compilation stage to the given file.
 
   -Zi                       Enable debug information.
 	)", path);
@@ -46,6 +50,7 @@ int main(int argc, char *argv[])
 	const char *preprocess = nullptr;
 	const char *errorfile = nullptr;
 	const char *objectfile = nullptr;
+	const char *tracefile = nullptr;
 	const char *buffer_width = "800";
 	const char *buffer_height = "600";
 	bool print_glsl = false;
@@ -53,6 +58,7 @@ int main(int argc, char *argv[])
 	bool debug_info = false;
 	bool invert_y_axis = false;
 	bool spec_constants = false;
+	bool print_schedule = false;
 	unsigned int shader_model = 50;
 
 	reshadefx::parser parser;
@@ -101,6 +107,8 @@ int main(int argc, char *argv[])
 				invert_y_axis = true;
 			else if (0 == std::strcmp(arg, "--spec-constants"))
 				spec_constants = true;
+			else if (0 == std::strcmp(arg, "--schedule"))
+				print_schedule = true;
 
 			if (i + 1 >= argc)
 				continue;
@@ -116,6 +124,8 @@ int main(int argc, char *argv[])
 				buffer_width = argv[++i];
 			else if (0 == std::strcmp(arg, "--height"))
 				buffer_height = argv[++i];
+			else if (0 == std::strcmp(arg, "--trace"))
+				tracefile = argv[++i];
 		}
 		else
 		{
@@ -135,12 +145,32 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	// Write the trace on every exit path below, so that failed compilations can be looked at too
+	struct trace_writer
+	{
+		~trace_writer()
+		{
+			if (path == nullptr)
+				return;
+			reshade::trace::stop();
+			if (!reshade::trace::write(path))
+				std::cout << "error: Failed to write trace to " << path << std::endl;
+		}
+
+		const char *path;
+	} const trace_writer { tracefile };
+
+	if (tracefile != nullptr)
+		reshade::trace::start();
+
+	RESHADE_TRACE_SCOPE("compile", filename);
+
 	pp.add_macro_definition("BUFFER_WIDTH", buffer_width);
 	pp.add_macro_definition("BUFFER_HEIGHT", buffer_height);
 	pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
 	pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
 
-	if (!pp.append_file(filename))
+	if (RESHADE_TRACE_SCOPE("preprocess"); !pp.append_file(filename))
 	{
 		if (errorfile == nullptr)
 			std::cout << pp.errors() << std::endl;
@@ -166,7 +196,7 @@ int main(int argc, char *argv[])
 	else
 		backend.reset(reshadefx::create_codegen_spirv(true, debug_info, spec_constants, invert_y_axis));
 
-	if (!parser.parse(pp.output(), backend.get()))
+	if (RESHADE_TRACE_SCOPE("parse"); !parser.parse(pp.output(), backend.get()))
 	{
 		if (errorfile == nullptr)
 			std::cout << pp.errors() << parser.errors() << std::endl;
@@ -176,7 +206,37 @@ int main(int argc, char *argv[])
 	}
 
 	reshadefx::module module;
-	backend->write_result(module);
+	{ RESHADE_TRACE_SCOPE("write_result");
+		backend->write_result(module);
+	}
+
+	if (print_schedule)
+	{
+		for (const reshadefx::technique_info &technique : module.techniques)
+		{
+			RESHADE_TRACE_SCOPE("compile_pass_graph", technique.name.c_str());
+
+			const reshadefx::pass_schedule schedule = reshadefx::compile_pass_graph(module, technique);
+
+			printf("technique %s: %zu of %zu passes scheduled, %zu transient textures in %u alias slots\n",
+				technique.name.c_str(), schedule.passes.size(), technique.passes.size(), schedule.transient_textures.size(), schedule.num_alias_slots);
+
+			for (const reshadefx::scheduled_pass &scheduled : schedule.passes)
+			{
+				printf("  pass %u:%s%s%s%s", scheduled.pass_index,
+					scheduled.copy_backbuffer ? " copy-backbuffer" : "",
+					scheduled.clear_render_targets ? " clear" : "",
+					scheduled.begin_render_pass ? " begin" : "",
+					scheduled.end_render_pass ? " end" : "");
+				if (scheduled.generate_mipmaps != 0)
+					printf(" mipmaps=0x%02x", scheduled.generate_mipmaps);
+				printf("\n");
+			}
+
+			for (const reshadefx::transient_texture &lifetime : schedule.transient_textures)
+				printf("  transient %s: passes %u-%u, alias slot %u\n", lifetime.unique_name.c_str(), lifetime.first_pass, lifetime.last_pass, lifetime.alias_slot);
+		}
+	}
 
 	if (print_glsl || print_hlsl)
 	{
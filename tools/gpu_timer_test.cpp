@@ -0,0 +1,307 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the GPU time measurement of techniques: the ring of timestamp query slots ('query_ring'), the statistics over the recorded samples ('duration_statistics') and the conversion of timestamps to durations ('technique::append_gpu_timestamps').
+// Covers wraparound of the ring and the statistics window, queries that complete out of order on the GPU, the nearest-rank percentiles and tick counts that would overflow a naive conversion to nanoseconds.
+// Exits with a non-zero code if any check fails. Does not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/gpu_timer_test.cpp -o gpu_timer_test
+
+#include "runtime_objects.hpp"
+#include <deque>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace reshade;
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -f <value>                Number of frames to simulate (at least 1000). Defaults to 100000.
+	)", path);
+}
+
+static bool s_success = true;
+
+#define CHECK(name, condition, ...) \
+	if (!(condition)) { printf("%-40s FAILED: ", name); printf(__VA_ARGS__); printf("\n"); s_success = false; } else printf("%-40s ok\n", name)
+
+// The nearest-rank percentile, computed by sorting all samples
+static uint64_t reference_percentile(std::vector<uint64_t> samples, unsigned int percent)
+{
+	if (samples.empty())
+		return 0;
+	std::sort(samples.begin(), samples.end());
+	size_t rank = (percent * samples.size() + 99) / 100; // Ceiling of percent / 100 * count
+	if (rank == 0)
+		rank = 1;
+	return samples[rank - 1];
+}
+
+static void test_query_ring(size_t num_frames)
+{
+	// Issue and read back queries in lockstep for long enough that the counters pass through the slots many times
+	{
+		query_ring<NUM_GPU_QUERY_FRAMES> ring;
+		bool valid = true;
+		for (size_t frame = 0; frame < num_frames && valid; ++frame)
+		{
+			size_t slot = ~size_t(0), pending_slot = ~size_t(0);
+			valid = ring.push(slot) && slot == frame % NUM_GPU_QUERY_FRAMES && ring.oldest_pending(pending_slot) && pending_slot == slot;
+			ring.pop();
+			valid = valid && !ring.oldest_pending(pending_slot);
+		}
+		CHECK("ring wraparound in lockstep", valid, "slot indices did not follow the issue order");
+	}
+
+	// All slots in flight: Pushing fails until the oldest one is read back, after which exactly that slot is reused
+	{
+		query_ring<NUM_GPU_QUERY_FRAMES> ring;
+		size_t slot = 0;
+		for (size_t i = 0; i < NUM_GPU_QUERY_FRAMES; ++i)
+			ring.push(slot);
+		const bool full = !ring.push(slot);
+		size_t oldest = ~size_t(0);
+		ring.oldest_pending(oldest);
+		ring.pop();
+		const bool reused = ring.push(slot) && slot == oldest && !ring.push(slot);
+		CHECK("ring full", full && oldest == 0 && reused, "full=%d oldest=%zu reused=%d", full, oldest, reused);
+	}
+}
+
+// Simulates a GPU that finishes the queries of each frame after a random number of frames, so later frames may complete before earlier ones.
+// The read back loop is the one the runtimes use: read the oldest pending slot until one is not available yet.
+static void test_out_of_order_completion(size_t num_frames)
+{
+	struct slot_contents
+	{
+		size_t frame;
+		size_t complete_frame;
+		uint64_t timestamps[3];
+	};
+
+	reshadefx::technique_info info;
+	info.passes.resize(3);
+	technique technique(info);
+	// The second pass was removed by the pass graph, so it must not get any samples
+	technique.schedule.passes.resize(2);
+	technique.schedule.passes[0].pass_index = 0;
+	technique.schedule.passes[1].pass_index = 2;
+
+	std::mt19937 random(1);
+	query_ring<NUM_GPU_QUERY_FRAMES> ring;
+	slot_contents slots[NUM_GPU_QUERY_FRAMES] = {};
+
+	std::vector<size_t> read_frames;
+	size_t num_skipped_frames = 0;
+	bool wrong_slot = false;
+
+	for (size_t frame = 0; frame < num_frames + 64; ++frame)
+	{
+		for (size_t slot; ring.oldest_pending(slot); ring.pop())
+		{
+			if (slots[slot].complete_frame > frame)
+				break;
+
+			wrong_slot |= !read_frames.empty() && slots[slot].frame <= read_frames.back();
+			read_frames.push_back(slots[slot].frame);
+			technique.append_gpu_timestamps(slots[slot].timestamps, 1'000'000'000);
+		}
+
+		if (frame >= num_frames)
+			continue; // Only drain the remaining queries
+
+		if (size_t slot; ring.push(slot))
+		{
+			// Most frames complete within a frame or two, but some take much longer
+			const size_t latency = random() % 16 == 0 ? 4 + random() % 12 : random() % 3;
+			// Durations encode the frame, so that the statistics can be checked against the read frames
+			const uint64_t begin = frame * 1'000'000;
+			slots[slot] = { frame, frame + latency, { begin, begin + 100 + frame % 7, begin + 300 + frame % 7 } };
+		}
+		else
+		{
+			num_skipped_frames++;
+		}
+	}
+
+	bool complete = read_frames.size() + num_skipped_frames == num_frames;
+
+	// Compare the statistics with those of the last samples in the order they were read back
+	std::vector<uint64_t> expected_total, expected_first;
+	for (size_t i = read_frames.size() > 120 ? read_frames.size() - 120 : 0; i < read_frames.size(); ++i)
+	{
+		expected_total.push_back(300 + read_frames[i] % 7);
+		expected_first.push_back(100 + read_frames[i] % 7);
+	}
+
+	const bool statistics_match =
+		technique.gpu_duration.count() == expected_total.size() &&
+		technique.gpu_duration.percentile(95) == reference_percentile(expected_total, 95) &&
+		technique.gpu_duration.max() == *std::max_element(expected_total.begin(), expected_total.end()) &&
+		technique.pass_gpu_durations.size() == 3 &&
+		technique.pass_gpu_durations[0].percentile(50) == reference_percentile(expected_first, 50) &&
+		technique.pass_gpu_durations[1].count() == 0 &&
+		technique.pass_gpu_durations[2].max() == 200;
+
+	CHECK("out-of-order completion", !wrong_slot && complete && num_skipped_frames != 0 && statistics_match,
+		"wrong_slot=%d, %zu read + %zu skipped of %zu frames, statistics_match=%d", wrong_slot, read_frames.size(), num_skipped_frames, num_frames, statistics_match);
+}
+
+static void test_duration_statistics(size_t num_frames)
+{
+	std::mt19937_64 random(2);
+
+	// Compare against a plain list of the most recent samples, both before and after the window filled up
+	duration_statistics<120> statistics;
+	std::deque<uint64_t> window;
+	bool valid = statistics.count() == 0 && statistics.mean() == 0 && statistics.percentile(95) == 0;
+	size_t first_mismatch = 0;
+
+	for (size_t i = 0; i < num_frames && valid; ++i)
+	{
+		// Include runs of equal values, so that ties around the rank are covered too
+		const uint64_t value = random() % 4 == 0 ? 16'666'666 : random() % 50'000'000;
+		statistics.append(value);
+		window.push_back(value);
+		if (window.size() > 120)
+			window.pop_front();
+
+		const std::vector<uint64_t> samples(window.begin(), window.end());
+		uint64_t sum = 0;
+		for (const uint64_t sample : samples)
+			sum += sample;
+
+		valid = statistics.count() == samples.size() &&
+			statistics.mean() == sum / samples.size() &&
+			statistics.min() == *std::min_element(samples.begin(), samples.end()) &&
+			statistics.max() == *std::max_element(samples.begin(), samples.end());
+
+		for (const unsigned int percent : { 0u, 1u, 50u, 95u, 99u, 100u })
+			valid = valid && statistics.percentile(percent) == reference_percentile(samples, percent);
+
+		if (!valid)
+			first_mismatch = i;
+	}
+	CHECK("statistics window wraparound", valid, "statistics differ from reference after %zu samples", first_mismatch + 1);
+
+	// Nearest rank of small sample counts, where rounding matters most
+	duration_statistics<120> small;
+	for (uint64_t value = 1; value <= 20; ++value)
+		small.append(value);
+	const bool rank_valid =
+		small.percentile(0) == 1 &&   // Rank is at least one
+		small.percentile(5) == 1 &&   // 5% of 20 = 1
+		small.percentile(6) == 2 &&   // 6% of 20 = 1.2, rounded up
+		small.percentile(95) == 19 && // 95% of 20 = 19
+		small.percentile(96) == 20 &&
+		small.percentile(100) == 20 &&
+		small.percentile(200) == 20;  // Clamped to 100%
+	CHECK("percentile rank", rank_valid, "p0=%llu p5=%llu p6=%llu p95=%llu p96=%llu p100=%llu p200=%llu",
+		(unsigned long long)small.percentile(0), (unsigned long long)small.percentile(5), (unsigned long long)small.percentile(6), (unsigned long long)small.percentile(95),
+		(unsigned long long)small.percentile(96), (unsigned long long)small.percentile(100), (unsigned long long)small.percentile(200));
+
+	statistics.clear();
+	CHECK("statistics clear", statistics.count() == 0 && statistics.max() == 0 && statistics.percentile(50) == 0, "samples remained after clearing");
+}
+
+static void test_tick_conversion()
+{
+	struct test_case
+	{
+		uint64_t begin, end, frequency, expected_nanoseconds;
+	};
+
+	const test_case cases[] = {
+		// D3D frequency of 3 GHz over 7 million seconds: 'ticks * 1e9' would overflow
+		{ 0, 3'000'000'000ull * 7'000'000, 3'000'000'000, 7'000'000'000'000'000 },
+		// A third of a second on top of that, which is only exact if the remainder is converted separately
+		{ 0, 3'000'000'000ull * 7'000'000 + 1'000'000'000, 3'000'000'000, 7'000'000'333'333'333 },
+		// HPET frequency over a year and a half second, starting at a large counter value
+		{ 1ull << 62, (1ull << 62) + 14'318'180ull * 31'536'000 + 7'159'090, 14'318'180, 31'536'000'500'000'000 },
+		// Vulkan timestamp period of 52.08 ns (19.2 MHz)
+		{ 1000, 1000 + 19'200'000ull * 3600 + 1, 19'200'000, 3'600'000'000'052 },
+		// Nanosecond ticks (OpenGL) are passed through unchanged, even close to the limit
+		{ 0, ~0ull, 1'000'000'000, ~0ull },
+		// Non-monotonic timestamps are clamped to zero
+		{ 5000, 4000, 1'000'000'000, 0 },
+		{ ~0ull, 0, 3'000'000'000, 0 },
+	};
+
+	reshadefx::technique_info info;
+	info.passes.resize(1);
+	technique technique(info);
+	technique.schedule.passes.resize(1);
+
+	bool valid = true;
+	for (const test_case &c : cases)
+	{
+		technique.clear_gpu_durations();
+		const uint64_t timestamps[2] = { c.begin, c.end };
+		technique.append_gpu_timestamps(timestamps, c.frequency);
+
+		const uint64_t actual = technique.gpu_duration.max();
+		if (actual != c.expected_nanoseconds || technique.pass_gpu_durations[0].max() != c.expected_nanoseconds)
+		{
+			printf("%-40s FAILED: %llu ticks at %llu Hz converted to %llu ns instead of %llu ns\n", "tick conversion",
+				(unsigned long long)(c.end - c.begin), (unsigned long long)c.frequency, (unsigned long long)actual, (unsigned long long)c.expected_nanoseconds);
+			valid = false;
+		}
+	}
+
+	// A frequency of zero (reported by a disjoint query) must not record anything
+	technique.clear_gpu_durations();
+	const uint64_t timestamps[2] = { 0, 1000 };
+	technique.append_gpu_timestamps(timestamps, 0);
+	valid &= technique.gpu_duration.count() == 0;
+
+	if (valid)
+		printf("%-40s ok\n", "tick conversion");
+	s_success &= valid;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_frames = 100000;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-f"))
+			num_frames = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1000);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	test_query_ring(num_frames);
+	test_out_of_order_completion(num_frames);
+	test_duration_statistics(num_frames);
+	test_tick_conversion();
+
+	return s_success ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Stress tests the lock-free table the Vulkan layer uses to associate data with handles, by adding and erasing keys from many threads while other threads keep looking them up and reading their values.
+// Every value owns heap memory, so a value that is destroyed while another thread still reads it shows up as a mismatch (or as an error when built with '-fsanitize=address').
+// Afterwards measures look up throughput, both for keys that exist and for keys that do not (which probe until the next empty entry), and compares it with the previous schemes:
+// the linear lock-free table the Vulkan layer used before (copied below, since it no longer exists in the source tree) and a hash map guarded by a shared mutex.
+// Look ups of missing keys assert in debug builds, so those are only measured with 'NDEBUG' defined.
+// Does not depend on Vulkan, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -DNDEBUG -Isource tools/lockfree_table_stress.cpp -o lockfree_table_stress -lpthread
+
+#include "vulkan/lockfree_table.hpp"
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <shared_mutex>
+#include <unordered_map>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -t <value>                Maximum number of threads. Defaults to the number of processors.
+  -n <value>                Number of operations each thread does. Defaults to 1000000.
+  -k <value>                Number of keys each writing thread adds and erases, and number of keys in the look up benchmark. Defaults to 256.
+	)", path);
+}
+
+struct value
+{
+	value() = default;
+	explicit value(uint64_t key) : key(key), payload(16, key) {}
+	~value() { key = 0; }
+
+	uint64_t key = 0; // Zero for the default value returned when a key does not exist
+	std::vector<uint64_t> payload;
+};
+
+// Checks a value that was looked up for the specified key, returns false if it was destroyed or belongs to another key
+static bool verify(const value &value, uint64_t key)
+{
+	if (value.key == 0)
+		return true; // Key was not in the table at the time of the look up
+
+	if (value.key != key || value.payload.size() != 16)
+		return false;
+	for (const uint64_t item : value.payload)
+		if (item != key)
+			return false;
+	return true;
+}
+
+static bool stress(size_t num_threads, size_t num_operations, size_t num_keys)
+{
+	lockfree_table<uint64_t, value, 64> table;
+
+	// Half of the threads add and erase their own range of keys, the other half reads random keys of all ranges
+	const size_t num_writers = std::max<size_t>(num_threads / 2, 1);
+	const size_t num_readers = std::max<size_t>(num_threads - num_writers, 1);
+
+	std::atomic<size_t> num_errors = 0;
+	std::atomic<size_t> num_hits = 0;
+
+	const auto start_time = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t writer_index = 0; writer_index < num_writers; ++writer_index)
+	{
+		threads.emplace_back([&table, &num_errors, writer_index, num_operations, num_keys]() {
+			std::mt19937 random(static_cast<unsigned int>(writer_index));
+			std::vector<bool> is_present(num_keys);
+
+			for (size_t i = 0; i < num_operations; ++i)
+			{
+				const size_t index = random() % num_keys;
+				const uint64_t key = 1 + writer_index * num_keys + index;
+
+				if (is_present[index])
+				{
+					if (i % 2 == 0)
+					{
+						value erased_value;
+						if (!table.erase(key, erased_value) || erased_value.key != key)
+							num_errors++;
+					}
+					else if (!table.erase(key))
+					{
+						num_errors++;
+					}
+				}
+				else
+				{
+					table.emplace(key, value(key));
+
+					// Only this thread modifies this key, so it has to be found right away
+					const lockfree_epoch::guard guard;
+					if (const value &added_value = table.at(key); added_value.key != key || !verify(added_value, key))
+						num_errors++;
+				}
+
+				is_present[index] = !is_present[index];
+			}
+
+			for (size_t index = 0; index < num_keys; ++index)
+				if (is_present[index])
+					table.erase(1 + writer_index * num_keys + index);
+		});
+	}
+	for (size_t reader_index = 0; reader_index < num_readers; ++reader_index)
+	{
+		threads.emplace_back([&table, &num_errors, &num_hits, reader_index, num_operations, num_keys, num_writers]() {
+			std::mt19937 random(static_cast<unsigned int>(1000 + reader_index));
+			size_t hits = 0;
+
+			for (size_t i = 0; i < num_operations; ++i)
+			{
+				const uint64_t key = 1 + random() % (num_writers * num_keys);
+
+				const lockfree_epoch::guard guard;
+
+				const value &found_value = table.at(key);
+
+				// Give writers a chance to erase the value while it is being used
+				if (i % 64 == 0)
+					std::this_thread::yield();
+
+				if (!verify(found_value, key))
+					num_errors++;
+				hits += found_value.key != 0;
+			}
+
+			num_hits += hits;
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	const double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	printf("stress   %3zu writers, %3zu readers: %8.3f ms, %zu of %zu look ups found a value", num_writers, num_readers, duration * 1000, num_hits.load(), num_readers * num_operations);
+
+	if (num_errors != 0)
+	{
+		printf(", %zu operations returned a destroyed or wrong value\n", num_errors.load());
+		return false;
+	}
+
+	printf("\n");
+	return true;
+}
+
+// The table the Vulkan layer used before it was replaced with 'lockfree_table': A fixed-size array searched linearly (starting at a hashed index for large tables), with every value allocated separately
+// Keys "zero" and "one" are reserved, and erasing deletes the value right away, so this is only used for the look up benchmark
+template <typename TKey, typename TValue, size_t MAX_ENTRIES>
+class linear_lockfree_table
+{
+public:
+	~linear_lockfree_table()
+	{
+		for (size_t i = 0; i < MAX_ENTRIES; ++i)
+			if (const TKey key = _data[i].first.load(std::memory_order_relaxed); key != no_value && key != update_value)
+				delete _data[i].second;
+	}
+
+	static constexpr TKey no_value = (TKey)0;
+	static constexpr TKey update_value = (TKey)1;
+
+	TValue &at(TKey key) const
+	{
+		size_t start_index = 0;
+		if constexpr (MAX_ENTRIES > 512)
+			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
+
+		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
+			if (_data[i].first.load(std::memory_order_acquire) == key)
+				return *_data[i].second;
+
+		return _default;
+	}
+
+	TValue &emplace(TKey key, const TValue &value)
+	{
+		size_t start_index = 0;
+		if constexpr (MAX_ENTRIES > 512)
+			start_index = std::hash<TKey>()(key) % (MAX_ENTRIES / 2);
+
+		TValue *new_value = new TValue(value);
+
+		for (size_t i = start_index; i < MAX_ENTRIES; ++i)
+		{
+			if (TKey test_key = _data[i].first.load(std::memory_order_relaxed);
+				test_key == no_value &&
+				_data[i].first.compare_exchange_strong(test_key, update_value, std::memory_order_relaxed))
+			{
+				_data[i].second = new_value;
+				_data[i].first.store(key, std::memory_order_release);
+				return *new_value;
+			}
+		}
+
+		delete new_value;
+		return _default;
+	}
+
+private:
+	mutable TValue _default = {};
+	std::pair<std::atomic<TKey>, TValue *> _data[MAX_ENTRIES] = {};
+};
+
+class locked_map
+{
+public:
+	void emplace(uint64_t key, const value &new_value)
+	{
+		const std::unique_lock<std::shared_mutex> lock(_mutex);
+		_values.emplace(key, new_value);
+	}
+	const value &at(uint64_t key) const
+	{
+		const std::shared_lock<std::shared_mutex> lock(_mutex);
+		if (const auto it = _values.find(key); it != _values.end())
+			return it->second;
+		return _default;
+	}
+
+private:
+	const value _default = {};
+	mutable std::shared_mutex _mutex;
+	std::unordered_map<uint64_t, value> _values;
+};
+
+// Vulkan handles are usually pointers to driver objects, so the look up benchmark uses aligned addresses as keys (which 'std::hash' does not mix)
+static uint64_t handle_key(size_t index)
+{
+	return 0x10000 + index * 64;
+}
+
+template <typename TTable, bool GUARD, bool MISS>
+static bool benchmark(const char *name, size_t num_threads, size_t num_operations, size_t num_keys)
+{
+	const auto table = std::make_unique<TTable>();
+	for (size_t index = 0; index < num_keys; ++index)
+		table->emplace(handle_key(index), value(handle_key(index)));
+
+	std::atomic<size_t> num_errors = 0;
+
+	const auto start_time = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t thread_index = 0; thread_index < num_threads; ++thread_index)
+	{
+		threads.emplace_back([&table, &num_errors, thread_index, num_operations, num_keys]() {
+			std::mt19937 random(static_cast<unsigned int>(thread_index));
+			size_t errors = 0;
+
+			for (size_t i = 0; i < num_operations; ++i)
+			{
+				// Missing keys are taken from a range of the same size right after the keys that were added
+				const uint64_t key = handle_key((MISS ? num_keys : 0) + random() % num_keys);
+				const uint64_t expected_key = MISS ? 0 : key;
+
+				if constexpr (GUARD)
+				{
+					const lockfree_epoch::guard guard;
+					errors += table->at(key).key != expected_key;
+				}
+				else
+				{
+					errors += table->at(key).key != expected_key;
+				}
+			}
+
+			num_errors += errors;
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	const double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	printf("%-8s %-4s %3zu threads: %8.3f ms, %12.0f look ups/s", name, MISS ? "miss" : "hit", num_threads, duration * 1000, (num_threads * num_operations) / duration);
+
+	if (num_errors != 0)
+	{
+		printf(", %zu look ups returned the wrong value\n", num_errors.load());
+		return false;
+	}
+
+	printf("\n");
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_threads = std::max(std::thread::hardware_concurrency(), 2u);
+	size_t num_operations = 1000000;
+	size_t num_keys = 256;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-t"))
+			max_threads = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 2);
+		else if (0 == std::strcmp(arg, "-n"))
+			num_operations = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-k"))
+			num_keys = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	for (size_t num_threads = 2; num_threads <= max_threads; num_threads *= 2)
+		success &= stress(num_threads, num_operations, num_keys);
+
+	// The linear table has to be large enough for all keys, like the fixed sizes the Vulkan layer used for it
+	// The new table starts out small, so that it has to grow (and migrate its entries) a few times while the keys are added
+	for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+	{
+		success &= benchmark<locked_map, false, false>("locked", num_threads, num_operations, num_keys);
+		success &= benchmark<linear_lockfree_table<uint64_t, value, 4096>, false, false>("linear", num_threads, num_operations, num_keys);
+		success &= benchmark<lockfree_table<uint64_t, value, 16>, false, false>("table", num_threads, num_operations, num_keys);
+		success &= benchmark<lockfree_table<uint64_t, value, 16>, true, false>("guarded", num_threads, num_operations, num_keys);
+#ifdef NDEBUG
+		success &= benchmark<locked_map, false, true>("locked", num_threads, num_operations, num_keys);
+		success &= benchmark<linear_lockfree_table<uint64_t, value, 4096>, false, true>("linear", num_threads, num_operations, num_keys);
+		success &= benchmark<lockfree_table<uint64_t, value, 16>, false, true>("table", num_threads, num_operations, num_keys);
+		success &= benchmark<lockfree_table<uint64_t, value, 16>, true, true>("guarded", num_threads, num_operations, num_keys);
+#endif
+	}
+
+	return success ? 0 : 1;
+}
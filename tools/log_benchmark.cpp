@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Measures how fast multiple threads can log messages, comparing the previous logging scheme (a global lock held while formatting, with a flush per line)
+// with the asynchronous one used by 'reshade::log' (per-thread formatting, lock-free queue and a background writer that writes in batches).
+// The Windows specific parts of 'dll_log.cpp' (time stamps, thread pool) are replaced with standard equivalents, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/log_benchmark.cpp -o log_benchmark -lpthread
+
+#include "lockfree_queue.hpp"
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+#include <condition_variable>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -o <path>                 Log file to write to. Defaults to a file in the temporary directory.
+  -t <value>                Number of threads logging at the same time. Defaults to the number of processors.
+  -n <value>                Number of messages each thread logs. Defaults to 20000.
+	)", path);
+}
+
+static constexpr size_t max_history_lines = 4096;
+
+static void format_prefix(std::ostringstream &line, size_t thread_index)
+{
+	line << std::right << std::setfill('0')
+		<< std::setw(2) << 12 << ':' << std::setw(2) << 34 << ':' << std::setw(2) << 56 << ':' << std::setw(3) << 789 << ' '
+		<< '[' << std::setw(5) << thread_index << ']' << std::setfill(' ') << " | " << "INFO " << " | " << std::left;
+}
+
+namespace locked_log
+{
+	static std::mutex message_mutex;
+	static std::ostringstream line;
+	static std::vector<std::string> lines;
+	static std::ofstream file;
+
+	static void log(size_t thread_index, size_t message_index)
+	{
+		const std::lock_guard<std::mutex> lock(message_mutex);
+
+		line.str("");
+		line.clear();
+		format_prefix(line, thread_index);
+		line << "Message " << message_index << " with some typical payload " << 0x80004005 << " and " << 3.14159f;
+
+		std::string line_string = line.str();
+		lines.push_back(line_string);
+
+		file << line_string << std::endl;
+	}
+}
+
+namespace async_log
+{
+	static thread_local std::ostringstream line;
+	static lockfree_queue<std::string> pending_lines;
+	static std::atomic<size_t> num_pending_lines = 0;
+	static std::atomic<bool> is_writing = false;
+	static std::ofstream file;
+	static std::mutex history_mutex;
+	static std::vector<std::string> history_lines;
+	static size_t history_start = 0;
+	static size_t num_batches = 0;
+
+	// Stands in for the thread pool work object used on Windows
+	static std::mutex wake_mutex;
+	static std::condition_variable wake_condition;
+	static bool is_write_scheduled = false;
+	static bool is_stopping = false;
+
+	static void write_pending_lines()
+	{
+		std::string batch;
+		std::vector<std::string> lines;
+
+		for (std::string line; pending_lines.pop(line);)
+		{
+			num_pending_lines.fetch_sub(1);
+
+			batch += line;
+			batch += '\n';
+			lines.push_back(std::move(line));
+		}
+
+		if (lines.empty())
+			return;
+
+		file.write(batch.data(), batch.size());
+		file.flush();
+		num_batches++;
+
+		const std::lock_guard<std::mutex> lock(history_mutex);
+
+		for (std::string &line : lines)
+		{
+			if (history_lines.size() < max_history_lines)
+			{
+				history_lines.push_back(std::move(line));
+			}
+			else
+			{
+				history_lines[history_start] = std::move(line);
+				history_start = (history_start + 1) % max_history_lines;
+			}
+		}
+	}
+
+	static void background_writer()
+	{
+		while (true)
+		{
+			{	std::unique_lock<std::mutex> lock(wake_mutex);
+				wake_condition.wait(lock, []() { return is_write_scheduled || is_stopping; });
+				if (!is_write_scheduled && is_stopping)
+					break;
+				is_write_scheduled = false;
+			}
+
+			// Same as 'background_writer_callback' in 'dll_log.cpp'
+			do
+			{
+				write_pending_lines();
+
+				is_writing.store(false);
+			} while (num_pending_lines.load() != 0 && !is_writing.exchange(true));
+		}
+	}
+
+	static void log(size_t thread_index, size_t message_index)
+	{
+		line.str("");
+		line.clear();
+		line.flags(std::ios::dec | std::ios::left | std::ios::showbase);
+		format_prefix(line, thread_index);
+		line << "Message " << message_index << " with some typical payload " << 0x80004005 << " and " << 3.14159f;
+
+		pending_lines.push(line.str());
+		num_pending_lines.fetch_add(1);
+
+		if (!is_writing.exchange(true))
+		{
+			{	const std::lock_guard<std::mutex> lock(wake_mutex);
+				is_write_scheduled = true;
+			}
+			wake_condition.notify_one();
+		}
+	}
+}
+
+template <typename F>
+static double run_threads(size_t num_threads, size_t num_messages, F log)
+{
+	std::vector<std::thread> threads;
+	const auto start_time = std::chrono::high_resolution_clock::now();
+
+	for (size_t thread_index = 0; thread_index < num_threads; ++thread_index)
+	{
+		threads.emplace_back([&log, thread_index, num_messages]() {
+			for (size_t message_index = 0; message_index < num_messages; ++message_index)
+				log(thread_index, message_index);
+		});
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+}
+
+static size_t count_lines(const std::filesystem::path &path)
+{
+	std::ifstream file(path);
+	return std::count(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>(), '\n');
+}
+
+int main(int argc, char *argv[])
+{
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "reshade_log_benchmark.log";
+	size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	size_t num_messages = 20000;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-o"))
+			path = argv[++i];
+		else if (0 == std::strcmp(arg, "-t"))
+			num_threads = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-n"))
+			num_messages = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	const size_t total_messages = num_threads * num_messages;
+	printf("%zu threads logging %zu messages each to %s\n", num_threads, num_messages, path.u8string().c_str());
+
+	locked_log::file.open(path, std::ios::out | std::ios::trunc);
+	const double locked_duration = run_threads(num_threads, num_messages, locked_log::log);
+	locked_log::file.close();
+	const size_t locked_lines = count_lines(path);
+
+	printf("locked: %8.3f ms, %10.0f messages/s, %zu lines written, %zu lines kept in memory\n",
+		locked_duration * 1000, total_messages / locked_duration, locked_lines, locked_log::lines.size());
+
+	async_log::file.open(path, std::ios::out | std::ios::trunc);
+	std::thread writer_thread(async_log::background_writer);
+	const auto async_start_time = std::chrono::high_resolution_clock::now();
+	const double async_duration = run_threads(num_threads, num_messages, async_log::log);
+
+	// Also measure the time until everything reached the file, so that no work is hidden in the background writer
+	{	const std::lock_guard<std::mutex> lock(async_log::wake_mutex);
+		async_log::is_stopping = true;
+	}
+	async_log::wake_condition.notify_one();
+	writer_thread.join();
+	async_log::write_pending_lines(); // Pick up lines whose thread lost the race for the writing flag just before the writer stopped
+	const double async_total_duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - async_start_time).count();
+	async_log::file.close();
+	const size_t async_lines = count_lines(path);
+
+	printf("async:  %8.3f ms, %10.0f messages/s, %zu lines written in %zu batches (%.3f ms until written), %zu lines kept in memory\n",
+		async_duration * 1000, total_messages / async_duration, async_lines, async_log::num_batches, async_total_duration * 1000, async_log::history_lines.size());
+
+	if (locked_lines != total_messages || async_lines != total_messages)
+	{
+		fprintf(stderr, "error: expected %zu lines in the log file\n", total_messages);
+		return 1;
+	}
+
+	printf("speedup: %.2fx\n", locked_duration / async_duration);
+
+	return 0;
+}
@@ -0,0 +1,312 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the pass schedules the effect pass graph compiler ('reshadefx::compile_pass_graph') produces for small hand-written techniques against the expected ones.
+// Covers removal of dead passes, merging of adjacent passes, elision of mipmap regeneration and back buffer copies, as well as the alias slots of transient textures and which of them are aliased.
+// Exits with a non-zero code if any schedule does not match. Does not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/pass_graph_test.cpp source/effect_pass_graph.cpp -o pass_graph_test
+
+#include "effect_pass_graph.hpp"
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+  -v, --verbose             Print the schedules of all techniques, not just of those that do not match.
+	)", path);
+}
+
+static void add_texture(reshadefx::module &module, const char *name, uint32_t width = 1920, uint32_t height = 1080, uint32_t levels = 1, const char *semantic = "")
+{
+	reshadefx::texture_info &info = module.textures.emplace_back();
+	info.unique_name = name;
+	info.semantic = semantic;
+	info.width = width;
+	info.height = height;
+	info.levels = levels;
+}
+
+// Adds a "transient" annotation to a texture, which opts it into aliasing with other textures in its alias slot
+static void add_transient_annotation(reshadefx::module &module, const char *name)
+{
+	for (reshadefx::texture_info &info : module.textures)
+	{
+		if (info.unique_name != name)
+			continue;
+
+		reshadefx::annotation &annotation = info.annotations.emplace_back();
+		annotation.type.base = reshadefx::type::t_bool;
+		annotation.type.rows = 1;
+		annotation.type.cols = 1;
+		annotation.name = "transient";
+		annotation.value.as_uint[0] = 1;
+	}
+}
+
+// Adds a pass that renders to the specified targets (or the back buffer if there are none) and samples the specified textures
+static reshadefx::pass_info &add_pass(reshadefx::technique_info &technique, std::initializer_list<const char *> render_targets, std::initializer_list<const char *> sampled, bool clear = false)
+{
+	reshadefx::pass_info &pass = technique.passes.emplace_back();
+	size_t k = 0;
+	for (const char *name : render_targets)
+		pass.render_target_names[k++] = name;
+	for (const char *name : sampled)
+		pass.sampled_texture_names.push_back(name);
+	pass.clear_render_targets = clear;
+	return pass;
+}
+
+// Formats a schedule the same way as 'fxc --schedule' does, but on a single line
+static std::string format_schedule(const reshadefx::pass_schedule &schedule)
+{
+	std::string result;
+
+	for (const reshadefx::scheduled_pass &scheduled : schedule.passes)
+	{
+		if (!result.empty())
+			result += "; ";
+
+		result += std::to_string(scheduled.pass_index);
+		if (scheduled.copy_backbuffer)
+			result += " copy-backbuffer";
+		if (scheduled.clear_render_targets)
+			result += " clear";
+		if (scheduled.begin_render_pass)
+			result += " begin";
+		if (scheduled.end_render_pass)
+			result += " end";
+		if (scheduled.generate_mipmaps != 0)
+		{
+			char mipmaps[16];
+			snprintf(mipmaps, sizeof(mipmaps), " mipmaps=0x%02x", scheduled.generate_mipmaps);
+			result += mipmaps;
+		}
+	}
+
+	for (const reshadefx::transient_texture &lifetime : schedule.transient_textures)
+		result += " | " + lifetime.unique_name + " " + std::to_string(lifetime.first_pass) + "-" + std::to_string(lifetime.last_pass) + " slot " + std::to_string(lifetime.alias_slot);
+
+	return result;
+}
+
+static bool check(const char *name, const reshadefx::module &module, size_t technique_index, const std::string &expected, bool verbose)
+{
+	const std::string actual = format_schedule(reshadefx::compile_pass_graph(module, module.techniques[technique_index]));
+
+	if (actual != expected)
+	{
+		printf("%-28s FAILED\n  expected: %s\n  actual:   %s\n", name, expected.c_str(), actual.c_str());
+		return false;
+	}
+
+	if (verbose)
+		printf("%-28s ok: %s\n", name, actual.c_str());
+	else
+		printf("%-28s ok\n", name);
+	return true;
+}
+
+static bool check_aliases(const char *name, const reshadefx::module &module, size_t technique_index, const std::string &expected, bool verbose)
+{
+	std::string actual;
+	for (const auto &[unique_name, replacement_unique_name] : reshadefx::find_texture_aliases(module, reshadefx::compile_pass_graph(module, module.techniques[technique_index])))
+		actual += (actual.empty() ? "" : ", ") + unique_name + " -> " + replacement_unique_name;
+
+	if (actual != expected)
+	{
+		printf("%-28s FAILED\n  expected: %s\n  actual:   %s\n", name, expected.c_str(), actual.c_str());
+		return false;
+	}
+
+	if (verbose)
+		printf("%-28s ok: %s\n", name, actual.c_str());
+	else
+		printf("%-28s ok\n", name);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	bool verbose = false;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (0 == std::strcmp(arg, "-v") || 0 == std::strcmp(arg, "--verbose"))
+			verbose = true;
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	// Dead pass removal: The first pass is cleared by the second one before anything samples it, while passes writing the back buffer or using the stencil buffer are always kept
+	{
+		reshadefx::module module;
+		add_texture(module, "A");
+		add_texture(module, "B");
+		reshadefx::technique_info &technique = module.techniques.emplace_back();
+		add_pass(technique, { "A" }, {});
+		add_pass(technique, { "A" }, {}, true);
+		add_pass(technique, { "B" }, {}).stencil_enable = true;
+		add_pass(technique, { "B" }, {}, true);
+		add_pass(technique, {}, { "A", "B" });
+		add_pass(technique, {}, {});
+
+		success &= check("dead pass removal", module, 0,
+			"1 clear begin end; 2 begin end; 3 clear begin end; 4 begin; 5 end | A 0-3 slot 0", verbose);
+	}
+
+	// Merging: Passes with the same render targets are merged unless there is a clear or different render state in between
+	{
+		reshadefx::module module;
+		add_texture(module, "A");
+		add_texture(module, "B");
+		add_texture(module, "C");
+		reshadefx::technique_info &technique = module.techniques.emplace_back();
+		add_pass(technique, { "A" }, { "C" }, true);
+		add_pass(technique, { "A" }, { "C" });
+		add_pass(technique, { "B" }, { "A" }, true);
+		add_pass(technique, { "B" }, {}).viewport_width = 960; // Different viewport
+		add_pass(technique, { "A", "B" }, {});
+		add_pass(technique, { "A", "B" }, {});
+		add_pass(technique, { "C" }, { "A" }).stencil_enable = true;
+		add_pass(technique, { "C" }, {}, true).stencil_enable = true; // Clear starts a new render pass
+		add_pass(technique, {}, { "B", "C" });
+
+		success &= check("merging", module, 0,
+			"0 clear begin; 1 end; 2 clear begin end; 3 begin end; 4 begin; 5 end; 6 begin end; 7 clear begin end; 8 begin end | A 0-6 slot 0 | B 2-8 slot 1", verbose);
+	}
+
+	// Mipmap elision: Mipmaps are only regenerated after the last write before the render target is sampled (or at the end of the technique, since a later frame may sample it)
+	{
+		reshadefx::module module;
+		add_texture(module, "M", 1024, 1024, 4);
+		add_texture(module, "N", 1024, 1024, 4);
+		reshadefx::technique_info &technique = module.techniques.emplace_back();
+		add_pass(technique, { "M", "N" }, {});
+		add_pass(technique, { "M" }, {});
+		add_pass(technique, {}, { "M", "N" });
+		add_pass(technique, { "M" }, {});
+
+		success &= check("mipmap elision", module, 0,
+			"0 begin end mipmaps=0x02; 1 begin end mipmaps=0x01; 2 begin end; 3 begin end mipmaps=0x01", verbose);
+	}
+
+	// Back buffer copy elision: The back buffer is only copied before the first pass that samples it and again only after a pass modified it
+	{
+		reshadefx::module module;
+		add_texture(module, "BackBuffer", 1920, 1080, 1, "COLOR");
+		add_texture(module, "A");
+		add_texture(module, "B");
+		reshadefx::technique_info &technique = module.techniques.emplace_back();
+		add_pass(technique, { "A" }, { "BackBuffer" }, true);
+		add_pass(technique, { "B" }, { "BackBuffer" }, true);
+		add_pass(technique, {}, { "A", "B" });
+		add_pass(technique, {}, { "BackBuffer" });
+		add_pass(technique, {}, { "A" });
+
+		success &= check("back buffer copy elision", module, 0,
+			"0 copy-backbuffer clear begin end; 1 clear begin end; 2 begin end; 3 copy-backbuffer begin; 4 end | A 0-4 slot 0 | B 1-2 slot 1", verbose);
+	}
+
+	// Alias slots: Transient textures with matching descriptions and lifetimes that do not overlap share a slot, while textures whose previous contents are read or that are used by another technique are not transient
+	{
+		reshadefx::module module;
+		add_texture(module, "T1");
+		add_texture(module, "T2");
+		add_texture(module, "T3", 960, 540);
+		add_texture(module, "Feedback");
+		add_texture(module, "Shared");
+		reshadefx::technique_info &technique = module.techniques.emplace_back();
+		add_pass(technique, { "T1" }, {}, true);
+		add_pass(technique, { "T3" }, { "T1" }, true);
+		add_pass(technique, { "T2" }, { "T3", "Feedback" }, true);
+		add_pass(technique, { "Feedback" }, { "T2" });
+		add_pass(technique, { "Shared" }, {}, true);
+		add_pass(technique, {}, { "Feedback", "Shared" });
+		reshadefx::technique_info &other_technique = module.techniques.emplace_back();
+		add_pass(other_technique, {}, { "Shared" });
+
+		success &= check("alias slots", module, 0,
+			"0 clear begin end; 1 clear begin end; 2 clear begin end; 3 begin end; 4 clear begin end; 5 begin end | T1 0-1 slot 0 | T3 1-2 slot 1 | T2 2-3 slot 0", verbose);
+
+		// Apply the alias slot the same way the runtime does, after which the technique has to behave the same with one texture less
+		reshadefx::sampler_info &sampler = module.samplers.emplace_back();
+		sampler.texture_name = "T2";
+		reshadefx::rename_texture_references(module, "T2", "T1");
+
+		if (sampler.texture_name != "T1" || module.techniques[0].passes[2].render_target_names[0] != "T1" || module.techniques[0].passes[3].sampled_texture_names != std::vector<std::string> { "T1" })
+		{
+			printf("%-28s FAILED\n  references to T2 were not replaced with T1\n", "alias slots applied");
+			success = false;
+		}
+		else
+		{
+			success &= check("alias slots applied", module, 0,
+				"0 clear begin end; 1 clear begin end; 2 clear begin end; 3 begin end; 4 clear begin end; 5 begin end | T1 0-3 slot 0 | T3 1-2 slot 1", verbose);
+		}
+	}
+
+	// Textures shared across modules: Another effect may declare a texture with the same name, which then refers to the same texture and would observe the contents of another texture in its alias slot.
+	// The pass graph of one module cannot know about that, so only textures that opt in with a "transient" annotation are aliased, no matter that the others are transient within the technique as well.
+	{
+		reshadefx::module module;
+		add_texture(module, "T1");
+		add_texture(module, "T2");
+		add_texture(module, "Shared");
+		add_texture(module, "T3");
+		reshadefx::technique_info &technique = module.techniques.emplace_back();
+		add_pass(technique, { "T1" }, {}, true);
+		add_pass(technique, { "T2" }, { "T1" }, true);
+		add_pass(technique, { "Shared" }, { "T2" }, true);
+		add_pass(technique, { "T3" }, { "Shared" }, true);
+		add_pass(technique, {}, { "T3" });
+
+		// Another module samples the texture the first one writes last, so it sees whatever that texture contains after the technique of the first module ran
+		reshadefx::module other_module;
+		add_texture(other_module, "Shared");
+		add_pass(other_module.techniques.emplace_back(), {}, { "Shared" });
+
+		success &= check("shared across modules", module, 0,
+			"0 clear begin end; 1 clear begin end; 2 clear begin end; 3 clear begin end; 4 begin end | T1 0-1 slot 0 | T2 1-2 slot 1 | Shared 2-3 slot 0 | T3 3-4 slot 1", verbose);
+		success &= check("shared across modules other", other_module, 0,
+			"0 begin end", verbose);
+		success &= check_aliases("aliases without opt-in", module, 0,
+			"", verbose);
+
+		add_transient_annotation(module, "T1");
+		add_transient_annotation(module, "T2");
+		add_transient_annotation(module, "T3");
+
+		// "Shared" is in the same slot as "T1", but did not opt in, so the other module still sees its own contents instead of those of "T1"
+		success &= check_aliases("aliases with opt-in", module, 0,
+			"T3 -> T2", verbose);
+
+		add_transient_annotation(module, "Shared");
+
+		success &= check_aliases("aliases with all opted in", module, 0,
+			"Shared -> T1, T3 -> T2", verbose);
+	}
+
+	return success ? 0 : 1;
+}
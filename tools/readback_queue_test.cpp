@@ -0,0 +1,248 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the CPU side of asynchronous readbacks ('readback_queue') against a fake backend, whose copies only complete when the test says so.
+// Covers completion in the order readbacks were started, reuse of slots in ring order, waiting for the oldest readback when all slots are busy, reporting of failed copies and completing pending readbacks when the queue is destroyed.
+// Exits with a non-zero code if any check fails. Does not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/readback_queue_test.cpp source/runtime_readback.cpp -o readback_queue_test
+
+#include "runtime_readback.hpp"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+	)", path);
+}
+
+// Stands in for the graphics API: every copy writes the index of the frame it was started for into all pixels, so that callbacks can tell which frame they got
+class fake_backend : public reshade::readback_queue::backend
+{
+public:
+	explicit fake_backend(unsigned int num_slots) : slots(num_slots) {}
+
+	bool begin_readback(unsigned int slot) override
+	{
+		log += "begin " + std::to_string(slot) + "; ";
+
+		if (fail_next_begin)
+		{
+			fail_next_begin = false;
+			return false;
+		}
+
+		slots[slot] = { next_frame++, false, fail_next_finish };
+		fail_next_finish = false;
+		return true;
+	}
+	bool is_readback_complete(unsigned int slot) const override
+	{
+		return slots[slot].complete;
+	}
+	bool finish_readback(unsigned int slot, uint8_t *buffer) override
+	{
+		// Finishing a copy that did not complete yet means the queue waited for the GPU
+		log += (slots[slot].complete ? "finish " : "wait ") + std::to_string(slot) + "; ";
+
+		if (slots[slot].fail)
+			return false;
+
+		std::memset(buffer, slots[slot].frame, 4 * 4 * 4);
+		return true;
+	}
+
+	void complete(unsigned int slot)
+	{
+		slots[slot].complete = true;
+	}
+
+	struct slot
+	{
+		uint8_t frame;
+		bool complete;
+		bool fail;
+	};
+
+	std::vector<slot> slots;
+	std::string log;
+	uint8_t next_frame = 1;
+	bool fail_next_begin = false;
+	bool fail_next_finish = false;
+};
+
+// Records the frames callbacks receive, as the frame index written by the fake backend or 'x' if the readback failed
+struct completion_log
+{
+	reshade::readback_queue::completion_callback callback()
+	{
+		return [this](const uint8_t *pixels, unsigned int width, unsigned int height) {
+			if (width != 4 || height != 4)
+				frames += "?";
+			else if (pixels == nullptr)
+				frames += "x";
+			else
+				frames += std::to_string(pixels[0]) + (pixels[4 * 4 * 4 - 1] == pixels[0] ? "" : "?");
+			frames += ' ';
+		};
+	}
+
+	std::string frames;
+};
+
+static bool check(const char *name, const std::string &actual, const std::string &expected)
+{
+	if (actual != expected)
+	{
+		printf("%-40s FAILED\n  expected: %s\n  actual:   %s\n", name, expected.c_str(), actual.c_str());
+		return false;
+	}
+
+	printf("%-40s ok\n", name);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	bool success = true;
+
+	// FIFO completion: A readback that finished early is only completed after all readbacks started before it, so callbacks see frames in the order they were captured
+	{
+		fake_backend backend(4);
+		completion_log completed;
+		reshade::readback_queue queue(backend, 4);
+
+		for (int i = 0; i < 3; ++i)
+			queue.push(4, 4, completed.callback());
+
+		backend.complete(1);
+		queue.poll();
+		success &= check("fifo completion before oldest finished", completed.frames, "");
+
+		backend.complete(0);
+		queue.poll();
+		success &= check("fifo completion", completed.frames + "| " + std::to_string(queue.num_pending()), "1 2 | 1");
+
+		queue.poll(true);
+		success &= check("fifo completion with wait", completed.frames + "| " + backend.log, "1 2 3 | begin 0; begin 1; begin 2; finish 0; finish 1; wait 2; ");
+	}
+
+	// Ring wrap-around: Slots are reused in ring order once the readbacks in them were completed
+	{
+		fake_backend backend(3);
+		completion_log completed;
+		reshade::readback_queue queue(backend, 3);
+
+		std::string slots;
+		for (unsigned int frame = 0; frame < 8; ++frame)
+		{
+			queue.push(4, 4, completed.callback());
+
+			// The GPU lags one frame behind
+			if (frame != 0)
+				backend.complete((frame - 1) % 3);
+			queue.poll();
+		}
+		queue.poll(true);
+
+		success &= check("ring wrap-around", completed.frames + "| " + backend.log,
+			"1 2 3 4 5 6 7 8 | begin 0; begin 1; finish 0; begin 2; finish 1; begin 0; finish 2; begin 1; finish 0; begin 2; finish 1; begin 0; finish 2; begin 1; finish 0; wait 1; ");
+	}
+
+	// Forced wait: Pushing while all slots are busy waits for the oldest readback and completes it before its slot is reused
+	{
+		fake_backend backend(2);
+		completion_log completed;
+		reshade::readback_queue queue(backend, 2);
+
+		queue.push(4, 4, completed.callback());
+		queue.push(4, 4, completed.callback());
+		queue.poll();
+		const std::string before = completed.frames;
+		queue.push(4, 4, completed.callback());
+
+		success &= check("forced wait when all slots are busy", before + "| " + completed.frames + "| " + backend.log + "| " + std::to_string(queue.num_pending()),
+			"| 1 | begin 0; begin 1; wait 0; begin 0; | 2");
+	}
+
+	// Failure callbacks: A copy that cannot be started is reported right away without using up a slot, one that fails to finish is reported in order with the others
+	{
+		fake_backend backend(4);
+		completion_log completed;
+		reshade::readback_queue queue(backend, 4);
+
+		queue.push(4, 4, completed.callback());
+		backend.fail_next_begin = true;
+		const bool started = queue.push(4, 4, completed.callback());
+		backend.fail_next_finish = true;
+		queue.push(4, 4, completed.callback());
+		queue.push(4, 4, completed.callback());
+
+		success &= check("failure to begin", completed.frames + "| " + (started ? "started" : "not started") + " | " + std::to_string(queue.num_pending()), "x | not started | 3");
+
+		backend.complete(0);
+		backend.complete(1);
+		backend.complete(2);
+		queue.poll();
+
+		success &= check("failure to finish", completed.frames + "| " + backend.log, "x 1 x 3 | begin 0; begin 1; begin 1; begin 2; finish 0; finish 1; finish 2; ");
+	}
+
+	// Destination buffers: Image data is written to the buffer passed in instead of an internal one
+	{
+		fake_backend backend(2);
+		completion_log completed;
+		std::vector<uint8_t> destination(4 * 4 * 4);
+		bool pixels_in_destination = false;
+
+		{
+			reshade::readback_queue queue(backend, 2);
+			queue.push(4, 4, [&](const uint8_t *pixels, unsigned int width, unsigned int height) {
+				pixels_in_destination = pixels == destination.data();
+				completed.callback()(pixels, width, height);
+			}, destination.data());
+		}
+
+		success &= check("destination buffer", completed.frames + "| " + std::to_string(destination[0]) + (pixels_in_destination ? "" : " not in destination"), "1 | 1");
+	}
+
+	// Flushing on destruction: Pending readbacks are completed when the queue is destroyed, so no callback is lost
+	{
+		fake_backend backend(4);
+		completion_log completed;
+
+		{
+			reshade::readback_queue queue(backend, 4);
+			for (int i = 0; i < 3; ++i)
+				queue.push(4, 4, completed.callback());
+			backend.complete(0);
+			queue.poll();
+		}
+
+		success &= check("flushing on destruction", completed.frames + "| " + backend.log, "1 2 3 | begin 0; begin 1; begin 2; finish 0; wait 1; wait 2; ");
+	}
+
+	return success ? 0 : 1;
+}
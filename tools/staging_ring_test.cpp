@@ -0,0 +1,279 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the allocation logic of the upload staging buffer ('staging_ring') against a fake backend, which models command frames whose copies only execute once their fence is waited on.
+// Covers alignment, rewinding once all frames were released, waiting for the frames in flight before wrapping around (including the one still recording), growing the buffer and failure to do so.
+// Also runs a randomized simulation of several frames in flight, which checks that no allocation overwrites data a pending copy has yet to read.
+// Exits with a non-zero code if any check fails. Does not depend on any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/staging_ring_test.cpp source/runtime_staging_ring.cpp -o staging_ring_test
+
+#include "runtime_staging_ring.hpp"
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -f, --frames <count>      Number of frames to simulate (default: 10000).
+  -s, --seed <value>        Seed of the randomized simulation (default: 1).
+  -h, --help                Print this help.
+	)", path);
+}
+
+// Stands in for the graphics API: every allocation is a pending copy of its command frame, which reads the data from the staging buffer once the frame executes
+class fake_backend : public reshade::staging_ring::backend
+{
+public:
+	void wait_for_staging_frames(uint32_t frame_mask) override
+	{
+		char mask[16];
+		snprintf(mask, sizeof(mask), "0x%x", frame_mask);
+		log += std::string("wait ") + mask + "; ";
+
+		for (unsigned int frame = 0; frame < 32; ++frame)
+			if ((frame_mask & (1u << frame)) != 0)
+				execute(frame);
+	}
+	uint8_t *resize_staging_buffer(uint64_t size) override
+	{
+		log += "resize " + std::to_string(size) + "; ";
+
+		// The GPU must not read from the old buffer anymore
+		for (const copy &c : copies)
+			if (!c.executed)
+				errors += "resized while a copy was pending; ";
+
+		if (fail_next_resize)
+		{
+			fail_next_resize = false;
+			buffer.clear();
+			return nullptr;
+		}
+
+		buffer.assign(size_t(size), 0);
+		return buffer.data();
+	}
+
+	// Records a copy from the staging buffer and fills its data with a pattern that is checked again when it executes
+	void record(unsigned int frame, uint8_t *data, uint64_t offset, uint64_t size)
+	{
+		if (data != buffer.data() + offset || offset + size > buffer.size())
+			errors += "allocation outside of the buffer; ";
+
+		const uint8_t pattern = uint8_t(copies.size() * 31 + 7);
+		std::memset(data, pattern, size_t(size));
+		copies.push_back({ frame, offset, size, pattern, false });
+	}
+
+	// Executes all pending copies of a command frame, as if its fence was signaled
+	void execute(unsigned int frame)
+	{
+		for (copy &c : copies)
+		{
+			if (c.frame != frame || c.executed)
+				continue;
+
+			for (uint64_t i = 0; i < c.size; ++i)
+			{
+				if (buffer[size_t(c.offset + i)] != c.pattern)
+				{
+					errors += "data of a pending copy was overwritten; ";
+					break;
+				}
+			}
+
+			c.executed = true;
+		}
+	}
+
+	struct copy
+	{
+		unsigned int frame;
+		uint64_t offset, size;
+		uint8_t pattern;
+		bool executed;
+	};
+
+	std::vector<uint8_t> buffer;
+	std::vector<copy> copies;
+	std::string log;
+	std::string errors;
+	bool fail_next_resize = false;
+};
+
+static bool check(const char *name, const std::string &actual, const std::string &expected)
+{
+	if (actual != expected)
+	{
+		printf("%-40s FAILED\n  expected: %s\n  actual:   %s\n", name, expected.c_str(), actual.c_str());
+		return false;
+	}
+
+	printf("%-40s ok\n", name);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int num_frames = 10000;
+	unsigned int seed = 1;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 < argc && (0 == std::strcmp(arg, "-f") || 0 == std::strcmp(arg, "--frames")))
+		{
+			num_frames = std::strtoul(argv[++i], nullptr, 10);
+			continue;
+		}
+		if (i + 1 < argc && (0 == std::strcmp(arg, "-s") || 0 == std::strcmp(arg, "--seed")))
+		{
+			seed = std::strtoul(argv[++i], nullptr, 10);
+			continue;
+		}
+
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	bool success = true;
+
+	const auto allocate = [](reshade::staging_ring &ring, fake_backend &backend, uint64_t size, uint64_t alignment, unsigned int frame) {
+		uint64_t offset = 0;
+		uint8_t *const data = ring.allocate(size, alignment, frame, offset);
+		if (data == nullptr)
+			return std::string("null ");
+		backend.record(frame, data, offset, size);
+		return std::to_string(offset) + ' ';
+	};
+
+	// Alignment: Offsets are rounded up to the requested alignment, the first allocation creates the buffer at the minimum size
+	{
+		fake_backend backend;
+		reshade::staging_ring ring(backend, 1024);
+
+		std::string offsets;
+		offsets += allocate(ring, backend, 3, 4, 0);
+		offsets += allocate(ring, backend, 8, 256, 0);
+		offsets += allocate(ring, backend, 1, 4, 0);
+
+		success &= check("alignment", offsets + "| " + backend.log, "0 256 264 | resize 1024; ");
+	}
+
+	// Rewinding: The buffer is only rewound once every frame that read from it was released
+	{
+		fake_backend backend;
+		reshade::staging_ring ring(backend, 1024);
+
+		std::string offsets;
+		offsets += allocate(ring, backend, 100, 4, 0);
+		offsets += allocate(ring, backend, 100, 4, 1);
+		ring.release_frame(0);
+		offsets += allocate(ring, backend, 100, 4, 2);
+		ring.release_frame(1);
+		ring.release_frame(2);
+		offsets += allocate(ring, backend, 100, 4, 0);
+
+		success &= check("rewinding once all frames were released", offsets + "| " + backend.log, "0 100 200 0 | resize 1024; ");
+	}
+
+	// Wrap-around: Running out of space waits for all frames in flight, including the one the new copy is recorded in, and then starts over at the beginning
+	{
+		fake_backend backend;
+		reshade::staging_ring ring(backend, 1024);
+
+		std::string offsets;
+		offsets += allocate(ring, backend, 400, 4, 0);
+		offsets += allocate(ring, backend, 400, 4, 2);
+		offsets += allocate(ring, backend, 400, 4, 2);
+
+		success &= check("wrap-around", offsets + "| " + backend.log + "| " + std::to_string(ring.frames_in_flight()) + backend.errors, "0 400 0 | resize 1024; wait 0x5; | 4");
+	}
+
+	// Growth: An allocation that does not fit into the empty buffer grows it to the next power of two multiple of its size, after the frames in flight finished with the old one
+	{
+		fake_backend backend;
+		reshade::staging_ring ring(backend, 1024);
+
+		std::string offsets;
+		offsets += allocate(ring, backend, 100, 4, 1);
+		offsets += allocate(ring, backend, 3000, 4, 2);
+		offsets += allocate(ring, backend, 1000, 4, 2);
+
+		success &= check("growth", offsets + "| " + backend.log + "| " + std::to_string(ring.size()) + backend.errors, "0 0 3000 | resize 1024; wait 0x2; resize 4096; | 4096");
+	}
+
+	// Failure to grow: Allocation returns null and the next one tries to create the buffer again
+	{
+		fake_backend backend;
+		reshade::staging_ring ring(backend, 1024);
+
+		std::string offsets;
+		backend.fail_next_resize = true;
+		offsets += allocate(ring, backend, 100, 4, 0);
+		const uint64_t size_after_failure = ring.size();
+		offsets += allocate(ring, backend, 100, 4, 0);
+
+		success &= check("failure to grow", offsets + "| " + backend.log + "| " + std::to_string(size_after_failure), "null 0 | resize 1024; resize 1024; | 0");
+	}
+
+	// Simulation: Several frames in flight, where each frame waits for the fence of the frame that used the same command buffer before it (like 'runtime_vk::on_present'), and records a random number of uploads
+	// Sometimes the copies are executed synchronously mid-frame (like 'runtime_vk::execute_command_buffer' does), after which the frame is still in flight until its fence is waited on
+	{
+		const unsigned int num_command_frames = 5;
+
+		fake_backend backend;
+		reshade::staging_ring ring(backend, 64 * 1024);
+
+		std::mt19937 rng(seed);
+		std::uniform_int_distribution<unsigned int> num_uploads_dist(0, 4);
+		std::uniform_int_distribution<uint64_t> size_dist(1, 48 * 1024);
+		std::uniform_int_distribution<unsigned int> alignment_dist(2, 8);
+		std::uniform_int_distribution<unsigned int> percent_dist(0, 99);
+
+		unsigned int num_allocations = 0;
+		for (unsigned int i = 0; i < num_frames; ++i)
+		{
+			const unsigned int frame = i % num_command_frames;
+
+			backend.execute(frame);
+			ring.release_frame(frame);
+
+			for (unsigned int k = num_uploads_dist(rng); k != 0; --k, ++num_allocations)
+			{
+				// Rarely upload something large, which has to grow the buffer
+				const uint64_t size = percent_dist(rng) == 0 ? size_dist(rng) * 8 : size_dist(rng);
+
+				if (allocate(ring, backend, size, uint64_t(1) << alignment_dist(rng), frame) == "null ")
+					backend.errors += "allocation failed; ";
+
+				if (percent_dist(rng) < 5)
+					backend.execute(frame);
+			}
+		}
+
+		for (unsigned int frame = 0; frame < num_command_frames; ++frame)
+			backend.execute(frame);
+
+		const std::string name = "simulation of " + std::to_string(num_frames) + " frames (" + std::to_string(num_allocations) + " uploads)";
+		success &= check(name.c_str(), backend.errors, "");
+	}
+
+	return success ? 0 : 1;
+}
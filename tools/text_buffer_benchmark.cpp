@@ -0,0 +1,413 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Measures loading, typing into and undoing edits of the code editor text storage ('text_buffer') for files of increasing size, without any user interface.
+// Compares it with the previous storage (a vector of glyphs per line, with undo records holding copies of the text) and checks that both end up with the same text after every step.
+// Exits with a non-zero code on a mismatch. Does not depend on ImGui or any graphics API, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -DNDEBUG -Isource tools/text_buffer_benchmark.cpp source/text_buffer.cpp -o text_buffer_benchmark
+
+#include "text_buffer.hpp"
+#include <tuple>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -l <value>                Maximum number of lines of the generated file. Defaults to 100000.
+  -n <value>                Number of edits per file. Defaults to 2000.
+	)", path);
+}
+
+struct edit
+{
+	size_t line, column;
+	std::string text; // Inserted if 'insert' is set, otherwise the number of characters to remove is its size
+	bool insert;
+};
+
+// The storage the code editor used before, which keeps a color next to every character
+class glyph_buffer
+{
+public:
+	struct glyph
+	{
+		char c;
+		int col;
+	};
+	struct undo_record
+	{
+		size_t line, column;
+		std::string added;
+		std::string removed;
+	};
+
+	void set_text(const std::string &text)
+	{
+		_lines.clear();
+		_lines.emplace_back();
+
+		for (const char c : text)
+		{
+			if (c == '\n')
+				_lines.emplace_back();
+			else
+				_lines.back().push_back({ c, 0 });
+		}
+	}
+
+	std::string get_text() const
+	{
+		std::string text;
+		for (size_t i = 0; i < _lines.size(); ++i)
+		{
+			if (i != 0)
+				text.push_back('\n');
+			for (const glyph &glyph : _lines[i])
+				text.push_back(glyph.c);
+		}
+		return text;
+	}
+
+	undo_record apply(const edit &e)
+	{
+		undo_record u { e.line, e.column, {}, {} };
+		if (e.insert)
+		{
+			u.added = e.text;
+			insert(e.line, e.column, e.text);
+		}
+		else
+		{
+			u.removed = get_text(e.line, e.column, e.text.size());
+			erase(e.line, e.column, e.text.size());
+		}
+		return u;
+	}
+	void undo(const undo_record &u)
+	{
+		if (!u.added.empty())
+			erase(u.line, u.column, u.added.size());
+		if (!u.removed.empty())
+			insert(u.line, u.column, u.removed);
+	}
+
+private:
+	std::string get_text(size_t line, size_t column, size_t length) const
+	{
+		std::string text;
+		for (; text.size() < length; ++column)
+		{
+			if (column == _lines[line].size())
+			{
+				text.push_back('\n');
+				line++;
+				column = ~size_t(0);
+			}
+			else
+			{
+				text.push_back(_lines[line][column].c);
+			}
+		}
+		return text;
+	}
+
+	void insert(size_t line, size_t column, const std::string &text)
+	{
+		for (const char c : text)
+		{
+			if (c == '\n')
+			{
+				_lines.insert(_lines.begin() + line + 1, std::vector<glyph>(_lines[line].begin() + column, _lines[line].end()));
+				_lines[line].erase(_lines[line].begin() + column, _lines[line].end());
+				line++;
+				column = 0;
+			}
+			else
+			{
+				_lines[line].insert(_lines[line].begin() + column++, { c, 0 });
+			}
+		}
+	}
+	void erase(size_t line, size_t column, size_t length)
+	{
+		while (length-- != 0)
+		{
+			if (column == _lines[line].size())
+			{
+				_lines[line].insert(_lines[line].end(), _lines[line + 1].begin(), _lines[line + 1].end());
+				_lines.erase(_lines.begin() + line + 1);
+			}
+			else
+			{
+				_lines[line].erase(_lines[line].begin() + column);
+			}
+		}
+	}
+
+	std::vector<std::vector<glyph>> _lines;
+};
+
+// Applies edits the same way the code editor does, with undo records that reference pieces instead of copying text
+class piece_buffer
+{
+public:
+	struct undo_record
+	{
+		size_t beg_line, beg_column;
+		size_t added_end_line, added_end_column;
+		size_t removed_end_line, removed_end_column;
+		std::vector<text_buffer::piece> added;
+		std::vector<text_buffer::piece> removed;
+	};
+
+	void set_text(const std::string &text)
+	{
+		_text.set_text(text);
+	}
+
+	std::string get_text() const
+	{
+		const size_t last_line = _text.line_count() - 1;
+		return _text.get_text(0, 0, last_line, _text.line_length(last_line));
+	}
+
+	bool check_colors() const
+	{
+		for (size_t line = 0; line < _text.line_count(); ++line)
+		{
+			size_t length = 0;
+			for (const text_buffer::color_run &run : _text.line_colors(line))
+				length += run.length;
+			if (length != _text.line_length(line))
+				return false;
+		}
+		return true;
+	}
+
+	undo_record apply(const edit &e)
+	{
+		undo_record u { e.line, e.column, e.line, e.column, e.line, e.column, {}, {} };
+		if (e.insert)
+		{
+			std::tie(u.added_end_line, u.added_end_column) = _text.insert(e.line, e.column, e.text);
+			u.added = _text.get_pieces(u.beg_line, u.beg_column, u.added_end_line, u.added_end_column);
+		}
+		else
+		{
+			std::tie(u.removed_end_line, u.removed_end_column) = advance(e.line, e.column, e.text.size());
+			u.removed = _text.get_pieces(u.beg_line, u.beg_column, u.removed_end_line, u.removed_end_column);
+			_text.erase(u.beg_line, u.beg_column, u.removed_end_line, u.removed_end_column);
+		}
+		return u;
+	}
+	void undo(const undo_record &u)
+	{
+		if (!u.added.empty())
+			_text.erase(u.beg_line, u.beg_column, u.added_end_line, u.added_end_column);
+		if (!u.removed.empty())
+			_text.insert(u.beg_line, u.beg_column, u.removed);
+	}
+
+private:
+	std::pair<size_t, size_t> advance(size_t line, size_t column, size_t length) const
+	{
+		while (length-- != 0)
+		{
+			if (column == _text.line_length(line))
+				line++, column = 0;
+			else
+				column++;
+		}
+		return { line, column };
+	}
+
+	text_buffer _text;
+};
+
+static std::string generate_text(size_t num_lines)
+{
+	std::mt19937 random(1);
+	std::string text;
+	for (size_t i = 0; i < num_lines; ++i)
+	{
+		if (i != 0)
+			text.push_back('\n');
+		text.append(random() % 4, '\t');
+		for (size_t k = random() % 80; k != 0; --k)
+			text.push_back(static_cast<char>('a' + random() % 26));
+	}
+	return text;
+}
+
+// Generates a mix of typed characters, new lines, pasted blocks and deletions at random positions, keeping track of the line lengths to only generate valid positions
+static std::vector<edit> generate_edits(const std::string &text, size_t num_edits)
+{
+	std::vector<size_t> lengths(1);
+	for (const char c : text)
+	{
+		if (c == '\n')
+			lengths.push_back(0);
+		else
+			lengths.back()++;
+	}
+
+	std::mt19937 random(2);
+	std::vector<edit> edits;
+	for (size_t i = 0; i < num_edits; ++i)
+	{
+		const size_t line = random() % lengths.size();
+		const size_t column = lengths[line] != 0 ? random() % (lengths[line] + 1) : 0;
+
+		switch (random() % 8)
+		{
+		default: // Typing a character
+			edits.push_back({ line, column, std::string(1, static_cast<char>('a' + random() % 26)), true });
+			lengths[line]++;
+			break;
+		case 5: // Pressing enter
+			edits.push_back({ line, column, "\n", true });
+			lengths.insert(lengths.begin() + line + 1, lengths[line] - column);
+			lengths[line] = column;
+			break;
+		case 6: // Pasting a few lines
+			edits.push_back({ line, column, "float4 main()\n{\n\treturn 0;\n}", true });
+			lengths.insert(lengths.begin() + line + 1, { 1, 10, 1 + lengths[line] - column });
+			lengths[line] = column + 13;
+			break;
+		case 7: // Deleting a character, which joins two lines at the end of one
+			if (column == lengths[line] && line + 1 == lengths.size())
+				continue;
+			edits.push_back({ line, column, std::string(1, ' '), false });
+			if (column == lengths[line])
+			{
+				lengths[line] += lengths[line + 1];
+				lengths.erase(lengths.begin() + line + 1);
+			}
+			else
+			{
+				lengths[line]--;
+			}
+			break;
+		}
+	}
+	return edits;
+}
+
+template <typename TBuffer>
+static bool benchmark(const char *name, const std::string &text, const std::vector<edit> &edits, const std::string &expected_text)
+{
+	using clock = std::chrono::high_resolution_clock;
+
+	TBuffer buffer;
+
+	const auto load_start = clock::now();
+	buffer.set_text(text);
+	const auto load_end = clock::now();
+
+	std::vector<typename TBuffer::undo_record> undo_records;
+	undo_records.reserve(edits.size());
+
+	const auto edit_start = clock::now();
+	for (const edit &e : edits)
+		undo_records.push_back(buffer.apply(e));
+	const auto edit_end = clock::now();
+
+	const bool edit_matches = buffer.get_text() == expected_text;
+
+	const auto undo_start = clock::now();
+	for (auto it = undo_records.rbegin(); it != undo_records.rend(); ++it)
+		buffer.undo(*it);
+	const auto undo_end = clock::now();
+
+	const bool undo_matches = buffer.get_text() == text;
+
+	printf("  %-8s load %9.3f ms, edit %8.3f us, undo %8.3f us",
+		name,
+		std::chrono::duration<double, std::milli>(load_end - load_start).count(),
+		std::chrono::duration<double, std::micro>(edit_end - edit_start).count() / edits.size(),
+		std::chrono::duration<double, std::micro>(undo_end - undo_start).count() / edits.size());
+
+	if (!edit_matches || !undo_matches)
+	{
+		printf(", text after %s does not match\n", !edit_matches ? "editing" : "undoing");
+		return false;
+	}
+
+	if constexpr (std::is_same_v<TBuffer, piece_buffer>)
+	{
+		if (!buffer.check_colors())
+		{
+			printf(", color runs do not add up to the line lengths\n");
+			return false;
+		}
+	}
+
+	printf("\n");
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_lines = 100000;
+	size_t num_edits = 2000;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-l"))
+			max_lines = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-n"))
+			num_edits = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	for (size_t num_lines = 100; num_lines <= max_lines; num_lines *= 10)
+	{
+		const std::string text = generate_text(num_lines);
+		const std::vector<edit> edits = generate_edits(text, num_edits);
+
+		// The previous storage is simple enough to serve as the reference for what the text has to look like after editing
+		glyph_buffer reference;
+		reference.set_text(text);
+		for (const edit &e : edits)
+			reference.apply(e);
+		const std::string expected_text = reference.get_text();
+
+		printf("%zu lines (%zu bytes), %zu edits:\n", num_lines, text.size(), edits.size());
+
+		success &= benchmark<glyph_buffer>("glyphs", text, edits, expected_text);
+		success &= benchmark<piece_buffer>("pieces", text, edits, expected_text);
+	}
+
+	return success ? 0 : 1;
+}
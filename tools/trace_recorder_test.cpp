@@ -0,0 +1,533 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Checks the trace recorder ('reshade::trace') by recording nested scopes from several threads at the same time and then reading back the file it writes.
+// The file has to be valid JSON in the Chrome trace event format, contain every scope that was closed while recording (and none that were not), escape detail text correctly and the events of each thread index have to nest.
+// Can also check a trace written by something else (e.g. 'fxc --trace'), which only checks the format and nesting.
+// Exits with a non-zero code if any check fails. Does not depend on any platform specific code, so this builds on other platforms too, e.g. with:
+//   g++ -std=c++17 -O2 -Isource tools/trace_recorder_test.cpp source/trace_recorder.cpp -o trace_recorder_test -lpthread
+
+#include "trace_recorder.hpp"
+#include <map>
+#include <set>
+#include <thread>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -t <value>                Number of threads recording at the same time. Defaults to 4.
+  -n <value>                Number of times each thread records its nested scopes. Defaults to 1000.
+  --check <file>            Only check the format and nesting of an existing trace file.
+	)", path);
+}
+
+// A minimal JSON reader, just enough to read back what the trace recorder writes (and to reject anything that is not valid JSON)
+struct json_value
+{
+	enum { null, boolean, number, string, array, object } type = null;
+	double number_value = 0;
+	std::string string_value;
+	std::vector<json_value> elements;
+	std::map<std::string, json_value> members;
+
+	const json_value *find(const char *name) const
+	{
+		const auto it = members.find(name);
+		return it != members.end() ? &it->second : nullptr;
+	}
+};
+
+class json_reader
+{
+public:
+	explicit json_reader(const std::string &text) : _text(text) {}
+
+	bool read(json_value &value)
+	{
+		if (!read_value(value))
+			return false;
+		skip_whitespace();
+		return _pos == _text.size();
+	}
+
+	size_t position() const { return _pos; }
+
+private:
+	void skip_whitespace()
+	{
+		while (_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\n' || _text[_pos] == '\r' || _text[_pos] == '\t'))
+			++_pos;
+	}
+
+	bool read_value(json_value &value)
+	{
+		skip_whitespace();
+		if (_pos >= _text.size())
+			return false;
+
+		switch (_text[_pos])
+		{
+		case '{':
+			value.type = json_value::object;
+			++_pos;
+			skip_whitespace();
+			if (_pos < _text.size() && _text[_pos] == '}')
+				return ++_pos, true;
+			while (true)
+			{
+				std::string name;
+				skip_whitespace();
+				if (!read_string(name))
+					return false;
+				skip_whitespace();
+				if (_pos >= _text.size() || _text[_pos++] != ':')
+					return false;
+				if (value.members.count(name) != 0 || !read_value(value.members[name]))
+					return false;
+				skip_whitespace();
+				if (_pos >= _text.size())
+					return false;
+				if (_text[_pos] == '}')
+					return ++_pos, true;
+				if (_text[_pos++] != ',')
+					return false;
+			}
+		case '[':
+			value.type = json_value::array;
+			++_pos;
+			skip_whitespace();
+			if (_pos < _text.size() && _text[_pos] == ']')
+				return ++_pos, true;
+			while (true)
+			{
+				if (!read_value(value.elements.emplace_back()))
+					return false;
+				skip_whitespace();
+				if (_pos >= _text.size())
+					return false;
+				if (_text[_pos] == ']')
+					return ++_pos, true;
+				if (_text[_pos++] != ',')
+					return false;
+			}
+		case '\"':
+			value.type = json_value::string;
+			return read_string(value.string_value);
+		case 't':
+			value.type = json_value::boolean;
+			value.number_value = 1;
+			return read_literal("true");
+		case 'f':
+			value.type = json_value::boolean;
+			return read_literal("false");
+		case 'n':
+			return read_literal("null");
+		default:
+			value.type = json_value::number;
+			return read_number(value.number_value);
+		}
+	}
+
+	bool read_literal(const char *literal)
+	{
+		const size_t length = std::strlen(literal);
+		if (_text.compare(_pos, length, literal) != 0)
+			return false;
+		_pos += length;
+		return true;
+	}
+
+	bool read_number(double &number)
+	{
+		const size_t begin = _pos;
+		if (_pos < _text.size() && _text[_pos] == '-')
+			++_pos;
+		if (_pos >= _text.size() || !isdigit(static_cast<unsigned char>(_text[_pos])))
+			return false;
+		while (_pos < _text.size() && (isdigit(static_cast<unsigned char>(_text[_pos])) || _text[_pos] == '.' || _text[_pos] == 'e' || _text[_pos] == 'E' || _text[_pos] == '+' || _text[_pos] == '-'))
+			++_pos;
+
+		const std::string text = _text.substr(begin, _pos - begin);
+		char *end = nullptr;
+		number = std::strtod(text.c_str(), &end);
+		return end == text.c_str() + text.size();
+	}
+
+	bool read_string(std::string &string)
+	{
+		if (_pos >= _text.size() || _text[_pos++] != '\"')
+			return false;
+
+		while (_pos < _text.size())
+		{
+			const char c = _text[_pos++];
+			if (c == '\"')
+				return true;
+			if (static_cast<unsigned char>(c) < 0x20)
+				return false; // Control characters have to be escaped
+			if (c != '\\')
+			{
+				string += c;
+				continue;
+			}
+
+			if (_pos >= _text.size())
+				return false;
+			switch (_text[_pos++])
+			{
+			case '\"': string += '\"'; break;
+			case '\\': string += '\\'; break;
+			case '/': string += '/'; break;
+			case 'b': string += '\b'; break;
+			case 'f': string += '\f'; break;
+			case 'n': string += '\n'; break;
+			case 'r': string += '\r'; break;
+			case 't': string += '\t'; break;
+			case 'u':
+			{
+				if (_pos + 4 > _text.size())
+					return false;
+				unsigned int code = 0;
+				for (int i = 0; i < 4; ++i)
+				{
+					const char digit = _text[_pos++];
+					if (!isxdigit(static_cast<unsigned char>(digit)))
+						return false;
+					code = code * 16 + (isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : (tolower(digit) - 'a' + 10));
+				}
+				if (code >= 0x80)
+					return false; // The trace recorder only escapes control characters
+				string += static_cast<char>(code);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	const std::string &_text;
+	size_t _pos = 0;
+};
+
+struct trace_event
+{
+	std::string name;
+	std::string detail;
+	unsigned int tid;
+	double ts, dur;
+};
+
+static bool is_valid_utf8(const std::string &string)
+{
+	for (size_t i = 0; i < string.size();)
+	{
+		const unsigned char c = string[i];
+		const size_t length = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+		if (length == 0 || i + length > string.size())
+			return false;
+		for (size_t k = 1; k < length; ++k)
+			if ((static_cast<unsigned char>(string[i + k]) & 0xC0) != 0x80)
+				return false;
+		i += length;
+	}
+	return true;
+}
+
+// Reads a trace file and checks that it is valid JSON in the Chrome trace event format and that the events of each thread nest
+static bool read_trace(const char *path, std::vector<trace_event> &events, std::string &error)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return error = "could not open file", false;
+	std::stringstream text;
+	text << file.rdbuf();
+	const std::string contents = text.str();
+
+	json_value root;
+	if (json_reader reader(contents); !reader.read(root))
+		return error = "invalid JSON near offset " + std::to_string(reader.position()), false;
+	if (!is_valid_utf8(contents))
+		return error = "invalid UTF-8", false;
+
+	const json_value *const trace_events = root.find("traceEvents");
+	if (root.type != json_value::object || trace_events == nullptr || trace_events->type != json_value::array)
+		return error = "missing 'traceEvents' array", false;
+
+	for (const json_value &element : trace_events->elements)
+	{
+		const json_value *const ph = element.find("ph"), *const name = element.find("name"), *const tid = element.find("tid"), *const ts = element.find("ts"), *const dur = element.find("dur");
+		if (ph == nullptr || ph->string_value != "X" || name == nullptr || name->type != json_value::string ||
+			tid == nullptr || tid->type != json_value::number || ts == nullptr || ts->type != json_value::number || dur == nullptr || dur->type != json_value::number)
+			return error = "event " + std::to_string(events.size()) + " is missing a field", false;
+		if (ts->number_value < 0 || dur->number_value < 0)
+			return error = "event " + std::to_string(events.size()) + " has a negative time", false;
+
+		trace_event &e = events.emplace_back();
+		e.name = name->string_value;
+		e.tid = static_cast<unsigned int>(tid->number_value);
+		e.ts = ts->number_value;
+		e.dur = dur->number_value;
+		if (const json_value *const args = element.find("args"); args != nullptr)
+			if (const json_value *const detail = args->find("detail"); detail != nullptr)
+				e.detail = detail->string_value;
+	}
+
+	// Sort events of each thread so that enclosing events come before the ones they enclose, then check that every event ends before the one enclosing it ends
+	// Times are written in microseconds with three decimal places, so they are exact to the nanosecond (up to rounding of the sum)
+	std::vector<trace_event> sorted = events;
+	std::stable_sort(sorted.begin(), sorted.end(), [](const trace_event &lhs, const trace_event &rhs) {
+		return lhs.tid != rhs.tid ? lhs.tid < rhs.tid : lhs.ts != rhs.ts ? lhs.ts < rhs.ts : lhs.dur > rhs.dur;
+	});
+
+	std::vector<const trace_event *> stack;
+	for (const trace_event &e : sorted)
+	{
+		while (!stack.empty() && (stack.back()->tid != e.tid || stack.back()->ts + stack.back()->dur <= e.ts + 0.0005))
+			stack.pop_back();
+		if (!stack.empty() && e.ts + e.dur > stack.back()->ts + stack.back()->dur + 0.0015)
+			return error = "event '" + e.name + "' at " + std::to_string(e.ts) + " overlaps '" + stack.back()->name + "' at " + std::to_string(stack.back()->ts) + " without nesting in it", false;
+		stack.push_back(&e);
+	}
+
+	return true;
+}
+
+static bool check(const char *name, const std::string &actual, const std::string &expected)
+{
+	if (actual != expected)
+	{
+		printf("%-40s FAILED\n  expected: %s\n  actual:   %s\n", name, expected.c_str(), actual.c_str());
+		return false;
+	}
+
+	printf("%-40s ok\n", name);
+	return true;
+}
+
+static void spin(unsigned int microseconds)
+{
+	const uint64_t end = reshade::trace::timestamp() + microseconds * 1000ull;
+	while (reshade::trace::timestamp() < end)
+		continue;
+}
+
+// Records three levels of nested scopes, with a few sibling scopes on the inner levels
+static void record_nested_scopes(const char *detail)
+{
+	RESHADE_TRACE_SCOPE("outer", detail);
+	spin(1);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		RESHADE_TRACE_SCOPE("middle", detail);
+		spin(1);
+
+		for (int k = 0; k < 2; ++k)
+		{
+			RESHADE_TRACE_SCOPE("inner", detail);
+			spin(1);
+		}
+	}
+}
+static const size_t NUM_EVENTS_PER_NESTED_SCOPES = 1 + 2 + 2 * 2;
+
+int main(int argc, char *argv[])
+{
+	size_t num_threads = 4;
+	size_t num_iterations = 1000;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-t"))
+			num_threads = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-n"))
+			num_iterations = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "--check"))
+		{
+			const char *const path = argv[++i];
+
+			std::vector<trace_event> events;
+			std::string error;
+			if (!read_trace(path, events, error))
+			{
+				printf("%s: %s\n", path, error.c_str());
+				return 1;
+			}
+
+			printf("%s: %zu events, ok\n", path, events.size());
+			return 0;
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	const std::string path = "trace_recorder_test.json";
+
+	// Nesting: Threads record nested scopes at the same time, each into its own buffer (threads started later may take over the buffer of one that exited, which must not make their events overlap)
+	{
+		// Scopes that are still open when recording starts or stops are not recorded
+		std::vector<trace_event> events;
+		std::string error;
+		{
+			RESHADE_TRACE_SCOPE("opened before start");
+
+			reshade::trace::start();
+
+			{
+				std::vector<std::thread> threads;
+				for (size_t thread_index = 0; thread_index < num_threads; ++thread_index)
+				{
+					threads.emplace_back([thread_index, num_iterations]() {
+						const std::string detail = "thread " + std::to_string(thread_index);
+						for (size_t i = 0; i < num_iterations; ++i)
+							record_nested_scopes(detail.c_str());
+					});
+				}
+
+				for (std::thread &thread : threads)
+					thread.join();
+			}
+
+			RESHADE_TRACE_SCOPE("closed after stop");
+
+			reshade::trace::stop();
+		}
+
+		if (!reshade::trace::write(path))
+			error = "could not write trace";
+		else
+			read_trace(path.c_str(), events, error);
+
+		success &= check("nested scopes form valid trace", error, "");
+
+		// Every scope carries the index of the thread that recorded it, so events can be counted per thread even though a thread that starts later may take over the buffer (and thread index) of one that exited
+		std::map<std::string, std::map<std::string, size_t>> counts;
+		std::map<std::string, std::set<unsigned int>> tids;
+		for (const trace_event &e : events)
+		{
+			counts[e.detail][e.name]++;
+			tids[e.detail].insert(e.tid);
+		}
+
+		const size_t expected_num_events = num_threads * num_iterations * NUM_EVENTS_PER_NESTED_SCOPES;
+		const size_t num_dropped_events = reshade::trace::num_dropped_events();
+
+		std::string actual = std::to_string(events.size() + num_dropped_events) + " events";
+		std::string expected = std::to_string(expected_num_events) + " events";
+		for (size_t thread_index = 0; thread_index < num_threads; ++thread_index)
+		{
+			const std::string detail = "thread " + std::to_string(thread_index);
+
+			actual += " | " + detail + ':';
+			for (const auto &[name, count] : counts[detail])
+				actual += ' ' + name + '=' + std::to_string(count);
+			actual += " tids=" + std::to_string(tids[detail].size());
+			expected += " | " + detail + ": inner=" + std::to_string(num_iterations * 4) + " middle=" + std::to_string(num_iterations * 2) + " outer=" + std::to_string(num_iterations) + " tids=1";
+		}
+		if (counts.size() != num_threads)
+			actual += " | events of " + std::to_string(counts.size() - num_threads) + " other scopes";
+
+		// Buffers have a fixed size, so only compare the total if events did not fit
+		if (num_dropped_events != 0)
+		{
+			printf("%zu events were dropped, since they did not fit into the buffer of their thread\n", num_dropped_events);
+			success &= check("nested scopes were all recorded", std::to_string(events.size() + num_dropped_events) + " events", std::to_string(expected_num_events) + " events");
+		}
+		else
+		{
+			success &= check("nested scopes were all recorded", actual, expected);
+		}
+	}
+
+	// Detail text: Special characters are escaped and long text is truncated without cutting a UTF-8 sequence in half
+	{
+		reshade::trace::start();
+
+		// 61 ASCII characters followed by a three byte sequence, which would be cut after its first byte at the 63 byte limit
+		const std::string long_detail = std::string(61, 'a') + "\xE2\x82\xAC" + "tail";
+		const std::string special_detail = "quote \" backslash \\ newline \n tab \t bell \x07";
+
+		{ RESHADE_TRACE_SCOPE("long", long_detail.c_str()); }
+		{ RESHADE_TRACE_SCOPE("special", special_detail.c_str()); }
+		{ RESHADE_TRACE_SCOPE("special \"name\""); }
+
+		reshade::trace::stop();
+
+		std::vector<trace_event> events;
+		std::string error;
+		if (!reshade::trace::write(path))
+			error = "could not write trace";
+		else
+			read_trace(path.c_str(), events, error);
+
+		std::string actual = error;
+		for (const trace_event &e : events)
+			actual += e.name + ": " + e.detail + "; ";
+
+		success &= check("detail text is escaped and truncated", actual, "long: " + std::string(61, 'a') + "; special: " + special_detail + "; special \"name\": ; ");
+	}
+
+	// Restarting: Events recorded before the last start are discarded
+	{
+		reshade::trace::start();
+		{ RESHADE_TRACE_SCOPE("discarded"); }
+		reshade::trace::start();
+		{ RESHADE_TRACE_SCOPE("kept"); }
+		reshade::trace::stop();
+		{ RESHADE_TRACE_SCOPE("after stop"); }
+
+		std::vector<trace_event> events;
+		std::string error;
+		if (!reshade::trace::write(path))
+			error = "could not write trace";
+		else
+			read_trace(path.c_str(), events, error);
+
+		std::string actual = error;
+		for (const trace_event &e : events)
+			actual += e.name + "; ";
+
+		success &= check("restarting discards previous events", actual, "kept; ");
+	}
+
+	std::remove(path.c_str());
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+/**
+ * Copyright (C) 2014 Patrick Mours. All rights reserved.
+ * License: https://github.com/crosire/reshade#license
+ */
+
+// Records synthetic command buffers the same way the Vulkan layer does (tracking the depth-stencil images of render passes and counting draw calls), against a mock dispatch table that does nothing,
+// and submits them from multiple threads while another thread keeps presenting (which merges all submitted statistics and selects a depth-stencil image).
+// Compares the submission path with the previous one (which allocated a node and merged a whole tracker into it for every command buffer) and counts the heap allocations of both.
+// Exits with a non-zero code if the presented statistics do not add up to the recorded ones or the wrong depth-stencil image is selected.
+// Does not depend on the Vulkan loader or any Windows API, so this builds on other platforms too (with the Vulkan headers), e.g. with:
+//   g++ -std=c++17 -O2 -DRESHADE_DEPTH -Isource -Isource/vulkan -I<Vulkan-Headers>/include/vulkan tools/vulkan_submit_benchmark.cpp source/vulkan/buffer_detection.cpp source/depth_selection.cpp -o vulkan_submit_benchmark -lpthread
+
+#include "buffer_detection.hpp"
+#include "lockfree_table.hpp"
+#include <new>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static std::atomic<size_t> s_num_allocations = 0;
+
+void *operator new(size_t size)
+{
+	s_num_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *const p = std::malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+static void print_usage(const char *path)
+{
+	printf(R"(usage: %s [options]
+
+Options:
+  -h, --help                Print this help.
+
+  -t <value>                Number of threads recording and submitting command buffers. Defaults to 4.
+  -f <value>                Number of frames. Defaults to 2000.
+  -c <value>                Number of command buffers each thread submits per frame. Defaults to 16.
+  -d <value>                Number of draw calls per render pass. Defaults to 64.
+	)", path);
+}
+
+// Stands in for the driver entry points the layer calls after its own bookkeeping, so that only the cost of the layer is measured
+struct mock_dispatch_table
+{
+	void(*CmdBeginRenderPass)(VkImage depthstencil);
+	void(*CmdDraw)(uint32_t vertex_count);
+	void(*CmdEndRenderPass)();
+};
+
+static const mock_dispatch_table s_dispatch_table = {
+	[](VkImage) {},
+	[](uint32_t) {},
+	[]() {},
+};
+
+struct mock_image
+{
+	VkImage handle;
+	VkImageCreateInfo create_info;
+};
+
+// Records a command buffer with a few render passes, most of which go to the first image (the one that should be selected), like the hooks of 'vkCmdBeginRenderPass', 'vkCmdDraw' and 'vkCmdEndRenderPass' do
+static uint32_t record_command_buffer(reshade::vulkan::buffer_detection &data, const std::vector<mock_image> &images, size_t command_buffer_index, size_t num_draws)
+{
+	const mock_dispatch_table *volatile dispatch_table = &s_dispatch_table;
+
+	data.reset();
+
+	uint32_t num_drawcalls = 0;
+
+	for (size_t pass = 0; pass < 4; ++pass)
+	{
+		const mock_image &image = images[pass < 3 ? 0 : 1 + (command_buffer_index + pass) % (images.size() - 1)];
+
+		data.on_set_depthstencil(image.handle, VK_IMAGE_LAYOUT_GENERAL, image.create_info);
+		dispatch_table->CmdBeginRenderPass(image.handle);
+
+		for (size_t draw = 0; draw < num_draws; ++draw, ++num_drawcalls)
+		{
+			const uint32_t vertices = pass < 3 ? 300 : 3;
+			data.on_draw(vertices);
+			dispatch_table->CmdDraw(vertices);
+		}
+
+		data.on_set_depthstencil(VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED, {});
+		dispatch_table->CmdEndRenderPass();
+	}
+
+	return num_drawcalls;
+}
+
+// The previous way of passing statistics from 'vkQueueSubmit' to 'vkQueuePresentKHR'
+class allocating_context : public reshade::vulkan::buffer_detection
+{
+public:
+	~allocating_context()
+	{
+		for (submission *next = _submitted.exchange(nullptr, std::memory_order_acquire); next != nullptr;)
+			delete std::exchange(next, next->next);
+	}
+
+	void submit(const buffer_detection &source)
+	{
+		if (source.total_drawcalls() == 0)
+			return;
+
+		const auto node = new submission();
+		node->stats.merge(source);
+
+		node->next = _submitted.load(std::memory_order_relaxed);
+		while (!_submitted.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+			continue;
+	}
+	void flush_submitted()
+	{
+		for (submission *next = _submitted.exchange(nullptr, std::memory_order_acquire); next != nullptr;)
+		{
+			merge(next->stats);
+
+			delete std::exchange(next, next->next);
+		}
+	}
+
+	VkImage find_best_depth_image() const
+	{
+		return VK_NULL_HANDLE; // Selection is the same for both, so it is only checked for the current context
+	}
+
+private:
+	struct submission
+	{
+		submission *next = nullptr;
+		buffer_detection stats;
+	};
+
+	std::atomic<submission *> _submitted = nullptr;
+};
+
+class pooled_context : public reshade::vulkan::buffer_detection_context
+{
+public:
+	VkImage find_best_depth_image() const
+	{
+		return find_best_depth_texture({ 1920, 1080 }).image;
+	}
+};
+
+template <typename TContext>
+static bool benchmark(const char *name, size_t num_threads, size_t num_frames, size_t num_command_buffers, size_t num_draws)
+{
+	std::vector<mock_image> images(8);
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		images[i].handle = reinterpret_cast<VkImage>(0x1000 * (i + 1));
+		images[i].create_info.extent = { i == 0 ? 1920u : 256u << (i % 4), i == 0 ? 1080u : 256u << (i % 4), 1 };
+		images[i].create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		images[i].create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	}
+
+	TContext context;
+
+	std::atomic<size_t> num_recorded_drawcalls = 0;
+	std::atomic<uint64_t> submit_nanoseconds = 0;
+	// Threads may record one frame ahead of the one being presented (like applications do that buffer their frames), so submitting and presenting overlap
+	std::atomic<size_t> num_submitted_frames = 0; // Sum over all threads
+	std::atomic<size_t> num_presented_frames = 0;
+
+	const size_t num_allocations_before = s_num_allocations.load();
+	const auto start_time = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t thread_index = 0; thread_index < num_threads; ++thread_index)
+	{
+		threads.emplace_back([&, thread_index]() {
+			// Command buffers are reused every frame, like those of most applications
+			std::vector<reshade::vulkan::buffer_detection> command_buffers(num_command_buffers);
+			size_t recorded_drawcalls = 0;
+			uint64_t submit_duration = 0;
+
+			for (size_t frame = 0; frame < num_frames; ++frame)
+			{
+				while (num_presented_frames.load() + 1 < frame)
+					std::this_thread::yield();
+
+				for (size_t i = 0; i < num_command_buffers; ++i)
+				{
+					recorded_drawcalls += record_command_buffer(command_buffers[i], images, thread_index * num_command_buffers + i, num_draws);
+
+					// This is what 'vkQueueSubmit' does for every command buffer
+					const auto submit_start = std::chrono::high_resolution_clock::now();
+					{
+						const lockfree_epoch::guard guard;
+						context.submit(command_buffers[i]);
+					}
+					submit_duration += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - submit_start).count();
+				}
+
+				num_submitted_frames++;
+			}
+
+			num_recorded_drawcalls += recorded_drawcalls;
+			submit_nanoseconds += submit_duration;
+		});
+	}
+
+	// This is what 'vkQueuePresentKHR' does, once all threads submitted their command buffers for a frame (while they may already submit those of the next one)
+	size_t num_presented_drawcalls = 0;
+	bool selected_wrong_image = false;
+	for (size_t frame = 0; frame < num_frames; ++frame)
+	{
+		while (num_submitted_frames.load() < (frame + 1) * num_threads)
+			std::this_thread::yield();
+
+		{
+			const lockfree_epoch::guard guard;
+			context.flush_submitted();
+		}
+
+		num_presented_drawcalls += context.total_drawcalls();
+
+		if (const VkImage best = context.find_best_depth_image(); best != VK_NULL_HANDLE && best != images[0].handle)
+			selected_wrong_image = true;
+
+		context.reset();
+
+		num_presented_frames++;
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	const double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+	const size_t num_allocations = s_num_allocations.load() - num_allocations_before;
+	const size_t num_submits = num_threads * num_frames * num_command_buffers;
+
+	printf("%-10s %3zu threads: %8.3f ms, %7.1f ns per submit, %6.3f allocations per submit", name, num_threads,
+		duration * 1000, static_cast<double>(submit_nanoseconds.load()) / num_submits, static_cast<double>(num_allocations) / num_submits);
+
+	if (num_presented_drawcalls != num_recorded_drawcalls.load())
+	{
+		printf(", %zu draw calls were presented instead of %zu\n", num_presented_drawcalls, num_recorded_drawcalls.load());
+		return false;
+	}
+	if (selected_wrong_image)
+	{
+		printf(", selected the wrong depth-stencil image\n");
+		return false;
+	}
+
+	printf("\n");
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_threads = 4;
+	size_t num_frames = 2000;
+	size_t num_command_buffers = 16;
+	size_t num_draws = 64;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *const arg = argv[i];
+
+		if (0 == std::strcmp(arg, "-h") || 0 == std::strcmp(arg, "--help"))
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (0 == std::strcmp(arg, "-t"))
+			max_threads = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-f"))
+			num_frames = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-c"))
+			num_command_buffers = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else if (0 == std::strcmp(arg, "-d"))
+			num_draws = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool success = true;
+
+	for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+	{
+		success &= benchmark<allocating_context>("allocating", num_threads, num_frames, num_command_buffers, num_draws);
+		success &= benchmark<pooled_context>("pooled", num_threads, num_frames, num_command_buffers, num_draws);
+	}
+
+	return success ? 0 : 1;
+}